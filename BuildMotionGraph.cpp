@@ -0,0 +1,134 @@
+// g++ -std=c++11 -O2 -o BuildMotionGraph BuildMotionGraph.cpp LeafSim/MotionGraph.cpp LeafSim/TrajectoryIndex.cpp LeafSim/TrajectoryDb.cpp LeafSim/MappedFile.cpp LeafSim/TrajectorySpline.cpp LeafSim/FlutterModel.cpp
+//
+// Finds the transitions between the clips of a trajectory database
+// (LeafSim/MotionGraph.hpp) and writes the runtime table:
+//
+//   BuildMotionGraph motion_database.bin -o motion_graph.bin
+//   BuildMotionGraph --stride 2 --theta-tol 0.05 sweep.bin -o sweep_graph.bin
+//
+// The table is only valid with the database it was built from.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "LeafSim/MotionGraph.hpp"
+#include "LeafSim/TrajectoryDb.hpp"
+
+static void PrintUsage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] database.bin -o graph.bin\n"
+            "  --stride N          frames between candidate transition points (5)\n"
+            "  --min-remaining N   frames a target must have left in its clip (20)\n"
+            "  --min-loop-back N   same-clip jumps go back at least N frames (50)\n"
+            "  --theta-tol R       rad (0.1)\n"
+            "  --velocity-tol V    m/s (0.05)\n"
+            "  --omega-tol W       rad/s (0.2)\n"
+            "  --param-tol F       relative, for the leaf parameters (0.01)\n",
+            prog);
+}
+
+int main(int argc, char* argv[])
+{
+    MotionGraphSettings settings;
+    std::string dbPath, outPath;
+
+    struct { const char* name; int* value; } ints[] = {
+        { "--stride", &settings.stride }, { "--min-remaining", &settings.minRemaining },
+        { "--min-loop-back", &settings.minLoopBack },
+    };
+    struct { const char* name; float* value; } floats[] = {
+        { "--theta-tol", &settings.thetaTolerance }, { "--velocity-tol", &settings.velocityTolerance },
+        { "--omega-tol", &settings.omegaTolerance }, { "--param-tol", &settings.paramTolerance },
+    };
+    const int NUM_INTS = sizeof(ints) / sizeof(ints[0]);
+    const int NUM_FLOATS = sizeof(floats) / sizeof(floats[0]);
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        int n = -1, f = -1;
+        for (int k = 0; k < NUM_INTS; ++k) {
+            if (strcmp(arg, ints[k].name) == 0) {
+                n = k;
+            }
+        }
+        for (int k = 0; k < NUM_FLOATS; ++k) {
+            if (strcmp(arg, floats[k].name) == 0) {
+                f = k;
+            }
+        }
+
+        if ((n >= 0 || f >= 0 || strcmp(arg, "-o") == 0) && value == NULL) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        } else if (n >= 0) {
+            *ints[n].value = atoi(value);
+            if (*ints[n].value < (n == 0 ? 1 : 0)) {
+                fprintf(stderr, "Bad value for %s\n", arg);
+                return 1;
+            }
+            ++i;
+        } else if (f >= 0) {
+            *floats[f].value = (float)atof(value);
+            if (!(*floats[f].value > 0.f)) {
+                fprintf(stderr, "Bad value for %s\n", arg);
+                return 1;
+            }
+            ++i;
+        } else if (strcmp(arg, "-o") == 0) {
+            outPath = value;
+            ++i;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        } else if (dbPath.empty()) {
+            dbPath = arg;
+        } else {
+            fprintf(stderr, "Only one database, please\n");
+            return 1;
+        }
+    }
+    if (dbPath.empty() || outPath.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    TrajectoryDb db;
+    if (!db.open(dbPath.c_str())) {
+        return 1;
+    }
+
+    // 1) Build
+    auto t0 = std::chrono::steady_clock::now();
+    MotionGraph graph;
+    graph.build(db, settings);
+    double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    // 2) Report: how many clips only have their end transition, and how good those are
+    int onlyEnd = 0, endOutside = 0;
+    for (int c = 0; c < graph.GetNumClips(); ++c) {
+        int count;
+        const MotionTransition* t = graph.GetTransitions(c, &count);
+        if (count == 1) {
+            onlyEnd++;
+        }
+        if (count > 0 && t[count - 1].cost > 1.f) {
+            endOutside++;
+        }
+    }
+
+    // 3) Write
+    if (!graph.save(outPath.c_str())) {
+        return 1;
+    }
+    fprintf(stderr, "%d clips, %d transitions -> %s (%.3f ms)\n", graph.GetNumClips(),
+            graph.GetNumTransitions(), outPath.c_str(), buildMs);
+    fprintf(stderr, "%d clip(s) only loop at their end, %d end transition(s) outside tolerance\n",
+            onlyEnd, endOutside);
+    return 0;
+}
@@ -1,3 +1,8 @@
+# Reference / plotting version of the flutter model.  The database itself is
+# now built by GenerateTrajectories (GenerateTrajectories.cpp, same model in
+# LeafSim/FlutterModel.cpp), which also sweeps parameters on all cores.
+# Note: at dt = 0.01 three of the four starts below blow up; the C++ tool
+# takes 100 RK4 steps per sample by default.
 import numpy as np
 import matplotlib.pyplot as plt
 import json
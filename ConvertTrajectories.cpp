@@ -0,0 +1,365 @@
+// g++ -std=c++11 -O2 -o ConvertTrajectories ConvertTrajectories.cpp LeafSim/TrajectoryDb.cpp LeafSim/MappedFile.cpp LeafSim/TrajectorySpline.cpp LeafSim/TrajectoryStream.cpp LeafSim/FlutterModel.cpp -pthread
+//
+// Converts trajectory files to the binary database (LeafSim/TrajectoryDb.hpp):
+//
+//   ConvertTrajectories precomputed_trajectory_database.json -o motion_database.bin
+//   ConvertTrajectories fluttering_trajectory.trs -o segment.bin
+//
+// .json: ComputeTrajectory.py / GenerateTrajectories layout, full states.
+// .trs:  Simulation trajectory stream (LeafSim/TrajectoryStream.hpp), full
+//        states; it records its leaf, air and dt, which the options don't change.
+// .txt:  Simulation --out *.txt layout, "x y theta" per line; the velocities
+//        are rebuilt by finite differences, so --dt must match the run.
+// .json and .txt don't record the leaf, so its parameters come from the
+// options (default: the ComputeTrajectory.py leaf).
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "LeafSim/TrajectoryDb.hpp"
+#include "LeafSim/TrajectoryStream.hpp"
+
+struct NamedTrajectory {
+    std::string name;
+    std::vector<double> states;     // FLUTTER_DIM per sample
+    bool recorded;                  // the file gave the leaf, air and dt below
+    FlutterParams leaf;
+    double rho, g, dt;
+
+    NamedTrajectory() : recorded(false) {}
+};
+
+static void PrintUsage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options] input.json|input.trs|input.txt ... -o output.bin\n"
+            "  --quantize          16-bit states instead of float32\n"
+            "  --spline            keyframe curves instead of float32 (see LeafSim/TrajectorySpline.hpp)\n"
+            "  --dt S              sample interval (0.01 for .json, 0.001 for .txt)\n"
+            "  --mass --width --height --perp --para --rho --g  leaf and air (ComputeTrajectory.py values)\n",
+            prog);
+}
+
+static bool ReadFile(const char* path, std::string* text)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open '%s'\n", path);
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    text->clear();
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        text->append(buf, n);
+    }
+    fclose(fp);
+    return true;
+}
+
+// -------------------------------------
+// JSON: { "name": [[x, y, theta, vx, vy, omega], ...], ... }
+// Just enough of a parser for that shape (Python also writes NaN / Infinity).
+// -------------------------------------
+class JsonScanner {
+public:
+    JsonScanner(const std::string& text) : m_p(text.c_str()), m_ok(true) {}
+
+    bool ok() const { return m_ok; }
+
+    void skipSpace()
+    {
+        while (*m_p != '\0' && isspace((unsigned char)*m_p)) {
+            m_p++;
+        }
+    }
+    bool accept(char c)
+    {
+        skipSpace();
+        if (*m_p == c) {
+            m_p++;
+            return true;
+        }
+        return false;
+    }
+    void expect(char c)
+    {
+        if (!accept(c)) {
+            m_ok = false;
+        }
+    }
+    std::string string()
+    {
+        std::string s;
+        expect('"');
+        while (m_ok && *m_p != '"') {
+            if (*m_p == '\0') {
+                m_ok = false;
+                break;
+            }
+            if (*m_p == '\\' && m_p[1] != '\0') {
+                m_p++;
+            }
+            s += *m_p++;
+        }
+        expect('"');
+        return s;
+    }
+    double number()
+    {
+        skipSpace();
+        if (strncmp(m_p, "NaN", 3) == 0) {
+            m_p += 3;
+            return NAN;
+        }
+        bool negative = (*m_p == '-');
+        if (strncmp(m_p + (negative ? 1 : 0), "Infinity", 8) == 0) {
+            m_p += negative ? 9 : 8;
+            return negative ? -INFINITY : INFINITY;
+        }
+        char* end;
+        double v = strtod(m_p, &end);
+        if (end == m_p) {
+            m_ok = false;
+        }
+        m_p = end;
+        return v;
+    }
+
+private:
+    const char* m_p;
+    bool m_ok;
+};
+
+static bool ReadJson(const char* path, std::vector<NamedTrajectory>* out)
+{
+    std::string text;
+    if (!ReadFile(path, &text)) {
+        return false;
+    }
+    JsonScanner in(text);
+    in.expect('{');
+    if (!in.accept('}')) {
+        do {
+            NamedTrajectory traj;
+            traj.name = in.string();
+            in.expect(':');
+            in.expect('[');
+            if (!in.accept(']')) {
+                do {
+                    in.expect('[');
+                    for (int c = 0; c < FLUTTER_DIM && in.ok(); ++c) {
+                        if (c > 0) {
+                            in.expect(',');
+                        }
+                        traj.states.push_back(in.number());
+                    }
+                    in.expect(']');
+                } while (in.ok() && in.accept(','));
+                in.expect(']');
+            }
+            out->push_back(traj);
+        } while (in.ok() && in.accept(','));
+        in.expect('}');
+    }
+    if (!in.ok()) {
+        fprintf(stderr, "'%s': not a trajectory JSON file (expected {\"name\": [[6 numbers], ...], ...})\n", path);
+        return false;
+    }
+    return true;
+}
+
+// -------------------------------------
+// Simulation trajectory stream
+// -------------------------------------
+static bool ReadTrs(const char* path, std::vector<NamedTrajectory>* out)
+{
+    TrajectoryStreamReader reader;
+    if (!reader.open(path)) {
+        return false;
+    }
+    NamedTrajectory traj;
+    traj.name = path;
+    reader.readAll(&traj.states);
+    const TrajectoryStreamHeader& header = reader.GetHeader();
+    if (header.numSamples != (uint64_t)traj.states.size() / FLUTTER_DIM) {
+        fprintf(stderr, "'%s': stream was not closed; keeping its %zu whole samples\n",
+                path, traj.states.size() / FLUTTER_DIM);
+    }
+    traj.recorded = true;
+    traj.leaf = reader.GetParams();
+    traj.rho = header.rho;
+    traj.g = header.g;
+    traj.dt = header.dt;
+    out->push_back(traj);
+    return true;
+}
+
+// -------------------------------------
+// Simulation text: x y theta per line
+// -------------------------------------
+static bool ReadTxt(const char* path, double dt, std::vector<NamedTrajectory>* out)
+{
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open '%s'\n", path);
+        return false;
+    }
+    std::vector<double> pos;        // x, y, theta
+    double x, y, theta;
+    while (fscanf(fp, "%lf %lf %lf", &x, &y, &theta) == 3) {
+        pos.push_back(x);
+        pos.push_back(y);
+        pos.push_back(theta);
+    }
+    bool atEnd = feof(fp) != 0;
+    fclose(fp);
+    if (!atEnd) {
+        fprintf(stderr, "'%s': expected three numbers per line\n", path);
+        return false;
+    }
+
+    NamedTrajectory traj;
+    traj.name = path;
+    int n = (int)pos.size() / 3;
+    for (int i = 0; i < n; ++i) {
+        // central differences inside, one-sided at the ends
+        int a = (i > 0) ? i - 1 : i;
+        int b = (i + 1 < n) ? i + 1 : i;
+        double span = (b - a) * dt;
+        for (int c = 0; c < 3; ++c) {
+            traj.states.push_back(pos[3 * i + c]);
+        }
+        for (int c = 0; c < 3; ++c) {
+            traj.states.push_back(span > 0. ? (pos[3 * b + c] - pos[3 * a + c]) / span : 0.);
+        }
+    }
+    out->push_back(traj);
+    return true;
+}
+
+static bool EndsWith(const std::string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    FlutterParams leaf = { 0.01, 0.1, 0.1, 4.1, 0.9 };
+    double rho = 1.225, g = 9.81;
+    double dt = 0.;             // 0 = per input type
+    TrajectoryEncoding encoding = ENCODING_FLOAT32;
+    std::string outPath;
+    std::vector<std::string> inputs;
+
+    struct { const char* name; double* value; } values[] = {
+        { "--dt", &dt }, { "--mass", &leaf.mass }, { "--width", &leaf.width }, { "--height", &leaf.height },
+        { "--perp", &leaf.dragCoeffPerp }, { "--para", &leaf.dragCoeffPara }, { "--rho", &rho }, { "--g", &g },
+    };
+    const int NUM_VALUES = sizeof(values) / sizeof(values[0]);
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        int v = -1;
+        for (int k = 0; k < NUM_VALUES; ++k) {
+            if (strcmp(arg, values[k].name) == 0) {
+                v = k;
+            }
+        }
+
+        if (strcmp(arg, "--quantize") == 0) {
+            encoding = ENCODING_UINT16;
+        } else if (strcmp(arg, "--spline") == 0) {
+            encoding = ENCODING_SPLINE;
+        } else if ((v >= 0 || strcmp(arg, "-o") == 0) && value == NULL) {
+            fprintf(stderr, "Missing value for %s\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        } else if (v >= 0) {
+            *values[v].value = atof(value);
+            if (!(*values[v].value > 0.)) {
+                fprintf(stderr, "Bad value for %s\n", arg);
+                return 1;
+            }
+            ++i;
+        } else if (strcmp(arg, "-o") == 0) {
+            outPath = value;
+            ++i;
+        } else if (arg[0] == '-') {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty() || outPath.empty()) {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // 1) Read
+    TrajectoryDbWriter writer;
+    auto t0 = std::chrono::steady_clock::now();
+    for (size_t f = 0; f < inputs.size(); ++f) {
+        std::vector<NamedTrajectory> trajs;
+        bool txt = EndsWith(inputs[f], ".txt");
+        double fileDt = (dt > 0.) ? dt : (txt ? 0.001 : 0.01);
+        bool ok = txt ? ReadTxt(inputs[f].c_str(), fileDt, &trajs)
+                : EndsWith(inputs[f], ".trs") ? ReadTrs(inputs[f].c_str(), &trajs)
+                : ReadJson(inputs[f].c_str(), &trajs);
+        if (!ok) {
+            return 1;
+        }
+
+        for (size_t t = 0; t < trajs.size(); ++t) {
+            // keep the finite prefix: later samples of a run that blew up are noise
+            const std::vector<double>& s = trajs[t].states;
+            int n = (int)s.size() / FLUTTER_DIM;
+            int finite = 0;
+            while (finite < n) {
+                bool ok = true;
+                for (int c = 0; c < FLUTTER_DIM; ++c) {
+                    ok = ok && std::isfinite(s[finite * FLUTTER_DIM + c]);
+                }
+                if (!ok) {
+                    break;
+                }
+                finite++;
+            }
+            if (finite < n) {
+                fprintf(stderr, "%s: '%s' has non-finite states from sample %d on; keeping %d of %d\n",
+                        inputs[f].c_str(), trajs[t].name.c_str(), finite, finite, n);
+            }
+            const NamedTrajectory& tr = trajs[t];
+            writer.add(tr.recorded ? tr.leaf : leaf, tr.recorded ? tr.rho : rho, tr.recorded ? tr.g : g,
+                       tr.recorded ? tr.dt : fileDt, finite > 0 ? &s[0] : NULL, finite);
+        }
+    }
+    double readMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    // 2) Write
+    if (!writer.write(outPath.c_str(), encoding)) {
+        return 1;
+    }
+
+    // 3) Read it back the way the scene will
+    t0 = std::chrono::steady_clock::now();
+    TrajectoryDb db;
+    if (!db.open(outPath.c_str())) {
+        return 1;
+    }
+    double openMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    fprintf(stderr, "%d trajectories -> %s (%zu bytes, %s)\n", db.GetNumTrajectories(), outPath.c_str(),
+            db.GetFileSize(), encoding == ENCODING_SPLINE ? "spline" : encoding == ENCODING_UINT16 ? "uint16" : "float32");
+    fprintf(stderr, "parse inputs %.3f ms, open database %.3f ms\n", readMs, openMs);
+    return 0;
+}
@@ -18,6 +18,7 @@
  * - 'o' or 'O':           Use orthographic projection
  * - 'p' or 'P':           Use perspective projection
  * - 'r' or 'R':           Toggle through different L-system rules
+ * - 'k' or 'K':           Save the simulation to scene.snap (--load-snapshot to resume)
  * - 'q' or 'Q' or ESC:    Quit
  *
  * Menus:
@@ -38,6 +39,7 @@
 #include <unordered_map>
 #include <math.h>
 #include "glm/gtc/type_ptr.hpp"
+#include "glm/gtc/quaternion.hpp"
 
 // For Apple vs. Windows/OpenGL
 #ifdef __APPLE__
@@ -55,6 +57,24 @@
 // Project headers
 #include "TreeBody/LSystem.hpp"
 #include "TreeBody/Turtle.hpp"
+#include "Render/Culling.hpp"
+#include "Render/ShadowCascades.hpp"
+#include "Render/RenderQueue.hpp"
+#include "Render/LeafSort.hpp"
+#include "Render/FrameTimes.hpp"
+#include "Render/Headless.hpp"
+#include "LeafSim/FixedStep.hpp"
+#include "LeafSim/WindField.hpp"
+#include "LeafSim/LeafBatch3D.hpp"
+#include "LeafSim/LeafLitter.hpp"
+#include "LeafSim/LeafCollision.hpp"
+#include "LeafSim/FallLod.hpp"
+#include "LeafSim/TrajectoryDb.hpp"
+#include "LeafSim/TrajectoryIndex.hpp"
+#include "LeafSim/Detachment.hpp"
+#include "LeafSim/Snapshot.hpp"
+#include "Jobs/JobSystem.hpp"
+#include "Jobs/SpscQueue.hpp"
 
 //=============================================================================
 //  2. Macros/Defines
@@ -203,6 +223,7 @@ void DoDepthMenu(int);
 void DoDebugMenu(int);
 void DoMainMenu(int);
 void DoProjectMenu(int);
+void DoShadowsMenu(int);
 void DoRasterString(float, float, float, char *);
 void DoStrokeString(float, float, float, float, char *);
 float ElapsedSeconds();
@@ -301,17 +322,223 @@ GLSLProgram LeafProgram;
 GLSLProgram GetDepth;
 GLSLProgram RenderWithShadows;
 GLSLProgram BarkTextureProgram;
-// shadow texture
+// shadow textures, one per cascade
+const int NUM_CASCADES = 3;
 GLuint DepthFramebuffer;
-GLuint DepthTexture;
+GLuint DepthTextures[NUM_CASCADES];
 const int SHADOW_WIDTH = 1024;
 const int SHADOW_HEIGHT = 1024;
+const float SHADOW_DISTANCE = 150.f;
+ShadowCascades Cascades(NUM_CASCADES, SHADOW_WIDTH);
+
+// culling stage: bounds for every branch segment and leaf of the tree
+SceneCuller Culler;
+
+// render queue: Display() records draws, the GL backend issues them sorted
+enum ShaderIds {
+    SHADER_FIXED = 0,
+    SHADER_BARK  = 1,
+    SHADER_LEAF  = 2
+};
+enum DrawKinds {
+    DRAW_TREE_BODY,
+    DRAW_LEAF,
+    DRAW_SORTED_LEAVES,     // all translucent leaves, back to front
+    DRAW_FALLING_LEAVES,    // every leaf that has come off the tree
+    DRAW_LITTER             // the fallen leaves on the ground
+};
+RenderQueue Queue;
+
+// translucent leaves (NowAlpha < 1) are drawn back to front in one queue item
+DepthSorter LeafSorter;
+std::vector<float> LeafDepths;
+std::vector<unsigned char> LeafVisible;
 GLuint Noise2;
 
+// --headless: render into an offscreen framebuffer along a scripted camera path
+HeadlessOptions Headless;
+GLuint SceneFramebuffer = 0;    // 0 = the window's back buffer
+FrameTimes Timings;
+
+// Simulation: stepped at a fixed rate, independent of how often frames are
+// drawn; each frame draws a blend of the last two states.  In the window,
+// Animate() starts one step at a time on the workers and only draws once
+// they have caught up (see there); headless, AdvanceSim() steps in place.
+struct SceneState {
+    double simTime;     // seconds since InitSim()
+    float windAmp;      // Kamp, Kfreq, Kspeed at simTime
+    float windFreq;     // sway cycles per second
+    float windSpeed;
+    float swayPhase;    // integral of 2*pi*windFreq, wrapped to [0, 2*pi)
+};
+const double SIM_STEP = 1. / 60.;
+const float LEAF_SWAY_DEGREES = 12.f;   // at windAmp = 1
+FixedStepClock SimClock(SIM_STEP, 5);
+SceneState SimPrev, SimCurr;            // the last two sim states
+SceneState SimDraw;                     // between them, for this frame
+int LastAnimateMs = -1;
+
+// Worker threads for the sim and the culling stage.  A sim step is a task
+// graph launched on them (SimGraph, counted by SimStep) that the GLUT thread
+// does not wait for: it polls SimStep and only reads the sim once the step
+// has finished.  The culling stage is a parallelFor the GLUT thread helps with.
+JobSystem Jobs;
+TaskGraph SimGraph;
+JobCounter SimStep;
+bool SimRunning = false;                // SimGraph launched and not yet picked up
+int SimStepsOwed = 0;                   // to catch up with real time before the next frame
+bool SnapshotWanted = false;            // 'k': saved between two steps
+
+// Wind over the whole tree, re-evaluated every sim step from the keytimes.
+// Branch ends and leaves are pushed downwind in proportion to their flex
+// (Turtle::Segment), so the trunk base stays put and the twigs move most.
+WindField Wind;
+const float WIND_LO[3] = { -200.f, -10.f, -200.f };
+const float WIND_HI[3] = {  200.f, 290.f,  200.f };
+const float BRANCH_SWAY_TIP = 0.6f;     // offset of the most flexible twig per m/s of wind
+std::vector<glm::vec3> BranchSway;      // start and end offset of every tree segment
+std::vector<glm::vec3> LeafSway;        // offset of every leaf
+std::vector<float> LeafGust;            // local wind speed / mean wind speed, per leaf
+std::vector<float> WindPx, WindPy, WindPz, WindUx, WindUy, WindUz;  // UpdateTreeWind() scratch
+
+// Leaves that have come off the tree, tumbling with the 3D flutter model
+// (LeafSim/LeafBatch3D.hpp) in metres and drawn in scene units.  Like the
+// wind, only the latest sim step is kept.  The model needs steps of about
+// 1e-4 s, so every sim step is split into FALL_SUBSTEPS.
+LeafBatch3D FallingLeaves;
+std::vector<uint8_t> FallingColor;      // LeafColorIndex() of the tree leaf each one came off
+const float SCENE_UNITS_PER_METER = 20.f;   // a ~15 m tree with ~10 cm leaves
+const float LEAF_RELEASE_RATE = 3.f;    // leaves let go per second in a 5 m/s wind of gustiness 0.5
+const int FALL_SUBSTEPS = 128;
+const uint32_t MAX_FALLING = 2048;      // awake ones
+const float LEAF_MODEL_CENTER = 0.59f;  // the leaf model sits off to -x; falling ones tumble about its middle
+
+// Which tree leaves let go (LeafSim/Detachment.hpp): the rate follows the
+// wind keytimes, the branches the wind is strongest at give up more, and
+// higher leaves go more readily.  The scheduler is its own task in StepSim()
+// and hands leaves to IntegrateFallingLeaves() through a lock-free queue;
+// the ones it queues in a step start falling in the next.
+// Leaves let go stay off the tree until it is rebuilt or the sim reset.
+// SIM_SEED seeds the scheduler and, with its index, each leaf's spin and
+// size, so a run (and one from a snapshot) is the same every time.
+const uint32_t SIM_SEED = 1;
+DetachScheduler Detacher;
+SpscQueue<uint32_t> DetachQueue(MAX_FALLING);
+std::vector<glm::vec3> BranchTip;       // per Turtle branch: where its exposure is sampled
+
+// Level of detail for the falling leaves (LeafSim/FallLod.hpp): the flutter
+// model near the camera, playback of the motion database further out and
+// plain drift beyond that, with at most FALL_MAX_FULL on the full model.
+// Without the database files the middle range drifts too.
+FallLod FallingLod;
+TrajectoryDb FallingDb;
+MotionGraph FallingGraph;
+TrajectoryIndex FallingIndex;
+glm::vec3 CameraEye(0.f);               // scene units, set by Display()
+const float FALL_LOD_NEAR = 5.f;        // m
+const float FALL_LOD_FAR = 12.f;        // m
+const uint32_t FALL_MAX_FULL = 512;
+
+// Ground level: the grid (GridDL), and where falling leaves land
+#define YGRID   0.f
+
+// Fallen leaves.  Leaves that come to rest on the ground move out of
+// FallingLeaves into the litter, binned in LITTER_CELLS^2 cells over the wind
+// grid's footprint.  Each cell is drawn from display lists (all its leaves, and
+// a quarter of them for the middle distance) rebuilt only when the cell
+// changes, and beyond LITTER_LOD_FAR as one quad of its mean color.
+GroundContact Ground;
+LeafLitter Litter;
+std::vector<uint32_t> Settled;          // SettleFallingLeaves() scratch
+
+// Falling leaves that have stopped (lodged in the tree) sleep until a gust
+// or another leaf wakes them, and cost nothing meanwhile
+LeafSleep Sleep;
+std::vector<uint32_t> SleepOrder;       // IntegrateFallingLeaves() scratch
+std::vector<uint8_t> SleepColor;
+
+// Falling leaves against each other and the branches, once per sim step.
+// The branches are the tree's segments as capsules, where the wind last
+// swayed them (BranchSway).
+LeafCollider Collider;
+std::vector<Capsule> BranchCapsules;    // UpdateBranchCapsules() scratch
+const int LITTER_CELLS = 50;            // per side: 8 units
+const uint32_t LITTER_PER_CELL = 256;   // before the oldest are buried
+const uint32_t LITTER_BUDGET = 200000;  // leaves kept in all cells
+const float LITTER_LOD_NEAR = 100.f;    // full lists within this distance
+const float LITTER_LOD_FAR = 250.f;     // quarter lists within this, quads beyond
+struct LitterLists {
+    GLuint base;        // 2 * LITTER_COLORS lists: color c, full (2c) and quarter (2c + 1)
+    uint32_t version;   // the cell's version they were built from
+};
+std::vector<LitterLists> LitterCellLists;
+std::vector<uint32_t> LitterVisible;    // cells to draw this frame
+std::vector<uint8_t> LitterLod;         // and how: 0 full, 1 quarter, 2 quad
+
+// Leaf colors by height on the tree (LeafColorIndex())
+const float LEAF_PALETTE[LITTER_COLORS][3] = {
+    { 1.0f,  0.55f, 0.0f },
+    { 1.0f,  0.6f,  0.2f },
+    { 0.8f,  0.1f,  0.1f },
+    { 0.85f, 0.2f,  0.1f },
+    { 0.7f,  0.0f,  0.0f },
+};
+
+// The tree only changes when its rules do, so it is built once and kept
+Turtle Tree;
+bool TreeDirty = true;
+
 // Display the scene
-Turtle drawTreeBody();
+std::string generateTreeString();
+Turtle buildTreeBody(const std::string& lsystemString);
 Turtle drawTernaryTreeBody();
-void DisplayOneScene(GLSLProgram * prog, Turtle& turtle);
+void RenderFrame(int width, int height);
+int RunHeadless();
+void InitSim();
+void AdvanceSim(double frameSeconds);
+bool SaveSnapshot(const char* path);
+bool LoadSnapshot(const char* path);
+bool CheckSnapshot(const char* path, int frames);
+void StepSim(SceneState& state, double dt);
+void LaunchSimStep(SceneState& state, double dt);
+void FinishSimStep();
+SceneState InterpolateSim(const SceneState& a, const SceneState& b, float alpha);
+float LeafSwayDegrees(const Turtle::Leaf& leaf, uint32_t i);
+void UpdateTreeWind(Turtle& turtle);
+void ReleaseLeaf(const Turtle::Leaf& leaf, uint32_t i);
+void RebuildDetacher();
+void DetachLeaves(double dt, float rate, uint32_t budget);
+void IntegrateFallingLeaves(double dt, uint32_t released);
+void UpdateBranchCapsules();
+void SettleFallingLeaves(double dt);
+void InitRenderResources();
+void PrepareLeaves(Turtle& turtle, const glm::mat4& cameraView);
+void QueueScene(Turtle& turtle, const glm::mat4& cameraView);
+void BuildCullItems(Turtle& turtle);
+void RenderShadowCascades(Turtle& turtle);
+void DrawLeaf(const Turtle::Leaf& leaf, uint32_t i);
+void DrawFallingLeaf(uint32_t i);
+void PrepareLitter(const glm::mat4& viewProj, const glm::mat4& cameraView);
+void BuildLitterLists(int cell);
+void DrawLitterCell(int cell, int lod, float lastColor[3]);
+int LeafColorIndex(const Turtle::Leaf& leaf);
+void LeafColor(const Turtle::Leaf& leaf, float rgb[3]);
+
+// Issues RenderQueue items with real GL calls
+class GLRenderBackend : public RenderBackend
+{
+public:
+    GLRenderBackend(Turtle& turtle);
+    void setPass(unsigned pass);
+    void bindShader(uint32_t shader);
+    void bindTexture(uint32_t unit, uint32_t texture);
+    void draw(const DrawItem& item);
+
+private:
+    Turtle& m_turtle;
+    std::vector<Turtle::Leaf> m_leaves;
+    float m_lastColor[3];
+};
 // void DisplayOneScene2(GLSLProgram * prog );
 
 //glui
@@ -331,18 +558,30 @@ float Ranf(float low, float high)
 //----------------------------------------------------------------------------
 int main(int argc, char* argv[])
 {
+    if(!ParseHeadlessArgs(argc, argv, &Headless))
+        return 1;
+    if(Headless.enabled)
+        return RunHeadless();
+
     // Turn on the glut package:
     glutInit(&argc, argv);
 
     // Setup all the graphics stuff:
     InitGraphics();
 
+    // Wind keytimes and the fixed-step clock:
+    InitSim();
+
     // Create the display lists that do not change:
     InitLists();
 
     // Init all the global variables used by Display():
     Reset();
 
+    // Pick up where a saved run left off:
+    if(!Headless.loadSnapshot.empty() && !LoadSnapshot(Headless.loadSnapshot.c_str()))
+        return 1;
+
     // Setup all the user interface stuff:
     InitMenus();
 
@@ -358,12 +597,46 @@ int main(int argc, char* argv[])
 //  8. Callback and Event Functions
 //=============================================================================
 
-// Animate the scene
+// Animate the scene.  The sim steps run on the workers while this returns
+// to GLUT, so it never waits on them: each call picks up a finished step,
+// starts the next one owed, and once none are owed asks for a frame.
 void Animate()
 {
-    int ms = glutGet(GLUT_ELAPSED_TIME);
-    ms %= MS_PER_CYCLE; // 0..MS_PER_CYCLE-1
-    Time = (float)ms / (float)MS_PER_CYCLE; // 0..1
+    // 1) A step still running: come back later (without workers nothing
+    //    else runs it, so it is run here)
+    if(SimRunning)
+    {
+        if(!SimStep.isDone() && Jobs.GetNumThreads() > 1)
+            return;
+        FinishSimStep();
+    }
+
+    // 2) Real time since the last frame drives the fixed-step sim:
+    if(SimStepsOwed == 0)
+    {
+        int ms = glutGet(GLUT_ELAPSED_TIME);
+        if(LastAnimateMs < 0)
+            LastAnimateMs = ms;
+        SimStepsOwed = SimClock.advance((double)(ms - LastAnimateMs) / 1000.);
+        LastAnimateMs = ms;
+    }
+    if(SimStepsOwed > 0)
+    {
+        SimStepsOwed--;
+        SimPrev = SimCurr;
+        LaunchSimStep(SimCurr, SimClock.GetStepSize());
+        return;
+    }
+
+    // 3) Caught up: nothing is running, so the sim can be saved and drawn
+    if(SnapshotWanted)
+    {
+        SaveSnapshot("scene.snap");
+        SnapshotWanted = false;
+    }
+    SimDraw = InterpolateSim(SimPrev, SimCurr, (float)SimClock.GetAlpha());
+    double cycle = (double)MS_PER_CYCLE / 1000.;
+    Time = (float)(fmod(SimDraw.simTime, cycle) / cycle); // 0..1
 
     // Force a call to Display():
     glutSetWindow(MainWindow);
@@ -377,11 +650,44 @@ Display()
     if(DebugOn != 0)
         fprintf(stderr, "Starting Display.\n");
 
+    // A redraw asked for by another callback while a sim step runs: the
+    // step owns the sim state, and Animate() asks again once it is done
+    if(SimRunning)
+        return;
+
     // Set which window to render into:
     glutSetWindow(MainWindow);
 
+    Timings.clear();
+    Timings.beginFrame();
+    RenderFrame(glutGet(GLUT_WINDOW_WIDTH), glutGet(GLUT_WINDOW_HEIGHT));
+
+    if(DebugOn != 0)
+    {
+        for(int s = 0; s < FrameTimes::NUM_STAGES; s++)
+            fprintf(stderr, "%s %.2fms  ", FrameTimes::StageName(s), Timings.GetMs(0, s));
+        fprintf(stderr, "\n");
+    }
+
+    // Swap buffers:
+    glutSwapBuffers();
+    glFlush();
+}
+
+// Draw one frame into SceneFramebuffer (the window or the headless target),
+// recording the CPU time of each stage in Timings (the caller begins the frame)
+void RenderFrame(int width, int height)
+{
     // Erase the background:
-    glDrawBuffer(GL_BACK);
+    if(SceneFramebuffer != 0)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, SceneFramebuffer);
+        glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    }
+    else
+    {
+        glDrawBuffer(GL_BACK);
+    }
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_DEPTH_TEST);
 
@@ -395,8 +701,8 @@ Display()
     glShadeModel(GL_FLAT);
 
     // Set viewport to a square centered in the window:
-    GLsizei vx = glutGet(GLUT_WINDOW_WIDTH);
-    GLsizei vy = glutGet(GLUT_WINDOW_HEIGHT);
+    GLsizei vx = width;
+    GLsizei vy = height;
     GLsizei v = (vx < vy) ? vx : vy; // minimum dimension
     GLint xl = (vx - v) / 2;
     GLint yb = (vy - v) / 2;
@@ -444,39 +750,51 @@ Display()
     LightY = 30.f;
     LightZ = 0.f;
 
-    Turtle turtle = drawTreeBody();
+    if(TreeDirty || (Headless.enabled && Headless.rebuildTree))
+    {
+        std::string lsystemString = generateTreeString();
+        Timings.endStage(FrameTimes::STAGE_LSYSTEM);
+        Tree = buildTreeBody(lsystemString);
+        Timings.endStage(FrameTimes::STAGE_TURTLE);
+        TreeDirty = false;
+        RebuildDetacher();
+    }
+    Turtle& turtle = Tree;
+
+    // Same camera as the fixed-function setup above, in glm:
+    glm::mat4 cameraProjection = (NowProjection == ORTHO)
+        ? glm::ortho(-2.f, 2.f, -2.f, 2.f, 0.1f, 1000.f)
+        : glm::perspective(glm::radians(70.f), 1.f, 0.1f, 1000.f);
+    glm::mat4 cameraView = glm::lookAt(glm::vec3(camX, camY, camZ),
+                                       glm::vec3(0.f, 5.f, 0.f),
+                                       glm::vec3(0.f, 1.f, 0.f));
+    cameraView = glm::rotate(cameraView, glm::radians(Yrot), glm::vec3(0.f, 1.f, 0.f));
+    cameraView = glm::rotate(cameraView, glm::radians(Xrot), glm::vec3(1.f, 0.f, 0.f));
+    cameraView = glm::scale(cameraView, glm::vec3(Scale, Scale, Scale));
+    CameraEye = glm::vec3(glm::inverse(cameraView) * glm::vec4(0.f, 0.f, 0.f, 1.f));
+
+    // Culling stage: camera-visible set for the leaf pass, and the caster list
+    // for the shadow cascades (with the branches where the wind has put them)
+    UpdateTreeWind(turtle);
+    BuildCullItems(turtle);
+    Culler.cull(cameraProjection * cameraView);
+    PrepareLeaves(turtle, cameraView);
+    PrepareLitter(cameraProjection * cameraView, cameraView);
+    Timings.endStage(FrameTimes::STAGE_LEAVES);
 
     //=============================================================
     // 1ST PASS: RENDER DEPTH FROM LIGHT’S POINT OF VIEW
     //=============================================================
-    glBindFramebuffer(GL_FRAMEBUFFER, DepthFramebuffer);
-    glClear(GL_DEPTH_BUFFER_BIT);
-
-    // We don’t need a color buffer here:
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glEnable(GL_DEPTH_TEST);
-    glShadeModel(GL_FLAT);
-    glDisable(GL_NORMALIZE); // Speed up depth pass
-
-    // Orthographic for a directional‐like light, or pick perspective if needed:
-    glm::mat4 lightProjection = glm::ortho(-30.f, 30.f, -30.f, 30.f, 0.1f, 80.f);
-    // glm::vec3 lightPos(LightX, LightY, LightZ);
-    // glm::mat4 lightView = glm::lookAt(lightPos,
-    //                                   glm::vec3(0.f, 0.f, 0.f),
-    //                                   glm::vec3(0.f, 1.f, 0.f));
-    // glm::mat4 lightSpaceMatrix = lightProjection * lightView;
-    // glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-
-    // // Use the GetDepth shader:
-    // GetDepth.Use();
-    // GetDepth.SetUniformVariable("uLightSpaceMatrix", lightSpaceMatrix);
-    // float color[3] = {0.f, 1.f, 1.f};
-    // GetDepth.SetUniformVariable("uColor", color);
-    // // DisplayOneScene2(&GetDepth);
-    // DisplayOneScene(&GetDepth, turtle);
-    // GetDepth.UnUse();
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);  // back to screen FBO
+    // Cascades are fitted to the camera frustum every frame, but a cascade's
+    // depth texture is only re-rendered when its light matrix or casters change.
+    if(ShadowsOn)
+    {
+        glm::vec3 lightDir = glm::vec3(0.f, 0.f, 0.f) - glm::vec3(LightX, LightY, LightZ);
+        Cascades.update(cameraView, cameraProjection, 0.1f, 1000.f, lightDir, Culler.GetItems());
+        RenderShadowCascades(turtle);
+        glViewport(xl, yb, v, v);
+    }
+    Timings.endStage(FrameTimes::STAGE_SHADOWS);
 
     //=============================================================
     // 2ND PASS: RENDER THE SCENE FROM THE CAMERA’S POV, USING DEPTH MAP
@@ -513,11 +831,128 @@ Display()
     // DisplayOneScene(&RenderWithShadows, turtle);
     // // DisplayOneScene2(&RenderWithShadows);
     // RenderWithShadows.UnUse();
-    LeafProgram.Use();
-    DisplayOneScene(&LeafProgram, turtle);
-    // Swap buffers:
-    glutSwapBuffers();
-    glFlush();
+    // GLUI-controlled material:
+    LeafProgram.SetUniformVariable((char*)"uKa", NowKa);
+    LeafProgram.SetUniformVariable((char*)"uKd", NowKd);
+    LeafProgram.SetUniformVariable((char*)"uKs", NowKs);
+    LeafProgram.SetUniformVariable((char*)"uShininess", NowShine);
+    LeafProgram.SetUniformVariable((char*)"uAlpha", NowAlpha);
+    LeafProgram.SetUniformVariable((char*)"uShadowsOn", ShadowsOn ? 1 : 0);
+    if(ShadowsOn)
+    {
+        static char* lightSpaceNames[NUM_CASCADES] = {
+            (char*)"uLightSpaceMatrices[0]", (char*)"uLightSpaceMatrices[1]", (char*)"uLightSpaceMatrices[2]" };
+        // (separate scalars: the type-checked float setter can't find
+        // elements of a float array past [0])
+        static char* cascadeEndNames[NUM_CASCADES] = {
+            (char*)"uCascadeEnd0", (char*)"uCascadeEnd1", (char*)"uCascadeEnd2" };
+        static char* shadowMapNames[NUM_CASCADES] = {
+            (char*)"uShadowMap0", (char*)"uShadowMap1", (char*)"uShadowMap2" };
+        LeafProgram.SetUniformVariable((char*)"uEyeToWorld", glm::inverse(cameraView));
+        for(int i = 0; i < NUM_CASCADES; i++)
+        {
+            // shadow maps live on texture units 4, 5, 6 (3 is the bark noise)
+            glActiveTexture(GL_TEXTURE4 + i);
+            glBindTexture(GL_TEXTURE_2D, DepthTextures[i]);
+            LeafProgram.SetUniformVariable(lightSpaceNames[i], Cascades.GetCascade(i).lightSpaceMatrix);
+            LeafProgram.SetUniformVariable(cascadeEndNames[i], Cascades.GetCascade(i).farDist);
+            LeafProgram.SetUniformVariable(shadowMapNames[i], 4 + i);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // Record, sort and issue the bark and leaf draws:
+    Queue.begin();
+    QueueScene(turtle, cameraView);
+    GLRenderBackend backend(turtle);
+    Queue.flush(backend);
+    BarkTextureProgram.UnUse();
+    glDisable(GL_TEXTURE_2D);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    Timings.endStage(FrameTimes::STAGE_SUBMIT);
+
+    // Offscreen there is no swap to wait on, so wait here and keep the GPU
+    // time out of the next frame's stages
+    if(SceneFramebuffer != 0)
+    {
+        glFinish();
+        Timings.endStage(FrameTimes::STAGE_GPU_WAIT);
+    }
+    Timings.endFrame();
+
+    if(DebugOn != 0)
+    {
+        const RenderStats& stats = Queue.GetStats();
+        fprintf(stderr, "Queue: %d draws, %d shader / %d texture / %d pass changes\n",
+            stats.draws, stats.shaderChanges, stats.textureChanges, stats.passChanges);
+    }
+}
+
+// --headless: render Headless.frames frames along a fixed camera path (one orbit
+// around the tree while dollying in and out), print the stage timings and
+// optionally write every frame as a PPM for image regression checks
+int RunHeadless()
+{
+    OffscreenContext context;
+    if(!context.create(Headless.width, Headless.height))
+        return 1;
+    SceneFramebuffer = context.GetFramebuffer();
+
+    InitRenderResources();
+    InitLists();
+    InitSim();
+    Reset();
+    if(!Headless.loadSnapshot.empty() && !LoadSnapshot(Headless.loadSnapshot.c_str()))
+        return 1;
+    ShadowsOn = Headless.shadows ? 1 : 0;
+    NowAlpha = Headless.alpha;
+
+    const float baseX = camX, baseY = camY, baseZ = camZ;
+    std::vector<unsigned char> pixels;
+    int total = Headless.warmup + Headless.frames;
+    for(int f = 0; f < total; f++)
+    {
+        int timed = f - Headless.warmup;     // < 0 while warming up
+        if(timed == 0)
+            Timings.clear();
+
+        float t = (timed < 0) ? 0.f : (float)timed / (float)Headless.frames;
+        Yrot = 360.f * t;
+        float dolly = 1.f - 0.2f * sinf((float)M_PI * t);
+        camX = baseX * dolly;
+        camY = baseY * dolly;
+        camZ = baseZ * dolly;
+
+        Timings.beginFrame();
+        AdvanceSim(1. / Headless.fps);
+        Timings.endStage(FrameTimes::STAGE_SIM);
+        RenderFrame(Headless.width, Headless.height);
+
+        if(timed >= 0 && !Headless.dumpDir.empty() && timed % Headless.dumpEvery == 0)
+        {
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/frame_%04d.ppm", Headless.dumpDir.c_str(), timed);
+            context.readPixels(pixels);
+            if(!WritePPM(path, Headless.width, Headless.height, pixels))
+                fprintf(stderr, "(does the directory '%s' exist?)\n", Headless.dumpDir.c_str());
+        }
+    }
+
+    const RenderStats& stats = Queue.GetStats();
+    fprintf(stderr, "%dx%d, shadows %s, alpha %.2f, last frame %d draws, %lld sim steps\n",
+        Headless.width, Headless.height, ShadowsOn ? "on" : "off", NowAlpha, stats.draws,
+        SimClock.GetSteps());
+    Timings.printSummary(stdout);
+    if(!Headless.csvPath.empty() && !Timings.writeCsv(Headless.csvPath.c_str()))
+        fprintf(stderr, "Cannot write '%s'\n", Headless.csvPath.c_str());
+    if(!Headless.saveSnapshot.empty() && !SaveSnapshot(Headless.saveSnapshot.c_str()))
+        return 1;
+    if(!Headless.checkSnapshot.empty() && !CheckSnapshot(Headless.checkSnapshot.c_str(), (int)Headless.fps))
+        return 1;
+
+    context.destroy();
+    return 0;
 }
 
 // Keyboard callback
@@ -569,6 +1004,12 @@ Display()
             changeRule++;
             break;
 
+        // Save the simulation (once no step is running)
+        case 'k':
+        case 'K':
+            SnapshotWanted = true;
+            break;
+
         // ======== WASD MOVEMENT ========
         case 'w':
         case 'W':
@@ -684,6 +1125,7 @@ void Reset()
     DepthCueOn = 0;
     Scale = 1.f;
     ShadowsOn = 0;
+    Cascades.invalidate();
     NowColor = YELLOW;
     NowProjection = PERSP;
     Xrot = Yrot = 0.f;
@@ -786,6 +1228,13 @@ void DoProjectMenu(int id)
     glutPostRedisplay();
 }
 
+void DoShadowsMenu(int id)
+{
+    ShadowsOn = id;
+    glutSetWindow(MainWindow);
+    glutPostRedisplay();
+}
+
 //=============================================================================
 //  10. GL/GLUT Initialization and Menu Setup
 //=============================================================================
@@ -827,6 +1276,10 @@ void InitMenus()
     glutAddMenuEntry("Orthographic", ORTHO);
     glutAddMenuEntry("Perspective",  PERSP);
 
+    int shadowsmenu = glutCreateMenu(DoShadowsMenu);
+    glutAddMenuEntry("Off", 0);
+    glutAddMenuEntry("On",  1);
+
     int mainmenu = glutCreateMenu(DoMainMenu);
     glutAddSubMenu("Axes", axesmenu);
     glutAddSubMenu("Axis Colors", colormenu);
@@ -841,6 +1294,7 @@ void InitMenus()
 
     glutAddSubMenu("Depth Cue", depthcuemenu);
     glutAddSubMenu("Projection", projmenu);
+    glutAddSubMenu("Shadows", shadowsmenu);
     glutAddMenuEntry("Reset", RESET);
     glutAddSubMenu("Debug", debugmenu);
     glutAddMenuEntry("Quit", QUIT);
@@ -875,29 +1329,6 @@ void InitGraphics()
     if(DebugOn != 0)
         fprintf(stderr, "Starting InitGraphics.\n");
 
-    // 10s animation
-    Kamp.Init();
-    Kfreq.Init();
-    Kspeed.Init();
-
-    Kamp.AddTimeValue(0, 0.5);
-    Kfreq.AddTimeValue(0, 1);
-    Kspeed.AddTimeValue(0, 5);
-
-    Kamp.AddTimeValue(5, 1);
-    Kfreq.AddTimeValue(5, 0.5);
-    Kspeed.AddTimeValue(5, 7);
-
-    Kamp.AddTimeValue(7, 0.7f);
-    Kfreq.AddTimeValue(7, 2);
-    Kspeed.AddTimeValue(7, 3);
-
-    Kamp.AddTimeValue(10, 0.5);
-    Kfreq.AddTimeValue(10, 1);
-    Kspeed.AddTimeValue(10, 5);
-
-    Kamp.PrintTimeValues();
-
     // Request display modes:
     glutInitDisplayMode(GLUT_RGBA | GLUT_DOUBLE | GLUT_DEPTH);
 
@@ -928,6 +1359,26 @@ void InitGraphics()
 	// Setup GLUI:
 	initGlui();
 
+    InitRenderResources();
+}
+
+// Textures, shaders and framebuffers -- everything that only needs a current
+// GL context, so the headless mode can share it
+void InitRenderResources()
+{
+#ifdef WIN32
+    // init GLEW
+    GLenum err = glewInit();
+    if(err != GLEW_OK)
+    {
+        fprintf(stderr, "glewInit Error\n");
+    }
+    else
+    {
+        fprintf(stderr, "GLEW initialized OK\n");
+        fprintf(stderr, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
+    }
+#endif
 
     // Setup texture(s):
 	////////////////////////////////////////////////////////////
@@ -1010,42 +1461,634 @@ void InitGraphics()
      }
     
 	////////////////////////////////////////////////////////////
-	//set up shadow texture:
-	//Generate a framebuffer object and a depth texture:
+	//set up shadow textures:
+	//Generate a framebuffer object and one depth texture per cascade:
     glGenFramebuffers(1, &DepthFramebuffer);
-	glGenTextures(2, &DepthTexture);
-
-	//Create a texture that will be the framebuffer's depth buffer
-	glBindTexture(GL_TEXTURE_2D, DepthTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	//Attach texture to framebuffer as depth buffer
+	glGenTextures(NUM_CASCADES, DepthTextures);
+
+	//Create the textures that will be the framebuffer's depth buffer
+	for(int i = 0; i < NUM_CASCADES; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, DepthTextures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	Cascades.setShadowDistance(SHADOW_DISTANCE);
+	//Attach the first texture to framebuffer as depth buffer (the others are swapped in per cascade)
 	glBindFramebuffer(GL_FRAMEBUFFER, DepthFramebuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, DepthTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, DepthTextures[0], 0);
 
 	// force opengl to accept a framebuffer that doesn't have a color buffer in it:
 	glDrawBuffer(GL_NONE);
 	glReadBuffer(GL_NONE);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	
+	glBindFramebuffer(GL_FRAMEBUFFER, SceneFramebuffer);
+}
 
-#ifdef WIN32
-    // init GLEW
-    GLenum err = glewInit();
-    if(err != GLEW_OK)
+// Wind keytimes (one MS_PER_CYCLE loop) and the initial sim state
+void InitSim()
+{
+    // 10s animation
+    Kamp.Init();
+    Kfreq.Init();
+    Kspeed.Init();
+
+    Kamp.AddTimeValue(0, 0.5);
+    Kfreq.AddTimeValue(0, 1);
+    Kspeed.AddTimeValue(0, 5);
+
+    Kamp.AddTimeValue(5, 1);
+    Kfreq.AddTimeValue(5, 0.5);
+    Kspeed.AddTimeValue(5, 7);
+
+    Kamp.AddTimeValue(7, 0.7f);
+    Kfreq.AddTimeValue(7, 2);
+    Kspeed.AddTimeValue(7, 3);
+
+    Kamp.AddTimeValue(10, 0.5);
+    Kfreq.AddTimeValue(10, 1);
+    Kspeed.AddTimeValue(10, 5);
+
+    Kamp.PrintTimeValues();
+
+    // a 25 unit grid over the tree; gusts about the size of a big branch
+    WindSettings wind;
+    wind.direction = 0.5f;
+    wind.gustSize = 60.f;
+    Wind = WindField();
+    Wind.setGrid(WIND_LO, WIND_HI, 17, 13, 17);
+    Wind.setSettings(wind);
+    Wind.setJobs(&Jobs);
+    FallingLeaves.setJobs(&Jobs);
+    Collider.setJobs(&Jobs);
+    Culler.setJobs(&Jobs);
+
+    FallingLeaves.clear();
+    FallingColor.clear();
+    RebuildDetacher();
+
+    // the motion database, once; missing files just mean no playback tier
+    if (!FallingDb.isOpen() && FallingDb.open("motion_database.bin"))
     {
-        fprintf(stderr, "glewInit Error\n");
+        if (FallingGraph.load("motion_graph.bin", FallingDb))
+            FallingIndex.build(FallingDb);
+        else
+            fprintf(stderr, "motion_graph.bin: not loaded, distant leaves drift\n");
     }
-    else
+    FallLodSettings lod;
+    lod.nearDistance = FALL_LOD_NEAR;
+    lod.farDistance = FALL_LOD_FAR;
+    lod.maxFull = FALL_MAX_FULL;
+    lod.groundY = YGRID / SCENE_UNITS_PER_METER;
+    FallingLod.setSettings(lod);
+    FallingLod.setMotionGraph(&FallingGraph, &FallingIndex);
+    FallingLod.clear();
+
+    // leaves land on the grid and lie in cells over the wind grid's footprint
+    Ground = GroundContact();
+    Ground.groundY = YGRID / SCENE_UNITS_PER_METER;
+    Litter.setGrid(WIND_LO[0], WIND_LO[2], WIND_HI[0], WIND_HI[2], LITTER_CELLS, LITTER_CELLS, YGRID);
+    Litter.setCapacity(LITTER_PER_CELL, LITTER_BUDGET);
+    Litter.setLayerThickness(0.01f);
+    Litter.setLeafArea(4.f);        // a ~2 unit leaf
+
+    SimClock.reset();
+    memset(&SimCurr, 0, sizeof(SimCurr));
+    StepSim(SimCurr, 0.);       // evaluate the keytimes at t = 0
+    SimPrev = SimDraw = SimCurr;
+    SimStepsOwed = 0;
+    LastAnimateMs = -1;
+}
+
+// Run as many fixed sim steps as frameSeconds of real time allow, then blend
+// the last two states for drawing (headless; the window goes through Animate())
+void AdvanceSim(double frameSeconds)
+{
+    int steps = SimClock.advance(frameSeconds);
+    for(int i = 0; i < steps; i++)
     {
-        fprintf(stderr, "GLEW initialized OK\n");
-        fprintf(stderr, "Status: Using GLEW %s\n", glewGetString(GLEW_VERSION));
+        SimPrev = SimCurr;
+        StepSim(SimCurr, SimClock.GetStepSize());
     }
-#endif
+    SimDraw = InterpolateSim(SimPrev, SimCurr, (float)SimClock.GetAlpha());
+
+    double cycle = (double)MS_PER_CYCLE / 1000.;
+    Time = (float)(fmod(SimDraw.simTime, cycle) / cycle); // 0..1
+}
+
+// Snapshots (LeafSim/Snapshot.hpp) of everything the sim steps: the clock,
+// the last two scene states, the wind, the falling leaves and their tiers,
+// the litter and which tree leaves have let go.  The tree itself is not
+// saved: it comes out the same from the same rules, so only its shape goes
+// in, to refuse a snapshot of another tree.
+struct TreeShape {
+    uint32_t numSegments, numLeaves, numBranches;
+};
+
+TreeShape GetTreeShape()
+{
+    TreeShape shape;
+    shape.numSegments = (uint32_t)Tree.GetSegments().size();
+    shape.numLeaves = (uint32_t)Tree.GetLeaves().size();
+    shape.numBranches = (uint32_t)BranchTip.size();
+    return shape;
+}
+
+// Between sim steps only (not while StepSim() runs)
+bool SaveSnapshot(const char* path)
+{
+    // leaves let go but not yet falling: take them off the queue and put them back
+    std::vector<uint32_t> pending;
+    uint32_t leaf;
+    while (DetachQueue.pop(&leaf))
+        pending.push_back(leaf);
+    for (size_t i = 0; i < pending.size(); ++i)
+        DetachQueue.push(pending[i]);
+
+    SnapshotWriter out;
+    out.addValue("scene.tree", GetTreeShape());
+    out.addValue("scene.prev", SimPrev);
+    out.addValue("scene.curr", SimCurr);
+    out.add("scene.color", FallingColor);
+    out.add("scene.pending", pending);
+    SimClock.save(out);
+    Wind.save(out);
+    FallingLeaves.save(out);
+    FallingLod.save(out);
+    Litter.save(out);
+    Detacher.save(out);
+    if (!out.write(path))
+        return false;
+    fprintf(stderr, "Saved %s: %u falling, %u on the ground, sim time %.2f s\n", path,
+        FallingLeaves.size(), Litter.size(), SimCurr.simTime);
+    return true;
+}
+
+// After InitSim(); false (with a message) if the file can't be used, in
+// which case the sim may be part way restored and should be InitSim()'d
+bool LoadSnapshot(const char* path)
+{
+    Snapshot in;
+    if (!in.open(path))
+        return false;
+
+    // 1) The tree the snapshot was taken of
+    if (TreeDirty)
+    {
+        Tree = buildTreeBody(generateTreeString());
+        TreeDirty = false;
+        RebuildDetacher();
+    }
+    TreeShape shape, ours = GetTreeShape();
+    if (!in.readValue("scene.tree", &shape) || memcmp(&shape, &ours, sizeof(shape)) != 0)
+    {
+        fprintf(stderr, "%s: taken of another tree\n", path);
+        return false;
+    }
+
+    // 2) The scene states and the leaves let go but not yet falling
+    std::vector<uint32_t> pending;
+    if (!in.readValue("scene.prev", &SimPrev) || !in.readValue("scene.curr", &SimCurr) ||
+        !in.read("scene.color", &FallingColor) || !in.read("scene.pending", &pending) ||
+        pending.size() > DetachQueue.GetCapacity())
+    {
+        fprintf(stderr, "%s: no scene state\n", path);
+        return false;
+    }
+
+    // 3) Everything stepped
+    if (!SimClock.load(in) || !Wind.load(in) || !FallingLeaves.load(in) || !FallingLod.load(in) ||
+        !Litter.load(in) || !Detacher.load(in) || FallingColor.size() != FallingLeaves.size())
+    {
+        fprintf(stderr, "%s: sim state missing or for other settings\n", path);
+        return false;
+    }
+    DetachQueue.clear();
+    for (size_t i = 0; i < pending.size(); ++i)
+        DetachQueue.push(pending[i]);
+
+    SimDraw = InterpolateSim(SimPrev, SimCurr, (float)SimClock.GetAlpha());
+    LastAnimateMs = -1;
+    fprintf(stderr, "Loaded %s: %u falling, %u on the ground, sim time %.2f s\n", path,
+        FallingLeaves.size(), Litter.size(), SimCurr.simTime);
+    return true;
+}
+
+// --check-snapshot: save, run 'frames' more frames, load what was saved and
+// run them again; the falling leaves, their colors and the litter must come
+// out the same to the bit.  Nothing is drawn in between, so both runs see
+// the camera and the tree's sway of the last frame drawn.
+bool CheckSnapshot(const char* path, int frames)
+{
+    if (!SaveSnapshot(path))
+        return false;
+    for (int f = 0; f < frames; f++)
+        AdvanceSim(1. / Headless.fps);
+    std::vector<LeafState3D> states(FallingLeaves.size());
+    for (uint32_t i = 0; i < FallingLeaves.size(); ++i)
+        states[i] = FallingLeaves.GetState(i);
+    std::vector<uint8_t> colors = FallingColor;
+    uint32_t numAwake = FallingLeaves.GetNumAwake(), numLitter = Litter.size();
+    SceneState curr = SimCurr;
+
+    if (!LoadSnapshot(path))
+        return false;
+    for (int f = 0; f < frames; f++)
+        AdvanceSim(1. / Headless.fps);
+    bool same = FallingLeaves.size() == states.size() && FallingLeaves.GetNumAwake() == numAwake &&
+        FallingColor == colors && Litter.size() == numLitter && SimCurr.simTime == curr.simTime &&
+        SimCurr.swayPhase == curr.swayPhase;
+    for (uint32_t i = 0; same && i < FallingLeaves.size(); ++i)
+    {
+        LeafState3D s = FallingLeaves.GetState(i);
+        same = memcmp(&s, &states[i], sizeof(s)) == 0;
+    }
+    fprintf(stderr, "%s: %d frames on from the snapshot, %u falling: %s\n", path, frames,
+        FallingLeaves.size(), same ? "the same" : "DIFFERENT");
+    return same;
+}
+
+// One fixed step, waited for
+void StepSim(SceneState& state, double dt)
+{
+    LaunchSimStep(state, dt);
+    FinishSimStep();
+}
+
+// Start one fixed step: the wind keytimes and sway phase here, the wind
+// field and the falling leaves as SimGraph on Jobs.  Nothing may read or
+// change the sim until FinishSimStep(), or until SimStep is done.
+void LaunchSimStep(SceneState& state, double dt)
+{
+    state.simTime += dt;
+    float t = (float)fmod(state.simTime, (double)MS_PER_CYCLE / 1000.);
+    state.windAmp   = Kamp.GetValue(t);
+    state.windFreq  = Kfreq.GetValue(t);
+    state.windSpeed = Kspeed.GetValue(t);
+
+    // mean speed, gust strength and gust rate come from the keytimes; only
+    // the latest step's field is kept (it changes slowly next to a frame)
+    WindSettings wind = Wind.GetSettings();
+    wind.speed = state.windSpeed;
+    wind.gustiness = state.windAmp;
+    wind.gustFrequency = 0.5f * state.windFreq;
+    Wind.setSettings(wind);
+
+    // Leaves let go: more in a stronger, gustier wind, and no more than
+    // there is room for among the awake falling ones (counting those still
+    // in the queue)
+    uint32_t pending = DetachQueue.GetCapacity() - DetachQueue.GetFree();
+    uint32_t awake = FallingLeaves.GetNumAwake() + pending;
+    uint32_t budget = (awake < MAX_FALLING) ? MAX_FALLING - awake : 0;
+    float rate = LEAF_RELEASE_RATE * (state.windSpeed / 5.f) * (state.windAmp / 0.5f);
+
+    // The wind field and the branch capsules do not depend on each other;
+    // the falling leaves and the detachment scheduler need the wind, the
+    // collisions everything before them.  The scheduler has no edge to the
+    // falling leaves: it hands them leaves through DetachQueue, and they take
+    // only the 'pending' ones queued before this step, so a leaf always
+    // starts falling the step after it lets go, however the tasks interleave
+    double simTime = state.simTime;
+    SimGraph.clear();
+    uint32_t windTask      = SimGraph.add([simTime]() { Wind.update(simTime); });
+    uint32_t detachTask    = SimGraph.add([dt, rate, budget]() { DetachLeaves(dt, rate, budget); });
+    uint32_t capsuleTask   = SimGraph.add([]() { UpdateBranchCapsules(); });
+    uint32_t integrateTask = SimGraph.add([dt, pending]() { IntegrateFallingLeaves(dt, pending); });
+    uint32_t collideTask   = SimGraph.add([]() { Collider.collide(FallingLeaves); });
+    uint32_t settleTask    = SimGraph.add([dt]() { SettleFallingLeaves(dt); });
+    SimGraph.precede(windTask, integrateTask);
+    SimGraph.precede(windTask, detachTask);
+    SimGraph.precede(integrateTask, collideTask);
+    SimGraph.precede(capsuleTask, collideTask);
+    SimGraph.precede(collideTask, settleTask);
+    Jobs.launch(SimGraph, &SimStep);
+    SimRunning = true;
+
+    // integrating (rather than sin(freq * t)) keeps the sway continuous when
+    // the frequency keytime changes
+    state.swayPhase += 2.f * (float)M_PI * state.windFreq * (float)dt;
+    state.swayPhase = fmodf(state.swayPhase, 2.f * (float)M_PI);
+}
+
+// The launched step, once it is done (waits, helping, if it is not)
+void FinishSimStep()
+{
+    if(!SimRunning)
+        return;
+    Jobs.wait(&SimStep);
+    SimRunning = false;
+}
+
+SceneState InterpolateSim(const SceneState& a, const SceneState& b, float alpha)
+{
+    SceneState s;
+    s.simTime   = a.simTime   + alpha * (b.simTime - a.simTime);
+    s.windAmp   = a.windAmp   + alpha * (b.windAmp - a.windAmp);
+    s.windFreq  = a.windFreq  + alpha * (b.windFreq - a.windFreq);
+    s.windSpeed = a.windSpeed + alpha * (b.windSpeed - a.windSpeed);
+
+    // the phase only moves forward; undo the wrap before blending
+    float dPhase = b.swayPhase - a.swayPhase;
+    if(dPhase < 0.f)
+        dPhase += 2.f * (float)M_PI;
+    s.swayPhase = fmodf(a.swayPhase + alpha * dPhase, 2.f * (float)M_PI);
+    return s;
+}
+
+// Sway of leaf i about its right axis, stronger in a local gust; the phase
+// offset comes from the leaf's position so neighbours don't move in lockstep
+float LeafSwayDegrees(const Turtle::Leaf& leaf, uint32_t i)
+{
+    float offset = 0.37f * leaf.position.x + 0.13f * leaf.position.y + 0.61f * leaf.position.z;
+    float gust = (i < LeafGust.size()) ? LeafGust[i] : 1.f;
+    return LEAF_SWAY_DEGREES * SimDraw.windAmp * gust * sinf(SimDraw.swayPhase + offset);
+}
+
+// Sample the wind at every segment end and leaf in one batch and turn it into
+// BranchSway, LeafSway and LeafGust
+void UpdateTreeWind(Turtle& turtle)
+{
+    const std::vector<Turtle::Segment>& segments = turtle.GetSegments();
+    const std::vector<Turtle::Leaf>& leaves = turtle.GetLeaves();
+    size_t numEnds = 2 * segments.size();
+    size_t n = numEnds + leaves.size();
+
+    // 1) Points and their flex; flex is normalised so BRANCH_SWAY_TIP holds for any tree
+    WindPx.resize(n);
+    WindPy.resize(n);
+    WindPz.resize(n);
+    WindUx.resize(n);
+    WindUy.resize(n);
+    WindUz.resize(n);
+    float maxFlex = 0.f;
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        const Turtle::Segment& seg = segments[i];
+        WindPx[2*i] = seg.start.x;  WindPy[2*i] = seg.start.y;  WindPz[2*i] = seg.start.z;
+        WindPx[2*i+1] = seg.end.x;  WindPy[2*i+1] = seg.end.y;  WindPz[2*i+1] = seg.end.z;
+        maxFlex = std::max(maxFlex, seg.flexEnd);
+    }
+    for (size_t i = 0; i < leaves.size(); ++i)
+    {
+        WindPx[numEnds + i] = leaves[i].position.x;
+        WindPy[numEnds + i] = leaves[i].position.y;
+        WindPz[numEnds + i] = leaves[i].position.z;
+    }
+
+    // 2) One vectorised lookup for all of them
+    Wind.sample(WindPx.data(), WindPy.data(), WindPz.data(), (uint32_t)n,
+                WindUx.data(), WindUy.data(), WindUz.data());
+
+    // 3) Offsets
+    float scale = (maxFlex > 0.f) ? BRANCH_SWAY_TIP / maxFlex : 0.f;
+    float invMean = 1.f / std::max(Wind.GetSettings().speed, 0.1f);
+    BranchSway.resize(numEnds);
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        float f0 = scale * segments[i].flexStart, f1 = scale * segments[i].flexEnd;
+        BranchSway[2*i]   = f0 * glm::vec3(WindUx[2*i], WindUy[2*i], WindUz[2*i]);
+        BranchSway[2*i+1] = f1 * glm::vec3(WindUx[2*i+1], WindUy[2*i+1], WindUz[2*i+1]);
+    }
+    LeafSway.resize(leaves.size());
+    LeafGust.resize(leaves.size());
+    for (size_t i = 0; i < leaves.size(); ++i)
+    {
+        glm::vec3 u(WindUx[numEnds + i], WindUy[numEnds + i], WindUz[numEnds + i]);
+        LeafSway[i] = scale * leaves[i].flex * u;
+        LeafGust[i] = glm::length(u) * invMean;
+    }
+}
+
+// Leaf i's own random numbers, the same whichever thread or run asks: an LCG
+// started from a hash (splitmix32's finalizer) of i and SIM_SEED
+struct LeafRandom
+{
+    explicit LeafRandom(uint32_t i)
+    {
+        uint32_t h = i * 0x9E3779B9u + SIM_SEED;
+        h = (h ^ (h >> 16)) * 0x85EBCA6Bu;
+        h = (h ^ (h >> 13)) * 0xC2B2AE35u;
+        m_state = h ^ (h >> 16);
+    }
+
+    float next(float low, float high)
+    {
+        m_state = m_state * 1664525u + 1013904223u;
+        return low + (high - low) * (float)(m_state >> 8) / 16777216.f;
+    }
+
+private:
+    uint32_t m_state;
+};
+
+// Let tree leaf i go: a falling leaf where it hangs, oriented like DrawLeaf()
+// draws it, with a little spin
+void ReleaseLeaf(const Turtle::Leaf& leaf, uint32_t i)
+{
+    glm::vec3 position = leaf.position + ((i < LeafSway.size()) ? LeafSway[i] : glm::vec3(0.f));
+
+    // DrawLeaf()'s [right, up, right x up] turned 90 degrees about y: the
+    // model's x, y (its normal), z are -(right x up), up, right
+    glm::vec3 right = glm::normalize(leaf.right);
+    glm::vec3 back = glm::normalize(glm::cross(right, leaf.up));
+    glm::vec3 up = glm::cross(back, right);
+    glm::quat q = glm::quat_cast(glm::mat3(-back, up, right));
+    position += 5.f * LEAF_MODEL_CENTER * back;    // undo DrawFallingLeaf()'s recentring
+
+    LeafState3D s;
+    s.px = position.x / SCENE_UNITS_PER_METER;
+    s.py = position.y / SCENE_UNITS_PER_METER;
+    s.pz = position.z / SCENE_UNITS_PER_METER;
+    s.qw = q.w;  s.qx = q.x;  s.qy = q.y;  s.qz = q.z;
+    s.vx = s.vy = s.vz = 0.f;
+    LeafRandom random(i);
+    s.wx = random.next(-1.f, 1.f);
+    s.wy = random.next(-1.f, 1.f);
+    s.wz = random.next(-1.f, 1.f);
+
+    // the ComputeTrajectory.py leaf, give or take 20%
+    LeafParams p;
+    p.mass = 0.01f * random.next(0.8f, 1.2f);
+    p.width = 0.1f * random.next(0.8f, 1.2f);
+    p.height = 0.1f * random.next(0.8f, 1.2f);
+    p.dragCoeffPerp = 4.1f * random.next(0.8f, 1.2f);
+    p.dragCoeffPara = 0.9f * random.next(0.8f, 1.2f);
+
+    FallingLeaves.add(s, p);
+    FallingColor.push_back((uint8_t)LeafColorIndex(leaf));
+    FallingLod.add(p);
+}
+
+// Every tree leaf back on its branch (after a rebuild or a reset): the
+// scheduler's buckets, and the tip of each branch for its exposure
+void RebuildDetacher()
+{
+    const std::vector<Turtle::Segment>& segments = Tree.GetSegments();
+    const std::vector<Turtle::Leaf>& leaves = Tree.GetLeaves();
+
+    int numBranches = 0;
+    for (size_t i = 0; i < segments.size(); ++i)
+        numBranches = std::max(numBranches, segments[i].branch + 1);
+    BranchTip.assign(numBranches, glm::vec3(0.f));
+    std::vector<float> tipFlex(numBranches, -1.f);
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        int b = segments[i].branch;
+        if (segments[i].flexEnd > tipFlex[b])
+        {
+            tipFlex[b] = segments[i].flexEnd;
+            BranchTip[b] = segments[i].end;
+        }
+    }
+
+    std::vector<int> branch(leaves.size());
+    std::vector<float> height(leaves.size());
+    for (size_t i = 0; i < leaves.size(); ++i)
+    {
+        branch[i] = segments[leaves[i].segment].branch;
+        height[i] = leaves[i].position.y;
+    }
+    Detacher.setSeed(SIM_SEED);
+    Detacher.build(branch.data(), height.data(), (uint32_t)leaves.size(), (uint32_t)numBranches);
+    DetachQueue.clear();
+}
+
+// Let go of the leaves due this step (at most budget) into DetachQueue.  A
+// branch's exposure is the wind speed at its tip against the strongest
+// gusts the settings give.
+void DetachLeaves(double dt, float rate, uint32_t budget)
+{
+    const WindSettings& wind = Wind.GetSettings();
+    float invGust = 1.f / std::max(wind.speed * (1.f + wind.gustiness), 0.1f);
+    Detacher.schedule(rate, (float)dt, budget, [invGust](uint32_t b)
+    {
+        float p[3] = { BranchTip[b].x, BranchTip[b].y, BranchTip[b].z };
+        float u[3];
+        Wind.sample(p, u);
+        return sqrtf(u[0] * u[0] + u[1] * u[1] + u[2] * u[2]) * invGust;
+    }, DetachQueue);
+}
+
+// The first 'released' leaves DetachLeaves() has let go (those queued before
+// this step), the wind at every falling leaf (once
+// per sim step, in one batch), which of them sleep, tiers of the awake ones
+// by distance from the camera, then FALL_SUBSTEPS steps of the flutter model
+// over the job system for the near ones and FallLod for the rest
+void IntegrateFallingLeaves(double dt, uint32_t released)
+{
+    const std::vector<Turtle::Leaf>& leaves = Tree.GetLeaves();
+    uint32_t leaf;
+    for (uint32_t r = 0; r < released && DetachQueue.pop(&leaf); ++r)
+        ReleaseLeaf(leaves[leaf], leaf);
+
+    uint32_t n = FallingLeaves.size();
+    if (n == 0)
+        return;
+
+    WindPx.resize(n);
+    WindPy.resize(n);
+    WindPz.resize(n);
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        WindPx[i] = SCENE_UNITS_PER_METER * FallingLeaves.GetPx()[i];
+        WindPy[i] = SCENE_UNITS_PER_METER * FallingLeaves.GetPy()[i];
+        WindPz[i] = SCENE_UNITS_PER_METER * FallingLeaves.GetPz()[i];
+    }
+    Wind.sample(WindPx.data(), WindPy.data(), WindPz.data(), n,
+                FallingLeaves.GetWindX(), FallingLeaves.GetWindY(), FallingLeaves.GetWindZ());
+
+    FallingLeaves.updateSleep(Sleep, (float)dt, &SleepOrder);
+    if (!SleepOrder.empty())
+    {
+        SleepColor.resize(n);
+        for (uint32_t i = 0; i < n; ++i)
+            SleepColor[i] = FallingColor[SleepOrder[i]];
+        FallingColor.swap(SleepColor);
+        FallingLod.reorder(SleepOrder);
+    }
+
+    float eye[3] = { CameraEye.x / SCENE_UNITS_PER_METER, CameraEye.y / SCENE_UNITS_PER_METER,
+                     CameraEye.z / SCENE_UNITS_PER_METER };
+    FallingLod.classify(FallingLeaves, eye, [](uint32_t a, uint32_t b) { std::swap(FallingColor[a], FallingColor[b]); });
+
+    FallingLeaves.step((float)dt / (float)FALL_SUBSTEPS, FALL_SUBSTEPS, FallingLod.GetNumFull());
+    FallingLod.advance(FallingLeaves, (float)dt);
+}
+
+// The tree's segments as capsules, where the wind last swayed them
+void UpdateBranchCapsules()
+{
+    const std::vector<Turtle::Segment>& segments = Tree.GetSegments();
+    bool swayed = BranchSway.size() == 2 * segments.size();
+    BranchCapsules.resize(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        glm::vec3 a = segments[i].start, b = segments[i].end;
+        if (swayed)
+        {
+            a += BranchSway[2*i];
+            b += BranchSway[2*i+1];
+        }
+        Capsule& cap = BranchCapsules[i];
+        for (int k = 0; k < 3; ++k)
+        {
+            cap.a[k] = a[k] / SCENE_UNITS_PER_METER;
+            cap.b[k] = b[k] / SCENE_UNITS_PER_METER;
+        }
+        cap.radius = segments[i].baseRadius / SCENE_UNITS_PER_METER;
+    }
+    Collider.setBranches(BranchCapsules);
+}
+
+// Ground contact; leaves at rest go into the litter, lying as they landed
+void SettleFallingLeaves(double dt)
+{
+    Settled.clear();
+    FallingLeaves.collideGround(Ground, (float)dt, &Settled);
+    for (size_t k = Settled.size(); k-- > 0; )
+    {
+        uint32_t i = Settled[k];
+        float model[16];
+        FallingLeaves.GetTransform(i, SCENE_UNITS_PER_METER, model);
+
+        LitterLeaf leaf;
+        memset(&leaf, 0, sizeof(leaf));
+        leaf.x = model[12];
+        leaf.z = model[14];
+        leaf.yaw = atan2f(-model[2], model[0]);     // of the leaf's x axis about +y
+        leaf.flipped = model[5] < 0.f;
+        leaf.color = FallingColor[i];
+        Litter.add(leaf);       // (blown off the grid: just gone)
+
+        FallingLeaves.remove(i);
+        FallingLod.remove(i);
+        FallingColor[i] = FallingColor.back();
+        FallingColor.pop_back();
+    }
+
+    // Blown up (see LeafSim/FlutterModel.hpp on step sizes): gone
+    for (uint32_t i = FallingLeaves.size(); i-- > 0; )
+    {
+        if (!(fabsf(FallingLeaves.GetPy()[i]) < 1.e6f))
+        {
+            FallingLeaves.remove(i);
+            FallingLod.remove(i);
+            FallingColor[i] = FallingColor.back();
+            FallingColor.pop_back();
+        }
+    }
+}
+
+// Cull pose for something swayed by 'offset', to half a unit
+uint32_t SwayPose(const glm::vec3& offset)
+{
+    uint32_t x = (uint32_t)lroundf(2.f * offset.x) & 0x3ff;
+    uint32_t y = (uint32_t)lroundf(2.f * offset.y) & 0x3ff;
+    uint32_t z = (uint32_t)lroundf(2.f * offset.z) & 0x3ff;
+    return x | (y << 10) | (z << 20);
 }
 
 // Create display lists
@@ -1058,7 +2101,8 @@ void InitLists()
     float dx = BOXSIZE / 2.f;
     float dy = BOXSIZE / 2.f;
     float dz = BOXSIZE / 2.f;
-    glutSetWindow(MainWindow);
+    if(!Headless.enabled)
+        glutSetWindow(MainWindow);
 
     // Grid display list
     #define XSIDE   20
@@ -1066,7 +2110,6 @@ void InitLists()
     #define NX      400
     #define DX      (XSIDE/(float)NX)
 
-    #define YGRID   0.f
     #define ZSIDE   20
     #define Z0      (-ZSIDE/2.)
     #define NZ      400
@@ -1108,10 +2151,12 @@ void InitLists()
     glEndList();
 
     // A simple box list if needed for DEMO_Z_FIGHTING:
+    // (glut shapes need glutInit, which headless mode never calls)
     BoxList = glGenLists(1);
     glNewList(BoxList, GL_COMPILE);
         glColor3f(1.f, 1.f, 1.f);
-        glutSolidCube(BOXSIZE);
+        if(!Headless.enabled)
+            glutSolidCube(BOXSIZE);
     glEndList();
 }
 
@@ -1328,8 +2373,9 @@ void SetUpTexture(char* filename, GLuint* texture)
     glTexImage2D(GL_TEXTURE_2D, 0, 3, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, textureData);
 }
 
-// Set up scene
-Turtle drawTreeBody()
+// Build the tree geometry (nothing is drawn here)
+// Rewrite the L-system string for the tree
+std::string generateTreeString()
 {
     // Define the L-system:
     // Axiom & rules
@@ -1344,7 +2390,12 @@ Turtle drawTreeBody()
     };   
     // 1) Create the L-System
     LSystem lsystem(axiom, rules, /*iterations*/ 8 );
-    std::string finalString = lsystem.generate();
+    return lsystem.generate();
+}
+
+// Interpret an L-system string into branch segments and leaves
+Turtle buildTreeBody(const std::string& lsystemString)
+{
     // std::string finalString = "!(1)F(200)/(45)!(vr*vr)F(l*lr)[&(a)F(l*lr)!(vr)F(l)[&(a)F(l)A]/(d1)[&(a)F(l)A]/(d2)[&(a)F(l)A]]/(d1)[&(a)F(l*lr)!(vr)F(l)[&(a)F(l)A]/(d1)[&(a)F(l)A]/(d2)[&(a)F(l)A]]/(d2)[&(a)F(l*lr)!(vr)F(l)[&(a)F(l)A]/(d1)[&(a)F(l)A]/(d2)[&(a)F(l)A]]";
     // std::cout << "Ternary L-System final string: " << finalString << std::endl;
     // 2) Create a Turtle to interpret that L-System
@@ -1359,84 +2410,475 @@ Turtle drawTreeBody()
      //set tropism 
     turtle.setTropismVector(glm::vec3(0.0f, -.5f, 0.0f)); // gravity downward
     turtle.setTropismCoefficient(0.12f); // how strongly it bends'
-    
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, Noise2);
-    BarkTextureProgram.Use();
-    BarkTextureProgram.SetUniformVariable((char*)"uKa", 0.5f);
-    BarkTextureProgram.SetUniformVariable((char*)"uKd", 0.5f);
-    BarkTextureProgram.SetUniformVariable((char*)"uKs", 0.4f);
-    BarkTextureProgram.SetUniformVariable((char*)"uShininess", 1.f);
-    BarkTextureProgram.SetUniformVariable((char*)"uNoiseAmp", 2.9f);
-    BarkTextureProgram.SetUniformVariable((char*)"uNoiseFreq", 2.4f);
-    BarkTextureProgram.SetUniformVariable((char*)"Noise2", 3);
-
-    // 3) Draw
-    glPushMatrix(); 
-        turtle.interpret(finalString, &BarkTextureProgram);
-    glPopMatrix();
-    BarkTextureProgram.UnUse();
+
+    // 3) Record the branch segments and leaves
+    turtle.interpret(lsystemString);
     return turtle;
 } 
 
-void DisplayOneScene(GLSLProgram * prog, Turtle& turtle) {
-
-    // Draw Leaves
-    std::vector<Turtle::Leaf> leafPositions = turtle.GetLeaves();
-    for (const auto& leaf : leafPositions)
-    {
-        glPushMatrix();
-            // 1) Translate to leaf position
-            glTranslatef(leaf.position.x, leaf.position.y, leaf.position.z);
-
-            // 2) Build orientation matrix
-            //    - leaf.right goes in the first column
-            //    - leaf.up goes in the second column
-            //    - cross(right, up) goes in the third column
-            glm::mat3 orientationMatrix;
-            orientationMatrix[0] = glm::normalize(leaf.right); 
-            orientationMatrix[1] = glm::normalize(leaf.up);
-            orientationMatrix[2] = glm::normalize(glm::cross(leaf.right, leaf.up));
-            glm::mat4 rotationMatrix = glm::mat4(orientationMatrix);
-
-            // Multiply current matrix by this orientation
-            glMultMatrixf(glm::value_ptr(rotationMatrix));
-
-            // 3) Scale 
-            float finalScale = 5.0f;  // base scaling
-            #ifdef HAS_LEAF_SCALE // If your Leaf has a 'scale' field
-            finalScale *= leaf.scale;
-            #endif
-            glScalef(finalScale, finalScale, finalScale);
-
-            // 4) Determine leaf color from leaf.position.y
-            float randval = leaf.position.y / 100.f;
-            if (randval < 0.30f) {
-                NowLeafColor[0] = 1.0f;  NowLeafColor[1] = 0.55f; NowLeafColor[2] = 0.0f;
-            } else if (randval < 0.50f) {
-                NowLeafColor[0] = 1.0f;  NowLeafColor[1] = 0.6f;  NowLeafColor[2] = 0.2f;
-            } else if (randval < 0.80f) {
-                NowLeafColor[0] = 0.8f;  NowLeafColor[1] = 0.1f;  NowLeafColor[2] = 0.1f;
-            } else if (randval < 0.90f) {
-                NowLeafColor[0] = 0.85f; NowLeafColor[1] = 0.2f;  NowLeafColor[2] = 0.1f;
-            } else {
-                NowLeafColor[0] = 0.7f;  NowLeafColor[1] = 0.0f;  NowLeafColor[2] = 0.0f;
+// Fill the culling stage with one bounding sphere per branch segment and leaf.
+// Ids [0, numSegments) are segments, ids from numSegments on are leaves.
+void BuildCullItems(Turtle& turtle)
+{
+    const std::vector<Turtle::Segment>& segments = turtle.GetSegments();
+    const std::vector<Turtle::Leaf>& leaves = turtle.GetLeaves();
+
+    Culler.clear();
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        // swayed by the wind (UpdateTreeWind()); the end offset is the pose,
+        // so moving branches refresh the shadow cascades they are in
+        const Turtle::Segment& seg = segments[i];
+        glm::vec3 start = seg.start + BranchSway[2*i], end = seg.end + BranchSway[2*i+1];
+        glm::vec3 center = 0.5f * (start + end);
+        float radius = 0.5f * glm::length(end - start) + seg.baseRadius;
+        Culler.addItem(center, radius, (uint32_t)i, SwayPose(BranchSway[2*i+1]));
+    }
+    for (size_t i = 0; i < leaves.size(); ++i)
+    {
+        if (i < Detacher.GetNumLeaves() && !Detacher.IsAttached((uint32_t)i))
+            continue;   // falling, or fallen
+        // leaf model is about 1 unit across before the 5x scale in DrawLeaf();
+        // the offset and the sway (to half a degree) are the pose
+        uint32_t pose = SwayPose(LeafSway[i]) * 257u + (uint32_t)lroundf(2.f * LeafSwayDegrees(leaves[i], (uint32_t)i));
+        Culler.addItem(leaves[i].position + LeafSway[i], 5.f, (uint32_t)(segments.size() + i), pose);
+    }
+}
+
+// Re-render the depth texture of every cascade whose casters or light matrix changed
+void RenderShadowCascades(Turtle& turtle)
+{
+    const std::vector<Turtle::Segment>& segments = turtle.GetSegments();
+    const std::vector<Turtle::Leaf>& leaves = turtle.GetLeaves();
+    const std::vector<CullItem>& items = Culler.GetItems();
+
+    glBindFramebuffer(GL_FRAMEBUFFER, DepthFramebuffer);
+    // We don’t need a color buffer here:
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+    glDisable(GL_NORMALIZE); // Speed up depth pass
+
+    // GetDepth applies uLightSpaceMatrix on top of the modelview, so the
+    // modelview only has to hold each object's own transform:
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+
+    GetDepth.Use();
+    for (int c = 0; c < Cascades.GetNumCascades(); ++c)
+    {
+        const ShadowCascade& cascade = Cascades.GetCascade(c);
+        if (!cascade.dirty)
+            continue;
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, DepthTextures[c], 0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        GetDepth.SetUniformVariable((char*)"uLightSpaceMatrix", cascade.lightSpaceMatrix);
+
+        for (size_t k = 0; k < cascade.casters.size(); ++k)
+        {
+            uint32_t id = items[cascade.casters[k]].id;
+            if (id < segments.size())
+                turtle.drawSegment(segments[id], &BranchSway[2 * id]);
+            else
+                DrawLeaf(leaves[id - segments.size()], (uint32_t)(id - segments.size()));
+        }
+        Cascades.markClean(c);
+    }
+    GetDepth.UnUse();
+
+    glPopMatrix();
+    glEnable(GL_NORMALIZE);
+    glBindFramebuffer(GL_FRAMEBUFFER, SceneFramebuffer);  // back to the scene target
+}
+
+// Position, orient and draw leaf i with the current program
+void DrawLeaf(const Turtle::Leaf& leaf, uint32_t i)
+{
+    glPushMatrix();
+        // 1) Translate to leaf position, moved with its branch by the wind
+        glm::vec3 position = leaf.position + ((i < LeafSway.size()) ? LeafSway[i] : glm::vec3(0.f));
+        glTranslatef(position.x, position.y, position.z);
+
+        // 2) Build orientation matrix
+        //    - leaf.right goes in the first column
+        //    - leaf.up goes in the second column
+        //    - cross(right, up) goes in the third column
+        glm::mat3 orientationMatrix;
+        orientationMatrix[0] = glm::normalize(leaf.right); 
+        orientationMatrix[1] = glm::normalize(leaf.up);
+        orientationMatrix[2] = glm::normalize(glm::cross(leaf.right, leaf.up));
+        glm::mat4 rotationMatrix = glm::mat4(orientationMatrix);
+
+        // Multiply current matrix by this orientation
+        glMultMatrixf(glm::value_ptr(rotationMatrix));
+
+        // Wind sway about the leaf's right axis (hinged at the stem)
+        glRotatef(LeafSwayDegrees(leaf, i), 1.f, 0.f, 0.f);
+
+        // 3) Scale 
+        float finalScale = 5.0f;  // base scaling
+        #ifdef HAS_LEAF_SCALE // If your Leaf has a 'scale' field
+        finalScale *= leaf.scale;
+        #endif
+        glScalef(finalScale, finalScale, finalScale);
+
+        glRotatef(90.f, 0.f, 1.f, 0.f);
+        glCallList(Leaf2DL);  // <-- your 2D leaf display list
+    glPopMatrix();
+}
+
+// Draw falling leaf i with the current program
+void DrawFallingLeaf(uint32_t i)
+{
+    float model[16];
+    FallingLeaves.GetTransform(i, SCENE_UNITS_PER_METER, model);
+    glPushMatrix();
+        glMultMatrixf(model);
+        glScalef(5.f, 5.f, 5.f);            // as DrawLeaf()
+        glTranslatef(LEAF_MODEL_CENTER, 0.f, 0.f);
+        glCallList(Leaf2DL);
+    glPopMatrix();
+}
+
+// Litter cells to draw this frame and at which detail; (re)build the lists
+// of the ones that changed
+void PrepareLitter(const glm::mat4& viewProj, const glm::mat4& cameraView)
+{
+    Frustum frustum = extractFrustum(viewProj);
+    glm::vec3 eye = glm::vec3(glm::inverse(cameraView) * glm::vec4(0.f, 0.f, 0.f, 1.f));
+    if (LitterCellLists.size() != (size_t)Litter.GetNumCells())
+    {
+        LitterLists none = { 0, 0 };
+        LitterCellLists.assign(Litter.GetNumCells(), none);
+    }
+
+    LitterVisible.clear();
+    LitterLod.clear();
+    for (int c = 0; c < Litter.GetNumCells(); ++c)
+    {
+        const LitterCell& cell = Litter.GetCell(c);
+        if (cell.leaves.empty())
+            continue;
+        float lo[3], hi[3];
+        Litter.GetCellBounds(c, lo, hi);
+        glm::vec3 center = 0.5f * (glm::make_vec3(lo) + glm::make_vec3(hi));
+        float radius = 0.5f * glm::length(glm::make_vec3(hi) - glm::make_vec3(lo)) + 2.f;   // + half a leaf
+        if (!sphereInFrustum(frustum, center, radius))
+            continue;
+
+        float distance = glm::length(center - eye);
+        uint8_t lod = (distance < LITTER_LOD_NEAR) ? 0 : (distance < LITTER_LOD_FAR) ? 1 : 2;
+        if (lod < 2 && LitterCellLists[c].version != cell.version)
+            BuildLitterLists(c);
+        LitterVisible.push_back((uint32_t)c);
+        LitterLod.push_back(lod);
+    }
+}
+
+// Record the display lists of litter cell c: per color, every leaf and the
+// first quarter of them (an even thinning, see LeafLitter.hpp)
+void BuildLitterLists(int c)
+{
+    const LitterCell& cell = Litter.GetCell(c);
+    LitterLists& lists = LitterCellLists[c];
+    if (lists.base == 0)
+        lists.base = glGenLists(2 * LITTER_COLORS);
+
+    size_t quarter = (cell.leaves.size() + 3) / 4;
+    for (int color = 0; color < LITTER_COLORS; ++color)
+    {
+        for (int lod = 0; lod < 2; ++lod)
+        {
+            size_t count = (lod == 0) ? cell.leaves.size() : quarter;
+            glNewList(lists.base + 2 * color + lod, GL_COMPILE);
+            for (size_t j = 0; j < count; ++j)
+            {
+                const LitterLeaf& leaf = cell.leaves[j];
+                if (leaf.color != color)
+                    continue;
+                glPushMatrix();
+                    glTranslatef(leaf.x, leaf.y, leaf.z);
+                    glRotatef(leaf.yaw * (180.f / (float)M_PI), 0.f, 1.f, 0.f);
+                    if (leaf.flipped)
+                        glRotatef(180.f, 1.f, 0.f, 0.f);
+                    glScalef(5.f, 5.f, 5.f);            // as DrawFallingLeaf()
+                    glTranslatef(LEAF_MODEL_CENTER, 0.f, 0.f);
+                    glCallList(Leaf2DL);
+                glPopMatrix();
             }
+            glEndList();
+        }
+    }
+    lists.version = cell.version;
+}
 
-            // 5) Use GLSL shader and draw your leaf shape (e.g. a display list)
-            prog->Use();
-            prog->SetUniformVariable((char*)"uColor", NowLeafColor);
-            glRotatef(90.f, 0.f, 1.f, 0.f);
-            glCallList(Leaf2DL);  // <-- your 2D leaf display list
+// Draw litter cell c with the leaf program: its lists, or a quad of its mean
+// color as big as the ground its leaves cover
+void DrawLitterCell(int c, int lod, float lastColor[3])
+{
+    if (lod < 2)
+    {
+        uint32_t colorCounts[LITTER_COLORS];
+        memcpy(colorCounts, Litter.GetCell(c).colorCounts, sizeof(colorCounts));
+        for (int color = 0; color < LITTER_COLORS; ++color)
+        {
+            if (colorCounts[color] == 0)
+                continue;
+            if (memcmp(lastColor, LEAF_PALETTE[color], 3 * sizeof(float)) != 0)
+            {
+                LeafProgram.SetUniformVariable((char*)"uColor", (float*)LEAF_PALETTE[color]);
+                memcpy(lastColor, LEAF_PALETTE[color], 3 * sizeof(float));
+            }
+            glCallList(LitterCellLists[c].base + 2 * color + lod);
+        }
+        return;
+    }
 
-            prog->UnUse();
+    float lo[3], hi[3], rgb[3];
+    Litter.GetCellBounds(c, lo, hi);
+    Litter.GetMeanColor(c, LEAF_PALETTE, rgb);
+    LeafProgram.SetUniformVariable((char*)"uColor", rgb);
+    memcpy(lastColor, rgb, sizeof(rgb));
+
+    float half = 0.5f * (hi[0] - lo[0]) * sqrtf(Litter.GetCoverage(c));
+    float cx = 0.5f * (lo[0] + hi[0]), cz = 0.5f * (lo[2] + hi[2]), y = hi[1];
+    glBegin(GL_QUADS);
+        glNormal3f(0.f, 1.f, 0.f);
+        glVertex3f(cx - half, y, cz - half);
+        glVertex3f(cx - half, y, cz + half);
+        glVertex3f(cx + half, y, cz + half);
+        glVertex3f(cx + half, y, cz - half);
+    glEnd();
+}
 
-        glPopMatrix();
+// Index into LEAF_PALETTE from leaf.position.y
+int LeafColorIndex(const Turtle::Leaf& leaf)
+{
+    float randval = leaf.position.y / 100.f;
+    if (randval < 0.30f)
+        return 0;
+    else if (randval < 0.50f)
+        return 1;
+    else if (randval < 0.80f)
+        return 2;
+    else if (randval < 0.90f)
+        return 3;
+    return 4;
+}
+
+// Leaf color from leaf.position.y
+void LeafColor(const Turtle::Leaf& leaf, float rgb[3])
+{
+    memcpy(rgb, LEAF_PALETTE[LeafColorIndex(leaf)], 3 * sizeof(float));
+}
+
+// Translucent leaves: flag the visible ones and sort every leaf back to front
+// (all of them, so the count -- and with it the previous frame's order -- stays
+// stable while leaves move in and out of view)
+void PrepareLeaves(Turtle& turtle, const glm::mat4& cameraView)
+{
+    if (NowAlpha >= 1.f)
+        return;
+
+    const std::vector<Turtle::Leaf>& leaves = turtle.GetLeaves();
+    size_t firstLeafId = turtle.GetSegments().size();
+    const std::vector<CullItem>& items = Culler.GetItems();
+    const std::vector<uint32_t>& visible = Culler.GetVisible();
+
+    LeafDepths.resize(leaves.size());
+    LeafVisible.assign(leaves.size(), 0);
+    for (size_t i = 0; i < leaves.size(); ++i)
+        LeafDepths[i] = -(cameraView * glm::vec4(leaves[i].position, 1.f)).z;
+    for (size_t v = 0; v < visible.size(); ++v)
+    {
+        uint32_t id = items[visible[v]].id;
+        if (id >= firstLeafId)
+            LeafVisible[id - firstLeafId] = 1;
     }
-    glDisable(GL_TEXTURE_2D);
+    LeafSorter.sortBackToFront(LeafDepths.data(), (uint32_t)leaves.size());
+}
+
+// Record the tree body and the leaves that survived the culling stage
+void QueueScene(Turtle& turtle, const glm::mat4& cameraView)
+{
+    DrawItem item;
+    memset(&item, 0, sizeof(item));
+
+    // 1) The whole tree body is one draw with the bark shader + noise texture
+    item.pass        = RenderQueue::PASS_OPAQUE;
+    item.shader      = SHADER_BARK;
+    item.texture     = Noise2;
+    item.textureUnit = 3;
+    item.depth       = -(cameraView * glm::vec4(0.f, 0.f, 0.f, 1.f)).z;
+    item.kind        = DRAW_TREE_BODY;
+    Queue.submit(item);
+
+    const std::vector<Turtle::Leaf>& leaves = turtle.GetLeaves();
+    size_t firstLeafId = turtle.GetSegments().size();
+    const std::vector<CullItem>& items = Culler.GetItems();
+    const std::vector<uint32_t>& visible = Culler.GetVisible();
+    item.shader  = SHADER_LEAF;
+    item.texture = 0;
+
+    // 2) Falling leaves, one item for all of them (not culled), and the
+    //    litter cells PrepareLitter() kept
+    if (!LitterVisible.empty())
+    {
+        item.pass  = RenderQueue::PASS_OPAQUE;
+        item.kind  = DRAW_LITTER;
+        item.depth = 0.f;
+        Queue.submit(item);
+    }
+    if (FallingLeaves.size() > 0)
+    {
+        item.pass  = (NowAlpha < 1.f) ? RenderQueue::PASS_TRANSPARENT : RenderQueue::PASS_OPAQUE;
+        item.kind  = DRAW_FALLING_LEAVES;
+        item.depth = 0.f;
+        Queue.submit(item);
+    }
+
+    // 3) Translucent leaves: the visible ones in a single back-to-front item
+    //    (sorted by PrepareLeaves())
+    if (NowAlpha < 1.f)
+    {
+        item.pass  = RenderQueue::PASS_TRANSPARENT;
+        item.kind  = DRAW_SORTED_LEAVES;
+        item.depth = 0.f;
+        Queue.submit(item);
+        return;
+    }
+
+    // 4) Opaque leaves: one draw per visible leaf
+    item.kind = DRAW_LEAF;
+    for (size_t v = 0; v < visible.size(); ++v)
+    {
+        uint32_t id = items[visible[v]].id;
+        if (id < firstLeafId)
+            continue;
+        const Turtle::Leaf& leaf = leaves[id - firstLeafId];
+        item.index = (uint32_t)(id - firstLeafId);
+        item.depth = -(cameraView * glm::vec4(leaf.position, 1.f)).z;
+        LeafColor(leaf, item.color);
+        Queue.submit(item);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// GLRenderBackend
+//-----------------------------------------------------------------------------
+GLRenderBackend::GLRenderBackend(Turtle& turtle)
+    : m_turtle(turtle)
+    , m_leaves(turtle.GetLeaves())
+{
+    m_lastColor[0] = m_lastColor[1] = m_lastColor[2] = -1.f;
+}
+
+void GLRenderBackend::setPass(unsigned pass)
+{
+    glEnable(GL_DEPTH_TEST);
+    if (pass == RenderQueue::PASS_TRANSPARENT)
+    {
+        // test against the opaque depth, but don't write it
+        glEnable(GL_BLEND);
+        glDepthMask(GL_FALSE);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
+    else
+    {
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+    }
+}
 
-    // Done with the shader
-    prog->Use(0);
+void GLRenderBackend::bindShader(uint32_t shader)
+{
+    switch (shader)
+    {
+        case SHADER_BARK:
+            BarkTextureProgram.Use();
+            BarkTextureProgram.SetUniformVariable((char*)"uKa", 0.5f);
+            BarkTextureProgram.SetUniformVariable((char*)"uKd", 0.5f);
+            BarkTextureProgram.SetUniformVariable((char*)"uKs", 0.4f);
+            BarkTextureProgram.SetUniformVariable((char*)"uShininess", 1.f);
+            BarkTextureProgram.SetUniformVariable((char*)"uNoiseAmp", 2.9f);
+            BarkTextureProgram.SetUniformVariable((char*)"uNoiseFreq", 2.4f);
+            BarkTextureProgram.SetUniformVariable((char*)"Noise2", 3);
+            break;
+        case SHADER_LEAF:
+            LeafProgram.Use();
+            m_lastColor[0] = -1.f;    // uColor has to be sent again
+            break;
+        default:
+            LeafProgram.Use(0);
+            break;
+    }
+}
+
+void GLRenderBackend::bindTexture(uint32_t unit, uint32_t texture)
+{
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+void GLRenderBackend::draw(const DrawItem& item)
+{
+    switch (item.kind)
+    {
+        case DRAW_TREE_BODY:
+            glPushMatrix();
+                m_turtle.drawSegments(BranchSway.empty() ? NULL : BranchSway.data());
+            glPopMatrix();
+            break;
+        case DRAW_LEAF:
+            if (memcmp(m_lastColor, item.color, sizeof(m_lastColor)) != 0)
+            {
+                LeafProgram.SetUniformVariable((char*)"uColor", (float*)item.color);
+                memcpy(m_lastColor, item.color, sizeof(m_lastColor));
+            }
+            DrawLeaf(m_leaves[item.index], item.index);
+            break;
+        case DRAW_SORTED_LEAVES:
+        {
+            const std::vector<uint32_t>& order = LeafSorter.GetOrder();
+            float color[3];
+            for (size_t k = 0; k < order.size(); ++k)
+            {
+                uint32_t i = order[k];
+                if (!LeafVisible[i])
+                    continue;
+                LeafColor(m_leaves[i], color);
+                if (memcmp(m_lastColor, color, sizeof(m_lastColor)) != 0)
+                {
+                    LeafProgram.SetUniformVariable((char*)"uColor", color);
+                    memcpy(m_lastColor, color, sizeof(m_lastColor));
+                }
+                DrawLeaf(m_leaves[i], i);
+            }
+            break;
+        }
+        case DRAW_FALLING_LEAVES:
+        {
+            for (uint32_t i = 0; i < FallingLeaves.size(); ++i)
+            {
+                const float* color = LEAF_PALETTE[FallingColor[i]];
+                if (memcmp(m_lastColor, color, sizeof(m_lastColor)) != 0)
+                {
+                    LeafProgram.SetUniformVariable((char*)"uColor", (float*)color);
+                    memcpy(m_lastColor, color, sizeof(m_lastColor));
+                }
+                DrawFallingLeaf(i);
+            }
+            break;
+        }
+        case DRAW_LITTER:
+            for (size_t k = 0; k < LitterVisible.size(); ++k)
+                DrawLitterCell((int)LitterVisible[k], LitterLod[k], m_lastColor);
+            break;
+    }
 }
 
 // void
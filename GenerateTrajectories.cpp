@@ -0,0 +1,302 @@
+// g++ -std=c++11 -O2 -pthread -o GenerateTrajectories GenerateTrajectories.cpp LeafSim/TrajectoryGen.cpp LeafSim/TrajectoryDb.cpp LeafSim/MappedFile.cpp LeafSim/TrajectorySpline.cpp LeafSim/FlutterModel.cpp LeafSim/FlutterRhs.cpp LeafSim/Dopri45.cpp
+//
+// Builds the precomputed trajectory database (replaces ComputeTrajectory.py).
+//
+//   GenerateTrajectories                       the four ComputeTrajectory.py starts
+//   GenerateTrajectories --theta 0:1.5:16 --vx -1:1:9 --mass 0.005:0.02:4 --out sweep.bin
+//   GenerateTrajectories --lhs 5000 --theta -1.5:1.5 --vx -1:1 --mass 0.005:0.02 --perp 2:6 --out lhs.bin
+//
+// Any --<axis> lo:hi:n turns on a grid sweep over all axes (axes not given
+// keep the default leaf's value); --lhs N samples the same ranges as a Latin
+// hypercube of N jobs instead.  An output ending in .bin is written as a
+// binary database (LeafSim/TrajectoryDb.hpp), anything else as JSON.
+//
+// A sweep saves every finished trajectory to a checkpoint (OUT.ckpt) and
+// deletes it once the output is written; run the same command again after a
+// stop and it carries on from there.
+//
+// --tol R integrates with adaptive Dormand-Prince steps to relative tolerance
+// R (1e-6 is plenty) instead of --substeps RK4 steps, on the flutter model
+// with its drag switch smoothed (LeafSim/FlutterModel.hpp).
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include "LeafSim/TrajectoryDb.hpp"
+#include "LeafSim/TrajectoryGen.hpp"
+
+static void PrintUsage(const char* prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --out FILE          output .json or .bin (precomputed_trajectory_database.json)\n"
+            "  --quantize          16-bit states in a .bin output\n"
+            "  --spline            keyframe curves in a .bin output\n"
+            "  --dt S              sample interval in seconds (0.01)\n"
+            "  --samples N         samples per trajectory (1000)\n"
+            "  --substeps N        RK4 steps per sample (100; 1 = ComputeTrajectory.py)\n"
+            "  --tol R             adaptive steps to relative tolerance R instead of --substeps\n"
+            "  --threads N         worker threads (0 = all cores)\n"
+            "  --lhs N             Latin hypercube of N jobs over the axis ranges instead of a grid\n"
+            "  --seed N            of the hypercube (1)\n"
+            "  --checkpoint FILE   sweep checkpoint (OUT.ckpt)\n"
+            "  sweep axes, each VALUE, LO:HI or LO:HI:N:\n"
+            "  --theta --vx --vy --omega --mass --width --height --perp --para\n",
+            prog);
+}
+
+// "v", "lo:hi" (two values; the range for --lhs) or "lo:hi:n"
+static bool ParseRange(const char* text, SweepRange* range)
+{
+    double lo, hi;
+    int n = 2;
+    int fields = sscanf(text, "%lf:%lf:%d", &lo, &hi, &n);
+    if (fields >= 2) {
+        if (n < 1) {
+            return false;
+        }
+        *range = SweepRange(lo, hi, n);
+        return true;
+    }
+    char* end;
+    double v = strtod(text, &end);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    *range = SweepRange(v);
+    return true;
+}
+
+// The initial conditions ComputeTrajectory.py used
+static void PythonJobs(std::vector<TrajectoryJob>* jobs)
+{
+    const double PI = 3.14159265358979323846;
+    const double starts[4][FLUTTER_DIM] = {
+        { 0., 0., 0.,      1.,  -1.,  0. },
+        { 0., 0., PI / 6., 1.,  -1.,  0.1 },
+        { 0., 0., PI / 4., 0.5, -1., -0.1 },
+        { 0., 0., PI / 3., 1.5, -2.,  0. },
+    };
+    // the default sweep is a single job with the ComputeTrajectory.py leaf
+    std::vector<TrajectoryJob> leaf;
+    TrajectorySweep().buildJobs(&leaf);
+
+    jobs->clear();
+    for (int j = 0; j < 4; ++j) {
+        TrajectoryJob job = leaf[0];
+        for (int i = 0; i < FLUTTER_DIM; ++i) {
+            job.initial[i] = starts[j][i];
+        }
+        jobs->push_back(job);
+    }
+}
+
+// Same layout as ComputeTrajectory.py wrote: { "Trajectory 1": [[x, y, theta, vx, vy, omega], ...], ... }
+static bool WriteJson(const char* path, const std::vector<Trajectory>& trajectories)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open '%s' for writing\n", path);
+        return false;
+    }
+    fprintf(fp, "{\n");
+    for (size_t t = 0; t < trajectories.size(); ++t) {
+        const Trajectory& traj = trajectories[t];
+        fprintf(fp, "    \"Trajectory %d\": [\n", (int)t + 1);
+        for (int n = 0; n < traj.GetNumSamples(); ++n) {
+            const double* s = traj.GetSample(n);
+            fprintf(fp, "        [%.17g, %.17g, %.17g, %.17g, %.17g, %.17g]%s\n",
+                    s[0], s[1], s[2], s[3], s[4], s[5], (n + 1 < traj.GetNumSamples()) ? "," : "");
+        }
+        fprintf(fp, "    ]%s\n", (t + 1 < trajectories.size()) ? "," : "");
+    }
+    fprintf(fp, "}\n");
+    bool ok = !ferror(fp);
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error writing '%s'\n", path);
+    }
+    return ok;
+}
+
+static bool WriteBinary(const char* path, const std::vector<TrajectoryJob>& jobs,
+                        const std::vector<Trajectory>& trajectories, const TrajectorySettings& settings,
+                        TrajectoryEncoding encoding)
+{
+    TrajectoryDbWriter writer;
+    for (size_t t = 0; t < trajectories.size(); ++t) {
+        const Trajectory& traj = trajectories[t];
+        writer.add(jobs[t].params, settings.rho, settings.g, settings.dt,
+                   traj.GetNumSamples() > 0 ? traj.GetSample(0) : NULL, traj.GetNumSamples());
+    }
+    return writer.write(path, encoding);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string outPath = "precomputed_trajectory_database.json";
+    TrajectorySettings settings;
+    TrajectorySweep sweep;
+    bool sweeping = false;
+    TrajectoryEncoding encoding = ENCODING_FLOAT32;
+    int threads = 0;
+    int lhsSamples = 0;
+    uint32_t seed = 1;
+    std::string checkpointPath;
+
+    struct { const char* name; SweepRange* range; } axes[] = {
+        { "--theta", &sweep.theta }, { "--vx", &sweep.vx }, { "--vy", &sweep.vy }, { "--omega", &sweep.omega },
+        { "--mass", &sweep.mass }, { "--width", &sweep.width }, { "--height", &sweep.height },
+        { "--perp", &sweep.dragCoeffPerp }, { "--para", &sweep.dragCoeffPara },
+    };
+    const int NUM_AXES = sizeof(axes) / sizeof(axes[0]);
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool ok = (value != NULL);
+
+        if (strcmp(arg, "--quantize") == 0) {
+            encoding = ENCODING_UINT16;
+            continue;
+        }
+        if (strcmp(arg, "--spline") == 0) {
+            encoding = ENCODING_SPLINE;
+            continue;
+        }
+
+        int axis = -1;
+        for (int a = 0; a < NUM_AXES; ++a) {
+            if (strcmp(arg, axes[a].name) == 0) {
+                axis = a;
+            }
+        }
+
+        if (axis < 0 && strcmp(arg, "--out") != 0 && strcmp(arg, "--dt") != 0 && strcmp(arg, "--samples") != 0 &&
+            strcmp(arg, "--substeps") != 0 && strcmp(arg, "--threads") != 0 && strcmp(arg, "--lhs") != 0 &&
+            strcmp(arg, "--seed") != 0 && strcmp(arg, "--checkpoint") != 0 && strcmp(arg, "--tol") != 0) {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        }
+
+        // the rest take a value
+        if (!ok) {
+        } else if (axis >= 0) {
+            ok = ParseRange(value, axes[axis].range);
+            sweeping = true;
+        } else if (strcmp(arg, "--out") == 0) {
+            outPath = value;
+        } else if (strcmp(arg, "--dt") == 0) {
+            settings.dt = atof(value);
+            ok = settings.dt > 0.;
+        } else if (strcmp(arg, "--samples") == 0) {
+            settings.samples = atoi(value);
+            ok = settings.samples > 0;
+        } else if (strcmp(arg, "--substeps") == 0) {
+            settings.substeps = atoi(value);
+            ok = settings.substeps > 0;
+        } else if (strcmp(arg, "--tol") == 0) {
+            settings.tolerance = atof(value);
+            ok = settings.tolerance > 0.;
+        } else if (strcmp(arg, "--threads") == 0) {
+            threads = atoi(value);
+            ok = threads >= 0;
+        } else if (strcmp(arg, "--lhs") == 0) {
+            lhsSamples = atoi(value);
+            ok = lhsSamples > 0;
+            sweeping = true;
+        } else if (strcmp(arg, "--seed") == 0) {
+            seed = (uint32_t)strtoul(value, NULL, 10);
+        } else if (strcmp(arg, "--checkpoint") == 0) {
+            checkpointPath = value;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Bad or missing value for %s\n", arg);
+            PrintUsage(argv[0]);
+            return 1;
+        }
+        ++i;
+    }
+
+    std::vector<TrajectoryJob> jobs;
+    if (lhsSamples > 0) {
+        sweep.buildLatinHypercube(lhsSamples, seed, &jobs);
+    } else if (sweeping) {
+        sweep.buildJobs(&jobs);
+    } else {
+        PythonJobs(&jobs);
+    }
+    if (threads == 0) {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+
+    // 1) Integrate, picking up a stopped run of the same sweep
+    SweepCheckpoint checkpoint;
+    if (sweeping) {
+        if (checkpointPath.empty()) {
+            checkpointPath = outPath + ".ckpt";
+        }
+        if (!checkpoint.open(checkpointPath.c_str(), jobs, settings)) {
+            return 1;
+        }
+        if (checkpoint.GetNumDone() > 0) {
+            fprintf(stderr, "resuming from %s: %ld of %d trajectories done\n", checkpointPath.c_str(),
+                    checkpoint.GetNumDone(), (int)jobs.size());
+        }
+    }
+    std::vector<bool> resumed(jobs.size(), false);     // (not integrated this time)
+    for (size_t j = 0; sweeping && j < jobs.size(); ++j) {
+        resumed[j] = checkpoint.isDone(j);
+    }
+    auto t0 = std::chrono::steady_clock::now();
+    std::vector<Trajectory> trajectories;
+    GenerateTrajectories(jobs, settings, threads, &trajectories, sweeping ? &checkpoint : NULL);
+    double genSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    long steps = 0;
+    int diverged = 0;
+    for (size_t t = 0; t < trajectories.size(); ++t) {
+        if (!resumed[t]) {
+            steps += (long)std::max(0, trajectories[t].GetNumSamples() - 1) * settings.substeps;
+        }
+        if (trajectories[t].diverged) {
+            diverged++;
+        }
+    }
+
+    // 2) Write
+    t0 = std::chrono::steady_clock::now();
+    bool binary = outPath.size() >= 4 && outPath.compare(outPath.size() - 4, 4, ".bin") == 0;
+    bool written = binary ? WriteBinary(outPath.c_str(), jobs, trajectories, settings, encoding)
+                          : WriteJson(outPath.c_str(), trajectories);
+    if (!written) {
+        return 1;       // (the checkpoint stays)
+    }
+    if (sweeping) {
+        checkpoint.close();
+        remove(checkpointPath.c_str());
+    }
+    double writeSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    if (settings.tolerance > 0.) {
+        fprintf(stderr, "%d trajectories x %d samples (dt %g s, adaptive to %g) on %d thread(s)\n",
+                (int)jobs.size(), settings.samples, settings.dt, settings.tolerance, threads);
+        fprintf(stderr, "integrate %.3f s, write %.3f s -> %s\n", genSec, writeSec, outPath.c_str());
+    } else {
+        fprintf(stderr, "%d trajectories x %d samples (dt %g s, %d RK4 steps each) on %d thread(s)\n",
+                (int)jobs.size(), settings.samples, settings.dt, settings.substeps, threads);
+        fprintf(stderr, "integrate %.3f s (%.1f ns per RK4 step), write %.3f s -> %s\n",
+                genSec, steps > 0 ? 1.e9 * genSec / steps : 0., writeSec, outPath.c_str());
+    }
+    if (diverged > 0) {
+        fprintf(stderr, "warning: %d trajectories blew up and were cut short; try %s\n", diverged,
+                settings.tolerance > 0. ? "a smaller --tol" : "more --substeps");
+    }
+    return 0;
+}
@@ -1,8 +1,8 @@
 // #version 330 compatibility
-uniform mat4 uLightSpaceMatrix;
-uniform mat4 uAnim;
+uniform mat4 uLightSpaceMatrix;     // cascade's lightProj * lightView
+// the modelview only holds the object's own transform during the depth pass
 void
 main()
 {
-    gl_Position = uLightSpaceMatrix * uAnim * gl_Vertex;
+    gl_Position = uLightSpaceMatrix * gl_ModelViewMatrix * gl_Vertex;
 } 
\ No newline at end of file
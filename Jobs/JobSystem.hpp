@@ -0,0 +1,124 @@
+#ifndef JOBSYSTEM_HPP
+#define JOBSYSTEM_HPP
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// How many submitted jobs are not finished yet.  Wait on it with
+// JobSystem::wait(), or poll isDone() to pick up results when they are ready.
+class JobCounter {
+public:
+    JobCounter() : m_pending(0) {}
+    bool isDone() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+private:
+    JobCounter(const JobCounter&);
+    JobCounter& operator=(const JobCounter&);
+    friend class JobSystem;
+    std::atomic<int> m_pending;
+};
+
+// Tasks with "before" edges between them, run by JobSystem::launch() / run():
+// a task starts once every task that precedes it has finished, and tasks with
+// nothing between them run in parallel.  The graph must not have cycles, and
+// must outlive its run; it can be run again.
+class TaskGraph {
+public:
+    uint32_t add(const std::function<void()>& task);       // returns the task's id
+    void precede(uint32_t before, uint32_t after);
+    void clear();
+    uint32_t size() const { return (uint32_t)m_tasks.size(); }
+
+private:
+    friend class JobSystem;
+    std::vector< std::function<void()> > m_tasks;
+    std::vector< std::vector<uint32_t> > m_successors;
+    std::vector<int> m_predecessors;
+    std::unique_ptr< std::atomic<int>[] > m_remaining;     // per task, during a run
+};
+
+// A fixed pool of worker threads taking jobs from one queue.
+//
+// The thread that waits on a job helps run the queue until its job is done,
+// so a JobSystem of N threads has N - 1 workers and the caller is the Nth,
+// and waiting inside a job cannot deadlock.  Jobs are std::function, so the
+// intended grain is a few tens of microseconds and up; parallelFor() hands
+// out chunks through an atomic counter and queues only one job per thread.
+//
+// GetThreadIndex() is 0 outside the workers and 1 .. GetNumThreads() - 1 on
+// them, for per-thread scratch in parallel loops (as long as a job holding
+// scratch does not wait on other jobs that use the same scratch).
+class JobSystem {
+public:
+    explicit JobSystem(int threads = 0);    // callers included; 0 = one per hardware thread
+    ~JobSystem();
+
+    int GetNumThreads() const { return (int)m_workers.size() + 1; }
+    static int GetThreadIndex();
+
+    void submit(const std::function<void()>& job, JobCounter* counter);
+    void launch(TaskGraph& graph, JobCounter* counter);
+    void run(TaskGraph& graph);             // launch() and wait()
+    void wait(JobCounter* counter);         // runs queued jobs meanwhile
+
+    // f(b, e) over [begin, end) in chunks of grain (the last one shorter),
+    // chunk starts at begin + a multiple of grain; returns when all are done
+    template <class F> void parallelFor(uint32_t begin, uint32_t end, uint32_t grain, F f);
+
+private:
+    struct Job {
+        std::function<void()> fn;
+        JobCounter* counter;
+    };
+    void push(const Job& job);
+    bool runOne();                          // false if the queue was empty
+    void finish(JobCounter* counter);
+    void runTask(TaskGraph* graph, uint32_t task, JobCounter* counter);
+    void workerLoop(int index);
+
+    std::vector<std::thread> m_workers;
+    std::deque<Job> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;         // a job was queued, a counter reached zero, or quit
+    bool m_quit;
+};
+
+template <class F>
+void JobSystem::parallelFor(uint32_t begin, uint32_t end, uint32_t grain, F f)
+{
+    if (end <= begin) {
+        return;
+    }
+    grain = std::max(grain, 1u);
+    uint32_t chunks = (end - begin - 1) / grain + 1;
+    uint32_t runners = std::min(chunks, (uint32_t)GetNumThreads());
+    if (runners <= 1) {
+        for (uint32_t b = begin; b < end; b += std::min(grain, end - b)) {
+            f(b, b + std::min(grain, end - b));
+        }
+        return;
+    }
+
+    std::atomic<uint32_t> next(0);
+    auto runner = [&next, &f, begin, end, grain, chunks]() {
+        for (uint32_t c = next++; c < chunks; c = next++) {
+            uint32_t b = begin + c * grain;
+            f(b, b + std::min(grain, end - b));
+        }
+    };
+    JobCounter counter;
+    for (uint32_t r = 1; r < runners; ++r) {
+        submit(runner, &counter);
+    }
+    runner();           // this thread takes chunks too
+    wait(&counter);
+}
+
+#endif // JOBSYSTEM_HPP
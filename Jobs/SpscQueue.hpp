@@ -0,0 +1,83 @@
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// A bounded ring buffer between exactly one producer thread and one consumer
+// thread, without locks: each side owns one index and publishes it with a
+// release store, and reads the other's with an acquire load, so a value is
+// written before the producer's index moves past it and read before the
+// consumer's does.  The indices count up and wrap at 2^32; the slot is the
+// index masked by the (power of two) capacity.
+//
+// For handing work between tasks that run at the same time without an edge
+// between them in the TaskGraph, e.g. leaves let go by the detachment
+// scheduler picked up by the falling-leaf integration whenever it runs.
+template <class T>
+class SpscQueue {
+public:
+    explicit SpscQueue(uint32_t capacity = 1024) : m_head(0), m_tail(0) { setCapacity(capacity); }
+
+    // Rounded up to a power of two; empties the queue, so neither side may be running
+    void setCapacity(uint32_t capacity)
+    {
+        uint32_t size = 1;
+        while (size < capacity) {
+            size *= 2;
+        }
+        m_items.assign(size, T());
+        m_mask = size - 1;
+        clear();
+    }
+    uint32_t GetCapacity() const { return m_mask + 1; }
+    void clear()
+    {
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Producer: false if full
+    bool push(const T& value)
+    {
+        uint32_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) > m_mask) {
+            return false;
+        }
+        m_items[tail & m_mask] = value;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    // Producer: room for this many more (the consumer may make more meanwhile)
+    uint32_t GetFree() const
+    {
+        return m_mask + 1 - (m_tail.load(std::memory_order_relaxed) - m_head.load(std::memory_order_acquire));
+    }
+
+    // Consumer: false if empty
+    bool pop(T* value)
+    {
+        uint32_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *value = m_items[head & m_mask];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    SpscQueue(const SpscQueue&);
+    SpscQueue& operator=(const SpscQueue&);
+
+    std::vector<T> m_items;
+    uint32_t m_mask;
+    // each index on its own cache line, so the two sides don't share one
+    char m_pad0[64];
+    std::atomic<uint32_t> m_head;       // next to pop; written by the consumer
+    char m_pad1[64];
+    std::atomic<uint32_t> m_tail;       // next to push; written by the producer
+    char m_pad2[64];
+};
+
+#endif // SPSCQUEUE_HPP
@@ -0,0 +1,474 @@
+// Self-test: make libleafsim.a && g++ -std=c++11 -O2 -DTEST -o detachtest LeafSim/Detachment.cpp -L. -lleafsim -pthread
+#include "Detachment.hpp"
+#include "Snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const float WEIGHT_ONE = 256.f;     // fixed-point weights, so the Fenwick sums never drift
+
+DetachSettings::DetachSettings()
+    : heightBias(2.f)
+    , exposurePower(1.f)
+    , maxTries(8)
+{
+}
+
+DetachScheduler::DetachScheduler()
+    : m_topBit(0)
+    , m_totalWeight(0)
+    , m_numAttached(0)
+    , m_due(0.f)
+    , m_seed(0x9E3779B97F4A7C15ull)
+{
+}
+
+void DetachScheduler::setSeed(uint32_t seed)
+{
+    m_seed = 0x9E3779B97F4A7C15ull ^ seed;
+    if (m_seed == 0) {
+        m_seed = 1;
+    }
+}
+
+// xorshift64*
+uint64_t DetachScheduler::random()
+{
+    m_seed ^= m_seed >> 12;
+    m_seed ^= m_seed << 25;
+    m_seed ^= m_seed >> 27;
+    return m_seed * 0x2545F4914F6CDD1Dull;
+}
+
+void DetachScheduler::clear()
+{
+    m_bucketStart.clear();
+    m_bucketCount.clear();
+    m_slots.clear();
+    m_branchOf.clear();
+    m_weight.clear();
+    m_branchWeight.clear();
+    m_fenwick.clear();
+    m_slotFenwick.clear();
+    m_attached.clear();
+    m_topBit = 0;
+    m_totalWeight = 0;
+    m_numAttached = 0;
+    m_due = 0.f;
+}
+
+void DetachScheduler::build(const int* branch, const float* height, uint32_t numLeaves, uint32_t numBranches)
+{
+    clear();
+
+    // 1) Weights by height over the tree's range
+    float lo = 0.f, hi = 0.f;
+    if (numLeaves > 0) {
+        lo = hi = height[0];
+    }
+    for (uint32_t i = 1; i < numLeaves; ++i) {
+        lo = std::min(lo, height[i]);
+        hi = std::max(hi, height[i]);
+    }
+    float invRange = (hi > lo) ? 1.f / (hi - lo) : 0.f;
+    m_weight.resize(numLeaves);
+    for (uint32_t i = 0; i < numLeaves; ++i) {
+        float h = (height[i] - lo) * invRange;
+        m_weight[i] = std::max(1u, (uint32_t)lroundf(WEIGHT_ONE * (1.f + m_settings.heightBias * h)));
+    }
+
+    // 2) Buckets: count per branch, prefix sum, fill
+    m_bucketStart.assign(numBranches + 1, 0);
+    for (uint32_t i = 0; i < numLeaves; ++i) {
+        m_bucketStart[branch[i] + 1]++;
+    }
+    for (uint32_t b = 0; b < numBranches; ++b) {
+        m_bucketStart[b + 1] += m_bucketStart[b];
+    }
+    m_bucketCount.assign(numBranches, 0);
+    m_branchWeight.assign(numBranches, 0);
+    m_slots.resize(numLeaves);
+    m_branchOf.resize(numLeaves);
+    for (uint32_t i = 0; i < numLeaves; ++i) {
+        uint32_t b = (uint32_t)branch[i];
+        m_branchOf[i] = b;
+        m_slots[m_bucketStart[b] + m_bucketCount[b]++] = i;
+        m_branchWeight[b] += m_weight[i];
+        m_totalWeight += m_weight[i];
+    }
+
+    m_attached.assign(numLeaves, 1);
+    m_numAttached = numLeaves;
+    buildFenwick();
+}
+
+// highest power of two <= n (0 for 0)
+static uint32_t TopBit(uint32_t n)
+{
+    uint32_t bit = (n > 0) ? 1 : 0;
+    while (bit * 2 <= n) {
+        bit *= 2;
+    }
+    return bit;
+}
+
+// The Fenwick trees over m_branchWeight and over every bucket's slots, in
+// one pass each: each node passes its sum up to its parent
+void DetachScheduler::buildFenwick()
+{
+    uint32_t numBranches = (uint32_t)m_branchWeight.size();
+    m_fenwick.assign(numBranches + 1, 0);
+    for (uint32_t b = 1; b <= numBranches; ++b) {
+        m_fenwick[b] += m_branchWeight[b - 1];
+        uint32_t parent = b + (b & (0u - b));
+        if (parent <= numBranches) {
+            m_fenwick[parent] += m_fenwick[b];
+        }
+    }
+    m_topBit = TopBit(numBranches);
+
+    m_slotFenwick.assign(m_slots.size(), 0);
+    for (uint32_t b = 0; b < numBranches; ++b) {
+        uint64_t* node = &m_slotFenwick[m_bucketStart[b]] - 1;     // 1-based
+        uint32_t size = m_bucketStart[b + 1] - m_bucketStart[b];
+        for (uint32_t k = 1; k <= size; ++k) {
+            if (k <= m_bucketCount[b]) {
+                node[k] += m_weight[m_slots[m_bucketStart[b] + k - 1]];
+            }
+            uint32_t parent = k + (k & (0u - k));
+            if (parent <= size) {
+                node[parent] += node[k];
+            }
+        }
+    }
+}
+
+void DetachScheduler::addWeight(uint32_t branch, int64_t delta)
+{
+    m_branchWeight[branch] += delta;
+    m_totalWeight += delta;
+    uint32_t n = (uint32_t)m_branchWeight.size();
+    for (uint32_t b = branch + 1; b <= n; b += b & (0u - b)) {
+        m_fenwick[b] += delta;
+    }
+}
+
+void DetachScheduler::addSlotWeight(uint32_t branch, uint32_t slot, int64_t delta)
+{
+    uint64_t* node = &m_slotFenwick[m_bucketStart[branch]] - 1;
+    uint32_t size = m_bucketStart[branch + 1] - m_bucketStart[branch];
+    for (uint32_t k = slot - m_bucketStart[branch] + 1; k <= size; k += k & (0u - k)) {
+        node[k] += delta;
+    }
+}
+
+uint32_t DetachScheduler::pickSlot(uint32_t branch, uint64_t u) const
+{
+    const uint64_t* node = &m_slotFenwick[m_bucketStart[branch]] - 1;
+    uint32_t size = m_bucketStart[branch + 1] - m_bucketStart[branch];
+    uint32_t pos = 0;
+    for (uint32_t step = TopBit(size); step > 0; step /= 2) {
+        if (pos + step <= size && node[pos + step] <= u) {
+            pos += step;
+            u -= node[pos];
+        }
+    }
+    return m_bucketStart[branch] + pos;
+}
+
+uint32_t DetachScheduler::pickBranch(uint64_t u) const
+{
+    uint32_t n = (uint32_t)m_branchWeight.size();
+    uint32_t pos = 0;
+    for (uint32_t step = m_topBit; step > 0; step /= 2) {
+        if (pos + step <= n && m_fenwick[pos + step] <= u) {
+            pos += step;
+            u -= m_fenwick[pos];
+        }
+    }
+    return pos;
+}
+
+uint32_t DetachScheduler::schedule(float rate, float dt, uint32_t budget,
+                                   const std::function<float(uint32_t)>& exposure, SpscQueue<uint32_t>& out)
+{
+    m_due += std::max(rate, 0.f) * dt;
+    uint32_t room = std::min(budget, out.GetFree());
+    uint32_t sent = 0;
+    while (m_due >= 1.f && sent < room && m_numAttached > 0) {
+        m_due -= 1.f;
+        for (int t = 0; t < m_settings.maxTries; ++t) {
+            // 1) A branch by weight, kept as often as the wind there says
+            uint32_t b = pickBranch(random() % m_totalWeight);
+            float e = std::min(std::max(exposure(b), 0.f), 1.f);
+            float keep = std::pow(e, m_settings.exposurePower);
+            if ((float)(random() >> 40) * (1.f / 16777216.f) >= keep) {
+                continue;
+            }
+
+            // 2) A leaf on it by weight
+            uint32_t end = m_bucketStart[b] + m_bucketCount[b];
+            uint32_t s = pickSlot(b, random() % m_branchWeight[b]);
+
+            // 3) Off the tree: to the back of the attached part of its bucket,
+            //    where it weighs nothing
+            uint32_t leaf = m_slots[s];
+            uint32_t last = m_slots[end - 1];
+            addSlotWeight(b, s, (int64_t)m_weight[last] - (int64_t)m_weight[leaf]);
+            addSlotWeight(b, end - 1, -(int64_t)m_weight[last]);
+            std::swap(m_slots[s], m_slots[end - 1]);
+            m_bucketCount[b]--;
+            addWeight(b, -(int64_t)m_weight[leaf]);
+            m_attached[leaf] = 0;
+            m_numAttached--;
+            out.push(leaf);
+            ++sent;
+            break;
+        }
+    }
+    // no room for them now: don't save them up for a burst later
+    m_due = std::min(m_due, 1.f);
+    return sent;
+}
+
+struct DetachSnapshot {
+    uint32_t numLeaves;
+    uint32_t numBranches;
+    float due;
+    uint32_t pad;
+    uint64_t seed;
+};
+
+void DetachScheduler::save(SnapshotWriter& out) const
+{
+    DetachSnapshot d = { GetNumLeaves(), (uint32_t)m_branchWeight.size(), m_due, 0, m_seed };
+    out.addValue("detach", d);
+    out.add("detach.slots", m_slots);
+    out.add("detach.counts", m_bucketCount);
+}
+
+bool DetachScheduler::load(const Snapshot& in)
+{
+    // the buckets as they were, slot order and all, so picks by weight land
+    // on the same leaves
+    DetachSnapshot d;
+    std::vector<uint32_t> slots, counts;
+    if (!in.readValue("detach", &d) || d.numLeaves != GetNumLeaves() || d.numBranches != (uint32_t)m_branchWeight.size() ||
+        !in.read("detach.slots", &slots) || !in.read("detach.counts", &counts) ||
+        slots.size() != d.numLeaves || counts.size() != d.numBranches) {
+        return false;
+    }
+    for (uint32_t b = 0; b < d.numBranches; ++b) {
+        if (counts[b] > m_bucketStart[b + 1] - m_bucketStart[b]) {
+            return false;
+        }
+    }
+    std::vector<uint8_t> seen(d.numLeaves, 0);
+    for (uint32_t b = 0; b < d.numBranches; ++b) {
+        for (uint32_t s = m_bucketStart[b]; s < m_bucketStart[b + 1]; ++s) {
+            uint32_t leaf = slots[s];
+            if (leaf >= d.numLeaves || m_branchOf[leaf] != b || seen[leaf]) {
+                return false;
+            }
+            seen[leaf] = 1;
+        }
+    }
+
+    m_slots.swap(slots);
+    m_bucketCount.swap(counts);
+    m_attached.assign(d.numLeaves, 0);
+    m_numAttached = 0;
+    m_totalWeight = 0;
+    for (uint32_t b = 0; b < d.numBranches; ++b) {
+        m_branchWeight[b] = 0;
+        for (uint32_t s = m_bucketStart[b]; s < m_bucketStart[b] + m_bucketCount[b]; ++s) {
+            m_attached[m_slots[s]] = 1;
+            m_branchWeight[b] += m_weight[m_slots[s]];
+        }
+        m_totalWeight += m_branchWeight[b];
+        m_numAttached += m_bucketCount[b];
+    }
+    buildFenwick();
+    m_due = d.due;
+    m_seed = d.seed;
+    return true;
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include "../SelfTest.hpp"
+
+static float
+Exposed( uint32_t )
+{
+	return 1.f;
+}
+
+// a tree of numBranches branches, leaves on random ones at random heights
+static void
+MakeTree( uint32_t numLeaves, uint32_t numBranches, std::vector<int> *branch, std::vector<float> *height )
+{
+	branch->resize( numLeaves );
+	height->resize( numLeaves );
+	uint32_t seed = 7;
+	for( uint32_t i = 0; i < numLeaves; i++ )
+	{
+		seed = seed * 1664525u + 1013904223u;
+		(*branch)[i] = (int)( ( seed >> 8 ) % numBranches );
+		seed = seed * 1664525u + 1013904223u;
+		(*height)[i] = 15.f * (float)( seed >> 8 ) / 16777216.f;
+	}
+}
+
+// every leaf let go in a run of ticks, off the queue
+static void
+Drain( SpscQueue<uint32_t> &queue, std::vector<uint32_t> *got )
+{
+	uint32_t leaf;
+	while( queue.pop( &leaf ) )
+		got->push_back( leaf );
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const float DT = 1.f / 60.f;
+	std::vector<int> branch;
+	std::vector<float> height;
+
+	// 1) The rate: 10 s at 60 leaves a second
+	MakeTree( 5000, 200, &branch, &height );
+	DetachScheduler sched;
+	sched.build( branch.data( ), height.data( ), 5000, 200 );
+	SpscQueue<uint32_t> queue( 4096 );
+	std::vector<uint32_t> got;
+	for( int k = 0; k < 600; k++ )
+	{
+		sched.schedule( 60.f, DT, 1000, Exposed, queue );
+		Drain( queue, &got );
+	}
+	fprintf( stderr, "%d leaves let go in 10 s at 60/s\n", (int)got.size( ) );
+	Check( got.size( ) >= 598 && got.size( ) <= 600, "leaves let go at the rate" );
+	std::vector<uint8_t> seen( 5000, 0 );
+	bool once = true, detached = true;
+	for( size_t i = 0; i < got.size( ); i++ )
+	{
+		once = once && ! seen[ got[i] ];
+		seen[ got[i] ] = 1;
+		detached = detached && ! sched.IsAttached( got[i] );
+	}
+	Check( once && detached, "each leaf let go once, and marked" );
+	Check( sched.GetNumAttached( ) == 5000 - got.size( ), "attached count" );
+
+	// 2) Higher leaves go first (heightBias 2: the top three times as readily)
+	double meanAll = 0., meanGone = 0.;
+	for( size_t i = 0; i < height.size( ); i++ )
+		meanAll += height[i] / height.size( );
+	for( size_t i = 0; i < got.size( ); i++ )
+		meanGone += height[ got[i] ] / got.size( );
+	fprintf( stderr, "mean height: tree %.2f, let go %.2f\n", meanAll, meanGone );
+	Check( meanGone > meanAll + 1., "higher leaves let go more" );     // 1.25 expected
+
+	// 3) Only exposed branches let go
+	DetachScheduler sheltered;
+	sheltered.build( branch.data( ), height.data( ), 5000, 200 );
+	got.clear( );
+	for( int k = 0; k < 600; k++ )
+	{
+		sheltered.schedule( 60.f, DT, 1000, []( uint32_t b ) { return ( b % 2 == 0 ) ? 1.f : 0.f; }, queue );
+		Drain( queue, &got );
+	}
+	bool even = true;
+	for( size_t i = 0; i < got.size( ); i++ )
+		even = even && branch[ got[i] ] % 2 == 0;
+	Check( even && got.size( ) > 500, "sheltered branches keep their leaves" );
+
+	// 4) Budget and a full queue; nothing saved up for later
+	DetachScheduler limited;
+	limited.build( branch.data( ), height.data( ), 5000, 200 );
+	uint32_t most = 0;
+	for( int k = 0; k < 60; k++ )
+	{
+		most = std::max( most, limited.schedule( 600.f, DT, 3, Exposed, queue ) );
+		Drain( queue, &got );
+	}
+	Check( most == 3, "no more than the budget a tick" );
+	SpscQueue<uint32_t> small( 16 );
+	uint32_t before = limited.GetNumAttached( ), sent = 0;
+	for( int k = 0; k < 60; k++ )
+		sent += limited.schedule( 600.f, DT, 1000, Exposed, small );
+	Check( sent == 16 && limited.GetNumAttached( ) == before - 16, "stops at a full queue, losing none" );
+	got.clear( );
+	Drain( small, &got );
+	Check( limited.schedule( 60.f, DT, 1000, Exposed, small ) <= 2, "no burst once there is room" );     // this tick's and one held over
+
+	// 5) The whole tree, then nothing
+	DetachScheduler bare;
+	bare.build( branch.data( ), height.data( ), 5000, 200 );
+	got.clear( );
+	for( int k = 0; k < 100 && bare.GetNumAttached( ) > 0; k++ )
+	{
+		bare.schedule( 1.e6f, DT, 4096, Exposed, queue );
+		Drain( queue, &got );
+	}
+	std::sort( got.begin( ), got.end( ) );
+	Check( got.size( ) == 5000 && std::unique( got.begin( ), got.end( ) ) == got.end( ), "every leaf let go, once" );
+	Check( bare.schedule( 60.f, 1.f, 1000, Exposed, queue ) == 0, "a bare tree lets go of nothing" );
+
+	// 6) Cost follows the leaves let go, not the tree: 5k against 1M leaves,
+	// and 1M on only 4 branches
+	double nsPerLeaf[3];
+	uint32_t sizes[3] = { 5000, 1000000, 1000000 };
+	uint32_t branches[3] = { 200, 40000, 4 };
+	for( int t = 0; t < 3; t++ )
+	{
+		MakeTree( sizes[t], branches[t], &branch, &height );
+		DetachScheduler big;
+		big.build( branch.data( ), height.data( ), sizes[t], branches[t] );
+		got.clear( );
+		auto t0 = std::chrono::steady_clock::now( );
+		for( int k = 0; k < 300; k++ )
+		{
+			big.schedule( 600.f, DT, 1000, []( uint32_t b ) { return 0.5f + 0.5f * (float)( b % 2 ); }, queue );
+			Drain( queue, &got );
+		}
+		auto t1 = std::chrono::steady_clock::now( );
+		nsPerLeaf[t] = std::chrono::duration<double, std::nano>( t1 - t0 ).count( ) / std::max( (size_t)1, got.size( ) );
+	}
+	fprintf( stderr, "per leaf let go: %.0f ns (5k leaves), %.0f ns (1M leaves), %.0f ns (1M on 4 branches)\n",
+		nsPerLeaf[0], nsPerLeaf[1], nsPerLeaf[2] );
+	Check( nsPerLeaf[1] < 4. * nsPerLeaf[0] + 200., "cost independent of the tree's size" );
+	Check( nsPerLeaf[2] < 4. * nsPerLeaf[0] + 200., "cost independent of the leaves per branch" );
+
+	// 7) The queue between two threads: everything arrives, in order
+	SpscQueue<uint32_t> handoff( 256 );
+	const uint32_t N = 2000000;
+	std::thread producer( [&handoff, N]( )
+	{
+		for( uint32_t i = 0; i < N; i++ )
+			while( ! handoff.push( i ) )
+				std::this_thread::yield( );
+	} );
+	uint32_t next = 0;
+	bool inOrder = true;
+	while( next < N )
+	{
+		uint32_t v;
+		if( handoff.pop( &v ) )
+		{
+			inOrder = inOrder && v == next;
+			next++;
+		}
+		else
+			std::this_thread::yield( );
+	}
+	producer.join( );
+	uint32_t v;
+	Check( inOrder && ! handoff.pop( &v ), "queue across threads: all in order" );
+
+	return CheckResult( );
+}
+#endif
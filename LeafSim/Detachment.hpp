@@ -0,0 +1,90 @@
+#ifndef DETACHMENT_HPP
+#define DETACHMENT_HPP
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "../Jobs/SpscQueue.hpp"
+
+class SnapshotWriter;
+class Snapshot;
+
+struct DetachSettings {
+    float heightBias;       // a leaf at the top goes (1 + heightBias) times as readily as one at the bottom
+    float exposurePower;    // a branch picked lets go with probability exposure^exposurePower
+    int maxTries;           // branches picked per leaf due before giving that one up
+
+    DetachSettings();
+};
+
+// Which tree leaves let go, and when.
+//
+// The leaves still attached are kept in one bucket per branch (attached
+// ones first, so letting one go is a swap within its bucket), and a Fenwick
+// tree over the branches holds each one's total weight (by leaf height).
+// Each bucket has a Fenwick tree of its own over its slots, the ones let go
+// weighing nothing.  schedule() picks a branch by weight in O(log branches),
+// keeps the pick with a probability from the wind at that branch, then
+// picks a leaf in its bucket by weight in O(log leaves on it): the work per
+// tick follows the leaves let go, not the size of the tree or of a branch.
+//
+// Leaves let go are pushed (as the index they had in build()) onto a
+// single-producer single-consumer queue, so schedule() can run as its own
+// task with whatever steps the falling leaves taking them off at the same
+// time.
+class DetachScheduler {
+public:
+    DetachScheduler();
+
+    void setSettings(const DetachSettings& settings) { m_settings = settings; }
+    const DetachSettings& GetSettings() const { return m_settings; }
+    void setSeed(uint32_t seed);
+
+    // Every leaf of the tree, attached: leaf i hangs from branch[i] (in
+    // [0, numBranches)) at height[i] (any units)
+    void build(const int* branch, const float* height, uint32_t numLeaves, uint32_t numBranches);
+    void clear();
+
+    // Owe rate * dt more leaves and let go of as many as are owed, up to
+    // budget and the room in out.  exposure(branch) is how hard the wind is
+    // at a branch, 0 to 1.  Returns the number pushed.
+    uint32_t schedule(float rate, float dt, uint32_t budget,
+                      const std::function<float(uint32_t)>& exposure, SpscQueue<uint32_t>& out);
+
+    bool IsAttached(uint32_t leaf) const { return m_attached[leaf] != 0; }
+    uint32_t GetNumAttached() const { return m_numAttached; }
+    uint32_t GetNumLeaves() const { return (uint32_t)m_attached.size(); }
+
+    // Snapshots (Snapshot.hpp): the buckets, the leaves owed and the random
+    // state, so the same leaves go next.  load() goes on
+    // a scheduler build() for the same tree; it is false (and nothing
+    // changes) if the snapshot is for another, or its slots are not every
+    // leaf once, each in its own branch's bucket.
+    void save(SnapshotWriter& out) const;
+    bool load(const Snapshot& in);
+
+private:
+    uint64_t random();
+    uint32_t pickBranch(uint64_t u) const;     // smallest branch whose prefix weight is past u
+    uint32_t pickSlot(uint32_t branch, uint64_t u) const;     // the same among its bucket's slots
+    void addWeight(uint32_t branch, int64_t delta);
+    void addSlotWeight(uint32_t branch, uint32_t slot, int64_t delta);
+    void buildFenwick();
+
+    DetachSettings m_settings;
+    std::vector<uint32_t> m_bucketStart;    // per branch, into m_slots; one past the end last
+    std::vector<uint32_t> m_bucketCount;    // attached leaves at the front of each bucket
+    std::vector<uint32_t> m_slots;          // leaf indices by branch
+    std::vector<uint32_t> m_branchOf;       // per leaf, its branch in build()
+    std::vector<uint32_t> m_weight;         // per leaf, fixed point (256 = 1)
+    std::vector<uint64_t> m_branchWeight;   // attached leaves' weight per branch
+    std::vector<uint64_t> m_fenwick;        // over m_branchWeight, 1-based
+    std::vector<uint64_t> m_slotFenwick;    // per bucket, over its slots' weights, node k at bucket start + k - 1
+    uint32_t m_topBit;                      // highest power of two <= branches
+    uint64_t m_totalWeight;
+    std::vector<uint8_t> m_attached;
+    uint32_t m_numAttached;
+    float m_due;                            // leaves owed
+    uint64_t m_seed;
+};
+
+#endif // DETACHMENT_HPP
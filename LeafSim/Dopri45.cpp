@@ -0,0 +1,430 @@
+// Self-test: g++ -std=c++11 -O2 -DTEST -o dopritest LeafSim/Dopri45.cpp LeafSim/FlutterRhs.cpp LeafSim/FlutterModel.cpp
+#include "Dopri45.hpp"
+#include <cmath>
+#include <algorithm>
+
+// Dormand-Prince tableau
+static const double C2 = 1. / 5., C3 = 3. / 10., C4 = 4. / 5., C5 = 8. / 9.;
+static const double A21 = 1. / 5.;
+static const double A31 = 3. / 40., A32 = 9. / 40.;
+static const double A41 = 44. / 45., A42 = -56. / 15., A43 = 32. / 9.;
+static const double A51 = 19372. / 6561., A52 = -25360. / 2187., A53 = 64448. / 6561., A54 = -212. / 729.;
+static const double A61 = 9017. / 3168., A62 = -355. / 33., A63 = 46732. / 5247., A64 = 49. / 176.,
+                    A65 = -5103. / 18656.;
+static const double A71 = 35. / 384., A73 = 500. / 1113., A74 = 125. / 192., A75 = -2187. / 6784.,
+                    A76 = 11. / 84.;
+// 5th minus 4th order weights
+static const double E1 = 71. / 57600., E3 = -71. / 16695., E4 = 71. / 1920., E5 = -17253. / 339200.,
+                    E6 = 22. / 525., E7 = -1. / 40.;
+// dense output (Hairer & Wanner)
+static const double D1 = -12715105075. / 11282082432., D3 = 87487479700. / 32700410799.,
+                    D4 = -10690763975. / 1880347072., D5 = 701980252875. / 199316789632.,
+                    D6 = -1453857185. / 822651844., D7 = 69997945. / 29380423.;
+
+// step size controller
+static const double SAFETY = 0.9;
+static const double MIN_SCALE = 0.2;
+static const double MAX_SCALE = 10.;
+
+Dopri45::Dopri45(double rtol, double atol)
+    : m_maxStep(0.)
+    , m_minStep(1.e-12)
+    , m_initialStep(0.)
+    , m_maxSteps(0)
+    , m_n(0)
+    , m_t(0.), m_tPrev(0.), m_h(0.)
+    , m_accepted(0), m_rejected(0), m_evals(0)
+{
+    setTolerances(rtol, atol);
+}
+
+void Dopri45::setTolerances(double rtol, double atol)
+{
+    m_rtol = rtol > 0. ? rtol : 1.e-6;
+    m_atol = atol > 0. ? atol : 1.e-9;
+}
+
+void Dopri45::reset(const OdeRhs& rhs, double t0, const double* y0)
+{
+    m_n = rhs.GetDimension();
+    m_y.assign(y0, y0 + m_n);
+    m_yNew.resize(m_n);
+    m_yStage.resize(m_n);
+    m_err.resize(m_n);
+    for (int s = 0; s < 7; ++s) {
+        m_k[s].resize(m_n);
+    }
+    m_cont.assign(5 * m_n, 0.);
+    for (int i = 0; i < m_n; ++i) {
+        m_cont[i] = y0[i];      // interpolate() before the first step gives y0
+    }
+
+    m_t = m_tPrev = t0;
+    m_accepted = m_rejected = 0;
+    m_evals = 0;
+
+    rhs.eval(m_t, &m_y[0], &m_k[0][0]);
+    m_evals++;
+    m_h = (m_initialStep > 0.) ? m_initialStep : initialStep(rhs);
+}
+
+// RMS of err scaled by the tolerance of each component
+double Dopri45::errorNorm(const double* err, const double* y0, const double* y1) const
+{
+    double sum = 0.;
+    for (int i = 0; i < m_n; ++i) {
+        double scale = m_atol + m_rtol * std::max(std::fabs(y0[i]), std::fabs(y1[i]));
+        double e = err[i] / scale;
+        sum += e * e;
+    }
+    return std::sqrt(sum / m_n);
+}
+
+// Starting step from the size of y and y' and a trial Euler step (Hairer's
+// hinit, simplified)
+double Dopri45::initialStep(const OdeRhs& rhs)
+{
+    double d0 = 0., d1 = 0.;
+    for (int i = 0; i < m_n; ++i) {
+        double scale = m_atol + m_rtol * std::fabs(m_y[i]);
+        d0 += (m_y[i] / scale) * (m_y[i] / scale);
+        d1 += (m_k[0][i] / scale) * (m_k[0][i] / scale);
+    }
+    d0 = std::sqrt(d0 / m_n);
+    d1 = std::sqrt(d1 / m_n);
+    double h0 = (d0 < 1.e-5 || d1 < 1.e-5) ? 1.e-6 : 0.01 * d0 / d1;
+
+    for (int i = 0; i < m_n; ++i) {
+        m_yStage[i] = m_y[i] + h0 * m_k[0][i];
+    }
+    rhs.eval(m_t + h0, &m_yStage[0], &m_k[1][0]);
+    m_evals++;
+
+    double d2 = 0.;
+    for (int i = 0; i < m_n; ++i) {
+        double scale = m_atol + m_rtol * std::fabs(m_y[i]);
+        double d = (m_k[1][i] - m_k[0][i]) / scale;
+        d2 += d * d;
+    }
+    d2 = std::sqrt(d2 / m_n) / h0;
+
+    double dMax = std::max(d1, d2);
+    double h1 = (dMax <= 1.e-15) ? std::max(1.e-6, h0 * 1.e-3) : std::pow(0.01 / dMax, 1. / 5.);
+    double h = std::min(100. * h0, h1);
+    if (m_maxStep > 0.) {
+        h = std::min(h, m_maxStep);
+    }
+    return h;
+}
+
+bool Dopri45::step(const OdeRhs& rhs, double tEnd)
+{
+    const int n = m_n;
+    const double* y = &m_y[0];
+    double* ys = &m_yStage[0];
+    std::vector<double>* k = m_k;
+
+    for (;;) {
+        double h = m_h;
+        if (m_maxStep > 0.) {
+            h = std::min(h, m_maxStep);
+        }
+        bool last = false;
+        if (m_t + h >= tEnd) {
+            h = tEnd - m_t;
+            last = true;
+        }
+        if ((h < m_minStep && !last) || (m_maxSteps > 0 && m_accepted + m_rejected >= m_maxSteps)) {
+            return false;
+        }
+
+        // 1) Stages 2..7 (stage 1 is the previous step's last)
+        for (int i = 0; i < n; ++i) ys[i] = y[i] + h * A21 * k[0][i];
+        rhs.eval(m_t + C2 * h, ys, &k[1][0]);
+        for (int i = 0; i < n; ++i) ys[i] = y[i] + h * (A31 * k[0][i] + A32 * k[1][i]);
+        rhs.eval(m_t + C3 * h, ys, &k[2][0]);
+        for (int i = 0; i < n; ++i) ys[i] = y[i] + h * (A41 * k[0][i] + A42 * k[1][i] + A43 * k[2][i]);
+        rhs.eval(m_t + C4 * h, ys, &k[3][0]);
+        for (int i = 0; i < n; ++i)
+            ys[i] = y[i] + h * (A51 * k[0][i] + A52 * k[1][i] + A53 * k[2][i] + A54 * k[3][i]);
+        rhs.eval(m_t + C5 * h, ys, &k[4][0]);
+        for (int i = 0; i < n; ++i)
+            ys[i] = y[i] + h * (A61 * k[0][i] + A62 * k[1][i] + A63 * k[2][i] + A64 * k[3][i] + A65 * k[4][i]);
+        rhs.eval(m_t + h, ys, &k[5][0]);
+        for (int i = 0; i < n; ++i)
+            m_yNew[i] = y[i] + h * (A71 * k[0][i] + A73 * k[2][i] + A74 * k[3][i] + A75 * k[4][i] + A76 * k[5][i]);
+        rhs.eval(m_t + h, &m_yNew[0], &k[6][0]);
+        m_evals += 6;
+
+        // 2) Embedded error estimate
+        for (int i = 0; i < n; ++i) {
+            m_err[i] = h * (E1 * k[0][i] + E3 * k[2][i] + E4 * k[3][i] + E5 * k[4][i] + E6 * k[5][i] + E7 * k[6][i]);
+        }
+        double err = errorNorm(&m_err[0], y, &m_yNew[0]);
+        bool finite = (err == err) && err < 1.e300;
+
+        // 3) Next step size from the error (5th root: the error is O(h^5))
+        double scale = (!finite) ? MIN_SCALE
+                     : (err == 0.) ? MAX_SCALE
+                     : std::min(MAX_SCALE, std::max(MIN_SCALE, SAFETY * std::pow(err, -0.2)));
+
+        if (!finite || err > 1.) {
+            m_rejected++;
+            m_h = h * std::min(1., scale);
+            if (m_h < m_minStep) {
+                return false;
+            }
+            continue;
+        }
+
+        // 4) Accept: dense output coefficients, then move on
+        for (int i = 0; i < n; ++i) {
+            double dy = m_yNew[i] - y[i];
+            double bspl = h * k[0][i] - dy;
+            m_cont[i] = y[i];
+            m_cont[n + i] = dy;
+            m_cont[2 * n + i] = bspl;
+            m_cont[3 * n + i] = dy - h * k[6][i] - bspl;
+            m_cont[4 * n + i] = h * (D1 * k[0][i] + D3 * k[2][i] + D4 * k[3][i] + D5 * k[4][i] +
+                                     D6 * k[5][i] + D7 * k[6][i]);
+        }
+        m_tPrev = m_t;
+        m_t = last ? tEnd : m_t + h;
+        m_y.swap(m_yNew);
+        k[0].swap(k[6]);        // FSAL
+        m_accepted++;
+
+        // don't let a short final step shrink the next one
+        m_h = last ? std::max(m_h, h * scale) : h * scale;
+        return true;
+    }
+}
+
+bool Dopri45::integrate(const OdeRhs& rhs, double tEnd)
+{
+    while (m_t < tEnd) {
+        if (!step(rhs, tEnd)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static inline void EvalDense(const double* cont, int n, double s, double* y)
+{
+    double s1 = 1. - s;
+    for (int i = 0; i < n; ++i) {
+        y[i] = cont[i] + s * (cont[n + i] + s1 * (cont[2 * n + i] + s * (cont[3 * n + i] + s1 * cont[4 * n + i])));
+    }
+}
+
+void Dopri45::interpolate(double t, double* y) const
+{
+    double h = m_t - m_tPrev;
+    double s = (h > 0.) ? (t - m_tPrev) / h : 0.;
+    EvalDense(&m_cont[0], m_n, s, y);
+}
+
+// -------------------------------------
+// DenseTrajectory
+// -------------------------------------
+DenseTrajectory::DenseTrajectory()
+    : m_n(0)
+{
+}
+
+void DenseTrajectory::clear()
+{
+    m_start.clear();
+    m_h.clear();
+    m_cont.clear();
+}
+
+void DenseTrajectory::append(const Dopri45& integrator)
+{
+    m_n = integrator.GetDimension();
+    m_start.push_back(integrator.GetPrevTime());
+    m_h.push_back(integrator.GetTime() - integrator.GetPrevTime());
+    const std::vector<double>& cont = integrator.GetDenseCoefficients();
+    m_cont.insert(m_cont.end(), cont.begin(), cont.end());
+}
+
+void DenseTrajectory::evaluate(double t, double* y) const
+{
+    if (m_start.empty()) {
+        return;
+    }
+    // last step starting at or before t
+    size_t s = std::upper_bound(m_start.begin(), m_start.end(), t) - m_start.begin();
+    s = (s == 0) ? 0 : s - 1;
+    double u = (m_h[s] > 0.) ? (t - m_start[s]) / m_h[s] : 0.;
+    u = std::max(0., std::min(u, 1.));
+    EvalDense(&m_cont[s * 5 * m_n], m_n, u, y);
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include "../SelfTest.hpp"
+#include "FlutterRhs.hpp"
+
+// y'' = -y, y(0) = 1, y'(0) = 0  ->  y = cos t
+class Oscillator : public OdeRhs
+{
+  public:
+	int  GetDimension( ) const	{ return 2; }
+	void eval( double, const double *y, double *dydt ) const
+	{
+		dydt[0] = y[1];
+		dydt[1] = -y[0];
+	}
+};
+
+static double
+Ranu( unsigned *seed )
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return ( *seed >> 8 ) / 16777216.;
+}
+
+static double
+MaxDiff( const double *a, const double *b )
+{
+	double d = 0.;
+	for( int i = 0; i < 6; i++ )
+		d = std::max( d, fabs( a[i] - b[i] ) );
+	return std::isfinite( d ) ? d : 1.e300;		// a blown-up state is never close
+}
+
+// fixed-step RK4 on any OdeRhs, the way TrajectoryGen steps:
+static void
+Rk4( const OdeRhs &rhs, double t, double *y, double h, int steps )
+{
+	int n = rhs.GetDimension( );
+	std::vector<double> k1( n ), k2( n ), k3( n ), k4( n ), tmp( n );
+	for( int s = 0; s < steps; s++, t += h )
+	{
+		rhs.eval( t, y, &k1[0] );
+		for( int i = 0; i < n; i++ )	tmp[i] = y[i] + 0.5*h*k1[i];
+		rhs.eval( t + 0.5*h, &tmp[0], &k2[0] );
+		for( int i = 0; i < n; i++ )	tmp[i] = y[i] + 0.5*h*k2[i];
+		rhs.eval( t + 0.5*h, &tmp[0], &k3[0] );
+		for( int i = 0; i < n; i++ )	tmp[i] = y[i] + h*k3[i];
+		rhs.eval( t + h, &tmp[0], &k4[0] );
+		for( int i = 0; i < n; i++ )
+			y[i] += h/6. * ( k1[i] + 2.*k2[i] + 2.*k3[i] + k4[i] );
+	}
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	// 1. harmonic oscillator against the exact solution:
+	Oscillator osc;
+	double y0[2] = { 1., 0. };
+	Dopri45 dp( 1.e-8, 1.e-10 );
+	dp.reset( osc, 0., y0 );
+
+	DenseTrajectory traj;
+	const double T = 10.;
+	while( dp.GetTime( ) < T && dp.step( osc, T ) )
+		traj.append( dp );
+
+	const double *y = dp.GetState( );
+	double endErr = std::max( fabs( y[0] - cos( T ) ), fabs( y[1] + sin( T ) ) );
+	fprintf( stderr, "oscillator: %ld steps, %ld rejected, %ld rhs calls, end error %.2e\n",
+		dp.GetAcceptedSteps( ), dp.GetRejectedSteps( ), dp.GetRhsEvals( ), endErr );
+	Check( dp.GetTime( ) == T, "stops exactly at tEnd" );
+	Check( endErr < 1.e-6, "end state matches cos/sin" );
+	Check( dp.GetRhsEvals( ) <= 6 * ( dp.GetAcceptedSteps( ) + dp.GetRejectedSteps( ) ) + 2, "FSAL: 6 calls per step" );
+
+	// 2. dense output between the steps:
+	double denseErr = 0.;
+	for( int i = 0; i <= 1000; i++ )
+	{
+		double t = T * i / 1000.;
+		double yt[2];
+		traj.evaluate( t, yt );
+		denseErr = std::max( denseErr, fabs( yt[0] - cos( t ) ) );
+	}
+	fprintf( stderr, "dense output: %d steps kept, max error %.2e\n", traj.GetNumSteps( ), denseErr );
+	Check( denseErr < 1.e-6, "dense output matches cos between steps" );
+	Check( traj.GetStartTime( ) == 0. && traj.GetEndTime( ) == T, "trajectory covers [0,T]" );
+
+	double yMid[2];
+	dp.interpolate( 0.5 * ( dp.GetPrevTime( ) + dp.GetTime( ) ), yMid );
+	double tMid = 0.5 * ( dp.GetPrevTime( ) + dp.GetTime( ) );
+	Check( fabs( yMid[0] - cos( tMid ) ) < 1.e-6, "interpolate( ) inside the last step" );
+
+	// 3. the flutter model (smoothed switch) from random starts over a second,
+	// against fixed-step RK4 at the same error:
+	const int STARTS = 12;
+	unsigned seed = 7;
+	long dpCalls = 0, rkCalls = 0, dpMostCalls = 0;
+	double worstErr = 0., worstSharp = 0.;
+	bool allOk = true;
+	for( int st = 0; st < STARTS; st++ )
+	{
+		double s0[6] = { 0., 0., 3.*Ranu( &seed ) - 1.5, 2.*Ranu( &seed ) - 1., -2.*Ranu( &seed ), 4.*Ranu( &seed ) - 2. };
+		FlutterParams p = { 0.005 + 0.015*Ranu( &seed ), 0.1, 0.1, 4.1, 0.9 };
+		FlutterRhs flutter( p );
+
+		double ref[6];
+		std::copy( s0, s0 + 6, ref );
+		Rk4( flutter, 0., ref, 1./500000., 500000 );		// converged reference at t = 1
+
+		Dopri45 fdp( 1.e-6, 1.e-8 );
+		fdp.reset( flutter, 0., s0 );
+		allOk = fdp.integrate( flutter, 1. ) && allOk;
+		double dpErr = MaxDiff( fdp.GetState( ), ref );
+		dpCalls += fdp.GetRhsEvals( );
+		dpMostCalls = std::max( dpMostCalls, fdp.GetRhsEvals( ) );
+		worstErr = std::max( worstErr, dpErr );
+
+		// fewest RK4 steps that get as close:
+		int steps = 100;
+		for( ; steps < 500000; steps = steps * 6 / 5 )
+		{
+			double y[6];
+			std::copy( s0, s0 + 6, y );
+			Rk4( flutter, 0., y, 1./steps, steps );
+			if( MaxDiff( y, ref ) <= dpErr )
+				break;
+		}
+		rkCalls += 4 * steps;
+
+		// the smoothing against the sharp model, at a step that resolves its switch:
+		double sharp[6];
+		std::copy( s0, s0 + 6, sharp );
+		for( int k = 0; k < 10000; k++ )
+			FlutterRk4Step( sharp, p, 1.225, 9.81, 1.e-4 );
+		worstSharp = std::max( worstSharp, std::max( fabs( ref[0] - sharp[0] ), fabs( ref[1] - sharp[1] ) ) );
+	}
+	fprintf( stderr, "flutter model, %d starts: dopri %ld rhs calls (at most %ld per start, worst error %.2e), rk4 at the same error %ld; smooth vs sharp %.2e m\n",
+		STARTS, dpCalls, dpMostCalls, worstErr, rkCalls, worstSharp );
+	Check( allOk, "flutter model integrates to t = 1 from every start" );
+	Check( worstErr < 1.e-4, "flutter model matches the fine RK4 reference" );
+	Check( dpCalls < rkCalls, "fewer RHS calls than fixed-step RK4 at the same error" );
+	Check( dpMostCalls < 20000, "under 20000 RHS calls per simulated second from every start" );
+	Check( worstSharp < 0.01, "smoothed switch stays within 1cm of the sharp model" );
+
+	// the sharp switch is what made it grind; with a step budget it has to
+	// give up instead of stepping forever:
+	{
+		unsigned sharpSeed = 7;
+		double s0[6] = { 0., 0., 3.*Ranu( &sharpSeed ) - 1.5, 2.*Ranu( &sharpSeed ) - 1., -2.*Ranu( &sharpSeed ), 4.*Ranu( &sharpSeed ) - 2. };
+		FlutterParams p = { 0.005 + 0.015*Ranu( &sharpSeed ), 0.1, 0.1, 4.1, 0.9 };
+		FlutterRhs sharp( p, 1.225, 9.81, 0. );
+		Dopri45 fdp( 1.e-6, 1.e-8 );
+		fdp.setMaxSteps( 100000 );
+		fdp.reset( sharp, 0., s0 );
+		bool ok = fdp.integrate( sharp, 10. );
+		fprintf( stderr, "sharp switch: %s at t = %.4f after %ld steps (%ld rejected)\n",
+			ok ? "finished" : "gave up", fdp.GetTime( ), fdp.GetAcceptedSteps( ), fdp.GetRejectedSteps( ) );
+		Check( ! ok && fdp.GetAcceptedSteps( ) + fdp.GetRejectedSteps( ) == 100000, "step budget stops the sharp switch" );
+	}
+
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,95 @@
+#ifndef DOPRI45_HPP
+#define DOPRI45_HPP
+#include <vector>
+#include "OdeRhs.hpp"
+
+// Adaptive Dormand-Prince 5(4) integrator.
+//
+// Each step is 5th order with an embedded 4th-order estimate; the difference
+// drives the step size so that the local error stays below
+// atol + rtol * |y| per component.  Smooth stretches take big steps, sharp
+// ones (a leaf flipping over) small ones.  The last stage is reused as the
+// first stage of the next step (FSAL), so an accepted step costs 6 RHS calls.
+//
+// After every accepted step, interpolate() gives a 4th-order accurate state at
+// any t in [GetPrevTime(), GetTime()] (dense output) for free, e.g. for
+// sampling at render times.  DenseTrajectory keeps those steps to sample a
+// whole solution afterwards.
+class Dopri45 {
+public:
+    Dopri45(double rtol = 1.e-6, double atol = 1.e-9);
+
+    void setTolerances(double rtol, double atol);
+    void setMaxStep(double h) { m_maxStep = h; }
+    void setMinStep(double h) { m_minStep = h; }
+    void setMaxSteps(long n) { m_maxSteps = n; }           // accepted + rejected since reset(); 0 = no limit
+    void setInitialStep(double h) { m_initialStep = h; }   // 0 = estimate
+
+    // Start at (t0, y0); y0 has rhs.GetDimension() entries
+    void reset(const OdeRhs& rhs, double t0, const double* y0);
+
+    // Take one accepted step, never past tEnd.  Returns false if the step size
+    // would drop below the minimum or the steps run out (the problem is too
+    // stiff or singular).
+    bool step(const OdeRhs& rhs, double tEnd);
+    // Step until tEnd
+    bool integrate(const OdeRhs& rhs, double tEnd);
+
+    // Dense output inside the last accepted step
+    void interpolate(double t, double* y) const;
+
+    double GetTime() const { return m_t; }
+    double GetPrevTime() const { return m_tPrev; }
+    double GetStepSize() const { return m_h; }     // size the next step will try
+    const double* GetState() const { return &m_y[0]; }
+    int GetDimension() const { return m_n; }
+
+    long GetAcceptedSteps() const { return m_accepted; }
+    long GetRejectedSteps() const { return m_rejected; }
+    long GetRhsEvals() const { return m_evals; }
+
+    // interpolation coefficients of the last step (5 * dimension values)
+    const std::vector<double>& GetDenseCoefficients() const { return m_cont; }
+
+private:
+    double initialStep(const OdeRhs& rhs);
+    double errorNorm(const double* err, const double* y0, const double* y1) const;
+
+    double m_rtol, m_atol;
+    double m_maxStep, m_minStep, m_initialStep;
+    long m_maxSteps;
+
+    int m_n;
+    double m_t, m_tPrev, m_h;
+    std::vector<double> m_y, m_yNew, m_yStage, m_err;
+    std::vector<double> m_k[7];
+    std::vector<double> m_cont;     // dense output coefficients of the last step
+    long m_accepted, m_rejected, m_evals;
+};
+
+// All accepted steps of a solution, for sampling at arbitrary times later:
+//
+//     integrator.reset(rhs, 0., y0);
+//     DenseTrajectory traj;
+//     while (integrator.GetTime() < tEnd && integrator.step(rhs, tEnd))
+//         traj.append(integrator);
+//     traj.evaluate(renderTime, y);
+class DenseTrajectory {
+public:
+    DenseTrajectory();
+    void clear();
+    void append(const Dopri45& integrator);     // the integrator's last step
+    void evaluate(double t, double* y) const;   // clamped to the covered span
+
+    int GetDimension() const { return m_n; }
+    int GetNumSteps() const { return (int)m_start.size(); }
+    double GetStartTime() const { return m_start.empty() ? 0. : m_start.front(); }
+    double GetEndTime() const { return m_start.empty() ? 0. : m_start.back() + m_h.back(); }
+
+private:
+    int m_n;
+    std::vector<double> m_start, m_h;   // per step
+    std::vector<double> m_cont;         // 5 * m_n per step
+};
+
+#endif // DOPRI45_HPP
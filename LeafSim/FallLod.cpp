@@ -0,0 +1,565 @@
+// Self-test: make libleafsim.a libjobs.a && g++ -std=c++11 -O2 -DTEST -o falllodtest LeafSim/FallLod.cpp -L. -lleafsim -ljobs -pthread
+#include "FallLod.hpp"
+#include "TrajectoryDb.hpp"
+#include "TrajectoryIndex.hpp"
+#include "Snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const float G = 9.81f;
+static const float MIN_SPEED = 1.e-3f;      // m/s: slower than this, no direction of travel
+
+FallLodSettings::FallLodSettings()
+    : nearDistance(10.f)
+    , farDistance(30.f)
+    , hysteresis(0.1f)
+    , maxFull(512)
+    , groundY(0.f)
+    , groundMargin(1.f)
+    , blendTime(0.3f)
+    , driftSwayHz(0.7f)
+    , driftRock(0.6f)
+{
+}
+
+// -------------------------------------
+// Quaternions (w, x, y, z), body to world
+// -------------------------------------
+static void Rotate(const float* q, const float* v, float* out)
+{
+    float qw = q[0], qx = q[1], qy = q[2], qz = q[3];
+    out[0] = (1.f - 2.f * (qy * qy + qz * qz)) * v[0] + 2.f * (qx * qy - qw * qz) * v[1] + 2.f * (qx * qz + qw * qy) * v[2];
+    out[1] = 2.f * (qx * qy + qw * qz) * v[0] + (1.f - 2.f * (qx * qx + qz * qz)) * v[1] + 2.f * (qy * qz - qw * qx) * v[2];
+    out[2] = 2.f * (qx * qz - qw * qy) * v[0] + 2.f * (qy * qz + qw * qx) * v[1] + (1.f - 2.f * (qx * qx + qy * qy)) * v[2];
+}
+
+static void RotateBack(const float* q, const float* v, float* out)
+{
+    float inv[4] = { q[0], -q[1], -q[2], -q[3] };
+    Rotate(inv, v, out);
+}
+
+// a turn of angle about a unit axis, then q
+static void Turn(const float* axis, float angle, const float* q, float* out)
+{
+    float s = std::sin(0.5f * angle), c = std::cos(0.5f * angle);
+    float a[4] = { c, s * axis[0], s * axis[1], s * axis[2] };
+    out[0] = a[0] * q[0] - a[1] * q[1] - a[2] * q[2] - a[3] * q[3];
+    out[1] = a[0] * q[1] + a[1] * q[0] + a[2] * q[3] - a[3] * q[2];
+    out[2] = a[0] * q[2] - a[1] * q[3] + a[2] * q[0] + a[3] * q[1];
+    out[3] = a[0] * q[3] + a[1] * q[2] - a[2] * q[1] + a[3] * q[0];
+}
+
+// -------------------------------------
+// FallLod
+// -------------------------------------
+FallLod::FallLod()
+    : m_graph(NULL)
+    , m_index(NULL)
+    , m_numFull(0)
+    , m_seed(1)
+{
+    m_counts[0] = m_counts[1] = m_counts[2] = 0;
+}
+
+void FallLod::setMotionGraph(const MotionGraph* graph, const TrajectoryIndex* index)
+{
+    bool usable = graph != NULL && index != NULL && graph->GetDb() != NULL && index->GetSize() > 0;
+    m_graph = usable ? graph : NULL;
+    m_index = usable ? index : NULL;
+}
+
+void FallLod::add(const LeafParams& params)
+{
+    Leaf leaf;
+    leaf.params = params;
+    leaf.tier = FALL_FULL;          // until the next classify()
+    leaf.entered = true;
+    leaf.time = 0.f;
+    m_leaves.push_back(leaf);
+}
+
+void FallLod::remove(uint32_t i)
+{
+    m_leaves[i] = m_leaves.back();
+    m_leaves.pop_back();
+}
+
+void FallLod::reorder(const std::vector<uint32_t>& order)
+{
+    if (order.empty()) {
+        return;
+    }
+    std::vector<Leaf> leaves(order.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        leaves[i] = m_leaves[order[i]];
+    }
+    m_leaves.swap(leaves);
+}
+
+void FallLod::clear()
+{
+    m_leaves.clear();
+    m_numFull = 0;
+}
+
+void FallLod::save(SnapshotWriter& out) const
+{
+    std::vector<LeafParams> params(m_leaves.size());
+    for (size_t i = 0; i < m_leaves.size(); ++i) {
+        params[i] = m_leaves[i].params;
+    }
+    out.addCopy("lod.params", params.data(), params.size() * sizeof(LeafParams));
+}
+
+bool FallLod::load(const Snapshot& in)
+{
+    std::vector<LeafParams> params;
+    if (!in.read("lod.params", &params)) {
+        return false;
+    }
+    clear();
+    for (size_t i = 0; i < params.size(); ++i) {
+        add(params[i]);
+    }
+    return true;
+}
+
+FallTier FallLod::pickTier(const Leaf& leaf, float distance, float y) const
+{
+    if (y < m_settings.groundY + m_settings.groundMargin) {
+        return FALL_FULL;
+    }
+    // a boundary moves away from the side the leaf is on
+    float h = m_settings.hysteresis;
+    float nearD = m_settings.nearDistance * (leaf.tier == FALL_FULL ? 1.f + h : 1.f - h);
+    float farD = m_settings.farDistance * (leaf.tier == FALL_DRIFT ? 1.f - h : 1.f + h);
+    if (distance < nearD) {
+        return FALL_FULL;
+    }
+    return (distance < farD && m_graph != NULL) ? FALL_PLAYBACK : FALL_DRIFT;
+}
+
+void FallLod::classify(LeafBatch3D& leaves, const float* eye,
+                       const std::function<void(uint32_t, uint32_t)>& onSwap)
+{
+    uint32_t n = leaves.GetNumAwake();
+    const float* px = leaves.GetPx();
+    const float* py = leaves.GetPy();
+    const float* pz = leaves.GetPz();
+
+    // 1) The tier each leaf wants
+    std::vector<uint8_t> want(n);
+    m_distance.resize(n);
+    uint32_t full = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        float d[3] = { px[i] - eye[0], py[i] - eye[1], pz[i] - eye[2] };
+        m_distance[i] = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        want[i] = (uint8_t)pickTier(m_leaves[i], m_distance[i], py[i]);
+        full += (want[i] == FALL_FULL);
+    }
+
+    // 2) Over budget: only the nearest keep full physics (landing ones
+    // first); ties go to the lower index, so exactly maxFull are kept
+    if (full > m_settings.maxFull) {
+        float landingY = m_settings.groundY + m_settings.groundMargin;
+        const std::vector<float>& distance = m_distance;
+        auto nearer = [py, landingY, &distance](uint32_t a, uint32_t b) {
+            float ra = (py[a] < landingY) ? -1.f : distance[a];
+            float rb = (py[b] < landingY) ? -1.f : distance[b];
+            return ra < rb || (ra == rb && a < b);
+        };
+        std::vector<uint32_t> ranked;
+        ranked.reserve(full);
+        for (uint32_t i = 0; i < n; ++i) {
+            if (want[i] == FALL_FULL) {
+                ranked.push_back(i);
+            }
+        }
+        uint32_t keep = m_settings.maxFull;
+        std::nth_element(ranked.begin(), ranked.begin() + keep, ranked.end(), nearer);
+        for (uint32_t k = keep; k < full; ++k) {
+            want[ranked[k]] = (m_graph != NULL) ? FALL_PLAYBACK : FALL_DRIFT;
+        }
+        full = keep;
+    }
+
+    // 3) Changes of tier start from the leaf's state now
+    m_counts[0] = m_counts[1] = m_counts[2] = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        Leaf& leaf = m_leaves[i];
+        if (want[i] != leaf.tier) {
+            leaf.tier = want[i];
+            leaf.entered = false;
+        }
+        if (!leaf.entered) {
+            enter(leaves, i, leaf);
+        }
+        m_counts[leaf.tier]++;
+    }
+
+    // 4) FALL_FULL to the front
+    uint32_t a = 0, b = n;
+    while (true) {
+        while (a < b && m_leaves[a].tier == FALL_FULL) {
+            a++;
+        }
+        while (a < b && m_leaves[b - 1].tier != FALL_FULL) {
+            b--;
+        }
+        if (b - a < 2) {
+            break;
+        }
+        leaves.swap(a, b - 1);
+        std::swap(m_leaves[a], m_leaves[b - 1]);
+        if (onSwap) {
+            onSwap(a, b - 1);
+        }
+    }
+    m_numFull = m_counts[FALL_FULL];
+}
+
+void FallLod::enter(LeafBatch3D& leaves, uint32_t i, Leaf& leaf)
+{
+    leaf.entered = true;
+    leaf.time = 0.f;
+    if (leaf.tier == FALL_FULL) {
+        return;
+    }
+
+    LeafState3D s = leaves.GetState(i);
+    float wind[3] = { leaves.GetWindX()[i], leaves.GetWindY()[i], leaves.GetWindZ()[i] };
+    float q[4] = { s.qw, s.qx, s.qy, s.qz };
+    float bodyW[3] = { s.wx, s.wy, s.wz }, worldW[3];
+    Rotate(q, bodyW, worldW);
+    std::copy(q, q + 4, leaf.q0);
+
+    // 1) The vertical plane the leaf is moving in (relative to the air), or
+    // failing that the one its x axis is in
+    float u[3] = { s.vx - wind[0], s.vy - wind[1], s.vz - wind[2] };
+    float uh = std::sqrt(u[0] * u[0] + u[2] * u[2]);
+    float bodyX[3] = { 1.f, 0.f, 0.f }, bx[3];
+    Rotate(q, bodyX, bx);
+    if (uh > MIN_SPEED) {
+        leaf.dir[0] = u[0] / uh;
+        leaf.dir[1] = u[2] / uh;
+    } else {
+        float bh = std::sqrt(bx[0] * bx[0] + bx[2] * bx[2]);
+        leaf.dir[0] = bh > 1.e-6f ? bx[0] / bh : 1.f;
+        leaf.dir[1] = bh > 1.e-6f ? bx[2] / bh : 0.f;
+    }
+
+    // 2) Tier set-up
+    uint32_t seed = m_seed;
+    m_seed = m_seed * 1664525u + 1013904223u;
+    if (leaf.tier == FALL_PLAYBACK) {
+        // the leaf's state in that plane, as the database has it
+        float normal[3] = { -leaf.dir[1], 0.f, leaf.dir[0] };
+        float planar[FLUTTER_DIM] = {
+            0.f, 0.f,
+            std::atan2(bx[1], bx[0] * leaf.dir[0] + bx[2] * leaf.dir[1]),
+            u[0] * leaf.dir[0] + u[2] * leaf.dir[1], u[1],
+            worldW[0] * normal[0] + worldW[2] * normal[2]
+        };
+        const LeafParams& p = leaf.params;
+        FlutterParams params = { p.mass, p.width, p.height, p.dragCoeffPerp, p.dragCoeffPara };
+        float key[TRAJECTORY_KEY_DIM];
+        MakeTrajectoryKey(planar, params, key);
+        int clip = std::max(m_index->findNearest(key).nearest, 0);
+        leaf.cursor.start(m_graph, clip, 0, 0.f, 0.f, seed | 1u);
+        float clipState[FLUTTER_DIM];
+        leaf.cursor.getState(clipState);
+        leaf.theta0 = clipState[2];
+    } else {
+        // the model's broadside terminal speed (vy' = -g - Aperp vy), halved
+        // for the time a fluttering leaf spends gliding
+        leaf.fallSpeed = 0.5f * G / std::max(leaf.params.dragCoeffPerp, 0.1f);
+        float angle = (float)(seed >> 8) * (6.2831853f / 16777216.f);
+        leaf.swayDir[0] = std::cos(angle);
+        leaf.swayDir[1] = std::sin(angle);
+    }
+
+    // 3) What the tier would move at now, against what the leaf does
+    float v[3], w[3], qt[4];
+    tierVelocity(leaf, 0.f, wind, v, w, qt);
+    float worldV[3] = { s.vx, s.vy, s.vz };
+    for (int k = 0; k < 3; ++k) {
+        leaf.dv[k] = worldV[k] - v[k];
+        leaf.dw[k] = worldW[k] - w[k];
+    }
+}
+
+// Velocity and world angular velocity of the tier at time t in it, and the orientation
+void FallLod::tierVelocity(Leaf& leaf, float t, const float* wind, float* v, float* w, float* q) const
+{
+    if (leaf.tier == FALL_PLAYBACK) {
+        float s[FLUTTER_DIM];
+        leaf.cursor.getState(s);
+        float normal[3] = { -leaf.dir[1], 0.f, leaf.dir[0] };
+        v[0] = wind[0] + s[3] * leaf.dir[0];
+        v[1] = wind[1] + s[4];
+        v[2] = wind[2] + s[3] * leaf.dir[1];
+        for (int k = 0; k < 3; ++k) {
+            w[k] = s[5] * normal[k];
+        }
+        Turn(normal, s[2] - leaf.theta0, leaf.q0, q);
+        return;
+    }
+
+    // FALL_DRIFT: with the wind at fallSpeed, gliding side to side and
+    // rocking into the glide
+    float omega = 6.2831853f * m_settings.driftSwayHz;
+    float sway = std::sin(omega * t);
+    float glide = 0.5f * leaf.fallSpeed * sway;
+    float axis[3] = { leaf.swayDir[1], 0.f, -leaf.swayDir[0] };     // tips the leaf's front down
+    v[0] = wind[0] + glide * leaf.swayDir[0];
+    v[1] = wind[1] - leaf.fallSpeed;
+    v[2] = wind[2] + glide * leaf.swayDir[1];
+    float spin = m_settings.driftRock * omega * std::cos(omega * t);
+    for (int k = 0; k < 3; ++k) {
+        w[k] = spin * axis[k];
+    }
+    Turn(axis, m_settings.driftRock * sway, leaf.q0, q);
+}
+
+void FallLod::advance(LeafBatch3D& leaves, float dt)
+{
+    LeafArrays3D a = leaves.GetArrays();
+    const float* windX = leaves.GetWindX();
+    const float* windY = leaves.GetWindY();
+    const float* windZ = leaves.GetWindZ();
+    float blend = m_settings.blendTime > 0.f ? m_settings.blendTime : 1.e-6f;
+
+    for (uint32_t i = m_numFull; i < leaves.GetNumAwake(); ++i) {
+        Leaf& leaf = m_leaves[i];
+        if (leaf.tier == FALL_FULL) {
+            continue;       // added or moved here since classify()
+        }
+        leaf.time += dt;
+        if (leaf.tier == FALL_PLAYBACK) {
+            leaf.cursor.advance(dt);
+        }
+
+        // 1) The tier's motion, plus what is left of the difference on entering
+        float wind[3] = { windX[i], windY[i], windZ[i] }, v[3], w[3], q[4];
+        tierVelocity(leaf, leaf.time, wind, v, w, q);
+        float fade = std::exp(-leaf.time / blend);
+        for (int k = 0; k < 3; ++k) {
+            v[k] += fade * leaf.dv[k];
+            w[k] += fade * leaf.dw[k];
+        }
+
+        // 2) Back into the batch
+        a.px[i] += v[0] * dt;
+        a.py[i] += v[1] * dt;
+        a.pz[i] += v[2] * dt;
+        a.vx[i] = v[0];
+        a.vy[i] = v[1];
+        a.vz[i] = v[2];
+        a.qw[i] = q[0];
+        a.qx[i] = q[1];
+        a.qy[i] = q[2];
+        a.qz[i] = q[3];
+        float bodyW[3];
+        RotateBack(q, w, bodyW);
+        a.wx[i] = bodyW[0];
+        a.wy[i] = bodyW[1];
+        a.wz[i] = bodyW[2];
+    }
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include <chrono>
+#include "TrajectoryGen.hpp"
+#include "../SelfTest.hpp"
+
+static float
+Length( float x, float y, float z )
+{
+	return sqrtf( x*x + y*y + z*z );
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *DB = "falllodtest_db.bin";
+	const int SUBSTEPS = 128;
+	const float DT = 1.f / 60.f;
+
+	// 1) A small database and graph: 3 s clips of the default leaf
+	TrajectorySweep sweep;
+	sweep.theta = SweepRange( -1.2, 1.2, 9 );
+	sweep.vx = SweepRange( -0.5, 0.5, 3 );
+	std::vector<TrajectoryJob> jobs;
+	sweep.buildJobs( &jobs );
+	TrajectorySettings settings;
+	settings.samples = 300;
+	std::vector<Trajectory> clips;
+	GenerateTrajectories( jobs, settings, 0, &clips );
+	TrajectoryDbWriter writer;
+	for( size_t i = 0; i < clips.size( ); i++ )
+		writer.add( jobs[i].params, settings.rho, settings.g, settings.dt, clips[i].states.data( ), clips[i].GetNumSamples( ) );
+	writer.write( DB, ENCODING_FLOAT32 );
+	TrajectoryDb db;
+	Check( db.open( DB ), "database written and opened" );
+	MotionGraph graph;
+	graph.build( db, MotionGraphSettings( ) );
+	TrajectoryIndex index;
+	index.build( db );
+
+	// 2) Leaves in a line from the camera, 2 to 62 m away, 40 m up, in a breeze
+	const int N = 600;
+	const float eye[3] = { 0.f, 40.f, 0.f };
+	LeafBatch3D batch;
+	FallLod lod;
+	FallLodSettings ls;
+	ls.maxFull = 100;
+	lod.setSettings( ls );
+	lod.setMotionGraph( &graph, &index );
+	std::vector<int> ids( N );
+	for( int i = 0; i < N; i++ )
+	{
+		float d = 2.f + 60.f * i / N;
+		float a = 0.7f * i;
+		LeafState3D s = { d * cosf( 0.1f * i ), 40.f, d * sinf( 0.1f * i ), cosf( a ), 0.f, sinf( a ), 0.f,
+			0.f, -0.5f, 0.f, 1.f, 0.f, -1.f };
+		LeafParams p = { 0.01f, 0.1f, 0.1f, 4.1f, 0.9f };
+		batch.add( s, p );
+		batch.SetWind( i, 1.f, 0.f, 0.5f );
+		lod.add( p );
+		ids[i] = i;
+	}
+	auto swapIds = [&ids]( uint32_t a, uint32_t b ) { std::swap( ids[a], ids[b] ); };
+
+	// 3) Tiers, budget and order
+	lod.classify( batch, eye, swapIds );
+	bool ordered = true, tiered = true;
+	for( uint32_t i = 0; i < batch.size( ); i++ )
+	{
+		ordered = ordered && ( ( i < lod.GetNumFull( ) ) == ( lod.GetTier( i ) == FALL_FULL ) );
+		float d = Length( batch.GetPx( )[i] - eye[0], batch.GetPy( )[i] - eye[1], batch.GetPz( )[i] - eye[2] );
+		if( d > ls.farDistance * 1.1f )
+			tiered = tiered && lod.GetTier( i ) == FALL_DRIFT;
+		if( d > ls.nearDistance * 1.1f && d < ls.farDistance * 0.9f )
+			tiered = tiered && lod.GetTier( i ) == FALL_PLAYBACK;
+	}
+	fprintf( stderr, "tiers: %u full, %u playback, %u drift\n",
+		lod.GetCount( FALL_FULL ), lod.GetCount( FALL_PLAYBACK ), lod.GetCount( FALL_DRIFT ) );
+	Check( ordered, "full-physics leaves first" );
+	Check( tiered, "tiers by distance" );
+	Check( lod.GetCount( FALL_FULL ) <= ls.maxFull, "full physics within budget" );
+
+	// ties at the cut: 150 leaves all landing (ranked alike), then 150 at one
+	// spot 1 m from the eye
+	bool exact = true;
+	for( int k = 0; k < 2; k++ )
+	{
+		LeafBatch3D tied;
+		FallLod tiedLod;
+		tiedLod.setSettings( ls );
+		tiedLod.setMotionGraph( &graph, &index );
+		for( int i = 0; i < 150; i++ )
+		{
+			LeafState3D s = { 0.1f * i, 0.5f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, -0.5f, 0.f, 0.f, 0.f, 0.f };
+			if( k == 1 )
+			{
+				s.px = 1.f;
+				s.py = 40.f;
+			}
+			LeafParams p = { 0.01f, 0.1f, 0.1f, 4.1f, 0.9f };
+			tied.add( s, p );
+			tiedLod.add( p );
+		}
+		tiedLod.classify( tied, eye, []( uint32_t, uint32_t ) { } );
+		exact = exact && tiedLod.GetCount( FALL_FULL ) == ls.maxFull && tiedLod.GetNumFull( ) == ls.maxFull;
+	}
+	Check( exact, "ties at the budget cut: exactly maxFull kept" );
+
+	// 4) Five seconds, the camera flying along the line and back so leaves
+	// change tier both ways; no leaf may jump
+	std::vector<float> lastP( 3 * N ), lastV( 3 * N );
+	for( uint32_t i = 0; i < batch.size( ); i++ )
+	{
+		int id = ids[i];
+		lastP[3*id] = batch.GetPx( )[i];  lastP[3*id+1] = batch.GetPy( )[i];  lastP[3*id+2] = batch.GetPz( )[i];
+		lastV[3*id] = batch.GetVx( )[i];  lastV[3*id+1] = batch.GetVy( )[i];  lastV[3*id+2] = batch.GetVz( )[i];
+	}
+	std::vector<uint8_t> lastTier( N, 255 );
+	float worstJump = 0.f, worstStepDv = 0.f, worstChangeDv[3] = { 0.f, 0.f, 0.f };
+	int changes = 0;
+	uint32_t mostFull = 0;
+	double fullNs = 0., restNs = 0.;
+	long fullLeafSteps = 0, restLeafSteps = 0;
+	double drop[3] = { 0., 0., 0. };
+	long dropSteps[3] = { 0, 0, 0 };
+	for( int f = 0; f < 300; f++ )
+	{
+		float t = f * DT;
+		float cam[3] = { 30.f * sinf( 0.6f * t ), 40.f, 0.f };
+		lod.classify( batch, cam, swapIds );
+
+		auto t0 = std::chrono::steady_clock::now( );
+		batch.step( DT / SUBSTEPS, SUBSTEPS, lod.GetNumFull( ) );
+		auto t1 = std::chrono::steady_clock::now( );
+		lod.advance( batch, DT );
+		auto t2 = std::chrono::steady_clock::now( );
+		fullNs += std::chrono::duration<double, std::nano>( t1 - t0 ).count( );
+		restNs += std::chrono::duration<double, std::nano>( t2 - t1 ).count( );
+		fullLeafSteps += lod.GetNumFull( );
+		mostFull = std::max( mostFull, lod.GetNumFull( ) );
+		restLeafSteps += batch.size( ) - lod.GetNumFull( );
+
+		for( uint32_t i = 0; i < batch.size( ); i++ )
+		{
+			int id = ids[i];
+			float p[3] = { batch.GetPx( )[i], batch.GetPy( )[i], batch.GetPz( )[i] };
+			float v[3] = { batch.GetVx( )[i], batch.GetVy( )[i], batch.GetVz( )[i] };
+			float dp = Length( p[0] - lastP[3*id], p[1] - lastP[3*id+1], p[2] - lastP[3*id+2] );
+			float speed = std::max( Length( v[0], v[1], v[2] ), Length( lastV[3*id], lastV[3*id+1], lastV[3*id+2] ) );
+			worstJump = std::max( worstJump, dp / DT - speed );
+			float dv = Length( v[0] - lastV[3*id], v[1] - lastV[3*id+1], v[2] - lastV[3*id+2] );
+			uint8_t tier = (uint8_t)lod.GetTier( i );
+			if( lastTier[id] != 255 && tier != lastTier[id] )
+			{
+				changes++;
+				worstChangeDv[tier] = std::max( worstChangeDv[tier], dv );
+			}
+			else if( lastTier[id] != 255 )
+				worstStepDv = std::max( worstStepDv, dv );
+			drop[tier] += lastP[3*id+1] - p[1];
+			dropSteps[tier]++;
+			lastTier[id] = tier;
+			std::copy( p, p + 3, &lastP[3*id] );
+			std::copy( v, v + 3, &lastV[3*id] );
+		}
+	}
+	fprintf( stderr, "%d tier changes; worst distance past the speed in a frame %.3f m/s\n", changes, worstJump );
+	fprintf( stderr, "worst velocity change in a frame: same tier %.2f, into full %.2f, playback %.2f, drift %.2f m/s\n",
+		worstStepDv, worstChangeDv[0], worstChangeDv[1], worstChangeDv[2] );
+	fprintf( stderr, "mean fall speed: full %.2f, playback %.2f, drift %.2f m/s\n",
+		drop[0] / std::max( dropSteps[0], 1L ) / DT, drop[1] / std::max( dropSteps[1], 1L ) / DT, drop[2] / std::max( dropSteps[2], 1L ) / DT );
+	double perFull = fullNs / std::max( fullLeafSteps, 1L ), perRest = restNs / std::max( restLeafSteps, 1L );
+	fprintf( stderr, "per leaf and 60 Hz step: full %.0f ns, playback / drift %.0f ns\n", perFull, perRest );
+	Check( changes > 0, "leaves changed tier" );
+	Check( mostFull <= ls.maxFull, "full physics within budget throughout" );
+	Check( worstJump < 0.1f, "no leaf jumps: a frame moves it no further than its speed" );
+	Check( std::max( worstChangeDv[0], std::max( worstChangeDv[1], worstChangeDv[2] ) ) <= worstStepDv,
+		"velocity at a tier change no rougher than frame to frame" );
+	Check( perRest * 20. < perFull, "playback and drift 20x cheaper than full physics" );
+
+	// 5) No graph: the middle range drifts
+	FallLod plain;
+	plain.setSettings( ls );
+	for( uint32_t i = 0; i < batch.size( ); i++ )
+		plain.add( LeafParams( ) );
+	plain.classify( batch, eye, std::function<void( uint32_t, uint32_t )>( ) );
+	Check( plain.GetCount( FALL_PLAYBACK ) == 0 && plain.GetCount( FALL_DRIFT ) > 0, "without a graph, no playback" );
+
+	db.close( );
+	remove( DB );
+	return CheckResult( );
+}
+#endif
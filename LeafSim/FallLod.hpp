@@ -0,0 +1,123 @@
+#ifndef FALLLOD_HPP
+#define FALLLOD_HPP
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "LeafBatch3D.hpp"
+#include "MotionGraph.hpp"
+
+class TrajectoryIndex;
+class SnapshotWriter;
+class Snapshot;
+
+// How much simulation a falling leaf gets, by distance from the camera
+enum FallTier {
+    FALL_FULL     = 0,      // the 3D flutter model, LeafBatch3D::step()
+    FALL_PLAYBACK = 1,      // a motion graph walk in a vertical plane, drifting with the wind
+    FALL_DRIFT    = 2       // falling at its terminal speed with the wind, swaying
+};
+
+struct FallLodSettings {
+    float nearDistance;     // m: nearer than this, FALL_FULL
+    float farDistance;      // m: further than this, FALL_DRIFT
+    float hysteresis;       // fraction of a distance to go past it before changing tier
+    uint32_t maxFull;       // at most this many FALL_FULL leaves (the nearest)
+    float groundY;          // m: leaves this close
+    float groundMargin;     //    above the ground are FALL_FULL, to land properly
+    float blendTime;        // s: the velocity jump of a tier change fades over this
+    float driftSwayHz;      // FALL_DRIFT side to side
+    float driftRock;        // rad, and how far the leaf rocks with it
+
+    FallLodSettings();
+};
+
+// Level of detail for the falling leaves of a LeafBatch3D.
+//
+// classify() gives every leaf a tier from its distance to the camera, and
+// reorders the batch so the FALL_FULL leaves come first: the caller steps
+// only those (LeafBatch3D::step(dt, substeps, GetNumFull())) and advance()
+// moves the rest.  Either way the state lives in the batch, so collisions,
+// ground contact and drawing see every leaf alike.
+//
+// A leaf that changes tier starts the new one from its state in the batch,
+// so the position never jumps.  Velocity and spin are the new tier's from
+// then on, plus the difference there was at the change, fading out over
+// blendTime.  FALL_PLAYBACK picks the stored trajectory nearest the leaf's
+// motion in the vertical plane it is moving in (the index over the graph's
+// database) and walks the graph from there, turning the leaf about that
+// plane's normal as the clip's theta turns.  Without a graph it is
+// FALL_DRIFT.
+//
+// FALL_FULL costs FALL_SUBSTEPS RK4 steps a leaf, the other two a few dozen
+// flops, so with maxFull set the simulation cost stops growing with the
+// number of leaves.
+class FallLod {
+public:
+    FallLod();
+
+    void setSettings(const FallLodSettings& settings) { m_settings = settings; }
+    const FallLodSettings& GetSettings() const { return m_settings; }
+    // For FALL_PLAYBACK; both must outlive this (NULL: no playback)
+    void setMotionGraph(const MotionGraph* graph, const TrajectoryIndex* index);
+
+    // Mirror the batch: a leaf added at the end, LeafBatch3D::remove(i), and
+    // the order from LeafBatch3D::updateSleep()
+    void add(const LeafParams& params);
+    void remove(uint32_t i);
+    void reorder(const std::vector<uint32_t>& order);
+    void clear();
+
+    // Snapshots (Snapshot.hpp): each leaf's parameters.  After load() every
+    // leaf is as from add(): the next classify() picks its tier and sets it up
+    // from the batch, as for a tier change, so nothing jumps.  load() is false
+    // (and nothing changes) if the snapshot has none.
+    void save(SnapshotWriter& out) const;
+    bool load(const Snapshot& in);
+
+    // Tiers for eye (m), then FALL_FULL leaves first; sleeping leaves are
+    // left where they are.  Every swap of two
+    // leaves in the batch is passed to onSwap, for the caller's own per-leaf
+    // arrays.
+    void classify(LeafBatch3D& leaves, const float* eye,
+                  const std::function<void(uint32_t, uint32_t)>& onSwap);
+    // Move the awake leaves past GetNumFull() on by dt, in the wind the batch has
+    void advance(LeafBatch3D& leaves, float dt);
+
+    uint32_t GetNumFull() const { return m_numFull; }
+    FallTier GetTier(uint32_t i) const { return (FallTier)m_leaves[i].tier; }
+    // leaves per tier after the last classify()
+    uint32_t GetCount(FallTier tier) const { return m_counts[tier]; }
+
+private:
+    struct Leaf {
+        LeafParams params;
+        uint8_t tier;
+        bool entered;           // tier set up from the batch state
+        float time;             // s in this tier
+        float q0[4];            // orientation on entering
+        float dv[3];            // velocity difference on entering, fading out
+        float dw[3];            // and of the world angular velocity
+        // FALL_PLAYBACK
+        float dir[2];           // horizontal direction of the clip's x
+        float theta0;           // clip theta on entering
+        MotionCursor cursor;
+        // FALL_DRIFT
+        float fallSpeed;        // m/s
+        float swayDir[2];       // horizontal
+    };
+
+    FallTier pickTier(const Leaf& leaf, float distance, float y) const;
+    void enter(LeafBatch3D& leaves, uint32_t i, Leaf& leaf);
+    void tierVelocity(Leaf& leaf, float t, const float* wind, float* v, float* w, float* q) const;
+
+    FallLodSettings m_settings;
+    const MotionGraph* m_graph;
+    const TrajectoryIndex* m_index;
+    std::vector<Leaf> m_leaves;
+    std::vector<float> m_distance;      // classify() scratch
+    uint32_t m_numFull;
+    uint32_t m_counts[3];
+    uint32_t m_seed;
+};
+
+#endif // FALLLOD_HPP
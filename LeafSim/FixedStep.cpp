@@ -0,0 +1,150 @@
+// Self-test: make libleafsim.a && g++ -std=c++11 -DTEST -o fixedsteptest LeafSim/FixedStep.cpp -L. -lleafsim
+#include "FixedStep.hpp"
+#include "Snapshot.hpp"
+
+FixedStepClock::FixedStepClock(double stepSize, int maxStepsPerFrame)
+    : m_stepSize(stepSize > 0. ? stepSize : 1. / 60.)
+    , m_maxStepsPerFrame(maxStepsPerFrame > 0 ? maxStepsPerFrame : 1)
+{
+    reset();
+}
+
+void FixedStepClock::reset()
+{
+    m_accumulator = 0.;
+    m_steps = 0;
+    m_dropped = 0;
+}
+
+int FixedStepClock::advance(double frameSeconds)
+{
+    if (frameSeconds > 0.) {
+        m_accumulator += frameSeconds;
+    }
+
+    int steps = 0;
+    while (m_accumulator >= m_stepSize) {
+        m_accumulator -= m_stepSize;
+        if (steps < m_maxStepsPerFrame) {
+            steps++;
+        } else {
+            m_dropped++;
+        }
+    }
+    m_steps += steps;
+    return steps;
+}
+
+struct ClockSnapshot {
+    double stepSize;
+    double accumulator;
+    int64_t steps;
+    int64_t dropped;
+};
+
+void FixedStepClock::save(SnapshotWriter& out) const
+{
+    ClockSnapshot c = { m_stepSize, m_accumulator, m_steps, m_dropped };
+    out.addValue("clock", c);
+}
+
+bool FixedStepClock::load(const Snapshot& in)
+{
+    ClockSnapshot c;
+    if (!in.readValue("clock", &c) || c.stepSize != m_stepSize) {
+        return false;
+    }
+    m_accumulator = c.accumulator;
+    m_steps = c.steps;
+    m_dropped = c.dropped;
+    return true;
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include <math.h>
+#include "../SelfTest.hpp"
+
+// a toy sim: x' = v, v' = -x, stepped with semi-implicit Euler
+struct State
+{
+	double x, v;
+};
+
+static void
+Step( State &s, double dt )
+{
+	s.v -= s.x * dt;
+	s.x += s.v * dt;
+}
+
+// simulate 'seconds' of real time drawn at the given frame intervals
+static State
+Run( const double *frames, int numFrames, double seconds, long long *steps )
+{
+	FixedStepClock clock( 1. / 60., 5 );
+	State s = { 1., 0. };
+	double t = 0.;
+	for( int f = 0; t < seconds - 1.e-9; f++ )
+	{
+		double dt = frames[ f % numFrames ];
+		t += dt;
+		int n = clock.advance( dt );
+		for( int i = 0; i < n; i++ )
+			Step( s, clock.GetStepSize( ) );
+	}
+	*steps = clock.GetSteps( );
+	return s;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	// the same 2 seconds drawn at 144 Hz, 60 Hz, 30 Hz and with jittery frames:
+	const double fast[ ]   = { 1. / 144. };
+	const double even[ ]   = { 1. / 60. };
+	const double slow[ ]   = { 1. / 30. };
+	const double jitter[ ] = { 0.011, 0.023, 0.017, 0.009, 0.020 };
+	long long nFast, nEven, nSlow, nJitter;
+	State a = Run( fast, 1, 2.0, &nFast );
+	State b = Run( even, 1, 2.0, &nEven );
+	State c = Run( slow, 1, 2.0, &nSlow );
+	State d = Run( jitter, 5, 2.0, &nJitter );
+	fprintf( stderr, "steps: %lld %lld %lld %lld\n", nFast, nEven, nSlow, nJitter );
+
+	Check( llabs( nFast - 120 ) <= 1 && llabs( nEven - 120 ) <= 1 && llabs( nSlow - 120 ) <= 1, "2 s is 120 steps at any frame rate" );
+
+	// states after the same number of steps are identical, whatever the frame
+	// rate (the count itself can differ by one from rounding at the end):
+	FixedStepClock clock( 1. / 60. );
+	State states[121];
+	states[0].x = 1.;
+	states[0].v = 0.;
+	for( int i = 1; i <= 120; i++ )
+	{
+		states[i] = states[i-1];
+		Step( states[i], clock.GetStepSize( ) );
+	}
+	bool same = true;
+	const State *runs[4] = { &a, &b, &c, &d };
+	long long counts[4] = { nFast, nEven, nSlow, nJitter };
+	for( int r = 0; r < 4; r++ )
+		same = same && runs[r]->x == states[ counts[r] ].x && runs[r]->v == states[ counts[r] ].v;
+	Check( same, "frame timing does not change the states" );
+
+	// the leftover fraction is the interpolation factor:
+	clock.reset( );
+	Check( clock.advance( 1.5 / 60. ) == 1, "1.5 steps of time runs one step" );
+	Check( fabs( clock.GetAlpha( ) - 0.5 ) < 1.e-9, "and leaves alpha = 0.5" );
+	Check( clock.advance( 0.5 / 60. ) == 1 && clock.GetAlpha( ) < 1.e-9, "the rest completes the second step" );
+
+	// a long stall is clamped instead of spiralling:
+	clock.reset( );
+	Check( clock.advance( 1.0 ) == 5, "a 1 s stall runs at most 5 steps" );
+	Check( clock.GetDroppedSteps( ) >= 54 && clock.GetAlpha( ) < 1., "the rest is dropped" );
+
+	return CheckResult( );
+}
+#endif
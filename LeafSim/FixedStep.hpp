@@ -0,0 +1,44 @@
+#ifndef FIXEDSTEP_HPP
+#define FIXEDSTEP_HPP
+
+class SnapshotWriter;
+class Snapshot;
+
+// Fixed-timestep clock.  Real (variable) frame time goes in, a whole number of
+// simulation steps of exactly GetStepSize() seconds comes out, so the sim does
+// the same work and produces the same states no matter how fast frames are
+// drawn.  The fraction of a step left over is the blend factor between the
+// previous and the current sim state for rendering:
+//
+//     int steps = clock.advance(frameSeconds);
+//     for (int i = 0; i < steps; ++i) { prev = curr; step(curr, clock.GetStepSize()); }
+//     draw(interpolate(prev, curr, clock.GetAlpha()));
+class FixedStepClock {
+public:
+    // maxStepsPerFrame bounds the catch-up work after a long stall (e.g. the
+    // window being dragged); the time beyond it is dropped
+    explicit FixedStepClock(double stepSize = 1. / 60., int maxStepsPerFrame = 5);
+
+    void reset();
+    int advance(double frameSeconds);     // returns the number of steps to run
+
+    double GetStepSize() const { return m_stepSize; }
+    double GetAlpha() const { return m_accumulator / m_stepSize; }   // 0..1
+    double GetSimTime() const { return (double)m_steps * m_stepSize; }
+    long long GetSteps() const { return m_steps; }
+    long long GetDroppedSteps() const { return m_dropped; }
+
+    // Snapshots (Snapshot.hpp): steps taken and the time not yet simulated.
+    // load() is false (and the clock untouched) for another step size.
+    void save(SnapshotWriter& out) const;
+    bool load(const Snapshot& in);
+
+private:
+    double m_stepSize;
+    int m_maxStepsPerFrame;
+    double m_accumulator;       // real time not yet simulated, < m_stepSize
+    long long m_steps;
+    long long m_dropped;
+};
+
+#endif // FIXEDSTEP_HPP
@@ -0,0 +1,100 @@
+#include "Flutter3D.hpp"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+// |u x n| below this: flow straight onto the face, no lift direction
+static const double MIN_CROSS = 1.e-9;
+
+void Flutter3DDerivatives(const double* s, const FlutterParams& p, double rho, double g, double* ds,
+                          const double* wind)
+{
+    const double qw = s[3], qx = s[4], qy = s[5], qz = s[6];
+    const double wx = s[10], wy = s[11], wz = s[12];
+
+    // 1) Body axes in world space: t = body x, n = body y (normal), b = body z
+    double t[3] = { 1. - 2. * (qy * qy + qz * qz), 2. * (qx * qy + qw * qz), 2. * (qx * qz - qw * qy) };
+    double n[3] = { 2. * (qx * qy - qw * qz), 1. - 2. * (qx * qx + qz * qz), 2. * (qy * qz + qw * qx) };
+    double b[3] = { 2. * (qx * qz + qw * qy), 2. * (qy * qz - qw * qx), 1. - 2. * (qx * qx + qy * qy) };
+
+    double u[3] = { s[7], s[8], s[9] };
+    if (wind != NULL) {
+        u[0] -= wind[0];
+        u[1] -= wind[1];
+        u[2] -= wind[2];
+    }
+    double ut = u[0] * t[0] + u[1] * t[1] + u[2] * t[2];
+    double un = u[0] * n[0] + u[1] * n[1] + u[2] * n[2];
+    double ub = u[0] * b[0] + u[1] * b[1] + u[2] * b[2];
+
+    // 2) Linear: anisotropic drag, lift across u in the (u, n) plane, gravity
+    double c[3] = { u[1] * n[2] - u[2] * n[1], u[2] * n[0] - u[0] * n[2], u[0] * n[1] - u[1] * n[0] };
+    double e[3] = { c[1] * u[2] - c[2] * u[1], c[2] * u[0] - c[0] * u[2], c[0] * u[1] - c[1] * u[0] };
+    double cLen = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+    double lift = (cLen > MIN_CROSS) ? ((u[1] < 0.) ? -1. : 1.) * PI * rho * un / (cLen * p.mass) : 0.;
+    double dA = p.dragCoeffPerp - p.dragCoeffPara;
+
+    ds[7] = -p.dragCoeffPara * u[0] - dA * un * n[0] + lift * p.height * e[0];
+    ds[8] = -p.dragCoeffPara * u[1] - dA * un * n[1] + lift * p.width * e[1] - g;
+    ds[9] = -p.dragCoeffPara * u[2] - dA * un * n[2] + lift * p.height * e[2];
+
+    // 3) Angular, in body axes: broadside torque (n x u = (ub, 0, -ut) in body
+    //    axes), damping and the gyroscopic terms of a thin plate
+    double rotK = 3. * PI * rho * un;
+    double w2 = p.width * p.width, h2 = p.height * p.height;
+    double gyroY = (w2 - h2) / (w2 + h2);
+    ds[10] = rotK * ub - p.dragCoeffPerp * wx + wy * wz;
+    ds[11] = -p.dragCoeffPara * wy + gyroY * wz * wx;
+    ds[12] = -rotK * ut - p.dragCoeffPerp * wz - wx * wy;
+
+    // 4) Kinematics: p' = v, q' = q (0, w) / 2
+    ds[0] = s[7];
+    ds[1] = s[8];
+    ds[2] = s[9];
+    ds[3] = -0.5 * (qx * wx + qy * wy + qz * wz);
+    ds[4] = 0.5 * (qw * wx + qy * wz - qz * wy);
+    ds[5] = 0.5 * (qw * wy + qz * wx - qx * wz);
+    ds[6] = 0.5 * (qw * wz + qx * wy - qy * wx);
+}
+
+void Flutter3DRk4Step(double* s, const FlutterParams& p, double rho, double g, double dt,
+                      const double* wind)
+{
+    double k1[FLUTTER3D_DIM], k2[FLUTTER3D_DIM], k3[FLUTTER3D_DIM], k4[FLUTTER3D_DIM], tmp[FLUTTER3D_DIM];
+
+    Flutter3DDerivatives(s, p, rho, g, k1, wind);
+    for (int i = 0; i < FLUTTER3D_DIM; ++i) tmp[i] = s[i] + dt * k1[i] / 2.;
+    Flutter3DDerivatives(tmp, p, rho, g, k2, wind);
+    for (int i = 0; i < FLUTTER3D_DIM; ++i) tmp[i] = s[i] + dt * k2[i] / 2.;
+    Flutter3DDerivatives(tmp, p, rho, g, k3, wind);
+    for (int i = 0; i < FLUTTER3D_DIM; ++i) tmp[i] = s[i] + dt * k3[i];
+    Flutter3DDerivatives(tmp, p, rho, g, k4, wind);
+
+    for (int i = 0; i < FLUTTER3D_DIM; ++i) {
+        s[i] = s[i] + (dt / 6.) * (k1[i] + 2. * k2[i] + 2. * k3[i] + k4[i]);
+    }
+
+    // RK4 doesn't keep |q| = 1 by itself
+    double len = std::sqrt(s[3] * s[3] + s[4] * s[4] + s[5] * s[5] + s[6] * s[6]);
+    for (int i = 3; i < 7; ++i) {
+        s[i] /= len;
+    }
+}
+
+void Flutter3DFromPlanar(const double* planar, double* s)
+{
+    double half = 0.5 * planar[2];
+    s[0] = planar[0];
+    s[1] = planar[1];
+    s[2] = 0.;
+    s[3] = std::cos(half);
+    s[4] = 0.;
+    s[5] = 0.;
+    s[6] = std::sin(half);
+    s[7] = planar[3];
+    s[8] = planar[4];
+    s[9] = 0.;
+    s[10] = 0.;
+    s[11] = 0.;
+    s[12] = planar[5];
+}
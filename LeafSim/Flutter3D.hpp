@@ -0,0 +1,39 @@
+#ifndef FLUTTER3D_HPP
+#define FLUTTER3D_HPP
+#include <cstddef>
+#include "FlutterModel.hpp"
+
+// The flutter model (FlutterModel.hpp) for a rigid plate tumbling in 3D.
+//
+// State [px, py, pz, qw, qx, qy, qz, vx, vy, vz, wx, wy, wz]: position,
+// orientation quaternion (body to world), velocity, and angular velocity in
+// body axes.  The plate spans body x (width) and z (height); its normal n is
+// body y.  u = v - wind is the velocity relative to the air.
+//
+//   drag    -(Apara u + (Aperp - Apara) (u.n) n)          tensor Apara along the plate, Aperp across
+//   lift    s pi rho (u.n) S ((u x n) x u) / |u x n| / m   in the plane of u and n, across u;
+//                                                          s = sign(u_y), S = diag(height, width, height)
+//   gravity -g along y
+//
+//   spin    3 pi rho (u.n) (n x u)                         turns the plate broadside to the flow
+//           - diag(Aperp, Apara, Aperp) w                   damping; spinning in its own plane is cheap
+//           - I^-1 (w x I w)                                plate inertia, I ~ diag(h^2, w^2 + h^2, w^2)
+//
+// With the plate rotating about world z and moving in the xy plane this is
+// exactly the 2D model with theta the angle of body x from world x, so the
+// discontinuity and step-size caveats there apply here too.
+
+enum { FLUTTER3D_DIM = 13 };
+
+// ds = d/dt s; wind = air velocity [x, y, z] (NULL = still air)
+void Flutter3DDerivatives(const double* s, const FlutterParams& p, double rho, double g, double* ds,
+                          const double* wind = NULL);
+
+// One classic RK4 step, in place, renormalising the quaternion
+void Flutter3DRk4Step(double* s, const FlutterParams& p, double rho, double g, double dt,
+                      const double* wind = NULL);
+
+// The 3D state of a 2D one [x, y, theta, vx, vy, omega] (z = 0, spinning about z)
+void Flutter3DFromPlanar(const double* planar, double* s);
+
+#endif // FLUTTER3D_HPP
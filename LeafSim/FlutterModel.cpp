@@ -0,0 +1,64 @@
+#include "FlutterModel.hpp"
+#include <cmath>
+
+static const double PI = 3.14159265358979323846;
+
+void FlutterDerivatives(const double* s, const FlutterParams& p, double rho, double g, double* ds,
+                        const double* wind, double switchWidth)
+{
+    double theta = s[2];
+    double omega = s[5];
+    // the air forces only see the velocity relative to the air
+    double vx = s[3], vy = s[4];
+    if (wind != NULL) {
+        vx -= wind[0];
+        vy -= wind[1];
+    }
+
+    // the 1e-6 keeps V > 0, as in ComputeTrajectory.py
+    double V = std::sqrt(vx * vx + vy * vy) + 1.e-6;
+    double V2 = V * V;
+
+    double alpha = std::atan2(vx, vy);
+    double beta = alpha + theta;
+    double sinB = std::sin(beta), cosB = std::cos(beta);
+    double sinA = std::sin(alpha), cosA = std::cos(alpha);
+    double k;
+    if (switchWidth > 0.) {
+        k = std::tanh(cosA * sinB / switchWidth);      // cos(alpha) has the sign of vy
+    } else {
+        double signVy = (vy > 0.) ? 1. : (vy < 0.) ? -1. : 0.;
+        k = (signVy * sinB >= 0.) ? 1. : -1.;
+    }
+
+    double drag = k * PI * rho * p.height * V2 * cosB * cosA;
+    double lift = k * PI * rho * p.width * V2 * cosB * sinA;
+
+    double st = std::sin(theta), ct = std::cos(theta);
+    double sc = (p.dragCoeffPerp - p.dragCoeffPara) * st * ct;
+
+    ds[0] = s[3];
+    ds[1] = s[4];
+    ds[2] = omega;
+    ds[3] = -(p.dragCoeffPerp * st * st + p.dragCoeffPara * ct * ct) * vx + sc * vy - drag / p.mass;
+    ds[4] = -g - (p.dragCoeffPerp * ct * ct + p.dragCoeffPara * st * st) * vy + sc * vx + lift / p.mass;
+    ds[5] = -p.dragCoeffPerp * omega - 3. * PI * rho * V2 * cosB * sinB;
+}
+
+void FlutterRk4Step(double* s, const FlutterParams& p, double rho, double g, double dt,
+                    const double* wind)
+{
+    double k1[FLUTTER_DIM], k2[FLUTTER_DIM], k3[FLUTTER_DIM], k4[FLUTTER_DIM], tmp[FLUTTER_DIM];
+
+    FlutterDerivatives(s, p, rho, g, k1, wind);
+    for (int i = 0; i < FLUTTER_DIM; ++i) tmp[i] = s[i] + dt * k1[i] / 2.;
+    FlutterDerivatives(tmp, p, rho, g, k2, wind);
+    for (int i = 0; i < FLUTTER_DIM; ++i) tmp[i] = s[i] + dt * k2[i] / 2.;
+    FlutterDerivatives(tmp, p, rho, g, k3, wind);
+    for (int i = 0; i < FLUTTER_DIM; ++i) tmp[i] = s[i] + dt * k3[i];
+    FlutterDerivatives(tmp, p, rho, g, k4, wind);
+
+    for (int i = 0; i < FLUTTER_DIM; ++i) {
+        s[i] = s[i] + (dt / 6.) * (k1[i] + 2. * k2[i] + 2. * k3[i] + k4[i]);
+    }
+}
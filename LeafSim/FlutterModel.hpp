@@ -0,0 +1,59 @@
+#ifndef FLUTTERMODEL_HPP
+#define FLUTTERMODEL_HPP
+#include <cstddef>
+
+// The 2D falling-leaf (flutter) model, in one place for every user: the
+// scene, the trajectory generator and the integrator tests.  It is the model
+// ComputeTrajectory.py used to generate precomputed_trajectory_database.json:
+//
+//   alpha = atan2(vx, vy)            direction of travel
+//   beta  = alpha + theta            angle of attack
+//   k     = +1 if sign(vy) sin(beta) >= 0, else -1   (sign of the circulation)
+//
+//   drag  = k pi rho height V^2 cos(beta) cos(alpha)
+//   lift  = k pi rho width  V^2 cos(beta) sin(alpha)
+//
+//   vx' = -(Aperp sin^2 + Apara cos^2) vx + (Aperp - Apara) sin cos vy - drag / m
+//   vy' = -g - (Aperp cos^2 + Apara sin^2) vy + (Aperp - Apara) sin cos vx + lift / m
+//   w'  = -Aperp w - 3 pi rho V^2 cos(beta) sin(beta)
+//
+// (sin, cos of theta; A = dragCoeff).  State is [x, y, theta, vx, vy, omega].
+// In wind, every velocity above except x' = vx, y' = vy is the one relative to
+// the air, v - wind.
+//
+// k flips where the leaf's angle of attack crosses the direction of travel,
+// so the right-hand side is discontinuous there and the solution tends to
+// slide along that surface.  Adaptive integrators grind to a halt on it;
+// fixed-step RK4 is fine, but for the default leaf below about 1e-4 s per
+// step (at the 1e-2 s ComputeTrajectory.py used, most starts blow up).
+//
+// For adaptive steps the switch can be smoothed instead:
+// k = tanh(cos(alpha) sin(beta) / switchWidth), which is the sign above
+// once |cos(alpha) sin(beta)| is a few switchWidths.  At
+// FLUTTER_SWITCH_WIDTH a second of fall stays within a millimetre of the
+// sharp model.  Over longer falls the smoothing still shows: a leaf that
+// the sharp model holds sliding along the switch (hovering, barely
+// falling) drifts off it and falls on.
+
+struct FlutterParams {
+    double mass;            // kg
+    double width;           // m, lift cross-section
+    double height;          // m, drag cross-section
+    double dragCoeffPerp;
+    double dragCoeffPara;
+};
+
+enum { FLUTTER_DIM = 6 };
+
+static const double FLUTTER_SWITCH_WIDTH = 1.e-3;
+
+// ds = d/dt s; wind = air velocity [x, y] (NULL = still air); switchWidth > 0
+// smooths the switch in k (see above), 0 is the sharp model
+void FlutterDerivatives(const double* s, const FlutterParams& p, double rho, double g, double* ds,
+                        const double* wind = NULL, double switchWidth = 0.);
+
+// One classic RK4 step of the model, in place, with the wind held for the step
+void FlutterRk4Step(double* s, const FlutterParams& p, double rho, double g, double dt,
+                    const double* wind = NULL);
+
+#endif // FLUTTERMODEL_HPP
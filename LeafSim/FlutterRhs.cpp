@@ -0,0 +1,14 @@
+#include "FlutterRhs.hpp"
+
+FlutterRhs::FlutterRhs(const FlutterParams& params, double rho, double g, double switchWidth)
+    : m_params(params)
+    , m_rho(rho)
+    , m_g(g)
+    , m_switchWidth(switchWidth)
+{
+}
+
+void FlutterRhs::eval(double /*t*/, const double* y, double* dydt) const
+{
+    FlutterDerivatives(y, m_params, m_rho, m_g, dydt, NULL, m_switchWidth);
+}
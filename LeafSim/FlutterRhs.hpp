@@ -0,0 +1,24 @@
+#ifndef FLUTTERRHS_HPP
+#define FLUTTERRHS_HPP
+#include "OdeRhs.hpp"
+#include "FlutterModel.hpp"
+
+// The flutter model (FlutterModel.hpp) as an OdeRhs, state [x, y, theta, vx, vy, omega].
+// The switch in k is smoothed over switchWidth (see there), which is what
+// lets Dopri45 take big steps on it; 0 gives the sharp model, on which it
+// grinds to a halt.
+class FlutterRhs : public OdeRhs {
+public:
+    FlutterRhs(const FlutterParams& params, double rho = 1.225, double g = 9.81,
+               double switchWidth = FLUTTER_SWITCH_WIDTH);
+
+    int GetDimension() const { return FLUTTER_DIM; }
+    void eval(double t, const double* y, double* dydt) const;
+
+private:
+    FlutterParams m_params;
+    double m_rho, m_g;
+    double m_switchWidth;
+};
+
+#endif // FLUTTERRHS_HPP
@@ -0,0 +1,564 @@
+// Benchmark + check: g++ -std=c++11 -O2 -DBENCH -o leafbatchbench LeafSim/LeafBatch.cpp LeafSim/FlutterModel.cpp
+// Self-test (golden trajectories, must pass with any compiler and flags): g++ -std=c++11 -O2 -DTEST -o leafbatchtest LeafSim/LeafBatch.cpp LeafSim/FlutterModel.cpp
+#include "LeafBatch.hpp"
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <limits>
+
+// stepDeterministic() needs every float operation rounded on its own, to float
+#if defined(__FAST_MATH__)
+    #error "LeafBatch.cpp needs IEEE float math: build it without -ffast-math"
+#endif
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+    #error "LeafBatch.cpp needs float evaluated in float (SSE, not x87)"
+#endif
+#if defined(__clang__)
+    #pragma clang fp contract(off)
+#elif defined(__GNUC__)
+    #pragma GCC optimize("fp-contract=off")
+#endif
+#include "SimdMath.hpp"         // after the pragmas, so SinCos1() is under them too
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define LEAFBATCH_X86 1
+    #include <immintrin.h>
+#endif
+
+// added to |V| as in FlutterDerivatives()
+static const float MIN_V = 1.e-6f;
+static const float PI = 3.14159265f;
+
+LeafBatch::LeafBatch(float rho, float g)
+    : m_rho(rho)
+    , m_g(g)
+    , m_rotK(3.f * PI * rho)
+{
+}
+
+void LeafBatch::reserve(uint32_t n)
+{
+    std::vector<float>* arrays[] = { &m_x, &m_y, &m_theta, &m_vx, &m_vy, &m_omega,
+                                     &m_windX, &m_windY, &m_perp, &m_para, &m_liftK, &m_dragK };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        arrays[a]->reserve(n);
+    }
+}
+
+void LeafBatch::clear()
+{
+    std::vector<float>* arrays[] = { &m_x, &m_y, &m_theta, &m_vx, &m_vy, &m_omega,
+                                     &m_windX, &m_windY, &m_perp, &m_para, &m_liftK, &m_dragK };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        arrays[a]->clear();
+    }
+}
+
+uint32_t LeafBatch::add(const LeafState& state, const LeafParams& params)
+{
+    m_x.push_back(state.x);
+    m_y.push_back(state.y);
+    m_theta.push_back(state.theta);
+    m_vx.push_back(state.vx);
+    m_vy.push_back(state.vy);
+    m_omega.push_back(state.omega);
+    m_windX.push_back(0.f);
+    m_windY.push_back(0.f);
+
+    m_perp.push_back(params.dragCoeffPerp);
+    m_para.push_back(params.dragCoeffPara);
+    m_liftK.push_back(PI * m_rho * params.width / params.mass);
+    m_dragK.push_back(PI * m_rho * params.height / params.mass);
+    return size() - 1;
+}
+
+void LeafBatch::remove(uint32_t i)
+{
+    std::vector<float>* arrays[] = { &m_x, &m_y, &m_theta, &m_vx, &m_vy, &m_omega,
+                                     &m_windX, &m_windY, &m_perp, &m_para, &m_liftK, &m_dragK };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        std::vector<float>& v = *arrays[a];
+        v[i] = v.back();
+        v.pop_back();
+    }
+}
+
+LeafState LeafBatch::GetState(uint32_t i) const
+{
+    LeafState s;
+    s.x = m_x[i];
+    s.y = m_y[i];
+    s.theta = m_theta[i];
+    s.vx = m_vx[i];
+    s.vy = m_vy[i];
+    s.omega = m_omega[i];
+    return s;
+}
+
+void LeafBatch::SetState(uint32_t i, const LeafState& state)
+{
+    m_x[i] = state.x;
+    m_y[i] = state.y;
+    m_theta[i] = state.theta;
+    m_vx[i] = state.vx;
+    m_vy[i] = state.vy;
+    m_omega[i] = state.omega;
+}
+
+void LeafBatch::SetWind(uint32_t i, float wx, float wy)
+{
+    m_windX[i] = wx;
+    m_windY[i] = wy;
+}
+
+// -------------------------------------
+// Scalar path
+// -------------------------------------
+
+// FlutterDerivatives() for the velocity part (the position part is just the
+// velocity).  sin and cos of alpha = atan2(vx, vy) are vx / |v| and vy / |v|,
+// and those of beta = alpha + theta follow from the angle sum, so the only
+// trig call is sin/cos of theta.  vx, vy are relative to the air.
+static inline void Accel(float theta, float vx, float vy, float omega,
+                         float perp, float para, float liftK, float dragK, float rotK, float g,
+                         bool deterministic, float& ax, float& ay, float& aw)
+{
+    float st, ct;
+    if (deterministic) {
+        SinCos1(theta, &st, &ct);
+    } else {
+        st = std::sin(theta);
+        ct = std::cos(theta);
+    }
+    float r = std::sqrt(vx * vx + vy * vy);
+    float V = r + MIN_V;
+    float V2 = V * V;
+
+    float sa = 0.f, ca = 1.f;           // atan2(0, 0) = 0
+    if (r > 0.f) {
+        sa = vx / r;
+        ca = vy / r;
+    }
+    float sb = sa * ct + ca * st;
+    float cb = ca * ct - sa * st;
+    float kV2cb = (vy * sb >= 0.f) ? V2 * cb : -V2 * cb;
+
+    float sc = (perp - para) * st * ct;
+    ax = -(perp * st * st + para * ct * ct) * vx + sc * vy - dragK * kV2cb * ca;
+    ay = -g - (perp * ct * ct + para * st * st) * vy + sc * vx + liftK * kV2cb * sa;
+    aw = -perp * omega - rotK * V2 * cb * sb;
+}
+
+void LeafBatch::stepRange(uint32_t begin, uint32_t end, float dt, bool deterministic)
+{
+    const float h = 0.5f * dt;
+    const float sixth = dt / 6.f;
+    for (uint32_t i = begin; i < end; ++i) {
+        float perp = m_perp[i], para = m_para[i], liftK = m_liftK[i], dragK = m_dragK[i], rotK = m_rotK;
+        float th = m_theta[i], vx = m_vx[i], vy = m_vy[i], w = m_omega[i];
+        float wx = m_windX[i], wy = m_windY[i];
+
+        // 1) k1 at the start, k2 and k3 at the midpoint, k4 at the end
+        float ax1, ay1, aw1;
+        Accel(th, vx - wx, vy - wy, w, perp, para, liftK, dragK, rotK, m_g, deterministic, ax1, ay1, aw1);
+
+        float th2 = th + h * w, vx2 = vx + h * ax1, vy2 = vy + h * ay1, w2 = w + h * aw1;
+        float ax2, ay2, aw2;
+        Accel(th2, vx2 - wx, vy2 - wy, w2, perp, para, liftK, dragK, rotK, m_g, deterministic, ax2, ay2, aw2);
+
+        float th3 = th + h * w2, vx3 = vx + h * ax2, vy3 = vy + h * ay2, w3 = w + h * aw2;
+        float ax3, ay3, aw3;
+        Accel(th3, vx3 - wx, vy3 - wy, w3, perp, para, liftK, dragK, rotK, m_g, deterministic, ax3, ay3, aw3);
+
+        float th4 = th + dt * w3, vx4 = vx + dt * ax3, vy4 = vy + dt * ay3, w4 = w + dt * aw3;
+        float ax4, ay4, aw4;
+        Accel(th4, vx4 - wx, vy4 - wy, w4, perp, para, liftK, dragK, rotK, m_g, deterministic, ax4, ay4, aw4);
+
+        // 2) Weighted sum
+        m_x[i]     += sixth * (vx + 2.f * vx2 + 2.f * vx3 + vx4);
+        m_y[i]     += sixth * (vy + 2.f * vy2 + 2.f * vy3 + vy4);
+        m_theta[i] += sixth * (w + 2.f * w2 + 2.f * w3 + w4);
+        m_vx[i]    += sixth * (ax1 + 2.f * ax2 + 2.f * ax3 + ax4);
+        m_vy[i]    += sixth * (ay1 + 2.f * ay2 + 2.f * ay3 + ay4);
+        m_omega[i] += sixth * (aw1 + 2.f * aw2 + 2.f * aw3 + aw4);
+    }
+}
+
+void LeafBatch::stepScalar(float dt)
+{
+    stepRange(0, size(), dt, false);
+}
+
+void LeafBatch::stepDeterministic(float dt)
+{
+    stepRange(0, size(), dt, true);
+}
+
+// -------------------------------------
+// AVX2 path
+// -------------------------------------
+#ifdef LEAFBATCH_X86
+
+bool LeafBatch::HasAvx2()
+{
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+}
+
+#define AVX2_FN __attribute__((target("avx2,fma"))) static inline
+
+struct Consts8 {
+    __m256 perp, para, liftK, dragK, rotK, g;
+};
+
+AVX2_FN void Accel8(__m256 theta, __m256 vx, __m256 vy, __m256 omega, const Consts8& k,
+                    __m256* ax, __m256* ay, __m256* aw)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    __m256 st, ct;
+    SinCos8(theta, &st, &ct);
+
+    // |v| and 1 / |v| from one approximate reciprocal square root instead of a
+    // sqrt and a divide; lanes with |v| == 0 get r = 0 and alpha = 0
+    __m256 r2 = _mm256_fmadd_ps(vx, vx, _mm256_mul_ps(vy, vy));
+    __m256 moving = _mm256_cmp_ps(r2, zero, _CMP_GT_OQ);
+    __m256 invR = _mm256_and_ps(moving, InvSqrt8(r2));
+    __m256 r = _mm256_mul_ps(r2, invR);
+    __m256 V = _mm256_add_ps(r, _mm256_set1_ps(MIN_V));
+    __m256 V2 = _mm256_mul_ps(V, V);
+
+    // sin, cos of alpha
+    __m256 sa = _mm256_mul_ps(vx, invR);
+    __m256 ca = _mm256_blendv_ps(one, _mm256_mul_ps(vy, invR), moving);
+    __m256 sb = _mm256_fmadd_ps(sa, ct, _mm256_mul_ps(ca, st));
+    __m256 cb = _mm256_fmsub_ps(ca, ct, _mm256_mul_ps(sa, st));
+
+    // k V^2 cos(beta): flip the sign where vy sin(beta) < 0
+    __m256 flip = _mm256_and_ps(_mm256_cmp_ps(_mm256_mul_ps(vy, sb), zero, _CMP_LT_OQ), _mm256_set1_ps(-0.f));
+    __m256 kV2cb = _mm256_xor_ps(_mm256_mul_ps(V2, cb), flip);
+
+    __m256 s2 = _mm256_mul_ps(st, st), c2 = _mm256_mul_ps(ct, ct);
+    __m256 sc = _mm256_mul_ps(_mm256_sub_ps(k.perp, k.para), _mm256_mul_ps(st, ct));
+
+    __m256 x = _mm256_fmadd_ps(sc, vy, _mm256_mul_ps(_mm256_fmadd_ps(k.perp, s2, _mm256_mul_ps(k.para, c2)),
+                                                     _mm256_sub_ps(zero, vx)));
+    *ax = _mm256_fnmadd_ps(_mm256_mul_ps(k.dragK, kV2cb), ca, x);
+
+    __m256 y = _mm256_fmadd_ps(sc, vx, _mm256_mul_ps(_mm256_fmadd_ps(k.perp, c2, _mm256_mul_ps(k.para, s2)),
+                                                     _mm256_sub_ps(zero, vy)));
+    y = _mm256_fmadd_ps(_mm256_mul_ps(k.liftK, kV2cb), sa, y);
+    *ay = _mm256_sub_ps(y, k.g);
+
+    *aw = _mm256_fnmadd_ps(_mm256_mul_ps(k.rotK, V2), _mm256_mul_ps(cb, sb), _mm256_mul_ps(_mm256_sub_ps(zero, k.perp), omega));
+}
+
+// a + 2b + 2c + d
+AVX2_FN __m256 Rk4Sum(__m256 a, __m256 b, __m256 c, __m256 d)
+{
+    return _mm256_fmadd_ps(_mm256_set1_ps(2.f), _mm256_add_ps(b, c), _mm256_add_ps(a, d));
+}
+
+__attribute__((target("avx2,fma")))
+void LeafBatch::stepAvx2(float dt)
+{
+    const __m256 h = _mm256_set1_ps(0.5f * dt);
+    const __m256 full = _mm256_set1_ps(dt);
+    const __m256 sixth = _mm256_set1_ps(dt / 6.f);
+    uint32_t blocks = size() / 8;
+
+    for (uint32_t b = 0; b < blocks; ++b) {
+        uint32_t i = b * 8;
+        Consts8 k;
+        k.perp  = _mm256_loadu_ps(&m_perp[i]);
+        k.para  = _mm256_loadu_ps(&m_para[i]);
+        k.liftK = _mm256_loadu_ps(&m_liftK[i]);
+        k.dragK = _mm256_loadu_ps(&m_dragK[i]);
+        k.rotK  = _mm256_set1_ps(m_rotK);
+        k.g     = _mm256_set1_ps(m_g);
+
+        __m256 th = _mm256_loadu_ps(&m_theta[i]);
+        __m256 vx = _mm256_loadu_ps(&m_vx[i]);
+        __m256 vy = _mm256_loadu_ps(&m_vy[i]);
+        __m256 w  = _mm256_loadu_ps(&m_omega[i]);
+        __m256 wx = _mm256_loadu_ps(&m_windX[i]);
+        __m256 wy = _mm256_loadu_ps(&m_windY[i]);
+
+        // 1) The four stages, all in registers
+        __m256 ax1, ay1, aw1;
+        Accel8(th, _mm256_sub_ps(vx, wx), _mm256_sub_ps(vy, wy), w, k, &ax1, &ay1, &aw1);
+
+        __m256 vx2 = _mm256_fmadd_ps(h, ax1, vx), vy2 = _mm256_fmadd_ps(h, ay1, vy);
+        __m256 w2 = _mm256_fmadd_ps(h, aw1, w);
+        __m256 ax2, ay2, aw2;
+        Accel8(_mm256_fmadd_ps(h, w, th), _mm256_sub_ps(vx2, wx), _mm256_sub_ps(vy2, wy), w2, k, &ax2, &ay2, &aw2);
+
+        __m256 vx3 = _mm256_fmadd_ps(h, ax2, vx), vy3 = _mm256_fmadd_ps(h, ay2, vy);
+        __m256 w3 = _mm256_fmadd_ps(h, aw2, w);
+        __m256 ax3, ay3, aw3;
+        Accel8(_mm256_fmadd_ps(h, w2, th), _mm256_sub_ps(vx3, wx), _mm256_sub_ps(vy3, wy), w3, k, &ax3, &ay3, &aw3);
+
+        __m256 vx4 = _mm256_fmadd_ps(full, ax3, vx), vy4 = _mm256_fmadd_ps(full, ay3, vy);
+        __m256 w4 = _mm256_fmadd_ps(full, aw3, w);
+        __m256 ax4, ay4, aw4;
+        Accel8(_mm256_fmadd_ps(full, w3, th), _mm256_sub_ps(vx4, wx), _mm256_sub_ps(vy4, wy), w4, k, &ax4, &ay4, &aw4);
+
+        // 2) Weighted sums
+        _mm256_storeu_ps(&m_x[i], _mm256_fmadd_ps(sixth, Rk4Sum(vx, vx2, vx3, vx4), _mm256_loadu_ps(&m_x[i])));
+        _mm256_storeu_ps(&m_y[i], _mm256_fmadd_ps(sixth, Rk4Sum(vy, vy2, vy3, vy4), _mm256_loadu_ps(&m_y[i])));
+        _mm256_storeu_ps(&m_theta[i], _mm256_fmadd_ps(sixth, Rk4Sum(w, w2, w3, w4), th));
+        _mm256_storeu_ps(&m_vx[i], _mm256_fmadd_ps(sixth, Rk4Sum(ax1, ax2, ax3, ax4), vx));
+        _mm256_storeu_ps(&m_vy[i], _mm256_fmadd_ps(sixth, Rk4Sum(ay1, ay2, ay3, ay4), vy));
+        _mm256_storeu_ps(&m_omega[i], _mm256_fmadd_ps(sixth, Rk4Sum(aw1, aw2, aw3, aw4), w));
+    }
+}
+
+void LeafBatch::step(float dt)
+{
+    uint32_t done = 0;
+    if (HasAvx2()) {
+        stepAvx2(dt);
+        done = size() / 8 * 8;
+    }
+    stepRange(done, size(), dt, false);     // the tail (or everything)
+}
+
+#else
+
+bool LeafBatch::HasAvx2()
+{
+    return false;
+}
+
+void LeafBatch::step(float dt)
+{
+    stepRange(0, size(), dt, false);
+}
+
+#endif // LEAFBATCH_X86
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include "FlutterModel.hpp"
+#include "../SelfTest.hpp"
+
+// the library model one leaf at a time, in double, as the baseline:
+static FlutterParams
+ToDouble( const LeafParams &p )
+{
+	FlutterParams d = { p.mass, p.width, p.height, p.dragCoeffPerp, p.dragCoeffPara };
+	return d;
+}
+
+static double
+Ms( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const uint32_t N = 100003;		// not a multiple of 8: exercises the tail
+	const int STEPS = 100;
+	const float DT = 1.e-4f;		// the model needs small steps (see FlutterModel.hpp)
+	std::mt19937 rng( 7 );
+	std::uniform_real_distribution<float> u( 0.f, 1.f );
+
+	// random leaves around the ComputeTrajectory.py defaults:
+	std::vector<LeafParams> params( N );
+	std::vector<double> ref( 6 * N ), wind( 2 * N );
+	LeafBatch simd, scalar;
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		LeafParams p = { 0.005f + 0.01f*u(rng), 0.05f + 0.1f*u(rng), 0.05f + 0.1f*u(rng), 2.f + 3.f*u(rng), 0.5f + u(rng) };
+		LeafState s = { 0.f, 0.f, 6.f*u(rng) - 3.f, u(rng) - 0.5f, -u(rng), 2.f*u(rng) - 1.f };
+		params[i] = p;
+		double r[6] = { s.x, s.y, s.theta, s.vx, s.vy, s.omega };
+		std::copy( r, r + 6, &ref[6*i] );
+		simd.add( s, p );
+		scalar.add( s, p );
+
+		// a breeze of up to 1 m/s, held for the whole run
+		float wx = 2.f*u(rng) - 1.f, wy = 0.2f*u(rng) - 0.1f;
+		wind[2*i] = wx;
+		wind[2*i+1] = wy;
+		simd.SetWind( i, wx, wy );
+		scalar.SetWind( i, wx, wy );
+	}
+
+	fprintf( stderr, "AVX2 + FMA: %s\n", LeafBatch::HasAvx2( ) ? "yes" : "no (scalar fallback)" );
+
+	auto t0 = std::chrono::high_resolution_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		for( uint32_t i = 0; i < N; i++ )
+			FlutterRk4Step( &ref[6*i], ToDouble( params[i] ), 1.225, 9.81, DT, &wind[2*i] );
+	double refMs = Ms( t0 );
+
+	t0 = std::chrono::high_resolution_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		scalar.stepScalar( DT );
+	double scalarMs = Ms( t0 );
+
+	t0 = std::chrono::high_resolution_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		simd.step( DT );
+	double simdMs = Ms( t0 );
+
+	// float batch vs double reference, relative to the distance travelled
+	double maxErrScalar = 0., maxErrSimd = 0.;
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		double rx = ref[6*i], ry = ref[6*i+1];
+		double scale = std::max( 1.e-3, std::sqrt( rx*rx + ry*ry ) );
+		LeafState a = scalar.GetState( i );
+		LeafState b = simd.GetState( i );
+		maxErrScalar = std::max( maxErrScalar, std::max( fabs( a.x - rx ), fabs( a.y - ry ) ) / scale );
+		maxErrSimd   = std::max( maxErrSimd,   std::max( fabs( b.x - rx ), fabs( b.y - ry ) ) / scale );
+	}
+
+	double leafSteps = (double)N * STEPS;
+	fprintf( stderr, "%u leaves x %d RK4 steps:\n", N, STEPS );
+	fprintf( stderr, "  one leaf at a time (double)  %8.1f ms  %6.1f ns/leaf-step\n", refMs, 1.e6 * refMs / leafSteps );
+	fprintf( stderr, "  SoA scalar (float)           %8.1f ms  %6.1f ns/leaf-step  rel. err %.1e\n", scalarMs, 1.e6 * scalarMs / leafSteps, maxErrScalar );
+	fprintf( stderr, "  SoA step() (float)           %8.1f ms  %6.1f ns/leaf-step  rel. err %.1e\n", simdMs, 1.e6 * simdMs / leafSteps, maxErrSimd );
+
+	Check( maxErrScalar < 1.e-3 && maxErrSimd < 1.e-3, "batch follows the reference" );
+	return CheckResult( );
+}
+#endif
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include <cstring>
+#include "FlutterModel.hpp"
+#include "../SelfTest.hpp"
+
+// the golden trajectories: FNV-1a of the state bits, every GOLDEN_EVERY steps
+static const uint32_t GOLDEN_HASH = 0x4e866e01u;
+static const int GOLDEN_STEPS = 20000, GOLDEN_EVERY = 1000;
+
+static void
+Hash( uint32_t *h, const float *values, uint32_t n )
+{
+	for( uint32_t i = 0; i < n; i++ )
+	{
+		uint32_t bits;
+		memcpy( &bits, &values[i], 4 );
+		for( int b = 0; b < 4; b++ )
+		{
+			*h ^= ( bits >> ( 8 * b ) ) & 0xff;
+			*h *= 16777619u;
+		}
+	}
+}
+
+// five leaves, from a flat drop to a fast spin, two of them in a breeze
+static const LeafParams Params[5] =
+{
+	{ 0.01f,  0.1f,  0.1f,  4.1f, 0.9f },
+	{ 0.005f, 0.08f, 0.06f, 3.f,  0.6f },
+	{ 0.015f, 0.12f, 0.1f,  4.5f, 1.2f },
+	{ 0.008f, 0.05f, 0.12f, 2.5f, 0.8f },
+	{ 0.012f, 0.1f,  0.07f, 3.5f, 1.f  },
+};
+static const LeafState Starts[5] =
+{
+	{ 0.f, 0.f,  0.1f,  0.f,  -1.f,  0.f },
+	{ 0.f, 0.f,  0.3f,  0.5f, -1.f,  0.f },
+	{ 0.f, 0.f, -1.2f, -0.2f, -0.5f, 2.f },
+	{ 0.f, 0.f,  2.5f,  0.f,  -0.5f, -2.f },
+	{ 1.f, 2.f,  0.7f,  0.1f, -2.f,  1.f },
+};
+static const float Winds[5][2] = { { 0.f, 0.f }, { 0.5f, 0.f }, { 0.f, 0.f }, { -0.3f, 0.1f }, { 0.f, 0.f } };
+
+int
+main( int argc, char *argv[ ] )
+{
+	const float DT = 1.e-4f;
+
+	// 1) The golden trajectories
+	LeafBatch batch;
+	for( int l = 0; l < 5; l++ )
+	{
+		batch.add( Starts[l], Params[l] );
+		batch.SetWind( l, Winds[l][0], Winds[l][1] );
+	}
+	uint32_t hash = 2166136261u;
+	for( int k = 1; k <= GOLDEN_STEPS; k++ )
+	{
+		batch.stepDeterministic( DT );
+		if( k % GOLDEN_EVERY == 0 )
+		{
+			const float *arrays[6] = { batch.GetX( ), batch.GetY( ), batch.GetTheta( ), batch.GetVx( ), batch.GetVy( ), batch.GetOmega( ) };
+			for( int a = 0; a < 6; a++ )
+				Hash( &hash, arrays[a], batch.size( ) );
+		}
+	}
+	bool finite = true;
+	for( int l = 0; l < 5; l++ )
+	{
+		LeafState s = batch.GetState( l );
+		finite = finite && std::isfinite( s.x ) && std::isfinite( s.y ) && std::isfinite( s.omega );
+	}
+	Check( finite, "golden leaves stay finite" );
+	LeafState end = batch.GetState( 0 );
+	fprintf( stderr, "golden hash %08x (expected %08x); leaf 0 at %a %a after %g s\n",
+		hash, GOLDEN_HASH, end.x, end.y, GOLDEN_STEPS * DT );
+	Check( hash == GOLDEN_HASH, "golden trajectories reproduced bit for bit" );
+
+	// 2) A leaf's path doesn't depend on its slot or its neighbours
+	LeafBatch shuffled;
+	for( int pad = 0; pad < 3; pad++ )
+		shuffled.add( Starts[pad], Params[4 - pad] );
+	for( int l = 4; l >= 0; l-- )
+	{
+		uint32_t i = shuffled.add( Starts[l], Params[l] );
+		shuffled.SetWind( i, Winds[l][0], Winds[l][1] );
+	}
+	for( int k = 1; k <= GOLDEN_STEPS; k++ )
+		shuffled.stepDeterministic( DT );
+	bool same = true;
+	for( int l = 0; l < 5; l++ )
+	{
+		LeafState a = batch.GetState( l ), b = shuffled.GetState( 3 + 4 - l );
+		same = same && memcmp( &a, &b, sizeof( a ) ) == 0;
+	}
+	Check( same, "same paths in another order, among other leaves" );
+
+	// 3) Still the model: close to the double reference over the first
+	// 0.1 s (further on the two drift apart, the way any two integrations do)
+	LeafBatch fresh;
+	for( int l = 0; l < 5; l++ )
+	{
+		fresh.add( Starts[l], Params[l] );
+		fresh.SetWind( l, Winds[l][0], Winds[l][1] );
+	}
+	for( int k = 0; k < GOLDEN_EVERY; k++ )
+		fresh.stepDeterministic( DT );
+	double worstRel = 0.;
+	for( int l = 0; l < 5; l++ )
+	{
+		const LeafState &s0 = Starts[l];
+		const LeafParams &p = Params[l];
+		double ref[6] = { s0.x, s0.y, s0.theta, s0.vx, s0.vy, s0.omega };
+		double wind[2] = { Winds[l][0], Winds[l][1] };
+		FlutterParams fp = { p.mass, p.width, p.height, p.dragCoeffPerp, p.dragCoeffPara };
+		for( int k = 0; k < GOLDEN_EVERY; k++ )
+			FlutterRk4Step( ref, fp, 1.225, 9.81, DT, wind );
+		LeafState b = fresh.GetState( l );
+		double dist = std::max( 1.e-3, std::hypot( ref[0] - s0.x, ref[1] - s0.y ) );
+		worstRel = std::max( worstRel, std::max( std::fabs( b.x - ref[0] ), std::fabs( b.y - ref[1] ) ) / dist );
+	}
+	fprintf( stderr, "against the double model: rel. err %.1e\n", worstRel );
+	Check( worstRel < 1.e-3, "deterministic float path follows the double model" );
+
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,88 @@
+#ifndef LEAFBATCH_HPP
+#define LEAFBATCH_HPP
+#include <vector>
+#include <cstdint>
+
+// Per-leaf physical parameters (FlutterParams in float)
+struct LeafParams {
+    float mass;             // kg
+    float width;            // m, lift cross-section
+    float height;           // m, drag cross-section
+    float dragCoeffPerp;
+    float dragCoeffPara;
+};
+
+// 2D flutter state [x, y, theta, vx, vy, omega]
+struct LeafState {
+    float x, y, theta;
+    float vx, vy, omega;
+};
+
+// Many falling leaves in structure-of-arrays form, advanced together with one
+// RK4 step of the flutter model (FlutterModel.hpp) per call.
+//
+// The per-leaf constants the model needs are folded once at add() time
+// (pi * rho * width / mass, ...), so a derivative evaluation is a few dozen
+// multiply-adds plus one sqrt, one divide and one sin/cos pair per leaf.  step() runs
+// eight leaves at a time with AVX2 + FMA when the CPU has them (checked at
+// run time, no special compiler flags needed) and a plain loop otherwise.
+//
+// stepDeterministic() is for replays that have to match bit for bit: the
+// plain loop in float32 with a fixed order of operations, no FMA contraction
+// and sin/cos of its own instead of the platform's.  A leaf's path then
+// depends only on its own state, parameters and wind, not on the compiler,
+// the optimisation level, the CPU or where in the batch it is.
+//
+// Each leaf also has the air velocity around it (zero after add()), which the
+// caller refreshes from the wind field before step(); the air forces use the
+// velocity relative to it.
+class LeafBatch {
+public:
+    LeafBatch(float rho = 1.225f, float g = 9.81f);
+
+    void reserve(uint32_t n);
+    void clear();
+    uint32_t add(const LeafState& state, const LeafParams& params);    // returns the index
+    void remove(uint32_t i);        // moves the last leaf into slot i
+
+    uint32_t size() const { return (uint32_t)m_x.size(); }
+    LeafState GetState(uint32_t i) const;
+    void SetState(uint32_t i, const LeafState& state);
+    void SetWind(uint32_t i, float wx, float wy);
+    // writable wind arrays, to fill all leaves at once
+    float* GetWindX() { return m_windX.data(); }
+    float* GetWindY() { return m_windY.data(); }
+
+    void step(float dt);            // best available path
+    void stepScalar(float dt);      // always the plain loop (reference / tests)
+    void stepDeterministic(float dt);   // the same results everywhere (see above)
+    static bool HasAvx2();
+
+    // read-only state arrays, e.g. for drawing
+    const float* GetX() const { return m_x.data(); }
+    const float* GetY() const { return m_y.data(); }
+    const float* GetTheta() const { return m_theta.data(); }
+    const float* GetVx() const { return m_vx.data(); }
+    const float* GetVy() const { return m_vy.data(); }
+    const float* GetOmega() const { return m_omega.data(); }
+
+private:
+    void stepRange(uint32_t begin, uint32_t end, float dt, bool deterministic);
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    void stepAvx2(float dt);        // returns after the last full block of 8
+#endif
+
+    float m_rho, m_g;
+    float m_rotK;                   // 3 * pi * rho
+
+    // state
+    std::vector<float> m_x, m_y, m_theta, m_vx, m_vy, m_omega;
+    std::vector<float> m_windX, m_windY;
+    // folded parameters
+    std::vector<float> m_perp;      // dragCoeffPerp
+    std::vector<float> m_para;      // dragCoeffPara
+    std::vector<float> m_liftK;     // pi * rho * width / mass
+    std::vector<float> m_dragK;     // pi * rho * height / mass
+};
+
+#endif // LEAFBATCH_HPP
@@ -0,0 +1,997 @@
+// Benchmark + check: make libjobs.a && g++ -std=c++11 -O2 -DBENCH -o leafbatch3dbench LeafSim/LeafBatch3D.cpp LeafSim/Flutter3D.cpp LeafSim/FlutterModel.cpp LeafSim/Snapshot.cpp LeafSim/MappedFile.cpp -L. -ljobs -pthread
+#include "LeafBatch3D.hpp"
+#include "Snapshot.hpp"
+#include <cmath>
+#include <algorithm>
+#include <functional>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define LEAFBATCH3D_X86 1
+    #include <immintrin.h>
+#endif
+
+// |u x n| below this: no lift direction, as in Flutter3DDerivatives()
+static const float MIN_CROSS = 1.e-9f;
+static const float PI = 3.14159265f;
+// leaves per job in step(): a multiple of 8, and small enough to stay in L1
+static const uint32_t LEAVES_PER_JOB = 256;
+// leaves per block of updateSleep()'s compaction
+static const uint32_t COMPACT_BLOCK = 4096;
+
+GroundContact::GroundContact()
+    : groundY(0.f)
+    , restitution(0.2f)
+    , friction(4.f)
+    , spinDamping(6.f)
+    , flatten(8.f)
+    , settleSpeed(0.05f)
+    , settleSpin(0.5f)
+    , settleTime(0.25f)
+    , maxContactTime(3.f)
+{
+}
+
+LeafSleep::LeafSleep()
+    : sleepSpeed(0.1f)
+    , sleepSpin(1.f)
+    , sleepTime(0.5f)
+    , wakeGust(1.5f)
+{
+}
+
+LeafBatch3D::LeafBatch3D(float rho, float g)
+    : m_jobs(NULL)
+    , m_rho(rho)
+    , m_g(g)
+    , m_rotK(3.f * PI * rho)
+    , m_numAwake(0)
+{
+}
+
+void LeafBatch3D::reserve(uint32_t n)
+{
+    std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                     &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                     &m_windX, &m_windY, &m_windZ,
+                                     &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                     &m_still, &m_sleepWind };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        arrays[a]->reserve(n);
+    }
+    m_asleep.reserve(n);
+}
+
+void LeafBatch3D::clear()
+{
+    std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                     &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                     &m_windX, &m_windY, &m_windZ,
+                                     &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                     &m_still, &m_sleepWind };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        arrays[a]->clear();
+    }
+    m_asleep.clear();
+    m_numAwake = 0;
+}
+
+uint32_t LeafBatch3D::add(const LeafState3D& state, const LeafParams& params)
+{
+    bool allAwake = m_numAwake == size();
+    m_px.push_back(0.f);
+    m_py.push_back(0.f);
+    m_pz.push_back(0.f);
+    m_qw.push_back(1.f);
+    m_qx.push_back(0.f);
+    m_qy.push_back(0.f);
+    m_qz.push_back(0.f);
+    m_vx.push_back(0.f);
+    m_vy.push_back(0.f);
+    m_vz.push_back(0.f);
+    m_wx.push_back(0.f);
+    m_wy.push_back(0.f);
+    m_wz.push_back(0.f);
+    m_windX.push_back(0.f);
+    m_windY.push_back(0.f);
+    m_windZ.push_back(0.f);
+    SetState(size() - 1, state);
+
+    float w2 = params.width * params.width, h2 = params.height * params.height;
+    m_perp.push_back(params.dragCoeffPerp);
+    m_para.push_back(params.dragCoeffPara);
+    m_liftK.push_back(PI * m_rho * params.width / params.mass);
+    m_dragK.push_back(PI * m_rho * params.height / params.mass);
+    m_gyroY.push_back((w2 - h2) / (w2 + h2));
+    m_radius.push_back(0.5f * std::max(params.width, params.height));
+    m_contact.push_back(0.f);
+    m_still.push_back(0.f);
+    m_sleepWind.push_back(0.f);
+    m_asleep.push_back(0);
+    if (allAwake) {
+        m_numAwake = size();
+    }
+    return size() - 1;
+}
+
+void LeafBatch3D::remove(uint32_t i)
+{
+    std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                     &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                     &m_windX, &m_windY, &m_windZ,
+                                     &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                     &m_still, &m_sleepWind };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        std::vector<float>& v = *arrays[a];
+        v[i] = v.back();
+        v.pop_back();
+    }
+    m_asleep[i] = m_asleep.back();
+    m_asleep.pop_back();
+    m_numAwake = std::min(m_numAwake, size());
+}
+
+void LeafBatch3D::swap(uint32_t i, uint32_t j)
+{
+    std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                     &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                     &m_windX, &m_windY, &m_windZ,
+                                     &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                     &m_still, &m_sleepWind };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        std::swap((*arrays[a])[i], (*arrays[a])[j]);
+    }
+    std::swap(m_asleep[i], m_asleep[j]);
+}
+
+void LeafBatch3D::updateSleep(const LeafSleep& sleep, float dt, std::vector<uint32_t>* order)
+{
+    uint32_t n = size();
+    order->clear();
+
+    // 1) Who sleeps now
+    float speed2 = sleep.sleepSpeed * sleep.sleepSpeed, spin2 = sleep.sleepSpin * sleep.sleepSpin;
+    uint32_t awake = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        float wind = std::sqrt(m_windX[i] * m_windX[i] + m_windY[i] * m_windY[i] + m_windZ[i] * m_windZ[i]);
+        if (m_asleep[i]) {
+            if (wind > m_sleepWind[i] + sleep.wakeGust) {
+                wake(i);
+            }
+        } else {
+            float v2 = m_vx[i] * m_vx[i] + m_vy[i] * m_vy[i] + m_vz[i] * m_vz[i];
+            float w2 = m_wx[i] * m_wx[i] + m_wy[i] * m_wy[i] + m_wz[i] * m_wz[i];
+            bool slow = v2 < speed2 && w2 < spin2;
+            m_still[i] = slow ? m_still[i] + dt : 0.f;
+            if (slow && m_still[i] >= sleep.sleepTime) {
+                m_asleep[i] = 1;
+                m_sleepWind[i] = wind;
+                m_vx[i] = m_vy[i] = m_vz[i] = 0.f;
+                m_wx[i] = m_wy[i] = m_wz[i] = 0.f;
+            }
+        }
+        awake += !m_asleep[i];
+    }
+
+    // 2) Still awake first?
+    uint32_t misplaced = 0;
+    for (uint32_t i = 0; i < awake; ++i) {
+        misplaced += m_asleep[i];
+    }
+    m_numAwake = awake;
+    if (misplaced == 0) {
+        return;
+    }
+
+    // 3) Stream compaction: count the awake leaves of every block, scan the
+    //    counts into where each block writes its awake and its sleeping
+    //    leaves, then every block scatters its indices
+    uint32_t blocks = (n + COMPACT_BLOCK - 1) / COMPACT_BLOCK;
+    auto eachBlock = [this, blocks](const std::function<void(uint32_t)>& f) {
+        if (m_jobs == NULL || blocks == 1) {
+            for (uint32_t b = 0; b < blocks; ++b) {
+                f(b);
+            }
+            return;
+        }
+        m_jobs->parallelFor(0, blocks, 1, [&f](uint32_t begin, uint32_t end) {
+            for (uint32_t b = begin; b < end; ++b) {
+                f(b);
+            }
+        });
+    };
+    m_blockCount.assign(blocks, 0u);
+    eachBlock([this, n](uint32_t b) {
+        uint32_t end = std::min(n, (b + 1) * COMPACT_BLOCK), count = 0;
+        for (uint32_t i = b * COMPACT_BLOCK; i < end; ++i) {
+            count += !m_asleep[i];
+        }
+        m_blockCount[b] = count;
+    });
+    uint32_t sum = 0;
+    for (uint32_t b = 0; b < blocks; ++b) {
+        uint32_t count = m_blockCount[b];
+        m_blockCount[b] = sum;      // awake leaves before the block
+        sum += count;
+    }
+    order->resize(n);
+    uint32_t* dst = order->data();
+    eachBlock([this, n, awake, dst](uint32_t b) {
+        uint32_t begin = b * COMPACT_BLOCK, end = std::min(n, begin + COMPACT_BLOCK);
+        uint32_t up = m_blockCount[b], down = awake + begin - m_blockCount[b];
+        for (uint32_t i = begin; i < end; ++i) {
+            dst[m_asleep[i] ? down++ : up++] = i;
+        }
+    });
+
+    // 4) Every array into the new order
+    std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                     &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                     &m_windX, &m_windY, &m_windZ,
+                                     &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                     &m_still, &m_sleepWind };
+    m_gather.resize(n);
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        const float* from = arrays[a]->data();
+        float* to = m_gather.data();
+        eachBlock([n, from, to, dst](uint32_t b) {
+            uint32_t end = std::min(n, (b + 1) * COMPACT_BLOCK);
+            for (uint32_t i = b * COMPACT_BLOCK; i < end; ++i) {
+                to[i] = from[dst[i]];
+            }
+        });
+        arrays[a]->swap(m_gather);
+    }
+    std::fill(m_asleep.begin(), m_asleep.begin() + awake, (uint8_t)0);
+    std::fill(m_asleep.begin() + awake, m_asleep.end(), (uint8_t)1);
+}
+
+LeafState3D LeafBatch3D::GetState(uint32_t i) const
+{
+    LeafState3D s;
+    s.px = m_px[i];
+    s.py = m_py[i];
+    s.pz = m_pz[i];
+    s.qw = m_qw[i];
+    s.qx = m_qx[i];
+    s.qy = m_qy[i];
+    s.qz = m_qz[i];
+    s.vx = m_vx[i];
+    s.vy = m_vy[i];
+    s.vz = m_vz[i];
+    s.wx = m_wx[i];
+    s.wy = m_wy[i];
+    s.wz = m_wz[i];
+    return s;
+}
+
+void LeafBatch3D::SetState(uint32_t i, const LeafState3D& state)
+{
+    m_px[i] = state.px;
+    m_py[i] = state.py;
+    m_pz[i] = state.pz;
+    m_qw[i] = state.qw;
+    m_qx[i] = state.qx;
+    m_qy[i] = state.qy;
+    m_qz[i] = state.qz;
+    m_vx[i] = state.vx;
+    m_vy[i] = state.vy;
+    m_vz[i] = state.vz;
+    m_wx[i] = state.wx;
+    m_wy[i] = state.wy;
+    m_wz[i] = state.wz;
+}
+
+void LeafBatch3D::SetWind(uint32_t i, float wx, float wy, float wz)
+{
+    m_windX[i] = wx;
+    m_windY[i] = wy;
+    m_windZ[i] = wz;
+}
+
+LeafArrays3D LeafBatch3D::GetArrays()
+{
+    LeafArrays3D a = {
+        m_px.data(), m_py.data(), m_pz.data(),
+        m_qw.data(), m_qx.data(), m_qy.data(), m_qz.data(),
+        m_vx.data(), m_vy.data(), m_vz.data(),
+        m_wx.data(), m_wy.data(), m_wz.data(),
+        m_radius.data(),
+        m_asleep.data()
+    };
+    return a;
+}
+
+// -------------------------------------
+// Snapshots
+// -------------------------------------
+// chunk tags of the float arrays, in the order of the arrays[] lists
+static const char* const ARRAY_TAGS[] = { "lb.px", "lb.py", "lb.pz", "lb.qw", "lb.qx", "lb.qy", "lb.qz",
+                                          "lb.vx", "lb.vy", "lb.vz", "lb.wx", "lb.wy", "lb.wz",
+                                          "lb.windX", "lb.windY", "lb.windZ",
+                                          "lb.perp", "lb.para", "lb.liftK", "lb.dragK", "lb.gyroY", "lb.radius", "lb.contact",
+                                          "lb.still", "lb.sleepWind" };
+
+struct LeafBatchSnapshot {
+    uint32_t count;
+    uint32_t numAwake;
+    float rho, g;
+};
+
+void LeafBatch3D::save(SnapshotWriter& out) const
+{
+    const std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                           &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                           &m_windX, &m_windY, &m_windZ,
+                                           &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                           &m_still, &m_sleepWind };
+    LeafBatchSnapshot meta = { size(), m_numAwake, m_rho, m_g };
+    out.addValue("lb.meta", meta);
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); ++a) {
+        out.add(ARRAY_TAGS[a], *arrays[a]);
+    }
+    out.add("lb.asleep", m_asleep);
+}
+
+bool LeafBatch3D::load(const Snapshot& in)
+{
+    std::vector<float>* arrays[] = { &m_px, &m_py, &m_pz, &m_qw, &m_qx, &m_qy, &m_qz,
+                                     &m_vx, &m_vy, &m_vz, &m_wx, &m_wy, &m_wz,
+                                     &m_windX, &m_windY, &m_windZ,
+                                     &m_perp, &m_para, &m_liftK, &m_dragK, &m_gyroY, &m_radius, &m_contact,
+                                     &m_still, &m_sleepWind };
+    const size_t numArrays = sizeof(arrays) / sizeof(arrays[0]);
+
+    // 1) Everything there, and one value per leaf, before the batch changes
+    LeafBatchSnapshot meta;
+    if (!in.readValue("lb.meta", &meta) || meta.numAwake > meta.count) {
+        return false;
+    }
+    const float* from[numArrays];
+    uint64_t bytes = 0;
+    for (size_t a = 0; a < numArrays; ++a) {
+        from[a] = (const float*)in.find(ARRAY_TAGS[a], &bytes);
+        if (from[a] == NULL || bytes != (uint64_t)meta.count * sizeof(float)) {
+            return false;
+        }
+    }
+    const uint8_t* asleep = (const uint8_t*)in.find("lb.asleep", &bytes);
+    if (asleep == NULL || bytes != meta.count) {
+        return false;
+    }
+
+    // 2) Copy
+    for (size_t a = 0; a < numArrays; ++a) {
+        arrays[a]->assign(from[a], from[a] + meta.count);
+    }
+    m_asleep.assign(asleep, asleep + meta.count);
+    m_numAwake = meta.numAwake;
+    m_rho = meta.rho;
+    m_g = meta.g;
+    m_rotK = 3.f * PI * m_rho;
+    return true;
+}
+
+void LeafBatch3D::GetTransform(uint32_t i, float unitsPerMeter, float* m) const
+{
+    float qw = m_qw[i], qx = m_qx[i], qy = m_qy[i], qz = m_qz[i];
+    // body x, y, z in world space
+    m[0] = 1.f - 2.f * (qy * qy + qz * qz);
+    m[1] = 2.f * (qx * qy + qw * qz);
+    m[2] = 2.f * (qx * qz - qw * qy);
+    m[4] = 2.f * (qx * qy - qw * qz);
+    m[5] = 1.f - 2.f * (qx * qx + qz * qz);
+    m[6] = 2.f * (qy * qz + qw * qx);
+    m[8] = 2.f * (qx * qz + qw * qy);
+    m[9] = 2.f * (qy * qz - qw * qx);
+    m[10] = 1.f - 2.f * (qx * qx + qy * qy);
+    m[3] = m[7] = m[11] = 0.f;
+    m[12] = unitsPerMeter * m_px[i];
+    m[13] = unitsPerMeter * m_py[i];
+    m[14] = unitsPerMeter * m_pz[i];
+    m[15] = 1.f;
+}
+
+void LeafBatch3D::collideGround(const GroundContact& contact, float dt, std::vector<uint32_t>* settled)
+{
+    const float slide = std::exp(-contact.friction * dt);
+    const float spin = std::exp(-contact.spinDamping * dt);
+    const float tip = 1.f - std::exp(-contact.flatten * dt);
+    for (uint32_t i = 0; i < m_numAwake; ++i) {
+        // 1) The lowest point of a disc with normal n reaches r sqrt(1 - n_y^2) below the centre
+        float qw = m_qw[i], qx = m_qx[i], qy = m_qy[i], qz = m_qz[i];
+        float n[3] = { 2.f * (qx * qy - qw * qz), 1.f - 2.f * (qx * qx + qz * qz), 2.f * (qy * qz + qw * qx) };
+        float reach = m_radius[i] * std::sqrt(std::max(0.f, 1.f - n[1] * n[1]));
+        if (m_py[i] - reach > contact.groundY) {
+            m_contact[i] = 0.f;
+            continue;
+        }
+
+        // 2) Back onto the ground; bounce a little, slide and spin less
+        m_py[i] = contact.groundY + reach;
+        if (m_vy[i] < 0.f) {
+            m_vy[i] = -contact.restitution * m_vy[i];
+        }
+        m_vx[i] *= slide;
+        m_vz[i] *= slide;
+        m_wx[i] *= spin;
+        m_wy[i] *= spin;
+        m_wz[i] *= spin;
+
+        // 3) Tip part of the way towards the nearer of face up / face down:
+        //    rotate about n x (0, +-1, 0)
+        float up = (n[1] >= 0.f) ? 1.f : -1.f;
+        float axis[3] = { -n[2] * up, 0.f, n[0] * up };
+        float s = std::sqrt(axis[0] * axis[0] + axis[2] * axis[2]);
+        if (s > 1.e-6f) {
+            float half = 0.5f * tip * std::atan2(s, std::fabs(n[1]));
+            float k = std::sin(half) / s;
+            float rw = std::cos(half), rx = k * axis[0], rz = k * axis[2];
+            // r q, with r = (rw, rx, 0, rz)
+            m_qw[i] = rw * qw - rx * qx - rz * qz;
+            m_qx[i] = rw * qx + rx * qw - rz * qy;
+            m_qy[i] = rw * qy + rz * qx - rx * qz;
+            m_qz[i] = rw * qz + rx * qy + rz * qw;
+        }
+
+        // 4) At rest?
+        m_contact[i] += dt;
+        float v2 = m_vx[i] * m_vx[i] + m_vy[i] * m_vy[i] + m_vz[i] * m_vz[i];
+        float w2 = m_wx[i] * m_wx[i] + m_wy[i] * m_wy[i] + m_wz[i] * m_wz[i];
+        bool still = v2 < contact.settleSpeed * contact.settleSpeed && w2 < contact.settleSpin * contact.settleSpin;
+        if ((still && m_contact[i] >= contact.settleTime) || m_contact[i] >= contact.maxContactTime) {
+            settled->push_back(i);
+        }
+    }
+}
+
+// -------------------------------------
+// Scalar path
+// -------------------------------------
+
+struct Consts {
+    float perp, para, liftK, dragK, gyroY, rotK, g;
+};
+
+// Flutter3DDerivatives() for everything but the position (which is just the
+// velocity): q' (4), v' (3) and w' (3).  u is relative to the air.
+static inline void Deriv(const float* q, const float* u, const float* w, const Consts& k,
+                         float* dq, float* a, float* dw)
+{
+    float qw = q[0], qx = q[1], qy = q[2], qz = q[3];
+
+    // 1) Body axes
+    float t[3] = { 1.f - 2.f * (qy * qy + qz * qz), 2.f * (qx * qy + qw * qz), 2.f * (qx * qz - qw * qy) };
+    float n[3] = { 2.f * (qx * qy - qw * qz), 1.f - 2.f * (qx * qx + qz * qz), 2.f * (qy * qz + qw * qx) };
+    float b[3] = { 2.f * (qx * qz + qw * qy), 2.f * (qy * qz - qw * qx), 1.f - 2.f * (qx * qx + qy * qy) };
+    float ut = u[0] * t[0] + u[1] * t[1] + u[2] * t[2];
+    float un = u[0] * n[0] + u[1] * n[1] + u[2] * n[2];
+    float ub = u[0] * b[0] + u[1] * b[1] + u[2] * b[2];
+
+    // 2) Linear
+    float c[3] = { u[1] * n[2] - u[2] * n[1], u[2] * n[0] - u[0] * n[2], u[0] * n[1] - u[1] * n[0] };
+    float e[3] = { c[1] * u[2] - c[2] * u[1], c[2] * u[0] - c[0] * u[2], c[0] * u[1] - c[1] * u[0] };
+    float cLen = std::sqrt(c[0] * c[0] + c[1] * c[1] + c[2] * c[2]);
+    float f = (cLen > MIN_CROSS) ? ((u[1] < 0.f) ? -un : un) / cLen : 0.f;
+    float dA = k.perp - k.para;
+
+    a[0] = -k.para * u[0] - dA * un * n[0] + k.dragK * f * e[0];
+    a[1] = -k.para * u[1] - dA * un * n[1] + k.liftK * f * e[1] - k.g;
+    a[2] = -k.para * u[2] - dA * un * n[2] + k.dragK * f * e[2];
+
+    // 3) Angular, body axes
+    float rot = k.rotK * un;
+    dw[0] = rot * ub - k.perp * w[0] + w[1] * w[2];
+    dw[1] = -k.para * w[1] + k.gyroY * w[2] * w[0];
+    dw[2] = -rot * ut - k.perp * w[2] - w[0] * w[1];
+
+    // 4) q' = q (0, w) / 2
+    dq[0] = -0.5f * (qx * w[0] + qy * w[1] + qz * w[2]);
+    dq[1] = 0.5f * (qw * w[0] + qy * w[2] - qz * w[1]);
+    dq[2] = 0.5f * (qw * w[1] + qz * w[0] - qx * w[2]);
+    dq[3] = 0.5f * (qw * w[2] + qx * w[1] - qy * w[0]);
+}
+
+void LeafBatch3D::stepRange(uint32_t begin, uint32_t end, float dt)
+{
+    const float sixth = dt / 6.f;
+    for (uint32_t i = begin; i < end; ++i) {
+        Consts k = { m_perp[i], m_para[i], m_liftK[i], m_dragK[i], m_gyroY[i], m_rotK, m_g };
+        float wind[3] = { m_windX[i], m_windY[i], m_windZ[i] };
+
+        // 1) Four stages; stage s is evaluated at x + step[s] * (previous slope)
+        const float step[4] = { 0.f, 0.5f * dt, 0.5f * dt, dt };
+        float q0[4] = { m_qw[i], m_qx[i], m_qy[i], m_qz[i] };
+        float v0[3] = { m_vx[i], m_vy[i], m_vz[i] };
+        float w0[3] = { m_wx[i], m_wy[i], m_wz[i] };
+        float dq[4] = { 0.f, 0.f, 0.f, 0.f }, a[3] = { 0.f, 0.f, 0.f }, dw[3] = { 0.f, 0.f, 0.f };
+        float sumQ[4] = { 0.f, 0.f, 0.f, 0.f }, sumV[3] = { 0.f, 0.f, 0.f };
+        float sumA[3] = { 0.f, 0.f, 0.f }, sumW[3] = { 0.f, 0.f, 0.f };
+
+        for (int s = 0; s < 4; ++s) {
+            float q[4], v[3], u[3], w[3];
+            for (int j = 0; j < 4; ++j) q[j] = q0[j] + step[s] * dq[j];
+            for (int j = 0; j < 3; ++j) {
+                v[j] = v0[j] + step[s] * a[j];
+                u[j] = v[j] - wind[j];
+                w[j] = w0[j] + step[s] * dw[j];
+            }
+            Deriv(q, u, w, k, dq, a, dw);
+
+            float weight = (s == 0 || s == 3) ? 1.f : 2.f;
+            for (int j = 0; j < 4; ++j) sumQ[j] += weight * dq[j];
+            for (int j = 0; j < 3; ++j) {
+                sumV[j] += weight * v[j];
+                sumA[j] += weight * a[j];
+                sumW[j] += weight * dw[j];
+            }
+        }
+
+        // 2) Weighted sums, then back onto |q| = 1
+        m_px[i] += sixth * sumV[0];
+        m_py[i] += sixth * sumV[1];
+        m_pz[i] += sixth * sumV[2];
+        m_vx[i] = v0[0] + sixth * sumA[0];
+        m_vy[i] = v0[1] + sixth * sumA[1];
+        m_vz[i] = v0[2] + sixth * sumA[2];
+        m_wx[i] = w0[0] + sixth * sumW[0];
+        m_wy[i] = w0[1] + sixth * sumW[1];
+        m_wz[i] = w0[2] + sixth * sumW[2];
+
+        float q[4];
+        for (int j = 0; j < 4; ++j) q[j] = q0[j] + sixth * sumQ[j];
+        float inv = 1.f / std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+        m_qw[i] = q[0] * inv;
+        m_qx[i] = q[1] * inv;
+        m_qy[i] = q[2] * inv;
+        m_qz[i] = q[3] * inv;
+    }
+}
+
+void LeafBatch3D::stepScalar(float dt)
+{
+    stepRange(0, size(), dt);
+}
+
+void LeafBatch3D::step(float dt, int substeps)
+{
+    step(dt, substeps, size());
+}
+
+void LeafBatch3D::step(float dt, int substeps, uint32_t count)
+{
+    count = std::min(count, m_numAwake);
+    auto run = [this, dt, substeps](uint32_t begin, uint32_t end) {
+        for (int k = 0; k < substeps; ++k) {
+            stepBlock(begin, end, dt);
+        }
+    };
+    if (m_jobs == NULL || count <= LEAVES_PER_JOB) {
+        run(0, count);
+        return;
+    }
+    m_jobs->parallelFor(0, count, LEAVES_PER_JOB, run);
+}
+
+// -------------------------------------
+// AVX2 path
+// -------------------------------------
+#ifdef LEAFBATCH3D_X86
+
+bool LeafBatch3D::HasAvx2()
+{
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+}
+
+#define AVX2_FN __attribute__((target("avx2,fma"))) static inline
+
+struct Consts8 {
+    __m256 perp, para, liftK, dragK, gyroY, rotK, g;
+};
+
+// a.b of two 3-vectors of lanes
+AVX2_FN __m256 Dot8(const __m256* a, const __m256* b)
+{
+    return _mm256_fmadd_ps(a[0], b[0], _mm256_fmadd_ps(a[1], b[1], _mm256_mul_ps(a[2], b[2])));
+}
+
+// a x b
+AVX2_FN void Cross8(const __m256* a, const __m256* b, __m256* c)
+{
+    c[0] = _mm256_fmsub_ps(a[1], b[2], _mm256_mul_ps(a[2], b[1]));
+    c[1] = _mm256_fmsub_ps(a[2], b[0], _mm256_mul_ps(a[0], b[2]));
+    c[2] = _mm256_fmsub_ps(a[0], b[1], _mm256_mul_ps(a[1], b[0]));
+}
+
+// Deriv() for eight leaves
+AVX2_FN void Deriv8(const __m256* q, const __m256* u, const __m256* w, const Consts8& k,
+                    __m256* dq, __m256* a, __m256* dw)
+{
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 two = _mm256_set1_ps(2.f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    __m256 qw = q[0], qx = q[1], qy = q[2], qz = q[3];
+
+    // 1) Body axes
+    __m256 xx = _mm256_mul_ps(qx, qx), yy = _mm256_mul_ps(qy, qy), zz = _mm256_mul_ps(qz, qz);
+    __m256 xy = _mm256_mul_ps(qx, qy), xz = _mm256_mul_ps(qx, qz), yz = _mm256_mul_ps(qy, qz);
+    __m256 wx = _mm256_mul_ps(qw, qx), wy = _mm256_mul_ps(qw, qy), wz = _mm256_mul_ps(qw, qz);
+    __m256 t[3] = { _mm256_fnmadd_ps(two, _mm256_add_ps(yy, zz), one),
+                    _mm256_mul_ps(two, _mm256_add_ps(xy, wz)),
+                    _mm256_mul_ps(two, _mm256_sub_ps(xz, wy)) };
+    __m256 n[3] = { _mm256_mul_ps(two, _mm256_sub_ps(xy, wz)),
+                    _mm256_fnmadd_ps(two, _mm256_add_ps(xx, zz), one),
+                    _mm256_mul_ps(two, _mm256_add_ps(yz, wx)) };
+    __m256 b[3] = { _mm256_mul_ps(two, _mm256_add_ps(xz, wy)),
+                    _mm256_mul_ps(two, _mm256_sub_ps(yz, wx)),
+                    _mm256_fnmadd_ps(two, _mm256_add_ps(xx, yy), one) };
+    __m256 ut = Dot8(u, t), un = Dot8(u, n), ub = Dot8(u, b);
+
+    // 2) Linear; lanes with |u x n| <= MIN_CROSS get no lift
+    __m256 c[3], e[3];
+    Cross8(u, n, c);
+    Cross8(c, u, e);
+    __m256 cLen = _mm256_sqrt_ps(Dot8(c, c));
+    __m256 valid = _mm256_cmp_ps(cLen, _mm256_set1_ps(MIN_CROSS), _CMP_GT_OQ);
+    __m256 flip = _mm256_and_ps(_mm256_cmp_ps(u[1], zero, _CMP_LT_OQ), _mm256_set1_ps(-0.f));
+    __m256 f = _mm256_and_ps(valid, _mm256_div_ps(_mm256_xor_ps(un, flip), cLen));
+    __m256 dAun = _mm256_mul_ps(_mm256_sub_ps(k.perp, k.para), un);
+    __m256 fDrag = _mm256_mul_ps(k.dragK, f), fLift = _mm256_mul_ps(k.liftK, f);
+
+    a[0] = _mm256_fmadd_ps(fDrag, e[0], _mm256_fnmadd_ps(dAun, n[0], _mm256_mul_ps(_mm256_sub_ps(zero, k.para), u[0])));
+    a[1] = _mm256_fmadd_ps(fLift, e[1], _mm256_fnmadd_ps(dAun, n[1], _mm256_mul_ps(_mm256_sub_ps(zero, k.para), u[1])));
+    a[1] = _mm256_sub_ps(a[1], k.g);
+    a[2] = _mm256_fmadd_ps(fDrag, e[2], _mm256_fnmadd_ps(dAun, n[2], _mm256_mul_ps(_mm256_sub_ps(zero, k.para), u[2])));
+
+    // 3) Angular, body axes
+    __m256 rot = _mm256_mul_ps(k.rotK, un);
+    dw[0] = _mm256_fmadd_ps(w[1], w[2], _mm256_fnmadd_ps(k.perp, w[0], _mm256_mul_ps(rot, ub)));
+    dw[1] = _mm256_fmadd_ps(_mm256_mul_ps(k.gyroY, w[2]), w[0], _mm256_mul_ps(_mm256_sub_ps(zero, k.para), w[1]));
+    dw[2] = _mm256_fnmadd_ps(w[0], w[1], _mm256_fnmadd_ps(k.perp, w[2], _mm256_mul_ps(_mm256_sub_ps(zero, rot), ut)));
+
+    // 4) q' = q (0, w) / 2
+    dq[0] = _mm256_mul_ps(half, _mm256_sub_ps(zero, Dot8(q + 1, w)));
+    dq[1] = _mm256_mul_ps(half, _mm256_fmadd_ps(qw, w[0], _mm256_fmsub_ps(qy, w[2], _mm256_mul_ps(qz, w[1]))));
+    dq[2] = _mm256_mul_ps(half, _mm256_fmadd_ps(qw, w[1], _mm256_fmsub_ps(qz, w[0], _mm256_mul_ps(qx, w[2]))));
+    dq[3] = _mm256_mul_ps(half, _mm256_fmadd_ps(qw, w[2], _mm256_fmsub_ps(qx, w[1], _mm256_mul_ps(qy, w[0]))));
+}
+
+__attribute__((target("avx2,fma")))
+void LeafBatch3D::stepAvx2(uint32_t begin, uint32_t end, float dt)
+{
+    const __m256 sixth = _mm256_set1_ps(dt / 6.f);
+    const __m256 two = _mm256_set1_ps(2.f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 step[4] = { _mm256_setzero_ps(), _mm256_set1_ps(0.5f * dt), _mm256_set1_ps(0.5f * dt),
+                             _mm256_set1_ps(dt) };
+    float* qArrays[4] = { m_qw.data(), m_qx.data(), m_qy.data(), m_qz.data() };
+    float* pArrays[3] = { m_px.data(), m_py.data(), m_pz.data() };
+    float* vArrays[3] = { m_vx.data(), m_vy.data(), m_vz.data() };
+    float* wArrays[3] = { m_wx.data(), m_wy.data(), m_wz.data() };
+    float* windArrays[3] = { m_windX.data(), m_windY.data(), m_windZ.data() };
+    uint32_t blocks = (end - begin) / 8;
+
+    for (uint32_t blk = 0; blk < blocks; ++blk) {
+        uint32_t i = begin + blk * 8;
+        Consts8 k;
+        k.perp  = _mm256_loadu_ps(&m_perp[i]);
+        k.para  = _mm256_loadu_ps(&m_para[i]);
+        k.liftK = _mm256_loadu_ps(&m_liftK[i]);
+        k.dragK = _mm256_loadu_ps(&m_dragK[i]);
+        k.gyroY = _mm256_loadu_ps(&m_gyroY[i]);
+        k.rotK  = _mm256_set1_ps(m_rotK);
+        k.g     = _mm256_set1_ps(m_g);
+
+        __m256 q0[4], v0[3], w0[3], wind[3];
+        for (int j = 0; j < 4; ++j) q0[j] = _mm256_loadu_ps(qArrays[j] + i);
+        for (int j = 0; j < 3; ++j) {
+            v0[j] = _mm256_loadu_ps(vArrays[j] + i);
+            w0[j] = _mm256_loadu_ps(wArrays[j] + i);
+            wind[j] = _mm256_loadu_ps(windArrays[j] + i);
+        }
+
+        // 1) The four stages, all in registers (as far as 16 of them go)
+        __m256 dq[4], a[3], dw[3];
+        __m256 sumQ[4], sumV[3], sumA[3], sumW[3];
+        for (int s = 0; s < 4; ++s) {
+            __m256 q[4], v[3], u[3], w[3];
+            if (s == 0) {
+                for (int j = 0; j < 4; ++j) q[j] = q0[j];
+                for (int j = 0; j < 3; ++j) {
+                    v[j] = v0[j];
+                    w[j] = w0[j];
+                }
+            } else {
+                for (int j = 0; j < 4; ++j) q[j] = _mm256_fmadd_ps(step[s], dq[j], q0[j]);
+                for (int j = 0; j < 3; ++j) {
+                    v[j] = _mm256_fmadd_ps(step[s], a[j], v0[j]);
+                    w[j] = _mm256_fmadd_ps(step[s], dw[j], w0[j]);
+                }
+            }
+            for (int j = 0; j < 3; ++j) u[j] = _mm256_sub_ps(v[j], wind[j]);
+            Deriv8(q, u, w, k, dq, a, dw);
+
+            if (s == 0) {
+                for (int j = 0; j < 4; ++j) sumQ[j] = dq[j];
+                for (int j = 0; j < 3; ++j) {
+                    sumV[j] = v[j];
+                    sumA[j] = a[j];
+                    sumW[j] = dw[j];
+                }
+            } else {
+                __m256 weight = (s == 3) ? one : two;
+                for (int j = 0; j < 4; ++j) sumQ[j] = _mm256_fmadd_ps(weight, dq[j], sumQ[j]);
+                for (int j = 0; j < 3; ++j) {
+                    sumV[j] = _mm256_fmadd_ps(weight, v[j], sumV[j]);
+                    sumA[j] = _mm256_fmadd_ps(weight, a[j], sumA[j]);
+                    sumW[j] = _mm256_fmadd_ps(weight, dw[j], sumW[j]);
+                }
+            }
+        }
+
+        // 2) Weighted sums, then back onto |q| = 1
+        for (int j = 0; j < 3; ++j) {
+            _mm256_storeu_ps(pArrays[j] + i, _mm256_fmadd_ps(sixth, sumV[j], _mm256_loadu_ps(pArrays[j] + i)));
+            _mm256_storeu_ps(vArrays[j] + i, _mm256_fmadd_ps(sixth, sumA[j], v0[j]));
+            _mm256_storeu_ps(wArrays[j] + i, _mm256_fmadd_ps(sixth, sumW[j], w0[j]));
+        }
+        __m256 q[4];
+        for (int j = 0; j < 4; ++j) q[j] = _mm256_fmadd_ps(sixth, sumQ[j], q0[j]);
+        __m256 len = _mm256_sqrt_ps(_mm256_fmadd_ps(q[0], q[0], Dot8(q + 1, q + 1)));
+        __m256 inv = _mm256_div_ps(one, len);
+        for (int j = 0; j < 4; ++j) _mm256_storeu_ps(qArrays[j] + i, _mm256_mul_ps(q[j], inv));
+    }
+}
+
+void LeafBatch3D::stepBlock(uint32_t begin, uint32_t end, float dt)
+{
+    uint32_t done = begin;
+    if (HasAvx2()) {
+        stepAvx2(begin, end, dt);
+        done = begin + (end - begin) / 8 * 8;
+    }
+    stepRange(done, end, dt);       // the tail (or everything)
+}
+
+#else
+
+bool LeafBatch3D::HasAvx2()
+{
+    return false;
+}
+
+void LeafBatch3D::stepBlock(uint32_t begin, uint32_t end, float dt)
+{
+    stepRange(begin, end, dt);
+}
+
+#endif // LEAFBATCH3D_X86
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <thread>
+#include "Flutter3D.hpp"
+#include "../SelfTest.hpp"
+
+static FlutterParams
+ToDouble( const LeafParams &p )
+{
+	FlutterParams d = { p.mass, p.width, p.height, p.dragCoeffPerp, p.dragCoeffPara };
+	return d;
+}
+
+static double
+Ms( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const uint32_t N = 100003;		// not a multiple of 8: exercises the tail
+	const int STEPS = 100;
+	const float DT = 1.e-4f;		// same step-size caveat as the 2D model
+	std::mt19937 rng( 7 );
+	std::uniform_real_distribution<float> u( 0.f, 1.f );
+
+	// 1) Planar reduction: a leaf spinning about z in the xy plane is the 2D
+	//    model, up to its V = |v| + 1e-6 (~1e-6 relative in the derivatives)
+	{
+		const int STATES = 10000, LEAVES = 200, PLANAR_STEPS = 5000;
+		double maxDeriv = 0., maxErr = 0., maxOut = 0.;
+		for( int l = 0; l < STATES; l++ )
+		{
+			FlutterParams p = { 0.005 + 0.01*u(rng), 0.05 + 0.1*u(rng), 0.05 + 0.1*u(rng), 2. + 3.*u(rng), 0.5 + u(rng) };
+			double s2[6] = { 0., 0., 6.*u(rng) - 3., 2.*u(rng) - 1., -u(rng), 2.*u(rng) - 1. };
+			double wind2[2] = { 2.*u(rng) - 1., 0.2*u(rng) - 0.1 };
+			double wind3[3] = { wind2[0], wind2[1], 0. };
+			double s3[FLUTTER3D_DIM], d2[FLUTTER_DIM], d3[FLUTTER3D_DIM];
+			Flutter3DFromPlanar( s2, s3 );
+			FlutterDerivatives( s2, p, 1.225, 9.81, d2, wind2 );
+			Flutter3DDerivatives( s3, p, 1.225, 9.81, d3, wind3 );
+			double scale = std::max( 1., std::max( fabs( d2[3] ), std::max( fabs( d2[4] ), fabs( d2[5] ) ) ) );
+			double err = std::max( fabs( d3[7] - d2[3] ), std::max( fabs( d3[8] - d2[4] ), fabs( d3[12] - d2[5] ) ) );
+			maxDeriv = std::max( maxDeriv, err / scale );
+			maxOut = std::max( maxOut, std::max( fabs( d3[9] ), std::max( fabs( d3[10] ), fabs( d3[11] ) ) ) );
+
+			if( l >= LEAVES )
+				continue;
+			for( int k = 0; k < PLANAR_STEPS; k++ )
+			{
+				FlutterRk4Step( s2, p, 1.225, 9.81, 1.e-4, wind2 );
+				Flutter3DRk4Step( s3, p, 1.225, 9.81, 1.e-4, wind3 );
+			}
+			scale = std::max( 1.e-3, std::sqrt( s2[0]*s2[0] + s2[1]*s2[1] ) );
+			maxErr = std::max( maxErr, std::max( fabs( s3[0] - s2[0] ), fabs( s3[1] - s2[1] ) ) / scale );
+			maxOut = std::max( maxOut, std::max( fabs( s3[2] ), std::max( fabs( s3[4] ), fabs( s3[5] ) ) ) );
+		}
+		fprintf( stderr, "planar reduction: derivatives rel. err %.1e; %d leaves x %d steps rel. err %.1e; out of plane %.1e\n",
+			maxDeriv, LEAVES, PLANAR_STEPS, maxErr, maxOut );
+		Check( maxDeriv < 1.e-4 && maxErr < 1.e-3 && maxOut == 0., "3D model reduces to the 2D one" );
+	}
+
+	// 2) Random tumbling leaves in random 3D breezes, batch vs double reference
+	std::vector<LeafParams> params( N );
+	std::vector<double> ref( FLUTTER3D_DIM * N ), wind( 3 * N );
+	LeafBatch3D simd, scalar;
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		LeafParams p = { 0.005f + 0.01f*u(rng), 0.05f + 0.1f*u(rng), 0.05f + 0.1f*u(rng), 2.f + 3.f*u(rng), 0.5f + u(rng) };
+		float q[4] = { u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f };
+		float len = sqrtf( q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3] );
+		LeafState3D s = { 0.f, 0.f, 0.f, q[0]/len, q[1]/len, q[2]/len, q[3]/len,
+		                  u(rng) - 0.5f, -u(rng), u(rng) - 0.5f, 2.f*u(rng) - 1.f, 2.f*u(rng) - 1.f, 2.f*u(rng) - 1.f };
+		params[i] = p;
+		double r[FLUTTER3D_DIM] = { s.px, s.py, s.pz, s.qw, s.qx, s.qy, s.qz, s.vx, s.vy, s.vz, s.wx, s.wy, s.wz };
+		std::copy( r, r + FLUTTER3D_DIM, &ref[FLUTTER3D_DIM*i] );
+		simd.add( s, p );
+		scalar.add( s, p );
+
+		float wx = 2.f*u(rng) - 1.f, wy = 0.2f*u(rng) - 0.1f, wz = 2.f*u(rng) - 1.f;
+		wind[3*i] = wx;
+		wind[3*i+1] = wy;
+		wind[3*i+2] = wz;
+		simd.SetWind( i, wx, wy, wz );
+		scalar.SetWind( i, wx, wy, wz );
+	}
+
+	fprintf( stderr, "AVX2 + FMA: %s\n", LeafBatch3D::HasAvx2( ) ? "yes" : "no (scalar fallback)" );
+	const LeafBatch3D initial = simd;
+
+	auto t0 = std::chrono::high_resolution_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		for( uint32_t i = 0; i < N; i++ )
+			Flutter3DRk4Step( &ref[FLUTTER3D_DIM*i], ToDouble( params[i] ), 1.225, 9.81, DT, &wind[3*i] );
+	double refMs = Ms( t0 );
+
+	t0 = std::chrono::high_resolution_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		scalar.stepScalar( DT );
+	double scalarMs = Ms( t0 );
+
+	t0 = std::chrono::high_resolution_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		simd.step( DT );
+	double simdMs = Ms( t0 );
+
+	// float batch vs double reference, relative to the distance travelled;
+	// the orientation as the largest quaternion component difference.  A
+	// leaf whose u_y crosses zero (where the lift flips) can go one way in
+	// float and the other in double, so a few in 1e4 are allowed off.
+	double maxErrScalar = 0., maxErrSimd = 0., maxErrQ = 0.;
+	uint32_t offScalar = 0, offSimd = 0;
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		const double *r = &ref[FLUTTER3D_DIM*i];
+		double scale = std::max( 1.e-3, std::sqrt( r[0]*r[0] + r[1]*r[1] + r[2]*r[2] ) );
+		LeafState3D a = scalar.GetState( i );
+		LeafState3D b = simd.GetState( i );
+		double errScalar = std::max( fabs( a.px - r[0] ), std::max( fabs( a.py - r[1] ), fabs( a.pz - r[2] ) ) ) / scale;
+		double errSimd   = std::max( fabs( b.px - r[0] ), std::max( fabs( b.py - r[1] ), fabs( b.pz - r[2] ) ) ) / scale;
+		maxErrScalar = std::max( maxErrScalar, errScalar );
+		maxErrSimd   = std::max( maxErrSimd, errSimd );
+		offScalar += errScalar > 1.e-3;
+		offSimd   += errSimd > 1.e-3;
+		float qb[4] = { b.qw, b.qx, b.qy, b.qz };
+		for( int j = 0; j < 4; j++ )
+			maxErrQ = std::max( maxErrQ, fabs( qb[j] - r[3+j] ) );
+	}
+
+	double leafSteps = (double)N * STEPS;
+	fprintf( stderr, "%u leaves x %d RK4 steps:\n", N, STEPS );
+	fprintf( stderr, "  one leaf at a time (double)  %8.1f ms  %6.1f ns/leaf-step\n", refMs, 1.e6 * refMs / leafSteps );
+	fprintf( stderr, "  SoA scalar (float)           %8.1f ms  %6.1f ns/leaf-step  max rel. err %.1e, %u over 1e-3\n", scalarMs, 1.e6 * scalarMs / leafSteps, maxErrScalar, offScalar );
+	fprintf( stderr, "  SoA step() (float)           %8.1f ms  %6.1f ns/leaf-step  max rel. err %.1e, %u over 1e-3\n", simdMs, 1.e6 * simdMs / leafSteps, maxErrSimd, offSimd );
+	fprintf( stderr, "  quaternion max err %.1e\n", maxErrQ );
+
+	// All the steps in one call, a run of leaves at a time, over 1 .. N
+	// threads: the same leaves as step() one step at a time
+	unsigned hw = std::max( 1u, std::thread::hardware_concurrency( ) );
+	fprintf( stderr, "step( dt, %d ) (%u hardware threads):\n", STEPS, hw );
+	double base = 0.;
+	for( unsigned threads = 1; threads <= std::max( 8u, hw ); threads *= 2 )
+	{
+		JobSystem jobs( threads );
+		LeafBatch3D batch = initial;
+		batch.setJobs( &jobs );
+		t0 = std::chrono::high_resolution_clock::now( );
+		batch.step( DT, STEPS );
+		double ms = Ms( t0 );
+		if( threads == 1 )
+			base = ms;
+		bool same = true;
+		for( uint32_t i = 0; i < N; i++ )
+		{
+			LeafState3D a = batch.GetState( i ), b = simd.GetState( i );
+			same = same && a.px == b.px && a.qw == b.qw && a.wz == b.wz;
+		}
+		fprintf( stderr, "  %2u threads %8.1f ms  %6.1f ns/leaf-step  speedup %.2f  %s\n", threads, ms,
+			1.e6 * ms / leafSteps, base / ms, same ? "same leaves" : "DIFFERENT" );
+		Check( same, "same leaves on any number of threads" );
+	}
+
+	Check( offScalar <= N / 10000 && offSimd <= N / 10000, "batch follows the reference" );
+
+	// 3) Sleep: nine leaves in ten lying still go to sleep, the batch keeps
+	//    the awake ones first in their old order, step() costs only those,
+	//    and a gust or a new leaf is picked up by the next updateSleep()
+	{
+		const uint32_t M = 20000;
+		LeafBatch3D lying, batch;
+		for( uint32_t i = 0; i < M; i++ )
+		{
+			bool moving = i % 10 == 0;
+			LeafState3D s = { (float)i, 10.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, moving ? -1.f : 0.f, 0.f, 0.f, 0.f, 0.f };
+			lying.add( s, params[i] );
+		}
+		JobSystem jobs( 4 );
+		lying.setJobs( &jobs );		// the compaction in parallel too
+		batch = lying;
+		LeafSleep sleep;
+		std::vector<uint32_t> order;
+		auto t0 = std::chrono::high_resolution_clock::now( );
+		lying.step( DT, STEPS );
+		double allMs = Ms( t0 );
+		for( int k = 0; k < 10 && order.empty( ); k++ )
+			batch.updateSleep( sleep, 0.1f, &order );
+		bool sorted = batch.GetNumAwake( ) == M / 10 && order.size( ) == M;
+		for( uint32_t i = 0; i < M && sorted; i++ )
+		{
+			uint32_t old = (uint32_t)batch.GetState( i ).px;
+			sorted = old == order[i] && ( i < M / 10 ? old == 10 * i : old % 10 != 0 ) &&
+				( i == 0 || i == M / 10 || order[i] > order[i-1] ) && batch.IsAsleep( i ) == ( i >= M / 10 );
+		}
+		t0 = std::chrono::high_resolution_clock::now( );
+		batch.step( DT, STEPS );
+		double awakeMs = Ms( t0 );
+		bool still = true;
+		for( uint32_t i = M / 10; i < M; i++ )
+			still = still && batch.GetState( i ).py == 10.f;
+
+		uint32_t gusted = M - 1;
+		batch.SetWind( gusted, 2.f * sleep.wakeGust, 0.f, 0.f );
+		LeafState3D s = { -1.f, 10.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, -1.f, 0.f, 0.f, 0.f, 0.f };
+		batch.add( s, params[0] );
+		bool deferred = batch.GetNumAwake( ) == M / 10;
+		batch.updateSleep( sleep, 0.1f, &order );
+		bool woken = batch.GetNumAwake( ) == M / 10 + 2 && !order.empty( ) &&
+			order[M / 10] == gusted && order[M / 10 + 1] == M && batch.GetState( M / 10 + 1 ).px == -1.f;
+		batch.updateSleep( sleep, 0.1f, &order );
+		bool settled = order.empty( );
+
+		fprintf( stderr, "sleep: %u leaves, 1 in 10 awake: step( dt, %d ) %.1f ms -> %.1f ms (%.1fx)\n",
+			M, STEPS, allMs, awakeMs, allMs / awakeMs );
+		fprintf( stderr, "  compacted in order: %s, sleepers untouched: %s, gust and new leaf: %s, then no reorder: %s\n",
+			sorted ? "yes" : "NO", still ? "yes" : "NO", deferred && woken ? "yes" : "NO", settled ? "yes" : "NO" );
+		Check( sorted && still && deferred && woken && settled && allMs > 5. * awakeMs,
+			"sleepers cost nothing and wake on gusts and new leaves" );
+	}
+	return CheckResult( );
+}
+#endif
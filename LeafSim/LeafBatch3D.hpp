@@ -0,0 +1,173 @@
+#ifndef LEAFBATCH3D_HPP
+#define LEAFBATCH3D_HPP
+#include <vector>
+#include <cstdint>
+#include "LeafBatch.hpp"
+#include "../Jobs/JobSystem.hpp"
+
+class SnapshotWriter;
+class Snapshot;
+
+// 3D rigid-body leaf state (Flutter3D.hpp): position, orientation quaternion
+// (body to world), velocity, angular velocity in body axes
+struct LeafState3D {
+    float px, py, pz;
+    float qw, qx, qy, qz;
+    float vx, vy, vz;
+    float wx, wy, wz;
+};
+
+// Writable views of a batch's state arrays, for passes that change many
+// leaves at once (collisions); valid until the batch next grows or shrinks
+struct LeafArrays3D {
+    float *px, *py, *pz;
+    float *qw, *qx, *qy, *qz;
+    float *vx, *vy, *vz;
+    float *wx, *wy, *wz;
+    const float* radius;    // max(width, height) / 2
+    const uint8_t* asleep;  // LeafBatch3D::updateSleep()
+};
+
+// How leaves meet the ground plane y = groundY (in metres)
+struct GroundContact {
+    float groundY;
+    float restitution;      // of the velocity into the ground
+    float friction;         // 1/s, sliding velocity lost while in contact
+    float spinDamping;      // 1/s, angular velocity lost while in contact
+    float flatten;          // 1/s, how fast a leaf in contact tips over flat
+    float settleSpeed;      // m/s: slower than this,
+    float settleSpin;       // rad/s: spinning slower than this,
+    float settleTime;       // s: and in contact this long, a leaf is at rest
+    float maxContactTime;   // s: at rest after this long in contact regardless
+
+    GroundContact();
+};
+
+// When a leaf stops (lodged on a branch, stalled on other leaves) and when
+// it starts again
+struct LeafSleep {
+    float sleepSpeed;       // m/s: slower than this,
+    float sleepSpin;        // rad/s: spinning slower than this,
+    float sleepTime;        // s: for this long, a leaf goes to sleep
+    float wakeGust;         // m/s: the wind at it this much above what it fell asleep in wakes it
+
+    LeafSleep();
+};
+
+// Many tumbling leaves in structure-of-arrays form, advanced together with one
+// RK4 step of the 3D flutter model (Flutter3D.hpp) per call.  The 3D
+// counterpart of LeafBatch, laid out and used the same way: per-leaf
+// constants folded at add(), air velocity per leaf (zero after add()) that
+// the caller refreshes from the wind field, and step() eight leaves at a time
+// with AVX2 + FMA when the CPU has them.
+//
+// The wind is held fixed over a step(dt, substeps) call, so the leaves are
+// independent for all of it: each run of a few hundred leaves takes every
+// substep while it is in cache, and the runs are split over the job system.
+//
+// The body axes come straight from the quaternion, so unlike the 2D batch
+// there is no trig at all: a derivative evaluation is about a hundred
+// multiply-adds, one sqrt and one divide per leaf.
+//
+// Leaves that have stopped moving sleep: updateSleep() keeps the awake ones
+// in [0, GetNumAwake()) by stream compaction, and step() and collideGround()
+// only touch those, so leaves lodged in the tree cost next to nothing until
+// a gust or another leaf (LeafCollider) wakes them.
+class LeafBatch3D {
+public:
+    LeafBatch3D(float rho = 1.225f, float g = 9.81f);
+
+    void reserve(uint32_t n);
+    void clear();
+    uint32_t add(const LeafState3D& state, const LeafParams& params);   // returns the index, awake
+    void remove(uint32_t i);        // moves the last leaf into slot i
+    void swap(uint32_t i, uint32_t j);
+
+    // Put leaves that have been still for sleep.sleepTime to sleep (at rest),
+    // and wake sleeping ones the wind at them has picked up by sleep.wakeGust;
+    // dt is the time since the last call.  If that (or add(), remove(), wake()
+    // since) leaves a sleeping leaf before an awake one, the batch is
+    // reordered awake first, each part in its old order, and order gets the
+    // old index of every new one (order[new] = old) for the caller's own
+    // per-leaf arrays; otherwise order is left empty.  Until the next call,
+    // leaves added while others sleep are not stepped.
+    void updateSleep(const LeafSleep& sleep, float dt, std::vector<uint32_t>* order);
+    void wake(uint32_t i) { m_asleep[i] = 0; m_still[i] = 0.f; }
+    bool IsAsleep(uint32_t i) const { return m_asleep[i] != 0; }
+    uint32_t GetNumAwake() const { return m_numAwake; }
+
+    uint32_t size() const { return (uint32_t)m_px.size(); }
+    LeafState3D GetState(uint32_t i) const;
+    void SetState(uint32_t i, const LeafState3D& state);
+    void SetWind(uint32_t i, float wx, float wy, float wz);
+    // writable wind arrays, to fill all leaves at once
+    float* GetWindX() { return m_windX.data(); }
+    float* GetWindY() { return m_windY.data(); }
+    float* GetWindZ() { return m_windZ.data(); }
+
+    void setJobs(JobSystem* jobs) { m_jobs = jobs; }    // NULL = all on the calling thread
+    void step(float dt, int substeps = 1);  // substeps steps of dt on the awake leaves, best available path
+    void step(float dt, int substeps, uint32_t count);     // only leaves [0, min(count, GetNumAwake()))
+    void stepScalar(float dt);      // always the plain loop (reference / tests)
+    static bool HasAvx2();
+
+    // After step(): push awake leaves whose lowest point (a disc of their size) is
+    // below the ground back onto it, with restitution, friction and a tip
+    // towards lying flat, and append the ones now at rest to settled (in
+    // increasing order, so removing them back to front is safe).  dt is the
+    // time since the last call.
+    void collideGround(const GroundContact& contact, float dt, std::vector<uint32_t>* settled);
+
+    // Column-major model matrix of leaf i for glMultMatrixf(): body x, y
+    // (normal), z as the columns, the position scaled by unitsPerMeter
+    void GetTransform(uint32_t i, float unitsPerMeter, float* m) const;
+
+    // read-only state arrays, e.g. for drawing
+    const float* GetPx() const { return m_px.data(); }
+    const float* GetPy() const { return m_py.data(); }
+    const float* GetPz() const { return m_pz.data(); }
+    const float* GetVx() const { return m_vx.data(); }
+    const float* GetVy() const { return m_vy.data(); }
+    const float* GetVz() const { return m_vz.data(); }
+    LeafArrays3D GetArrays();
+
+    // Snapshots (Snapshot.hpp): save() adds every leaf's state, folded
+    // parameters, wind and sleep to out by reference, so leave the batch be
+    // until out.write().  load() replaces the batch with the snapshot's; false
+    // (and the batch untouched) if it has none or it is damaged.
+    void save(SnapshotWriter& out) const;
+    bool load(const Snapshot& in);
+
+private:
+    void stepBlock(uint32_t begin, uint32_t end, float dt);    // best available path
+    void stepRange(uint32_t begin, uint32_t end, float dt);
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    void stepAvx2(uint32_t begin, uint32_t end, float dt);     // whole blocks of 8 from begin
+#endif
+
+    JobSystem* m_jobs;
+    float m_rho, m_g;
+    float m_rotK;                   // 3 * pi * rho
+
+    // state
+    std::vector<float> m_px, m_py, m_pz, m_qw, m_qx, m_qy, m_qz;
+    std::vector<float> m_vx, m_vy, m_vz, m_wx, m_wy, m_wz;
+    std::vector<float> m_windX, m_windY, m_windZ;
+    // folded parameters
+    std::vector<float> m_perp;      // dragCoeffPerp
+    std::vector<float> m_para;      // dragCoeffPara
+    std::vector<float> m_liftK;     // pi * rho * width / mass
+    std::vector<float> m_dragK;     // pi * rho * height / mass
+    std::vector<float> m_gyroY;     // (width^2 - height^2) / (width^2 + height^2)
+    std::vector<float> m_radius;    // max(width, height) / 2
+    std::vector<float> m_contact;   // seconds on the ground so far
+    // sleep
+    std::vector<float> m_still;     // seconds slow enough to sleep so far
+    std::vector<float> m_sleepWind; // wind speed it fell asleep in
+    std::vector<uint8_t> m_asleep;
+    uint32_t m_numAwake;            // leaves [0, m_numAwake) are awake
+    std::vector<uint32_t> m_blockCount; // updateSleep() scratch
+    std::vector<float> m_gather;
+};
+
+#endif // LEAFBATCH3D_HPP
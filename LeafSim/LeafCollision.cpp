@@ -0,0 +1,480 @@
+// Benchmark: make libleafsim.a libjobs.a && g++ -std=c++11 -O2 -DBENCH -o collisionbench LeafSim/LeafCollision.cpp -L. -lleafsim -ljobs -pthread
+#include "LeafCollision.hpp"
+#include <algorithm>
+#include <cmath>
+
+// fewer leaves than this are not worth handing out
+static const uint32_t MIN_LEAVES_FOR_JOBS = 2048;
+// leaves per job-system chunk
+static const uint32_t CHUNK = 256;
+// closer than this, two centres give no direction to push apart in
+static const float MIN_DIST = 1.e-6f;
+
+CollisionSettings::CollisionSettings()
+    : leafScale(0.5f), restitution(0.3f), friction(0.3f), spin(0.3f)
+{
+}
+
+LeafCollider::LeafCollider()
+    : m_jobs(NULL), m_branchReach(0.f), m_branchDirty(false), m_maxRadius(0.f), m_leafContacts(0), m_branchContacts(0), m_wokenCount(0)
+{
+}
+
+void LeafCollider::setJobs(JobSystem* jobs)
+{
+    m_jobs = jobs;
+    m_leafHash.setJobs(jobs);
+    m_branchHash.setJobs(jobs);
+}
+
+void LeafCollider::setBranches(const std::vector<Capsule>& capsules)
+{
+    // 1) Samples along every segment, no further apart than the thickest
+    //    branch is wide, so the reach from a sample stays small
+    m_capsules = capsules;
+    float maxRadius = 0.f;
+    for (size_t c = 0; c < capsules.size(); ++c) {
+        maxRadius = std::max(maxRadius, capsules[c].radius);
+    }
+    float spacing = std::max(maxRadius, 1.e-3f);
+    m_branchReach = maxRadius + 0.5f * spacing;
+
+    m_sampleCapsule.clear();
+    m_samples[0].clear();
+    m_samples[1].clear();
+    m_samples[2].clear();
+    for (size_t c = 0; c < capsules.size(); ++c) {
+        const Capsule& cap = capsules[c];
+        float d[3] = { cap.b[0] - cap.a[0], cap.b[1] - cap.a[1], cap.b[2] - cap.a[2] };
+        float len = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        int steps = std::max(1, (int)std::ceil(len / spacing));
+        for (int s = 0; s <= steps; ++s) {
+            float f = (float)s / steps;
+            for (int a = 0; a < 3; ++a) {
+                m_samples[a].push_back(cap.a[a] + f * d[a]);
+            }
+            m_sampleCapsule.push_back((uint32_t)c);
+        }
+    }
+
+    // 2) Hashed on the next collide(), once the leaf sizes are known
+    m_branchDirty = true;
+}
+
+// f(begin, end, thread) over [0, n) in chunks, over the job system if there
+// is one; thread < the job system's GetNumThreads(), for scratch
+template <class F>
+static void ForChunks(JobSystem* jobs, uint32_t n, F f)
+{
+    if (jobs == NULL) {
+        f(0u, n, 0);
+        return;
+    }
+    jobs->parallelFor(0, n, CHUNK, [&f](uint32_t begin, uint32_t end) {
+        f(begin, end, JobSystem::GetThreadIndex());
+    });
+}
+
+void LeafCollider::collide(LeafBatch3D& leaves)
+{
+    uint32_t n = leaves.size();
+    m_leafContacts = m_branchContacts = m_wokenCount = 0;
+    if (n == 0) {
+        return;
+    }
+    LeafArrays3D a = leaves.GetArrays();
+
+    // 1) Hash the leaves, in cells four times as wide as the widest contact:
+    //    a query then touches 8 cells at most and 3.4 on average, and falling
+    //    leaves are sparse enough that fewer cells beats fewer candidates
+    float maxRadius = 0.f;
+    for (uint32_t i = 0; i < n; ++i) {
+        maxRadius = std::max(maxRadius, a.radius[i]);
+    }
+    maxRadius *= m_settings.leafScale;
+    if (maxRadius <= 0.f) {
+        return;
+    }
+    m_maxRadius = maxRadius;
+    if (m_leafHash.GetCellSize() != 8.f * maxRadius) {
+        m_leafHash.setCellSize(8.f * maxRadius);
+    }
+    m_leafHash.build(a.px, a.py, a.pz, n);
+
+    // 2) The branches, if they moved or the leaves outgrew their cells
+    float branchCell = 4.f * (m_branchReach + maxRadius);
+    if (!m_capsules.empty() && (m_branchDirty || m_branchHash.GetCellSize() < branchCell)) {
+        m_branchHash.setCellSize(branchCell);
+        m_branchHash.build(m_samples[0].data(), m_samples[1].data(), m_samples[2].data(),
+                           (uint32_t)m_sampleCapsule.size());
+        m_branchDirty = false;
+    }
+
+    JobSystem* jobs = (n >= MIN_LEAVES_FOR_JOBS) ? m_jobs : NULL;
+    int threads = (jobs != NULL) ? jobs->GetNumThreads() : 1;
+    for (int k = 0; k < 3; ++k) {
+        m_pos[k].resize(n);
+        m_dp[k].resize(n);
+        m_dv[k].resize(n);
+        m_dw[k].resize(n);
+    }
+    m_seen.resize(threads);
+    m_touched.resize(threads);
+    m_woken.resize(threads);
+    for (int t = 0; t < threads; ++t) {
+        m_seen[t].assign(m_capsules.size(), 0u);
+        m_touched[t].clear();
+        m_woken[t].clear();
+    }
+    m_radius.resize(n);
+    m_leafCount.assign(threads, 0u);
+    m_branchCount.assign(threads, 0u);
+    const uint32_t* sorted = m_leafHash.GetSorted();
+
+    // 3) A copy of what every query reads, in hash order: the leaves of a
+    //    cell side by side rather than all over the batch.  Velocities are
+    //    only needed on contact, which few leaves are in.
+    ForChunks(jobs, n, [this, &a, sorted](uint32_t begin, uint32_t end, int) {
+        for (uint32_t s = begin; s < end; ++s) {
+            uint32_t i = sorted[s];
+            m_pos[0][s] = a.px[i];
+            m_pos[1][s] = a.py[i];
+            m_pos[2][s] = a.pz[i];
+            m_radius[s] = m_settings.leafScale * a.radius[i];
+        }
+    });
+
+    // 4) Every leaf's response, from the state before the pass
+    ForChunks(jobs, n, [this, &a](uint32_t begin, uint32_t end, int t) {
+        collideRange(a, begin, end, t);
+    });
+
+    // 5) Apply it to the leaves in contact; the spin goes into body axes,
+    //    (t, n, b) . w
+    for (int t = 0; t < threads; ++t) {
+        const std::vector<uint32_t>& touched = m_touched[t];
+        for (size_t c = 0; c < touched.size(); ++c) {
+            uint32_t s = touched[c], i = sorted[s];
+            a.px[i] += m_dp[0][s];
+            a.py[i] += m_dp[1][s];
+            a.pz[i] += m_dp[2][s];
+            a.vx[i] += m_dv[0][s];
+            a.vy[i] += m_dv[1][s];
+            a.vz[i] += m_dv[2][s];
+            float w[3] = { m_dw[0][s], m_dw[1][s], m_dw[2][s] };
+            if (w[0] == 0.f && w[1] == 0.f && w[2] == 0.f) {
+                continue;
+            }
+            float qw = a.qw[i], qx = a.qx[i], qy = a.qy[i], qz = a.qz[i];
+            float tx = 1.f - 2.f * (qy * qy + qz * qz), ty = 2.f * (qx * qy + qw * qz), tz = 2.f * (qx * qz - qw * qy);
+            float nx = 2.f * (qx * qy - qw * qz), ny = 1.f - 2.f * (qx * qx + qz * qz), nz = 2.f * (qy * qz + qw * qx);
+            float bx = 2.f * (qx * qz + qw * qy), by = 2.f * (qy * qz - qw * qx), bz = 1.f - 2.f * (qx * qx + qy * qy);
+            a.wx[i] += tx * w[0] + ty * w[1] + tz * w[2];
+            a.wy[i] += nx * w[0] + ny * w[1] + nz * w[2];
+            a.wz[i] += bx * w[0] + by * w[1] + bz * w[2];
+        }
+    }
+
+    // 6) Sleeping leaves that were hit move from the next step on
+    for (int t = 0; t < threads; ++t) {
+        const std::vector<uint32_t>& woken = m_woken[t];
+        for (size_t c = 0; c < woken.size(); ++c) {
+            uint32_t i = woken[c];
+            m_wokenCount += leaves.IsAsleep(i);
+            leaves.wake(i);
+        }
+    }
+
+    for (int t = 0; t < threads; ++t) {
+        m_leafContacts += m_leafCount[t];
+        m_branchContacts += m_branchCount[t];
+    }
+    m_leafContacts /= 2;        // both leaves count a contact
+}
+
+void LeafCollider::collideRange(const LeafArrays3D& a, uint32_t begin, uint32_t end, int thread)
+{
+    const CollisionSettings& set = m_settings;
+    std::vector<uint32_t>& seen = m_seen[thread];
+    std::vector<uint32_t>& touched = m_touched[thread];
+    std::vector<uint32_t>& woken = m_woken[thread];
+    uint32_t leafCount = 0, branchCount = 0;
+
+    const uint32_t* sorted = m_leafHash.GetSorted();
+    const float *px = m_pos[0].data(), *py = m_pos[1].data(), *pz = m_pos[2].data();
+    const float* radius = m_radius.data();
+
+    // i, j below are slots in hash order
+    for (uint32_t i = begin; i < end; ++i) {
+        if (a.asleep[sorted[i]]) {
+            continue;
+        }
+        float p[3] = { px[i], py[i], pz[i] };
+        float v[3];
+        float r = radius[i];
+        bool contact = false;
+        float dp[3] = { 0.f, 0.f, 0.f }, dv[3] = { 0.f, 0.f, 0.f }, dw[3] = { 0.f, 0.f, 0.f };
+
+        // Response to a contact along the unit normal nrm (pointing at this
+        // leaf), overlapping by 'overlap', other side moving at vOther with a
+        // share of the response for this leaf
+        auto respond = [&](const float* nrm, float overlap, const float* vOther, float share) {
+            if (!contact) {
+                uint32_t leaf = sorted[i];
+                v[0] = a.vx[leaf];
+                v[1] = a.vy[leaf];
+                v[2] = a.vz[leaf];
+                contact = true;
+            }
+            float rel[3] = { v[0] - vOther[0], v[1] - vOther[1], v[2] - vOther[2] };
+            float vn = rel[0] * nrm[0] + rel[1] * nrm[1] + rel[2] * nrm[2];
+            float vt[3] = { rel[0] - vn * nrm[0], rel[1] - vn * nrm[1], rel[2] - vn * nrm[2] };
+            float push = share * overlap;
+            float bounce = (vn < 0.f) ? -share * (1.f + set.restitution) * vn : 0.f;
+            float spin = share * set.spin / r;
+            for (int k = 0; k < 3; ++k) {
+                dp[k] += push * nrm[k];
+                dv[k] += bounce * nrm[k] - share * set.friction * vt[k];
+            }
+            // friction at the contact point -r nrm turns the leaf about nrm x vt
+            dw[0] += spin * (nrm[1] * vt[2] - nrm[2] * vt[1]);
+            dw[1] += spin * (nrm[2] * vt[0] - nrm[0] * vt[2]);
+            dw[2] += spin * (nrm[0] * vt[1] - nrm[1] * vt[0]);
+        };
+
+        // 1) Other leaves: each takes half, or all against a sleeping one
+        m_leafHash.forNeighbourSlots(p[0], p[1], p[2], r + m_maxRadius, [&](uint32_t j) {
+            if (j == i) {
+                return;
+            }
+            float d[3] = { p[0] - px[j], p[1] - py[j], p[2] - pz[j] };
+            float reach = r + radius[j];
+            float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            if (d2 >= reach * reach) {
+                return;
+            }
+            float dist = std::sqrt(d2);
+            float nrm[3] = { 0.f, (i < j) ? 1.f : -1.f, 0.f };    // coincident: apart along y
+            if (dist > MIN_DIST) {
+                nrm[0] = d[0] / dist;
+                nrm[1] = d[1] / dist;
+                nrm[2] = d[2] / dist;
+            }
+            bool asleep = a.asleep[sorted[j]] != 0;
+            float vj[3] = { a.vx[sorted[j]], a.vy[sorted[j]], a.vz[sorted[j]] };
+            respond(nrm, reach - dist, vj, asleep ? 1.f : 0.5f);
+            leafCount++;
+            if (asleep) {
+                woken.push_back(sorted[j]);
+                leafCount++;        // it won't count this one itself
+            }
+        });
+
+        // 2) Branches, each capsule once: the leaf takes all of it
+        if (!m_capsules.empty()) {
+            const float still[3] = { 0.f, 0.f, 0.f };
+            m_branchHash.forNeighbours(p[0], p[1], p[2], r + m_branchReach, [&](uint32_t sample) {
+                uint32_t c = m_sampleCapsule[sample];
+                if (seen[c] == i + 1) {
+                    return;
+                }
+                seen[c] = i + 1;
+                const Capsule& cap = m_capsules[c];
+
+                // closest point on the segment
+                float ab[3] = { cap.b[0] - cap.a[0], cap.b[1] - cap.a[1], cap.b[2] - cap.a[2] };
+                float ap[3] = { p[0] - cap.a[0], p[1] - cap.a[1], p[2] - cap.a[2] };
+                float len2 = ab[0] * ab[0] + ab[1] * ab[1] + ab[2] * ab[2];
+                float f = (len2 > 0.f) ? (ap[0] * ab[0] + ap[1] * ab[1] + ap[2] * ab[2]) / len2 : 0.f;
+                f = std::max(0.f, std::min(1.f, f));
+                float d[3] = { ap[0] - f * ab[0], ap[1] - f * ab[1], ap[2] - f * ab[2] };
+                float reach = r + cap.radius;
+                float d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+                if (d2 >= reach * reach) {
+                    return;
+                }
+                float dist = std::sqrt(d2);
+                float nrm[3] = { 0.f, 1.f, 0.f };       // on the axis: out the top
+                if (dist > MIN_DIST) {
+                    nrm[0] = d[0] / dist;
+                    nrm[1] = d[1] / dist;
+                    nrm[2] = d[2] / dist;
+                }
+                respond(nrm, reach - dist, still, 1.f);
+                branchCount++;
+            });
+        }
+
+        if (!contact) {
+            continue;
+        }
+        for (int k = 0; k < 3; ++k) {
+            m_dp[k][i] = dp[k];
+            m_dv[k][i] = dv[k];
+            m_dw[k][i] = dw[k];
+        }
+        touched.push_back(i);
+    }
+
+    m_leafCount[thread] += leafCount;
+    m_branchCount[thread] += branchCount;
+}
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <thread>
+#include "../SelfTest.hpp"
+
+static double
+Ms( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+}
+
+// n leaves at one per (20 cm)^3, tumbling in all directions
+static void
+Scatter( LeafBatch3D &batch, uint32_t n, uint32_t seed )
+{
+	std::mt19937 rng( seed );
+	float side = 0.2f * std::cbrt( (float)n );
+	std::uniform_real_distribution<float> pos( 0.f, side ), vel( -1.f, 1.f ), unit( -1.f, 1.f );
+	LeafParams params;
+	params.width = 0.05f;
+	params.height = 0.05f;
+	params.mass = 2.e-4f;
+	params.dragCoeffPerp = 5.f;
+	params.dragCoeffPara = 0.5f;
+	batch.clear( );
+	batch.reserve( n );
+	for( uint32_t i = 0; i < n; i++ )
+	{
+		float q[4] = { unit(rng), unit(rng), unit(rng), unit(rng) };
+		float len = std::sqrt( q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3] ) + 1.e-6f;
+		LeafState3D s = { pos(rng), pos(rng), pos(rng), q[0]/len, q[1]/len, q[2]/len, q[3]/len,
+			vel(rng), vel(rng) - 1.f, vel(rng), 0.f, 0.f, 0.f };
+		batch.add( s, params );
+	}
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	// 1) Two leaves head on, and a leaf onto a branch
+	{
+		LeafBatch3D batch;
+		LeafParams params;
+		params.width = params.height = 0.1f;
+		params.mass = 1.e-3f;
+		LeafState3D a = { 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+		LeafState3D b = { 0.04f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, -1.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+		batch.add( a, params );
+		batch.add( b, params );
+		LeafCollider collider;
+		collider.collide( batch );
+		LeafState3D a1 = batch.GetState( 0 ), b1 = batch.GetState( 1 );
+		bool ok = collider.GetLeafContacts( ) == 1 && a1.vx < 0.f && b1.vx > 0.f &&
+			std::fabs( a1.vx + b1.vx ) < 1.e-6f && b1.px - a1.px > 0.04f;
+		fprintf( stderr, "head on: v %.3f, %.3f after\n", a1.vx, b1.vx );
+		Check( ok, "head on: they bounce apart, momentum kept" );
+
+		batch.clear( );
+		LeafState3D c = { 0.f, 0.05f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.5f, -1.f, 0.f, 0.f, 0.f, 0.f };
+		batch.add( c, params );
+		std::vector<Capsule> branch( 1 );
+		Capsule cap = { { -1.f, 0.f, 0.f }, { 1.f, 0.f, 0.f }, 0.03f };
+		branch[0] = cap;
+		collider.setBranches( branch );
+		collider.collide( batch );
+		LeafState3D c1 = batch.GetState( 0 );
+		ok = collider.GetBranchContacts( ) == 1 && c1.vy > 0.f && c1.py >= 0.055f - 1.e-6f &&
+			c1.vx < 0.5f && c1.wx * c1.wx + c1.wy * c1.wy + c1.wz * c1.wz > 0.f;
+		fprintf( stderr, "onto a branch: v (%.3f, %.3f), y %.3f, spin (%.2f, %.2f, %.2f)\n",
+			c1.vx, c1.vy, c1.py, c1.wx, c1.wy, c1.wz );
+		Check( ok, "onto a branch: pushed out, slowed and set spinning" );
+
+		// onto a sleeping leaf: it stays put this pass and wakes
+		batch.clear( );
+		collider.setBranches( std::vector<Capsule>( ) );
+		LeafState3D still = { 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+		batch.add( still, params );
+		batch.add( b, params );
+		LeafSleep sleep;
+		sleep.sleepTime = 0.f;
+		std::vector<uint32_t> order;
+		batch.updateSleep( sleep, 0.1f, &order );
+		bool asleep = batch.GetNumAwake( ) == 1 && order.size( ) == 2 && order[0] == 1 && batch.IsAsleep( 1 );
+		collider.collide( batch );
+		LeafState3D moved = batch.GetState( 0 ), slept = batch.GetState( 1 );
+		ok = asleep && !batch.IsAsleep( 1 ) && collider.GetWoken( ) == 1 && collider.GetLeafContacts( ) == 1 &&
+			slept.px == 0.f && slept.vx == 0.f && moved.vx > 0.f;
+		fprintf( stderr, "onto a sleeping leaf: %s, v %.3f after\n", batch.IsAsleep( 1 ) ? "still asleep" : "woken", moved.vx );
+		Check( ok, "onto a sleeping leaf: it wakes, and stays put this pass" );
+	}
+
+	// 2) The same pass on 1 and 4 threads gives the same leaves
+	{
+		LeafBatch3D one, four;
+		Scatter( one, 20000, 3 );
+		Scatter( four, 20000, 3 );
+		JobSystem jobs( 4 );
+		LeafCollider c1, c4;
+		c4.setJobs( &jobs );
+		c1.collide( one );
+		c4.collide( four );
+		bool same = c1.GetLeafContacts( ) == c4.GetLeafContacts( );
+		for( uint32_t i = 0; i < one.size( ); i++ )
+		{
+			LeafState3D s = one.GetState( i ), t = four.GetState( i );
+			same = same && s.px == t.px && s.vy == t.vy && s.wz == t.wz;
+		}
+		fprintf( stderr, "threads: %u contacts, %s\n", c1.GetLeafContacts( ), same ? "identical" : "DIFFERENT" );
+		Check( same, "same leaves on 1 and 4 threads" );
+	}
+
+	// 3) Scaling with the number of leaves, at constant density
+	fprintf( stderr, "\n%8s %10s %10s %10s\n", "leaves", "contacts", "ms", "ns/leaf" );
+	for( uint32_t n = 1000; n <= 100000; n *= 10 )
+	{
+		LeafBatch3D batch;
+		Scatter( batch, n, 1 );
+		LeafCollider collider;
+		collider.collide( batch );
+		Scatter( batch, n, 1 );
+		const int REPS = 10;
+		auto t0 = std::chrono::high_resolution_clock::now( );
+		for( int r = 0; r < REPS; r++ )
+			collider.collide( batch );
+		double ms = Ms( t0 ) / REPS;
+		fprintf( stderr, "%8u %10u %10.3f %10.1f\n", n, collider.GetLeafContacts( ), ms, ms * 1.e6 / n );
+	}
+
+	// 4) Scaling with threads, 100k leaves
+	unsigned hw = std::max( 1u, std::thread::hardware_concurrency( ) );
+	fprintf( stderr, "\n%8s %10s %10s   (%u hardware threads)\n", "threads", "ms", "speedup", hw );
+	double base = 0.;
+	for( unsigned threads = 1; threads <= std::max( 8u, hw ); threads *= 2 )
+	{
+		LeafBatch3D batch;
+		Scatter( batch, 100000, 1 );
+		JobSystem jobs( threads );
+		LeafCollider collider;
+		collider.setJobs( &jobs );
+		collider.collide( batch );
+		const int REPS = 10;
+		auto t0 = std::chrono::high_resolution_clock::now( );
+		for( int r = 0; r < REPS; r++ )
+			collider.collide( batch );
+		double ms = Ms( t0 ) / REPS;
+		if( threads == 1 )
+			base = ms;
+		fprintf( stderr, "%8u %10.3f %10.2f\n", threads, ms, base / ms );
+	}
+
+	fprintf( stderr, "\n" );
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,85 @@
+#ifndef LEAFCOLLISION_HPP
+#define LEAFCOLLISION_HPP
+#include <vector>
+#include <cstdint>
+#include "LeafBatch3D.hpp"
+#include "SpatialHash.hpp"
+
+// A branch segment as a capsule: the points within radius of a..b (metres)
+struct Capsule {
+    float a[3], b[3];
+    float radius;
+};
+
+struct CollisionSettings {
+    float leafScale;        // contact radius as a fraction of the leaf's (they are thin)
+    float restitution;      // of the approaching velocity
+    float friction;         // fraction of the sliding velocity lost per contact, 0..1
+    float spin;             // how much of the sliding turns into spin, 0..1
+
+    CollisionSettings();
+};
+
+// Falling leaves against each other and against the branches, as spheres
+// (the leaves) and capsules (the branch segments).
+//
+// Both sides are found through a SpatialHash.  The leaves are hashed again on
+// every collide(), since they all move; the branches only when setBranches()
+// is called, as points spaced along each segment that remember their capsule.
+// A contact pushes the leaf out of the overlap, takes out the approaching
+// velocity (with restitution), some of the sliding velocity, and turns that
+// into spin about the contact, so leaves glance off twigs tumbling.
+//
+// Every leaf works out its own response from the state before the pass and
+// nothing else writes to it, so the leaves can be split over the job system
+// freely and the result does not depend on how many threads it has.
+//
+// Sleeping leaves (LeafBatch3D::updateSleep()) are hashed but never looked
+// up from: awake leaves bounce off them as off something still, and wake
+// them up.
+class LeafCollider {
+public:
+    LeafCollider();
+
+    void setSettings(const CollisionSettings& settings) { m_settings = settings; }
+    const CollisionSettings& GetSettings() const { return m_settings; }
+    void setJobs(JobSystem* jobs);  // NULL = all on the calling thread
+
+    // The branches; again whenever they move (it is cheap next to the leaves)
+    void setBranches(const std::vector<Capsule>& capsules);
+    uint32_t GetNumBranches() const { return (uint32_t)m_capsules.size(); }
+
+    void collide(LeafBatch3D& leaves);
+
+    // contacts found by the last collide(), and the sleeping leaves it woke
+    uint32_t GetLeafContacts() const { return m_leafContacts; }
+    uint32_t GetWoken() const { return m_wokenCount; }
+    uint32_t GetBranchContacts() const { return m_branchContacts; }
+
+private:
+    void collideRange(const LeafArrays3D& a, uint32_t begin, uint32_t end, int thread);
+
+    CollisionSettings m_settings;
+    JobSystem* m_jobs;
+
+    // branches
+    std::vector<Capsule> m_capsules;
+    std::vector<float> m_samples[3];            // points along the segments
+    std::vector<uint32_t> m_sampleCapsule;      // capsule of each sample point
+    SpatialHash m_branchHash;
+    float m_branchReach;                        // sample to anything on its capsule
+    bool m_branchDirty;                         // samples not hashed yet
+
+    // leaves
+    SpatialHash m_leafHash;
+    float m_maxRadius;                                  // widest leaf contact
+    std::vector<float> m_pos[3], m_radius;              // in hash order
+    std::vector<float> m_dp[3], m_dv[3], m_dw[3];       // response, world axes, by slot
+    std::vector< std::vector<uint32_t> > m_touched;     // per thread, slots in contact
+    std::vector< std::vector<uint32_t> > m_seen;        // per thread, per capsule
+    std::vector< std::vector<uint32_t> > m_woken;       // per thread, sleeping leaves hit
+    std::vector<uint32_t> m_leafCount, m_branchCount;   // per thread
+    uint32_t m_leafContacts, m_branchContacts, m_wokenCount;
+};
+
+#endif // LEAFCOLLISION_HPP
@@ -0,0 +1,375 @@
+// Test: make libleafsim.a libjobs.a && g++ -std=c++11 -O2 -DTEST -o leaflittertest LeafSim/LeafLitter.cpp -L. -lleafsim -ljobs -pthread
+#include "LeafLitter.hpp"
+#include "Snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// the capacity never compacts below this
+static const uint32_t MIN_CAPACITY = 4;
+
+LeafLitter::LeafLitter()
+    : m_nx(0)
+    , m_nz(0)
+    , m_x0(0.f)
+    , m_z0(0.f)
+    , m_cellX(1.f)
+    , m_cellZ(1.f)
+    , m_groundY(0.f)
+    , m_layer(0.f)
+    , m_leafArea(1.f)
+    , m_capacity(64)
+    , m_budget(1u << 20)
+    , m_size(0)
+    , m_total(0)
+    , m_version(0)
+{
+}
+
+void LeafLitter::setGrid(float x0, float z0, float x1, float z1, int nx, int nz, float groundY)
+{
+    m_x0 = x0;
+    m_z0 = z0;
+    m_nx = std::max(nx, 1);
+    m_nz = std::max(nz, 1);
+    m_cellX = (x1 - x0) / (float)m_nx;
+    m_cellZ = (z1 - z0) / (float)m_nz;
+    m_groundY = groundY;
+    m_cells.resize((size_t)m_nx * m_nz);
+    clear();
+}
+
+void LeafLitter::setCapacity(uint32_t perCell, uint32_t budget)
+{
+    m_budget = budget;
+    compact(std::max(perCell, MIN_CAPACITY));
+}
+
+void LeafLitter::clear()
+{
+    for (size_t c = 0; c < m_cells.size(); ++c) {
+        LitterCell& cell = m_cells[c];
+        cell.leaves.clear();
+        cell.head = 0;
+        cell.buried = 0;
+        memset(cell.colorCounts, 0, sizeof(cell.colorCounts));
+        cell.version = ++m_version;
+    }
+    m_size = 0;
+    m_total = 0;
+}
+
+bool LeafLitter::add(const LitterLeaf& leaf)
+{
+    int i = (int)std::floor((leaf.x - m_x0) / m_cellX);
+    int k = (int)std::floor((leaf.z - m_z0) / m_cellZ);
+    if (m_cells.empty() || i < 0 || i >= m_nx || k < 0 || k >= m_nz) {
+        return false;
+    }
+    LitterCell& cell = m_cells[(size_t)k * m_nx + i];
+
+    // 1) On top of the pile: the pile stops growing once the cell is full
+    LitterLeaf l = leaf;
+    l.y = m_groundY + m_layer * (float)(cell.leaves.size() + 1);
+    l.color = (uint8_t)std::min<int>(l.color, LITTER_COLORS - 1);
+    cell.colorCounts[l.color]++;
+    cell.version = ++m_version;
+    m_total++;
+
+    // 2) A free slot, or the oldest one's
+    if (cell.leaves.size() < m_capacity) {
+        cell.leaves.push_back(l);
+        m_size++;
+    } else {
+        cell.leaves[cell.head] = l;
+        cell.head = (cell.head + 1) % (uint32_t)cell.leaves.size();
+        cell.buried++;
+    }
+
+    // 3) Over budget: halve every cell
+    if (m_size > m_budget && m_capacity > MIN_CAPACITY) {
+        compact(std::max(m_capacity / 2, MIN_CAPACITY));
+    }
+    return true;
+}
+
+void LeafLitter::compact(uint32_t perCell)
+{
+    m_capacity = perCell;
+    for (size_t c = 0; c < m_cells.size(); ++c) {
+        LitterCell& cell = m_cells[c];
+        if (cell.leaves.size() <= perCell) {
+            continue;
+        }
+        // oldest first, then drop from the front
+        std::rotate(cell.leaves.begin(), cell.leaves.begin() + cell.head, cell.leaves.end());
+        size_t drop = cell.leaves.size() - perCell;
+        cell.leaves.erase(cell.leaves.begin(), cell.leaves.begin() + drop);
+        std::vector<LitterLeaf>(cell.leaves).swap(cell.leaves);   // give the memory back
+        cell.head = 0;
+        cell.buried += drop;
+        cell.version = ++m_version;
+        m_size -= (uint32_t)drop;
+    }
+}
+
+void LeafLitter::GetCellBounds(int c, float* lo, float* hi) const
+{
+    int i = c % m_nx, k = c / m_nx;
+    const LitterCell& cell = m_cells[c];
+    lo[0] = m_x0 + m_cellX * (float)i;
+    lo[1] = m_groundY;
+    lo[2] = m_z0 + m_cellZ * (float)k;
+    hi[0] = lo[0] + m_cellX;
+    hi[1] = m_groundY + m_layer * (float)(cell.leaves.size() + 1);
+    hi[2] = lo[2] + m_cellZ;
+}
+
+float LeafLitter::GetCoverage(int c) const
+{
+    const LitterCell& cell = m_cells[c];
+    double landed = (double)cell.leaves.size() + (double)cell.buried;
+    return (float)std::min(1., landed * m_leafArea / ((double)m_cellX * m_cellZ));
+}
+
+void LeafLitter::GetMeanColor(int c, const float palette[][3], float* rgb) const
+{
+    const LitterCell& cell = m_cells[c];
+    double sum[3] = { 0., 0., 0. }, count = 0.;
+    for (int k = 0; k < LITTER_COLORS; ++k) {
+        for (int j = 0; j < 3; ++j) {
+            sum[j] += (double)cell.colorCounts[k] * palette[k][j];
+        }
+        count += cell.colorCounts[k];
+    }
+    for (int j = 0; j < 3; ++j) {
+        rgb[j] = (count > 0.) ? (float)(sum[j] / count) : 0.f;
+    }
+}
+
+// -------------------------------------
+// Snapshots
+// -------------------------------------
+struct LitterSnapshot {
+    int32_t nx, nz;
+    float x0, z0, cellX, cellZ;
+    float groundY, layer, leafArea;
+    uint32_t capacity, budget, size;
+    uint64_t total;
+};
+
+struct LitterCellSnapshot {
+    uint32_t count;             // leaves, stored in turn in "litter.leaves"
+    uint32_t head;
+    uint64_t buried;
+    uint32_t colorCounts[LITTER_COLORS];
+};
+
+void LeafLitter::save(SnapshotWriter& out) const
+{
+    LitterSnapshot l = { m_nx, m_nz, m_x0, m_z0, m_cellX, m_cellZ, m_groundY, m_layer, m_leafArea,
+                         m_capacity, m_budget, m_size, m_total };
+    std::vector<LitterCellSnapshot> cells(m_cells.size());
+    std::vector<LitterLeaf> leaves;
+    leaves.reserve(m_size);
+    for (size_t c = 0; c < m_cells.size(); ++c) {
+        const LitterCell& cell = m_cells[c];
+        cells[c].count = (uint32_t)cell.leaves.size();
+        cells[c].head = cell.head;
+        cells[c].buried = cell.buried;
+        memcpy(cells[c].colorCounts, cell.colorCounts, sizeof(cell.colorCounts));
+        leaves.insert(leaves.end(), cell.leaves.begin(), cell.leaves.end());
+    }
+    out.addValue("litter", l);
+    out.addCopy("litter.cells", cells.data(), cells.size() * sizeof(LitterCellSnapshot));
+    out.addCopy("litter.leaves", leaves.data(), leaves.size() * sizeof(LitterLeaf));
+}
+
+bool LeafLitter::load(const Snapshot& in)
+{
+    LitterSnapshot l;
+    std::vector<LitterCellSnapshot> cells;
+    uint64_t bytes = 0;
+    if (!in.readValue("litter", &l) || !in.read("litter.cells", &cells) ||
+        l.nx < 1 || l.nz < 1 || cells.size() != (size_t)l.nx * l.nz) {
+        return false;
+    }
+    const LitterLeaf* leaves = (const LitterLeaf*)in.find("litter.leaves", &bytes);
+    uint64_t count = 0;
+    for (size_t c = 0; c < cells.size(); ++c) {
+        count += cells[c].count;
+    }
+    if (leaves == NULL || bytes != count * sizeof(LitterLeaf)) {
+        return false;
+    }
+    for (uint64_t j = 0; j < count; ++j) {
+        if (leaves[j].color >= LITTER_COLORS) {
+            return false;
+        }
+    }
+
+    m_nx = l.nx;
+    m_nz = l.nz;
+    m_x0 = l.x0;
+    m_z0 = l.z0;
+    m_cellX = l.cellX;
+    m_cellZ = l.cellZ;
+    m_groundY = l.groundY;
+    m_layer = l.layer;
+    m_leafArea = l.leafArea;
+    m_capacity = l.capacity;
+    m_budget = l.budget;
+    m_size = l.size;
+    m_total = l.total;
+    m_cells.resize(cells.size());
+    for (size_t c = 0; c < cells.size(); ++c) {
+        LitterCell& cell = m_cells[c];
+        cell.leaves.assign(leaves, leaves + cells[c].count);
+        leaves += cells[c].count;
+        cell.head = cells[c].head;
+        cell.buried = cells[c].buried;
+        memcpy(cell.colorCounts, cells[c].colorCounts, sizeof(cell.colorCounts));
+        cell.version = ++m_version;
+    }
+    return true;
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include "LeafBatch3D.hpp"
+#include "../SelfTest.hpp"
+
+int
+main( int argc, char *argv[ ] )
+{
+	std::mt19937 rng( 11 );
+	std::uniform_real_distribution<float> u( 0.f, 1.f );
+
+	// 1) Leaves dropped from 3 m in a breeze land, lie flat and settle
+	{
+		const uint32_t N = 1000;
+		const float STEP = 1.f / 60.f;
+		const int SUBSTEPS = 128;
+		LeafBatch3D batch;
+		for( uint32_t i = 0; i < N; i++ )
+		{
+			LeafParams p = { 0.01f * ( 0.8f + 0.4f*u(rng) ), 0.1f, 0.1f, 4.1f, 0.9f };
+			float q[4] = { u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f, u(rng) - 0.5f };
+			float len = sqrtf( q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3] );
+			LeafState3D s = { 0.f, 3.f, 0.f, q[0]/len, q[1]/len, q[2]/len, q[3]/len, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
+			batch.add( s, p );
+			batch.SetWind( i, 1.f + u(rng), 0.f, u(rng) - 0.5f );
+		}
+
+		GroundContact ground;
+		std::vector<uint32_t> settled;
+		uint32_t numSettled = 0, numTilted = 0, numOff = 0;
+		float lastSettle = 0.f;
+		for( int k = 0; k < 60 * 30 && batch.size( ) > 0; k++ )
+		{
+			for( int j = 0; j < SUBSTEPS; j++ )
+				batch.step( STEP / SUBSTEPS );
+			settled.clear( );
+			batch.collideGround( ground, STEP, &settled );
+			for( size_t j = settled.size( ); j-- > 0; )
+			{
+				uint32_t i = settled[j];
+				float m[16];
+				batch.GetTransform( i, 1.f, m );
+				if( fabsf( m[5] ) < 0.98f )		// normal not within ~11 deg of vertical
+					numTilted++;
+				if( fabsf( m[13] - ground.groundY ) > 0.01f )
+					numOff++;
+				batch.remove( i );
+				numSettled++;
+				lastSettle = k * STEP;
+			}
+		}
+		fprintf( stderr, "%u of %u leaves settled, the last after %.1f s\n", numSettled, N, lastSettle );
+		Check( numSettled == N, "every leaf comes to rest" );
+		Check( numTilted == 0, "resting leaves lie flat" );
+		Check( numOff == 0, "resting leaves are on the ground" );
+	}
+
+	// 2) Millions of leaves into a bounded litter: newest kept, counts add up
+	{
+		const int CELLS = 50;
+		const uint32_t LEAVES = 2000000;
+		LeafLitter litter;
+		litter.setGrid( -200.f, -200.f, 200.f, 200.f, CELLS, CELLS, 0.f );
+		litter.setCapacity( 64, 100000 );
+		litter.setLayerThickness( 0.002f );
+		litter.setLeafArea( 4.f );
+
+		std::vector< std::vector<uint32_t> > landed( CELLS * CELLS );
+		uint32_t outside = 0;
+		auto t0 = std::chrono::high_resolution_clock::now( );
+		for( uint32_t n = 0; n < LEAVES; n++ )
+		{
+			// heaped under the tree, some blown off the grid
+			LitterLeaf leaf;
+			memset( &leaf, 0, sizeof(leaf) );
+			float r = 220.f * u(rng) * u(rng), a = 6.2831853f * u(rng);
+			leaf.x = r * cosf( a );
+			leaf.z = r * sinf( a );
+			leaf.yaw = (float)n;		// the leaf's number, to check which ones are kept
+			leaf.color = (uint8_t)( n % 5 );
+			if( litter.add( leaf ) )
+			{
+				int c = (int)std::floor( ( leaf.z + 200.f ) / 8.f ) * CELLS + (int)std::floor( ( leaf.x + 200.f ) / 8.f );
+				landed[c].push_back( n );
+			}
+			else
+				outside++;
+		}
+		double addMs = std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+
+		uint64_t buried = 0;
+		bool newest = true, pile = true;
+		float maxCoverage = 0.f;
+		for( int c = 0; c < litter.GetNumCells( ); c++ )
+		{
+			const LitterCell &cell = litter.GetCell( c );
+			buried += cell.buried;
+			maxCoverage = std::max( maxCoverage, litter.GetCoverage( c ) );
+
+			std::vector<uint32_t> kept;
+			for( size_t j = 0; j < cell.leaves.size( ); j++ )
+			{
+				kept.push_back( (uint32_t)cell.leaves[j].yaw );
+				pile = pile && cell.leaves[j].y > 0.f && cell.leaves[j].y <= 0.002f * 65.f;
+			}
+			std::sort( kept.begin( ), kept.end( ) );
+			std::vector<uint32_t> &all = landed[c];
+			newest = newest && kept.size( ) <= all.size( ) &&
+				std::equal( kept.begin( ), kept.end( ), all.end( ) - kept.size( ) );
+		}
+
+		fprintf( stderr, "%u leaves (%u off the grid) in %.1f ms, %.1f ns/leaf: %u kept, %u per cell\n",
+			LEAVES, outside, addMs, 1.e6 * addMs / LEAVES, litter.size( ), litter.GetCapacity( ) );
+		Check( litter.GetTotal( ) == LEAVES - outside, "every leaf on the grid is counted" );
+		Check( litter.size( ) <= 100000, "the litter stays within its budget" );
+		Check( litter.size( ) + buried == litter.GetTotal( ), "kept + buried = landed" );
+		Check( newest, "each cell keeps its newest leaves" );
+		Check( pile, "leaves are stacked just above the ground" );
+		Check( maxCoverage <= 1.f && maxCoverage > 0.99f, "coverage saturates at 1 under the tree" );
+
+		float palette[LITTER_COLORS][3] = { { 1.f, 0.f, 0.f }, { 0.f, 1.f, 0.f }, { 0.f, 0.f, 1.f }, { 1.f, 1.f, 1.f }, { 0.f, 0.f, 0.f } };
+		float rgb[3];
+		int centre = ( CELLS / 2 ) * CELLS + CELLS / 2;
+		litter.GetMeanColor( centre, palette, rgb );
+		Check( fabsf( rgb[0] - 0.4f ) < 0.01f && fabsf( rgb[1] - 0.4f ) < 0.01f, "mean color follows the color counts" );
+
+		uint32_t version = litter.GetCell( centre ).version;
+		litter.compact( 8 );
+		Check( litter.GetCell( centre ).leaves.size( ) == 8 && litter.GetCell( centre ).version != version,
+			"compact() thins a cell and bumps its version" );
+	}
+
+	return CheckResult( );
+}
+#endif
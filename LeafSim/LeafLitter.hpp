@@ -0,0 +1,95 @@
+#ifndef LEAFLITTER_HPP
+#define LEAFLITTER_HPP
+#include <vector>
+#include <cstdint>
+
+class SnapshotWriter;
+class Snapshot;
+
+// Leaf colors a palette has (FinalProject's LEAF_PALETTE); a leaf's color
+// indexes it
+enum { LITTER_COLORS = 5 };
+
+// One leaf lying on the ground, flat: rotated by yaw about +y (and turned
+// over when flipped), in scene units
+struct LitterLeaf {
+    float x, y, z;
+    float yaw;              // radians
+    uint8_t color;         // palette index, < LITTER_COLORS
+    uint8_t flipped;        // lying upside down
+    uint16_t pad;
+};
+
+// The leaves of one cell.  Slots are filled in landing order; once the cell
+// is at capacity each new leaf takes the oldest one's slot (it lies on top,
+// the old one is buried).  Leaves land at random spots in a cell, so any
+// prefix of 'leaves' is an even spread over it: drawing the first n / k of
+// them is a k-times thinner carpet.
+struct LitterCell {
+    std::vector<LitterLeaf> leaves;
+    uint32_t head;                          // the oldest slot once full
+    uint64_t buried;                        // leaves given up to newer ones
+    uint32_t colorCounts[LITTER_COLORS];  // every leaf that landed here
+    uint32_t version;                       // changes whenever the cell does
+};
+
+// Fallen leaves on the ground, binned into a grid of cells over x, z so a
+// renderer can cull, cache (per cell, by version) and thin them per cell.
+//
+// Memory stays bounded however long the scene runs: a cell keeps at most
+// GetCapacity() leaves, and when all cells together go over the budget the
+// capacity is halved and every cell compacted to its newest leaves.  What is
+// left of a cell beyond its leaves is its coverage and mean color, enough
+// for a flat far-away stand-in.
+class LeafLitter {
+public:
+    LeafLitter();
+
+    // nx * nz cells over [x0, x1] x [z0, z1], ground at groundY; clears
+    void setGrid(float x0, float z0, float x1, float z1, int nx, int nz, float groundY);
+    // leaves kept per cell, and in all cells together
+    void setCapacity(uint32_t perCell, uint32_t budget);
+    // how much each leaf lifts the ones landing after it (against z-fighting)
+    void setLayerThickness(float thickness) { m_layer = thickness; }
+    // area one leaf covers, for GetCoverage()
+    void setLeafArea(float area) { m_leafArea = area; }
+    void clear();
+
+    // Lay a leaf down at (leaf.x, leaf.z); y is set from the pile already in
+    // the cell.  False (and nothing stored) outside the grid.
+    bool add(const LitterLeaf& leaf);
+
+    uint32_t size() const { return m_size; }            // leaves stored
+    uint64_t GetTotal() const { return m_total; }       // leaves ever added
+    uint32_t GetCapacity() const { return m_capacity; }
+
+    int GetNumCells() const { return m_nx * m_nz; }
+    const LitterCell& GetCell(int c) const { return m_cells[c]; }
+    void GetCellBounds(int c, float* lo, float* hi) const;
+    // fraction of the cell's ground covered (1 at most), counting buried leaves
+    float GetCoverage(int c) const;
+    // color-count weighted mean of palette[LITTER_COLORS][3]
+    void GetMeanColor(int c, const float palette[][3], float* rgb) const;
+
+    // Keep only the newest perCell leaves of every cell
+    void compact(uint32_t perCell);
+
+    // Snapshots (Snapshot.hpp): the grid, capacity and every cell.  load() is
+    // false (and the litter untouched) if the snapshot has none or it is
+    // damaged (a leaf's color past the palette included); every cell gets a
+    // new version.
+    void save(SnapshotWriter& out) const;
+    bool load(const Snapshot& in);
+
+private:
+    std::vector<LitterCell> m_cells;
+    int m_nx, m_nz;
+    float m_x0, m_z0, m_cellX, m_cellZ;
+    float m_groundY, m_layer, m_leafArea;
+    uint32_t m_capacity, m_budget;
+    uint32_t m_size;
+    uint64_t m_total;
+    uint32_t m_version;             // last version handed out; never reset
+};
+
+#endif // LEAFLITTER_HPP
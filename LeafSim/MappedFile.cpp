@@ -0,0 +1,87 @@
+#include "MappedFile.hpp"
+#include <cstdio>
+
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+    : m_base(NULL)
+    , m_size(0)
+    , m_mapped(false)
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char* path, const char* what)
+{
+    close();
+
+#ifndef _WIN32
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open %s '%s'\n", what, path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        fprintf(stderr, "The %s '%s' is empty\n", what, path);
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);            // the mapping keeps the file
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Cannot map %s '%s'\n", what, path);
+        return false;
+    }
+    m_base = (const unsigned char*)p;
+    m_size = (size_t)st.st_size;
+    m_mapped = true;
+#else
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s '%s'\n", what, path);
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    unsigned char* copy = (size > 0) ? new unsigned char[size] : NULL;
+    if (copy == NULL || fread(copy, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "Cannot read %s '%s'\n", what, path);
+        delete[] copy;
+        fclose(fp);
+        return false;
+    }
+    fclose(fp);
+    m_base = copy;
+    m_size = (size_t)size;
+    m_mapped = false;
+#endif
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_base != NULL) {
+#ifndef _WIN32
+        if (m_mapped) {
+            munmap((void*)m_base, m_size);
+        }
+#endif
+        if (!m_mapped) {
+            delete[] m_base;
+        }
+    }
+    m_base = NULL;
+    m_size = 0;
+    m_mapped = false;
+}
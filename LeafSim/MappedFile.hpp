@@ -0,0 +1,32 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+#include <cstddef>
+
+// A whole file in memory, read-only: mapped with mmap, or read into a heap
+// copy where there is none (_WIN32).  The formats read in place
+// (TrajectoryDb, Snapshot) open one of these and check their own header on
+// top of it.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    // what names the file in messages ("snapshot"); false (with a message)
+    // if it is missing, empty or can't be read
+    bool open(const char* path, const char* what);
+    void close();
+    bool isOpen() const { return m_base != NULL; }
+
+    const unsigned char* GetData() const { return m_base; }
+    size_t GetSize() const { return m_size; }
+
+private:
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const unsigned char* m_base;
+    size_t m_size;
+    bool m_mapped;              // false: m_base is a heap copy
+};
+
+#endif // MAPPEDFILE_HPP
@@ -0,0 +1,433 @@
+// Self-test: make libleafsim.a && g++ -std=c++11 -O2 -DTEST -o motiongraphtest LeafSim/MotionGraph.cpp -L. -lleafsim -pthread
+#include "MotionGraph.hpp"
+#include "TrajectoryDb.hpp"
+#include "TrajectoryIndex.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+static const int MAX_CANDIDATES = 16;   // nearest frames looked at per source frame
+static const int MAX_PER_FRAME = 4;     // optional transitions kept per source frame
+
+static const char MAGIC[4] = { 'L', 'M', 'G', 'R' };
+enum { MOTION_GRAPH_VERSION = 1 };
+
+struct MotionGraphHeader {
+    char     magic[4];
+    uint32_t version;
+    uint32_t numClips;
+    uint32_t numTransitions;
+    uint64_t dbFileSize;        // of the database it was built from
+    uint64_t dbTotalSamples;
+};
+
+MotionGraphSettings::MotionGraphSettings()
+    : stride(5)
+    , minRemaining(20)
+    , minLoopBack(50)
+    , thetaTolerance(0.1f)
+    , velocityTolerance(0.05f)
+    , omegaTolerance(0.2f)
+    , paramTolerance(0.01f)
+{
+}
+
+MotionGraph::MotionGraph()
+    : m_db(NULL)
+{
+    m_clipFirst.assign(1, 0);
+}
+
+static uint64_t TotalSamples(const TrajectoryDb& db)
+{
+    uint64_t n = 0;
+    for (int c = 0; c < db.GetNumTrajectories(); ++c) {
+        n += db.GetRecord(c).numSamples;
+    }
+    return n;
+}
+
+void MotionGraph::build(const TrajectoryDb& db, const MotionGraphSettings& settings)
+{
+    m_db = &db;
+    int numClips = db.GetNumTrajectories();
+    int stride = std::max(1, settings.stride);
+
+    // 1) Candidate targets: every stride-th frame with enough clip left after it
+    std::vector<float> keys;
+    std::vector<int> pointClip, pointFrame;
+    double paramSum[5] = { 0., 0., 0., 0., 0. };
+    for (int c = 0; c < numClips; ++c) {
+        const TrajectoryRecord& rec = db.GetRecord(c);
+        FlutterParams params = db.GetParams(c);
+        const double p[5] = { params.mass, params.width, params.height, params.dragCoeffPerp, params.dragCoeffPara };
+        for (int k = 0; k < 5; ++k) {
+            paramSum[k] += std::fabs(p[k]);
+        }
+        for (int f = 0; f + settings.minRemaining < (int)rec.numSamples; f += stride) {
+            float state[FLUTTER_DIM], key[TRAJECTORY_KEY_DIM];
+            db.getSample(c, f, state);
+            MakeTrajectoryKey(state, params, key);
+            keys.insert(keys.end(), key, key + TRAJECTORY_KEY_DIM);
+            pointClip.push_back(c);
+            pointFrame.push_back(f);
+        }
+    }
+
+    // distance 1 = at the tolerance in every dimension
+    float scale[TRAJECTORY_KEY_DIM];
+    scale[KEY_THETA] = 1.f / settings.thetaTolerance;
+    scale[KEY_VX] = scale[KEY_VY] = 1.f / settings.velocityTolerance;
+    scale[KEY_OMEGA] = 1.f / settings.omegaTolerance;
+    for (int k = 0; k < 5; ++k) {
+        double typical = (numClips > 0) ? paramSum[k] / numClips : 0.;
+        scale[KEY_MASS + k] = (typical > 0.) ? (float)(1. / (settings.paramTolerance * typical)) : 0.f;
+    }
+    TrajectoryIndex index;
+    index.build(keys.empty() ? NULL : &keys[0], (int)pointClip.size());
+    index.setScale(scale);
+
+    // 2) Sources: the same stride-th frames (after the first) and each last frame
+    m_transitions.clear();
+    m_clipFirst.assign(1, 0);
+    for (int c = 0; c < numClips; ++c) {
+        const TrajectoryRecord& rec = db.GetRecord(c);
+        FlutterParams params = db.GetParams(c);
+        int last = (int)rec.numSamples - 1;
+
+        for (int f = stride; last > 0; f += stride) {
+            bool atEnd = (f >= last);
+            if (atEnd) {
+                f = last;
+            }
+            float state[FLUTTER_DIM], key[TRAJECTORY_KEY_DIM];
+            db.getSample(c, f, state);
+            MakeTrajectoryKey(state, params, key);
+
+            int ids[MAX_CANDIDATES];
+            float dist[MAX_CANDIDATES];
+            int found = index.findNearest(key, MAX_CANDIDATES, ids, dist);
+            int kept = 0;
+            for (int i = 0; i < found; ++i) {
+                int toClip = pointClip[ids[i]], toFrame = pointFrame[ids[i]];
+                bool valid = (toClip != c || toFrame <= f - settings.minLoopBack) &&
+                             db.GetRecord(toClip).dt == rec.dt;
+                if (!valid) {
+                    continue;
+                }
+                // mid-clip: only close matches; at the end: the best there is
+                if (!atEnd && (dist[i] > 1.f || kept >= MAX_PER_FRAME)) {
+                    break;
+                }
+                MotionTransition t = { (uint32_t)f, (uint32_t)toClip, (uint32_t)toFrame, dist[i] };
+                m_transitions.push_back(t);
+                if (++kept == 1 && atEnd) {
+                    break;
+                }
+            }
+            if (atEnd) {
+                break;
+            }
+        }
+        m_clipFirst.push_back((uint32_t)m_transitions.size());
+    }
+}
+
+const MotionTransition* MotionGraph::GetTransitions(int clip, int* count) const
+{
+    *count = (int)(m_clipFirst[clip + 1] - m_clipFirst[clip]);
+    return *count > 0 ? &m_transitions[m_clipFirst[clip]] : NULL;
+}
+
+const MotionTransition* MotionGraph::findTransitions(int clip, int frame, int* count) const
+{
+    int n;
+    const MotionTransition* t = GetTransitions(clip, &n);
+    const MotionTransition* end = t + n;
+    const MotionTransition* first = std::lower_bound(t, end, (uint32_t)frame,
+        [](const MotionTransition& a, uint32_t f) { return a.fromFrame < f; });
+    const MotionTransition* stop = first;
+    while (stop != end && stop->fromFrame == (uint32_t)frame) {
+        ++stop;
+    }
+    *count = (int)(stop - first);
+    return *count > 0 ? first : NULL;
+}
+
+bool MotionGraph::save(const char* path) const
+{
+    MotionGraphHeader h;
+    std::memset(&h, 0, sizeof(h));
+    std::memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.version = MOTION_GRAPH_VERSION;
+    h.numClips = (uint32_t)GetNumClips();
+    h.numTransitions = (uint32_t)m_transitions.size();
+    h.dbFileSize = m_db ? m_db->GetFileSize() : 0;
+    h.dbTotalSamples = m_db ? TotalSamples(*m_db) : 0;
+
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open '%s' for writing\n", path);
+        return false;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1 &&
+              fwrite(&m_clipFirst[0], sizeof(uint32_t), m_clipFirst.size(), fp) == m_clipFirst.size() &&
+              (m_transitions.empty() ||
+               fwrite(&m_transitions[0], sizeof(MotionTransition), m_transitions.size(), fp) == m_transitions.size());
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error writing '%s'\n", path);
+    }
+    return ok;
+}
+
+bool MotionGraph::load(const char* path, const TrajectoryDb& db)
+{
+    FILE* fp = fopen(path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open motion graph '%s'\n", path);
+        return false;
+    }
+    MotionGraphHeader h;
+    bool ok = fread(&h, sizeof(h), 1, fp) == 1 && std::memcmp(h.magic, MAGIC, sizeof(MAGIC)) == 0 &&
+              h.version == MOTION_GRAPH_VERSION;
+    if (ok && (h.numClips != (uint32_t)db.GetNumTrajectories() || h.dbFileSize != db.GetFileSize() ||
+               h.dbTotalSamples != TotalSamples(db))) {
+        fprintf(stderr, "Motion graph '%s' was built from a different database\n", path);
+        fclose(fp);
+        return false;
+    }
+
+    std::vector<uint32_t> clipFirst;
+    std::vector<MotionTransition> transitions;
+    if (ok) {
+        clipFirst.resize(h.numClips + 1);
+        transitions.resize(h.numTransitions);
+        ok = fread(&clipFirst[0], sizeof(uint32_t), clipFirst.size(), fp) == clipFirst.size() &&
+             (transitions.empty() ||
+              fread(&transitions[0], sizeof(MotionTransition), transitions.size(), fp) == transitions.size());
+    }
+    fclose(fp);
+
+    // everything must point inside the database
+    for (uint32_t c = 0; ok && c < h.numClips; ++c) {
+        ok = clipFirst[c] <= clipFirst[c + 1] && clipFirst[c + 1] <= h.numTransitions;
+        for (uint32_t i = clipFirst[c]; ok && i < clipFirst[c + 1]; ++i) {
+            const MotionTransition& t = transitions[i];
+            ok = t.fromFrame < db.GetRecord(c).numSamples && t.toClip < h.numClips &&
+                 t.toFrame < db.GetRecord(t.toClip).numSamples;
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "'%s' is not a valid motion graph\n", path);
+        return false;
+    }
+
+    m_db = &db;
+    m_clipFirst.swap(clipFirst);
+    m_transitions.swap(transitions);
+    return true;
+}
+
+// -------------------------------------
+// MotionCursor
+// -------------------------------------
+MotionCursor::MotionCursor()
+    : m_graph(NULL)
+    , m_clip(0), m_frame(0)
+    , m_fraction(0.)
+    , m_branch(0.25f)
+    , m_rng(1)
+    , m_jumps(0)
+{
+    m_offset[0] = m_offset[1] = m_offset[2] = 0.f;
+}
+
+void MotionCursor::start(const MotionGraph* graph, int clip, int frame, float x, float y, uint32_t seed)
+{
+    m_graph = graph;
+    m_clip = clip;
+    m_frame = frame;
+    m_fraction = 0.;
+    m_rng = seed ? seed : 1;
+    m_jumps = 0;
+
+    float s[FLUTTER_DIM];
+    graph->GetDb()->getSample(clip, frame, s);
+    m_offset[0] = x - s[0];
+    m_offset[1] = y - s[1];
+    m_offset[2] = 0.f;
+}
+
+// xorshift32, in [0, 1)
+float MotionCursor::random()
+{
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+    return (m_rng >> 8) * (1.f / 16777216.f);
+}
+
+void MotionCursor::advance(double seconds)
+{
+    const TrajectoryDb* db = m_graph->GetDb();
+    double dt = db->GetRecord(m_clip).dt;
+    m_fraction += seconds / dt;
+    while (m_fraction >= 1.) {
+        int last = (int)db->GetRecord(m_clip).numSamples - 1;
+        if (m_frame >= last) {
+            m_fraction = 0.;        // dead end (no end transition): hold
+            return;
+        }
+        m_fraction -= 1.;
+        nextFrame();
+    }
+}
+
+void MotionCursor::nextFrame()
+{
+    m_frame++;
+    int n;
+    const MotionTransition* t = m_graph->findTransitions(m_clip, m_frame, &n);
+    if (n == 0) {
+        return;
+    }
+    int last = (int)m_graph->GetDb()->GetRecord(m_clip).numSamples - 1;
+    if (m_frame == last || random() < m_branch) {
+        jump(t[std::min(n - 1, (int)(random() * n))]);
+    }
+}
+
+void MotionCursor::jump(const MotionTransition& t)
+{
+    const TrajectoryDb* db = m_graph->GetDb();
+    float from[FLUTTER_DIM], to[FLUTTER_DIM];
+    db->getSample(m_clip, m_frame, from);
+    db->getSample(t.toClip, t.toFrame, to);
+
+    // keep drawing from where the leaf is; theta may differ by a multiple of pi
+    for (int i = 0; i < 3; ++i) {
+        m_offset[i] += from[i] - to[i];
+    }
+    m_clip = t.toClip;
+    m_frame = t.toFrame;
+    m_jumps++;
+}
+
+void MotionCursor::getState(float* state) const
+{
+    // linear between samples, or along the curves of a spline database
+    m_graph->GetDb()->evaluate(m_clip, m_frame + m_fraction, state);
+    for (int i = 0; i < 3; ++i) {
+        state[i] += m_offset[i];
+    }
+}
+
+//#define TEST
+#ifdef TEST
+
+#include "TrajectoryGen.hpp"
+#include "../SelfTest.hpp"
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *DB = "motiongraphtest_db.bin";
+	const char *GRAPH = "motiongraphtest_graph.bin";
+
+	// a small sweep of the default leaf: 3 s clips at 100 Hz
+	TrajectorySweep sweep;
+	sweep.theta = SweepRange( -1.2, 1.2, 7 );
+	sweep.vx = SweepRange( -0.5, 0.5, 3 );
+	std::vector<TrajectoryJob> jobs;
+	sweep.buildJobs( &jobs );
+
+	TrajectorySettings settings;
+	settings.samples = 300;
+	std::vector<Trajectory> clips;
+	GenerateTrajectories( jobs, settings, 1, &clips );
+
+	TrajectoryDbWriter writer;
+	for( size_t i = 0; i < clips.size( ); i++ )
+		writer.add( jobs[i].params, settings.rho, settings.g, settings.dt,
+			clips[i].states.data( ), clips[i].GetNumSamples( ) );
+	Check( writer.write( DB, ENCODING_FLOAT32 ), "database written" );
+
+	TrajectoryDb db;
+	Check( db.open( DB ), "database opened" );
+
+	MotionGraph graph;
+	graph.build( db, MotionGraphSettings( ) );
+	fprintf( stderr, "%d clips, %d transitions\n", graph.GetNumClips( ), graph.GetNumTransitions( ) );
+
+	bool allEnds = true, sorted = true;
+	for( int c = 0; c < graph.GetNumClips( ); c++ )
+	{
+		int n;
+		const MotionTransition *t = graph.GetTransitions( c, &n );
+		int last = (int)db.GetRecord( c ).numSamples - 1;
+		allEnds = allEnds && n > 0 && (int)t[n-1].fromFrame == last;
+		for( int i = 1; i < n; i++ )
+			sorted = sorted && t[i-1].fromFrame <= t[i].fromFrame;
+	}
+	Check( allEnds, "every clip has an end transition" );
+	Check( sorted, "transitions sorted by frame" );
+	Check( graph.GetNumTransitions( ) > graph.GetNumClips( ), "some mid-clip transitions" );
+
+	// a minute of falling, far longer than any clip
+	MotionCursor cursor;
+	cursor.start( &graph, 0, 0, 0.f, 100.f, 12345 );
+	float prev[FLUTTER_DIM], cur[FLUTTER_DIM];
+	cursor.getState( prev );
+	float maxError = 0.f;
+	for( int i = 0; i < 6000; i++ )
+	{
+		cursor.advance( 0.01 );
+		cursor.getState( cur );
+		// compare the step with what the velocities say it should be
+		float ex = cur[0] - prev[0] - 0.005f * ( cur[3] + prev[3] );
+		float ey = cur[1] - prev[1] - 0.005f * ( cur[4] + prev[4] );
+		maxError = std::max( maxError, std::hypot( ex, ey ) );
+		memcpy( prev, cur, sizeof(prev) );
+	}
+	fprintf( stderr, "60 s: %d jumps, fell %.1f m, largest step error %.4f m\n", cursor.GetJumps( ), 100.f - cur[1], maxError );
+	Check( cursor.GetJumps( ) >= 20, "walk continues through many clips" );
+	Check( 100.f - cur[1] > 20.f, "still falling after 60 s" );
+	Check( maxError < 0.005f, "position is continuous across jumps" );
+
+	// same seed, same walk
+	MotionCursor again;
+	again.start( &graph, 0, 0, 0.f, 100.f, 12345 );
+	again.advance( 60. );
+	Check( again.GetJumps( ) == cursor.GetJumps( ) && again.GetClip( ) == cursor.GetClip( ), "deterministic for a seed" );
+
+	// file round trip
+	Check( graph.save( GRAPH ), "graph saved" );
+	MotionGraph loaded;
+	Check( loaded.load( GRAPH, db ), "graph loaded" );
+	bool same = loaded.GetNumTransitions( ) == graph.GetNumTransitions( );
+	for( int c = 0; same && c < graph.GetNumClips( ); c++ )
+	{
+		int n0, n1;
+		const MotionTransition *t0 = graph.GetTransitions( c, &n0 );
+		const MotionTransition *t1 = loaded.GetTransitions( c, &n1 );
+		same = n0 == n1 && (n0 == 0 || memcmp( t0, t1, n0 * sizeof(MotionTransition) ) == 0);
+	}
+	Check( same, "loaded graph matches" );
+
+	// a graph from another database is refused
+	writer.clear( );
+	writer.add( jobs[0].params, settings.rho, settings.g, settings.dt, clips[0].states.data( ), clips[0].GetNumSamples( ) );
+	writer.write( DB, ENCODING_FLOAT32 );
+	TrajectoryDb other;
+	other.open( DB );
+	Check( ! loaded.load( GRAPH, other ), "graph for a different database rejected" );
+
+	db.close( );
+	other.close( );
+	remove( DB );
+	remove( GRAPH );
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,96 @@
+#ifndef MOTIONGRAPH_HPP
+#define MOTIONGRAPH_HPP
+#include <cstdint>
+#include <vector>
+
+class TrajectoryDb;
+
+// Motion graph over the clips of a trajectory database, so a leaf can fall
+// for longer than any stored clip.
+//
+// Offline, build() looks for frames where one clip's state (theta mod pi,
+// velocities, spin, same leaf) matches a frame of another clip, or an earlier
+// frame of the same one, within tolerance.  Those become transitions.  Every
+// clip also gets an end transition from its last frame to the best match
+// found, so a walk never runs out.  The table is stored per clip, sorted by
+// frame, 16 bytes a transition.
+//
+// At run time a MotionCursor plays a clip and takes the transitions at random
+// (always at a clip's end), offsetting x, y and theta so the motion stays
+// continuous.
+struct MotionTransition {
+    uint32_t fromFrame;
+    uint32_t toClip;
+    uint32_t toFrame;
+    float    cost;          // scaled state distance, <= 1 is within tolerance
+};
+
+struct MotionGraphSettings {
+    int   stride;           // frames between candidate transition points
+    int   minRemaining;     // a target needs at least this many frames after it
+    int   minLoopBack;      // same-clip jumps go back at least this many frames
+    float thetaTolerance;   // rad
+    float velocityTolerance;// m/s
+    float omegaTolerance;   // rad/s
+    float paramTolerance;   // relative, for the leaf parameters
+
+    MotionGraphSettings();
+};
+
+class MotionGraph {
+public:
+    MotionGraph();
+
+    void build(const TrajectoryDb& db, const MotionGraphSettings& settings);
+    bool save(const char* path) const;
+    // The graph must have been built from this database
+    bool load(const char* path, const TrajectoryDb& db);
+
+    const TrajectoryDb* GetDb() const { return m_db; }
+    int GetNumClips() const { return (int)m_clipFirst.size() - 1; }
+    int GetNumTransitions() const { return (int)m_transitions.size(); }
+
+    // Transitions out of a clip, sorted by fromFrame
+    const MotionTransition* GetTransitions(int clip, int* count) const;
+    // Those leaving at exactly 'frame'
+    const MotionTransition* findTransitions(int clip, int frame, int* count) const;
+
+private:
+    const TrajectoryDb* m_db;
+    std::vector<uint32_t> m_clipFirst;      // CSR: clip c owns [m_clipFirst[c], m_clipFirst[c+1])
+    std::vector<MotionTransition> m_transitions;
+};
+
+// One leaf walking the graph
+class MotionCursor {
+public:
+    MotionCursor();
+
+    // Start at a frame of a clip, drawn at (x, y)
+    void start(const MotionGraph* graph, int clip, int frame, float x, float y, uint32_t seed);
+    // probability of taking an optional transition when passing one (default 0.25)
+    void setBranchProbability(float p) { m_branch = p; }
+
+    void advance(double seconds);
+    // [x, y, theta, vx, vy, omega] at the current time
+    void getState(float* state) const;
+
+    int GetClip() const { return m_clip; }
+    int GetFrame() const { return m_frame; }
+    int GetJumps() const { return m_jumps; }
+
+private:
+    void nextFrame();
+    void jump(const MotionTransition& t);
+    float random();
+
+    const MotionGraph* m_graph;
+    int m_clip, m_frame;
+    double m_fraction;          // between m_frame and m_frame + 1
+    float m_offset[3];          // added to x, y, theta
+    float m_branch;
+    uint32_t m_rng;
+    int m_jumps;
+};
+
+#endif // MOTIONGRAPH_HPP
@@ -0,0 +1,14 @@
+#ifndef ODERHS_HPP
+#define ODERHS_HPP
+
+// Right-hand side of an ODE system y' = f(t, y).  Integrators only see this
+// interface, so a new leaf model (or a test problem) plugs in without touching
+// them.
+class OdeRhs {
+public:
+    virtual ~OdeRhs() {}
+    virtual int GetDimension() const = 0;
+    virtual void eval(double t, const double* y, double* dydt) const = 0;
+};
+
+#endif // ODERHS_HPP
@@ -0,0 +1,197 @@
+// Benchmark + check: g++ -std=c++11 -O2 -DBENCH -o simdmathbench LeafSim/SimdMath.cpp
+// (SimdMath.hpp is header-only; this file holds its accuracy check and timings.)
+#include "SimdMath.hpp"
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "../SelfTest.hpp"
+
+static double
+Ns( std::chrono::steady_clock::time_point t0, double count )
+{
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now( ) - t0 ).count( ) / count;
+}
+
+static bool
+HasAvx2( )
+{
+#ifdef SIMDMATH_X86
+	return __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" );
+#else
+	return false;
+#endif
+}
+
+// ulps between a float and the exact value
+static double
+Ulps( float got, double exact )
+{
+	double ulp = std::max( std::ldexp( 1., std::ilogb( (float)exact ) - 23 ), (double)std::numeric_limits<float>::denorm_min( ) );
+	return std::fabs( got - exact ) / ulp;
+}
+
+#ifdef SIMDMATH_X86
+__attribute__((target("avx2,fma")))
+static void
+SinCosAll8( const float *x, int n, float *s, float *c )
+{
+	for( int i = 0; i + 8 <= n; i += 8 )
+	{
+		__m256 vs, vc;
+		SinCos8( _mm256_loadu_ps( x + i ), &vs, &vc );
+		_mm256_storeu_ps( s + i, vs );
+		_mm256_storeu_ps( c + i, vc );
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void
+Atan2All8( const float *y, const float *x, int n, float *a )
+{
+	for( int i = 0; i + 8 <= n; i += 8 )
+		_mm256_storeu_ps( a + i, Atan2_8( _mm256_loadu_ps( y + i ), _mm256_loadu_ps( x + i ) ) );
+}
+
+__attribute__((target("avx2,fma")))
+static void
+InvSqrtAll8( const float *x, int n, float *r )
+{
+	for( int i = 0; i + 8 <= n; i += 8 )
+		_mm256_storeu_ps( r + i, InvSqrt8( _mm256_loadu_ps( x + i ) ) );
+}
+#endif
+
+int
+main( int argc, char *argv[ ] )
+{
+	const int N = 1 << 20;			// a multiple of 8
+	bool avx2 = HasAvx2( );
+	fprintf( stderr, "AVX2 + FMA: %s\n", avx2 ? "yes" : "no (8-wide kernels skipped)" );
+
+	// 1) Inputs: a sweep over the documented ranges plus the awkward points
+	std::vector<float> angle( N ), ys( N ), xs( N ), pos( N );
+	std::mt19937 rng( 3 );
+	std::uniform_real_distribution<float> u( -1.f, 1.f );
+	for( int i = 0; i < N; i++ )
+	{
+		angle[i] = ( i < N / 2 ) ? 8192.f * ( 2.f * i / N * 2.f - 1.f ) : 4.f * u( rng );
+		ys[i] = u( rng ) * std::pow( 10.f, 4.f * u( rng ) );
+		xs[i] = u( rng ) * std::pow( 10.f, 4.f * u( rng ) );
+		pos[i] = std::pow( 10.f, 30.f * u( rng ) );
+	}
+	const float edges[][2] = { { 0.f, 0.f }, { 0.f, 1.f }, { 1.f, 0.f }, { 0.f, -1.f }, { -1.f, 0.f },
+		{ 1.f, 1.f }, { -1.f, 1.f }, { 1.f, -1.f }, { -1.f, -1.f }, { 1.e-30f, 1.f }, { 1.f, -1.e-30f } };
+	for( int e = 0; e < (int)( sizeof( edges ) / sizeof( edges[0] ) ); e++ )
+	{
+		ys[e] = edges[e][0];
+		xs[e] = edges[e][1];
+	}
+	angle[0] = 0.f;
+	pos[0] = 1.f;
+
+	// 2) Accuracy against libm in double
+	std::vector<float> s( N ), c( N ), a( N ), r( N );
+	double sinErr = 0., atanErr = 0.;
+	for( int i = 0; i < N; i++ )
+	{
+		SinCos1( angle[i], &s[i], &c[i] );
+		sinErr = std::max( sinErr, std::max( std::fabs( s[i] - std::sin( (double)angle[i] ) ), std::fabs( c[i] - std::cos( (double)angle[i] ) ) ) );
+		a[i] = Atan2_1( ys[i], xs[i] );
+		double exact = ( ys[i] == 0.f && xs[i] == 0.f ) ? 0. : std::atan2( (double)ys[i], (double)xs[i] );
+		atanErr = std::max( atanErr, std::fabs( a[i] - exact ) );
+	}
+	fprintf( stderr, "SinCos1  worst %.2e   Atan2_1  worst %.2e\n", sinErr, atanErr );
+	Check( sinErr <= 8.e-8, "SinCos1 within 8e-8 for |x| <= 8192" );
+	Check( atanErr <= 3.e-7, "Atan2_1 within 3e-7" );
+	float big, bigC;
+	SinCos1( 1.e6f, &big, &bigC );
+	Check( big != big && bigC != bigC, "SinCos1 NaN past its range" );
+
+#ifdef SIMDMATH_X86
+	if( avx2 )
+	{
+		SinCosAll8( angle.data( ), N, s.data( ), c.data( ) );
+		Atan2All8( ys.data( ), xs.data( ), N, a.data( ) );
+		InvSqrtAll8( pos.data( ), N, r.data( ) );
+		double sin8 = 0., atan8 = 0., inv8 = 0.;
+		for( int i = 0; i < N; i++ )
+		{
+			sin8 = std::max( sin8, std::max( std::fabs( s[i] - std::sin( (double)angle[i] ) ), std::fabs( c[i] - std::cos( (double)angle[i] ) ) ) );
+			double exact = ( ys[i] == 0.f && xs[i] == 0.f ) ? 0. : std::atan2( (double)ys[i], (double)xs[i] );
+			atan8 = std::max( atan8, std::fabs( a[i] - exact ) );
+			inv8 = std::max( inv8, Ulps( r[i], 1. / std::sqrt( (double)pos[i] ) ) );
+		}
+		float zero[8] = { 0.f }, inf[8];
+		InvSqrtAll8( zero, 8, inf );
+		fprintf( stderr, "SinCos8  worst %.2e   Atan2_8  worst %.2e   InvSqrt8 worst %.1f ulp\n", sin8, atan8, inv8 );
+		Check( sin8 <= 8.e-8, "SinCos8 within 8e-8 for |x| <= 8192" );
+		Check( atan8 <= 3.e-7, "Atan2_8 within 3e-7" );
+		Check( inv8 <= 4., "InvSqrt8 within 4 ulp" );
+		Check( std::isinf( inf[0] ), "InvSqrt8(0) = inf" );
+	}
+#endif
+
+	// 3) Timings, ns per value
+	float sink = 0.f;
+	auto t0 = std::chrono::steady_clock::now( );
+	for( int i = 0; i < N; i++ )
+		sink += std::sin( angle[i] ) + std::cos( angle[i] );
+	double libmSin = Ns( t0, N );
+	t0 = std::chrono::steady_clock::now( );
+	for( int i = 0; i < N; i++ )
+	{
+		float si, co;
+		SinCos1( angle[i], &si, &co );
+		sink += si + co;
+	}
+	double sin1 = Ns( t0, N );
+	t0 = std::chrono::steady_clock::now( );
+	for( int i = 0; i < N; i++ )
+		sink += std::atan2( ys[i], xs[i] );
+	double libmAtan = Ns( t0, N );
+	t0 = std::chrono::steady_clock::now( );
+	for( int i = 0; i < N; i++ )
+		sink += Atan2_1( ys[i], xs[i] );
+	double atan1 = Ns( t0, N );
+	t0 = std::chrono::steady_clock::now( );
+	for( int i = 0; i < N; i++ )
+		sink += 1.f / std::sqrt( pos[i] );
+	double libmInv = Ns( t0, N );
+
+	fprintf( stderr, "\nns per value      libm   one at a time   8 at a time\n" );
+#ifdef SIMDMATH_X86
+	if( avx2 )
+	{
+		t0 = std::chrono::steady_clock::now( );
+		SinCosAll8( angle.data( ), N, s.data( ), c.data( ) );
+		double sin8 = Ns( t0, N );
+		t0 = std::chrono::steady_clock::now( );
+		Atan2All8( ys.data( ), xs.data( ), N, a.data( ) );
+		double atan8 = Ns( t0, N );
+		t0 = std::chrono::steady_clock::now( );
+		InvSqrtAll8( pos.data( ), N, r.data( ) );
+		double inv8 = Ns( t0, N );
+		sink += s[N / 3] + a[N / 3] + r[N / 3];
+		fprintf( stderr, "  sin + cos     %6.2f   %6.2f          %6.2f\n", libmSin, sin1, sin8 );
+		fprintf( stderr, "  atan2         %6.2f   %6.2f          %6.2f\n", libmAtan, atan1, atan8 );
+		fprintf( stderr, "  1 / sqrt      %6.2f        -          %6.2f\n", libmInv, inv8 );
+		Check( sin8 < libmSin && atan8 < libmAtan, "8-wide kernels beat libm" );
+	}
+	else
+#endif
+	{
+		fprintf( stderr, "  sin + cos     %6.2f   %6.2f\n", libmSin, sin1 );
+		fprintf( stderr, "  atan2         %6.2f   %6.2f\n", libmAtan, atan1 );
+		fprintf( stderr, "  1 / sqrt      %6.2f\n", libmInv );
+	}
+
+	fprintf( stderr, "[%g]\n", sink );
+	return CheckResult( );
+}
+#endif
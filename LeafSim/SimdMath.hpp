@@ -0,0 +1,185 @@
+#ifndef SIMDMATH_HPP
+#define SIMDMATH_HPP
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+// Polynomial sin/cos, atan2 and 1/sqrt for the batched integrators, one value
+// at a time and eight at a time with AVX2 + FMA.  Everything is static inline
+// so each file compiles them under its own floating-point rules (LeafBatch.cpp
+// turns FMA contraction off for its deterministic path).
+//
+// Largest errors against libm in double, from the LeafSim/SimdMath.cpp check:
+//
+//   SinCos1, SinCos8     8e-8 absolute for |x| <= 8192 (Cephes sinf/cosf:
+//                        reduction by pi/4 in three parts, degree 7 / 8
+//                        polynomials); NaN past 65536 (SinCos1) or garbage
+//                        (SinCos8), so keep angles wrapped on long runs
+//   Atan2_1, Atan2_8     3e-7 absolute, about an ulp of pi (Cephes atanf
+//                        after folding into [0, tan(pi/8)]); atan2(0, 0) = 0,
+//                        and the signs of zero are not honoured
+//   InvSqrt8             4 ulp (rsqrt and one Newton step); x = 0
+//                        gives +inf, as 1 / sqrt(0)
+//
+// sqrt itself is left to the hardware: _mm256_sqrt_ps and std::sqrt are
+// correctly rounded and cheap next to the trig.
+
+static const float SIMDMATH_PI = 3.14159265358979f;
+
+// sin and cos of x
+static inline void SinCos1(float x, float* s, float* c)
+{
+    float signSin = 1.f;
+    if (x < 0.f) {
+        x = -x;
+        signSin = -1.f;
+    }
+    if (!(x < 65536.f)) {
+        *s = *c = std::numeric_limits<float>::quiet_NaN();
+        return;
+    }
+
+    // j = octant rounded up to even; x - j * pi/4 with pi/4 split in three
+    int j = ((int)(x * 1.27323954473516f) + 1) & ~1;
+    float y = (float)j;
+    x = x - y * 0.78515625f;
+    x = x - y * 2.4187564849853515625e-4f;
+    x = x - y * 3.77489497744594108e-8f;
+    float z = x * x;
+
+    float pc = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z;
+    pc = pc - 0.5f * z + 1.f;
+    float ps = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z;
+    ps = ps * x + x;
+
+    bool swap = (j & 2) != 0;
+    if (j & 4) {
+        signSin = -signSin;
+    }
+    float signCos = ((j - 2) & 4) ? 1.f : -1.f;
+    *s = signSin * (swap ? pc : ps);
+    *c = signCos * (swap ? ps : pc);
+}
+
+// atan2(y, x) in [-pi, pi]
+static inline float Atan2_1(float y, float x)
+{
+    float ax = std::fabs(x), ay = std::fabs(y);
+    float hi = ax > ay ? ax : ay, lo = ax > ay ? ay : ax;
+    if (hi == 0.f) {
+        return 0.f;
+    }
+
+    // t = tan of the angle in [0, pi/4]; above tan(pi/8) turn it by -pi/4
+    float t = lo / hi, base = 0.f;
+    if (t > 0.414213562373095f) {
+        t = (t - 1.f) / (t + 1.f);
+        base = 0.25f * SIMDMATH_PI;
+    }
+    float z = t * t;
+    float p = (((8.05374449538e-2f * z - 1.38776856032e-1f) * z + 1.99777106478e-1f) * z - 3.33329491539e-1f) * z;
+    float a = base + (p * t + t);
+
+    if (ay > ax) {
+        a = 0.5f * SIMDMATH_PI - a;
+    }
+    if (x < 0.f) {
+        a = SIMDMATH_PI - a;
+    }
+    return y < 0.f ? -a : a;
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMDMATH_X86 1
+#include <immintrin.h>
+
+#define SIMDMATH_FN __attribute__((target("avx2,fma"))) static inline
+
+// SinCos1() on 8 lanes
+SIMDMATH_FN void SinCos8(__m256 x, __m256* s, __m256* c)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    __m256 signSin = _mm256_and_ps(x, signMask);
+    x = _mm256_andnot_ps(signMask, x);
+
+    // j = octant rounded up to even
+    __m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f)));
+    j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+    __m256 y = _mm256_cvtepi32_ps(j);
+
+    __m256 swapSignSin = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+    __m256 polyMask = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)), _mm256_setzero_si256()));
+    __m256 signCos = _mm256_castsi256_ps(_mm256_slli_epi32(
+        _mm256_andnot_si256(_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+    signSin = _mm256_xor_ps(signSin, swapSignSin);
+
+    // x - y * pi/4, with pi/4 split in three so the product is exact
+    x = _mm256_fmadd_ps(y, _mm256_set1_ps(-0.78515625f), x);
+    x = _mm256_fmadd_ps(y, _mm256_set1_ps(-2.4187564849853515625e-4f), x);
+    x = _mm256_fmadd_ps(y, _mm256_set1_ps(-3.77489497744594108e-8f), x);
+    __m256 z = _mm256_mul_ps(x, x);
+
+    // cos polynomial
+    __m256 pc = _mm256_set1_ps(2.443315711809948e-5f);
+    pc = _mm256_fmadd_ps(pc, z, _mm256_set1_ps(-1.388731625493765e-3f));
+    pc = _mm256_fmadd_ps(pc, z, _mm256_set1_ps(4.166664568298827e-2f));
+    pc = _mm256_mul_ps(_mm256_mul_ps(pc, z), z);
+    pc = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, pc);
+    pc = _mm256_add_ps(pc, _mm256_set1_ps(1.f));
+
+    // sin polynomial
+    __m256 ps = _mm256_set1_ps(-1.9515295891e-4f);
+    ps = _mm256_fmadd_ps(ps, z, _mm256_set1_ps(8.3321608736e-3f));
+    ps = _mm256_fmadd_ps(ps, z, _mm256_set1_ps(-1.6666654611e-1f));
+    ps = _mm256_fmadd_ps(_mm256_mul_ps(ps, z), x, x);
+
+    // pick per octant which polynomial is the sine and which the cosine
+    __m256 sinPart = _mm256_blendv_ps(pc, ps, polyMask);
+    __m256 cosPart = _mm256_blendv_ps(ps, pc, polyMask);
+    *s = _mm256_xor_ps(sinPart, signSin);
+    *c = _mm256_xor_ps(cosPart, signCos);
+}
+
+// Atan2_1() on 8 lanes
+SIMDMATH_FN __m256 Atan2_8(__m256 y, __m256 x)
+{
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    __m256 ax = _mm256_andnot_ps(signMask, x), ay = _mm256_andnot_ps(signMask, y);
+    __m256 hi = _mm256_max_ps(ax, ay), lo = _mm256_min_ps(ax, ay);
+
+    // lanes with x = y = 0 divide 0 by 1 and come out 0
+    __m256 zero = _mm256_cmp_ps(hi, _mm256_setzero_ps(), _CMP_EQ_OQ);
+    __m256 t = _mm256_div_ps(lo, _mm256_blendv_ps(hi, one, zero));
+    __m256 big = _mm256_cmp_ps(t, _mm256_set1_ps(0.414213562373095f), _CMP_GT_OQ);
+    t = _mm256_blendv_ps(t, _mm256_div_ps(_mm256_sub_ps(t, one), _mm256_add_ps(t, one)), big);
+    __m256 base = _mm256_and_ps(big, _mm256_set1_ps(0.25f * SIMDMATH_PI));
+
+    __m256 z = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(8.05374449538e-2f);
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-1.38776856032e-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(1.99777106478e-1f));
+    p = _mm256_fmadd_ps(p, z, _mm256_set1_ps(-3.33329491539e-1f));
+    __m256 a = _mm256_add_ps(base, _mm256_fmadd_ps(_mm256_mul_ps(p, z), t, t));
+
+    // unfold: past the diagonal, then into the left half, then the sign of y
+    a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(0.5f * SIMDMATH_PI), a), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+    a = _mm256_blendv_ps(a, _mm256_sub_ps(_mm256_set1_ps(SIMDMATH_PI), a), _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LT_OQ));
+    __m256 negative = _mm256_and_ps(_mm256_cmp_ps(y, _mm256_setzero_ps(), _CMP_LT_OQ), signMask);
+    return _mm256_xor_ps(a, negative);
+}
+
+// 1 / sqrt(x) for x >= 0
+SIMDMATH_FN __m256 InvSqrt8(__m256 x)
+{
+    __m256 r = _mm256_rsqrt_ps(x);
+    // r (1.5 - 0.5 x r^2); an infinite r (x = 0) is kept as it is
+    __m256 half = _mm256_mul_ps(_mm256_set1_ps(0.5f), x);
+    __m256 refined = _mm256_mul_ps(r, _mm256_fnmadd_ps(half, _mm256_mul_ps(r, r), _mm256_set1_ps(1.5f)));
+    __m256 finite = _mm256_cmp_ps(r, _mm256_set1_ps(std::numeric_limits<float>::infinity()), _CMP_LT_OQ);
+    return _mm256_blendv_ps(r, refined, finite);
+}
+
+#endif // x86
+
+#endif // SIMDMATH_HPP
@@ -0,0 +1,477 @@
+// Self-test: make libleafsim.a libjobs.a && g++ -std=c++11 -O2 -DTEST -o snapshottest LeafSim/Snapshot.cpp -L. -lleafsim -ljobs -pthread
+#include "Snapshot.hpp"
+#include <cstdio>
+#include <algorithm>
+
+static_assert(sizeof(SnapshotHeader) == 64, "SnapshotHeader layout changed");
+static_assert(sizeof(SnapshotChunk) == 32, "SnapshotChunk layout changed");
+
+static const char MAGIC[4] = { 'L', 'S', 'N', 'P' };
+static const uint64_t ALIGN = 64;   // a cache line, and enough for any SIMD load
+
+static inline uint64_t AlignUp(uint64_t offset)
+{
+    return (offset + ALIGN - 1) & ~(ALIGN - 1);
+}
+
+static void CopyTag(const char* tag, char* out)
+{
+    std::memset(out, 0, SNAPSHOT_TAG_SIZE);
+    std::strncpy(out, tag, SNAPSHOT_TAG_SIZE - 1);
+}
+
+// -------------------------------------
+// Writer
+// -------------------------------------
+void SnapshotWriter::clear()
+{
+    m_entries.clear();
+    m_copies.clear();
+}
+
+void SnapshotWriter::add(const char* tag, const void* data, uint64_t bytes)
+{
+    Entry e;
+    CopyTag(tag, e.tag);
+    e.data = data;
+    e.size = bytes;
+    m_entries.push_back(e);
+}
+
+void SnapshotWriter::addCopy(const char* tag, const void* data, uint64_t bytes)
+{
+    m_copies.push_back(std::vector<unsigned char>((const unsigned char*)data, (const unsigned char*)data + bytes));
+    add(tag, m_copies.back().data(), bytes);
+}
+
+bool SnapshotWriter::write(const char* path) const
+{
+    // 1) Layout: header, chunk table, then each chunk aligned
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.endianTag = SNAPSHOT_ENDIAN_TAG;
+    header.headerSize = sizeof(SnapshotHeader);
+    header.chunkSize = sizeof(SnapshotChunk);
+    header.numChunks = (uint32_t)m_entries.size();
+    header.chunksOffset = sizeof(SnapshotHeader);
+
+    std::vector<SnapshotChunk> chunks(m_entries.size());
+    uint64_t offset = header.chunksOffset + chunks.size() * sizeof(SnapshotChunk);
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        std::memcpy(chunks[i].tag, m_entries[i].tag, SNAPSHOT_TAG_SIZE);
+        offset = AlignUp(offset);
+        chunks[i].offset = offset;
+        chunks[i].size = m_entries[i].size;
+        offset += m_entries[i].size;
+    }
+    header.fileSize = offset;
+
+    // 2) Write straight from where the data lives, padding between chunks
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open '%s' for writing\n", path);
+        return false;
+    }
+    static const unsigned char zeros[ALIGN] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+    if (!chunks.empty()) {
+        ok = ok && fwrite(&chunks[0], sizeof(SnapshotChunk), chunks.size(), fp) == chunks.size();
+    }
+    uint64_t at = header.chunksOffset + chunks.size() * sizeof(SnapshotChunk);
+    for (size_t i = 0; i < chunks.size() && ok; ++i) {
+        ok = fwrite(zeros, 1, chunks[i].offset - at, fp) == chunks[i].offset - at;
+        if (ok && chunks[i].size > 0) {
+            ok = fwrite(m_entries[i].data, 1, chunks[i].size, fp) == chunks[i].size;
+        }
+        at = chunks[i].offset + chunks[i].size;
+    }
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error writing '%s'\n", path);
+    }
+    return ok;
+}
+
+// -------------------------------------
+// Reader
+// -------------------------------------
+Snapshot::Snapshot()
+    : m_header(NULL)
+    , m_chunks(NULL)
+{
+}
+
+Snapshot::~Snapshot()
+{
+    close();
+}
+
+bool Snapshot::open(const char* path)
+{
+    close();
+    if (!m_file.open(path, "snapshot")) {
+        return false;
+    }
+
+    if (!validate(path)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool Snapshot::validate(const char* path)
+{
+    const unsigned char* base = m_file.GetData();
+    size_t size = m_file.GetSize();
+    if (size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "'%s' is too small to be a snapshot\n", path);
+        return false;
+    }
+    const SnapshotHeader* h = (const SnapshotHeader*)base;
+    if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fprintf(stderr, "'%s' is not a snapshot\n", path);
+        return false;
+    }
+    if (h->endianTag != SNAPSHOT_ENDIAN_TAG) {
+        fprintf(stderr, "'%s' was written with the other byte order\n", path);
+        return false;
+    }
+    if (h->version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "'%s' is version %u, expected %d\n", path, h->version, SNAPSHOT_VERSION);
+        return false;
+    }
+    if (h->headerSize != sizeof(SnapshotHeader) || h->chunkSize != sizeof(SnapshotChunk) ||
+        h->fileSize != size || h->chunksOffset % 8 != 0 ||
+        h->chunksOffset + (uint64_t)h->numChunks * sizeof(SnapshotChunk) > size) {
+        fprintf(stderr, "'%s' has a damaged header\n", path);
+        return false;
+    }
+
+    const SnapshotChunk* chunks = (const SnapshotChunk*)(base + h->chunksOffset);
+    for (uint32_t c = 0; c < h->numChunks; ++c) {
+        if (chunks[c].offset % ALIGN != 0 || chunks[c].offset > size ||
+            chunks[c].size > size - chunks[c].offset) {
+            fprintf(stderr, "'%s': chunk %u points outside the file\n", path, c);
+            return false;
+        }
+    }
+
+    m_header = h;
+    m_chunks = chunks;
+    return true;
+}
+
+void Snapshot::close()
+{
+    m_file.close();
+    m_header = NULL;
+    m_chunks = NULL;
+}
+
+const void* Snapshot::find(const char* tag, uint64_t* bytes) const
+{
+    if (m_header == NULL) {
+        return NULL;
+    }
+    char key[SNAPSHOT_TAG_SIZE];
+    CopyTag(tag, key);
+    for (uint32_t c = 0; c < m_header->numChunks; ++c) {
+        if (std::memcmp(m_chunks[c].tag, key, SNAPSHOT_TAG_SIZE) == 0) {
+            *bytes = m_chunks[c].size;
+            return m_file.GetData() + m_chunks[c].offset;
+        }
+    }
+    return NULL;
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <chrono>
+#include <unistd.h>
+#include "LeafBatch3D.hpp"
+#include "WindField.hpp"
+#include "LeafLitter.hpp"
+#include "FixedStep.hpp"
+#include "Detachment.hpp"
+#include "../SelfTest.hpp"
+
+static float
+Ranf( uint32_t *seed, float low, float high )
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return low + ( high - low ) * (float)( *seed >> 8 ) / 16777216.f;
+}
+
+// n leaves scattered in a 10 m box, tumbling
+static void
+Fill( LeafBatch3D *batch, uint32_t n )
+{
+	uint32_t seed = 11;
+	for( uint32_t i = 0; i < n; i++ )
+	{
+		LeafState3D s;
+		s.px = Ranf( &seed, -5.f, 5.f );  s.py = Ranf( &seed, 0.f, 10.f );  s.pz = Ranf( &seed, -5.f, 5.f );
+		s.qw = 1.f;  s.qx = s.qy = s.qz = 0.f;
+		s.vx = s.vy = s.vz = 0.f;
+		s.wx = Ranf( &seed, -1.f, 1.f );  s.wy = Ranf( &seed, -1.f, 1.f );  s.wz = Ranf( &seed, -1.f, 1.f );
+		LeafParams p = { 0.01f * Ranf( &seed, 0.8f, 1.2f ), 0.1f, 0.1f, 4.1f, 0.9f };
+		batch->add( s, p );
+	}
+}
+
+static bool
+SameLeaves( const LeafBatch3D &a, const LeafBatch3D &b )
+{
+	if( a.size( ) != b.size( ) || a.GetNumAwake( ) != b.GetNumAwake( ) )
+		return false;
+	for( uint32_t i = 0; i < a.size( ); i++ )
+	{
+		LeafState3D sa = a.GetState( i ), sb = b.GetState( i );
+		if( memcmp( &sa, &sb, sizeof( sa ) ) != 0 || a.IsAsleep( i ) != b.IsAsleep( i ) )
+			return false;
+	}
+	return true;
+}
+
+static void
+Wind( LeafBatch3D *batch, const WindField &wind )
+{
+	for( uint32_t i = 0; i < batch->size( ); i++ )
+	{
+		float p[3] = { batch->GetPx( )[i], batch->GetPy( )[i], batch->GetPz( )[i] }, u[3];
+		wind.sample( p, u );
+		batch->SetWind( i, u[0], u[1], u[2] );
+	}
+}
+
+static float
+Exposed( uint32_t )
+{
+	return 1.f;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *SNAP = "snapshottest.snap";
+	const float DT = 1.f / 60.f;
+	const int SUBSTEPS = 128;           // the 3D model wants steps of about 1e-4 s
+
+	// 1) A scene a few seconds in: wind, falling leaves (some asleep), litter, a clock, a tree losing leaves
+	WindField wind;
+	const float lo[3] = { -10.f, 0.f, -10.f }, hi[3] = { 10.f, 15.f, 10.f };
+	wind.setGrid( lo, hi, 9, 7, 9 );
+	WindSettings ws;
+	ws.speed = 4.f;
+	wind.setSettings( ws );
+	LeafBatch3D leaves;
+	Fill( &leaves, 1000 );
+	FixedStepClock clock( 1. / 60., 5 );
+	LeafSleep sleep;
+	sleep.sleepSpeed = sleep.sleepSpin = 1.e3f;    // everything is slow enough:
+	sleep.sleepTime = 0.2f;                         // all asleep after 12 steps
+	sleep.wakeGust = 1.e3f;
+	std::vector<uint32_t> order;
+	for( int k = 0; k < 30; k++ )
+	{
+		clock.advance( DT );
+		wind.update( clock.GetSimTime( ) );
+		Wind( &leaves, wind );
+		leaves.step( DT / SUBSTEPS, SUBSTEPS );
+		if( k == 20 )
+			for( uint32_t i = 0; i < leaves.size( ); i += 3 )
+				leaves.wake( i );         // and a third woken again
+		leaves.updateSleep( sleep, DT, &order );
+	}
+	clock.advance( 0.3 * DT );
+	LeafLitter litter;
+	litter.setGrid( -10.f, -10.f, 10.f, 10.f, 8, 8, 0.f );
+	uint32_t seed = 5;
+	for( int i = 0; i < 5000; i++ )
+	{
+		LitterLeaf l = { Ranf( &seed, -10.f, 10.f ), 0.f, Ranf( &seed, -10.f, 10.f ), Ranf( &seed, 0.f, 6.f ), (uint8_t)( i % LITTER_COLORS ), (uint8_t)( i % 2 ), 0 };
+		litter.add( l );
+	}
+	std::vector<int> branch( 2000 );
+	std::vector<float> height( 2000 );
+	for( int i = 0; i < 2000; i++ )
+	{
+		branch[i] = i % 50;
+		height[i] = Ranf( &seed, 0.f, 15.f );
+	}
+	DetachScheduler detach;
+	detach.build( branch.data( ), height.data( ), 2000, 50 );
+	SpscQueue<uint32_t> queue( 4096 );
+	for( int k = 0; k < 60; k++ )
+		detach.schedule( 120.f, DT, 1000, Exposed, queue );
+	fprintf( stderr, "%u leaves, %u awake; %u litter; %u of 2000 attached\n", leaves.size( ), leaves.GetNumAwake( ), litter.size( ), detach.GetNumAttached( ) );
+
+	// 2) Save, and load into fresh objects
+	SnapshotWriter writer;
+	leaves.save( writer );
+	wind.save( writer );
+	litter.save( writer );
+	clock.save( writer );
+	detach.save( writer );
+	Check( writer.write( SNAP ), "snapshot written" );
+	Snapshot snap;
+	Check( snap.open( SNAP ), "snapshot opened" );
+
+	LeafBatch3D leaves2;
+	WindField wind2;
+	LeafLitter litter2;
+	FixedStepClock clock2( 1. / 60., 5 );
+	DetachScheduler detach2;
+	detach2.build( branch.data( ), height.data( ), 2000, 50 );
+	Check( leaves2.load( snap ) && wind2.load( snap ) && litter2.load( snap ) && clock2.load( snap ) && detach2.load( snap ),
+		"everything loaded" );
+	Check( SameLeaves( leaves, leaves2 ) && leaves.GetNumAwake( ) < leaves.size( ), "leaves and their sleep restored" );
+	Check( clock2.GetSteps( ) == clock.GetSteps( ) && clock2.GetAlpha( ) == clock.GetAlpha( ), "clock restored" );
+	bool litterSame = litter2.size( ) == litter.size( ) && litter2.GetTotal( ) == litter.GetTotal( );
+	for( int c = 0; c < litter.GetNumCells( ) && litterSame; c++ )
+	{
+		const LitterCell &a = litter.GetCell( c ), &b = litter2.GetCell( c );
+		litterSame = a.leaves.size( ) == b.leaves.size( ) && a.head == b.head && a.buried == b.buried &&
+			( a.leaves.empty( ) || memcmp( &a.leaves[0], &b.leaves[0], a.leaves.size( ) * sizeof( LitterLeaf ) ) == 0 );
+	}
+	Check( litterSame, "litter restored" );
+	bool attachedSame = detach2.GetNumAttached( ) == detach.GetNumAttached( );
+	for( uint32_t i = 0; i < 2000; i++ )
+		attachedSame = attachedSame && detach2.IsAttached( i ) == detach.IsAttached( i );
+	Check( attachedSame, "attached leaves restored" );
+
+	// 3) Carrying on from the snapshot is the same as carrying on from the original, to the bit
+	SpscQueue<uint32_t> queue2( 4096 );
+	while( queue.pop( &seed ) )
+		;
+	for( int k = 0; k < 30; k++ )
+	{
+		clock.advance( DT );
+		clock2.advance( DT );
+		wind.update( clock.GetSimTime( ) );
+		wind2.update( clock2.GetSimTime( ) );
+		Wind( &leaves, wind );
+		Wind( &leaves2, wind2 );
+		leaves.step( DT / SUBSTEPS, SUBSTEPS );
+		leaves2.step( DT / SUBSTEPS, SUBSTEPS );
+		detach.schedule( 120.f, DT, 1000, Exposed, queue );
+		detach2.schedule( 120.f, DT, 1000, Exposed, queue2 );
+	}
+	bool sameDetached = true;
+	uint32_t a, b;
+	while( queue.pop( &a ) )
+		sameDetached = sameDetached && queue2.pop( &b ) && a == b;
+	Check( SameLeaves( leaves, leaves2 ), "same leaves a half second on" );
+	Check( sameDetached && ! queue2.pop( &b ), "same leaves let go" );
+
+	// 4) Damaged, missing, or for something else
+	FixedStepClock other( 1. / 30., 5 );
+	Check( ! other.load( snap ), "clock with another step size refused" );
+	SnapshotWriter partial;
+	partial.add( "lb.meta", "x", 1 );
+	partial.write( SNAP );
+	snap.close( );
+	Check( snap.open( SNAP ), "reopened" );
+	LeafBatch3D untouched;
+	Fill( &untouched, 10 );
+	Check( ! untouched.load( snap ) && untouched.size( ) == 10, "incomplete leaves refused, batch untouched" );
+	Check( ! wind2.load( snap ) && ! litter2.load( snap ), "missing chunks refused" );
+	snap.close( );
+	writer.write( SNAP );
+	FILE *fp = fopen( SNAP, "r+b" );
+	if( fp != NULL )
+	{
+		fseek( fp, 0, SEEK_END );
+		long size = ftell( fp );
+		fclose( fp );
+		Check( truncate( SNAP, size / 2 ) == 0, "truncated" );
+	}
+	Check( ! snap.open( SNAP ) && ! snap.isOpen( ), "truncated file refused" );
+	Check( ! snap.open( "no_such_file.snap" ), "missing file refused" );
+
+	// a litter leaf with a color past the palette
+	LeafLitter one;
+	one.setGrid( -10.f, -10.f, 10.f, 10.f, 2, 2, 0.f );
+	LitterLeaf leaf = { 1.f, 0.f, 1.f, 0.f, 0, 0, 0 };
+	one.add( leaf );
+	SnapshotWriter oneWriter;
+	one.save( oneWriter );
+	oneWriter.write( SNAP );
+	SnapshotWriter badWriter;
+	uint64_t bytes = 0;
+	if( snap.open( SNAP ) )
+	{
+		const void *meta = snap.find( "litter", &bytes );
+		badWriter.addCopy( "litter", meta, bytes );
+		const void *cells = snap.find( "litter.cells", &bytes );
+		badWriter.addCopy( "litter.cells", cells, bytes );
+		memcpy( &leaf, snap.find( "litter.leaves", &bytes ), sizeof( leaf ) );
+		leaf.color = LITTER_COLORS;
+		badWriter.addCopy( "litter.leaves", &leaf, sizeof( leaf ) );
+		snap.close( );
+	}
+	badWriter.write( SNAP );
+	Check( snap.open( SNAP ) && ! litter2.load( snap ) && litter2.size( ) == litter.size( ), "litter color past the palette refused" );
+	snap.close( );
+
+	// detach slots that are not the tree's: two leaves in each other's
+	// branch (slots 0 and 40 are the first of branches 0 and 1), a leaf twice
+	SnapshotWriter detachWriter;
+	detach.save( detachWriter );
+	detachWriter.write( SNAP );
+	std::vector<unsigned char> meta;
+	std::vector<uint32_t> slots, counts;
+	if( snap.open( SNAP ) )
+	{
+		const unsigned char *d = (const unsigned char *)snap.find( "detach", &bytes );
+		meta.assign( d, d + bytes );
+		snap.read( "detach.slots", &slots );
+		snap.read( "detach.counts", &counts );
+		snap.close( );
+	}
+	bool refused = slots.size( ) == 2000;
+	for( int k = 0; k < 2 && refused; k++ )
+	{
+		std::vector<uint32_t> bad = slots;
+		if( k == 0 )
+			std::swap( bad[0], bad[40] );
+		else
+			bad[1] = bad[0];
+		SnapshotWriter badSlots;
+		badSlots.addCopy( "detach", meta.data( ), meta.size( ) );
+		badSlots.add( "detach.slots", bad );
+		badSlots.add( "detach.counts", counts );
+		badSlots.write( SNAP );
+		refused = snap.open( SNAP ) && ! detach2.load( snap ) && detach2.GetNumAttached( ) == detach.GetNumAttached( );
+		snap.close( );
+	}
+	Check( refused, "detach slots in the wrong branch or twice refused" );
+
+	// 5) Speed: a million leaves
+	LeafBatch3D big;
+	big.reserve( 1000000 );
+	Fill( &big, 1000000 );
+	auto t0 = std::chrono::steady_clock::now( );
+	SnapshotWriter bigWriter;
+	big.save( bigWriter );
+	bigWriter.write( SNAP );
+	auto t1 = std::chrono::steady_clock::now( );
+	Snapshot bigSnap;
+	LeafBatch3D big2;
+	bool loaded = bigSnap.open( SNAP ) && big2.load( bigSnap );
+	auto t2 = std::chrono::steady_clock::now( );
+	double saveMs = std::chrono::duration<double, std::milli>( t1 - t0 ).count( );
+	double loadMs = std::chrono::duration<double, std::milli>( t2 - t1 ).count( );
+	fprintf( stderr, "1M leaves, %.0f MB: save %.0f ms, load %.0f ms\n", bigSnap.GetFileSize( ) / 1.e6, saveMs, loadMs );
+	Check( loaded && SameLeaves( big, big2 ), "1M leaves restored" );
+	Check( loadMs < 1000., "1M leaves load in under a second" );
+
+	bigSnap.close( );
+	remove( SNAP );
+	return CheckResult( );
+}
+#endif
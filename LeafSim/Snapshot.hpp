@@ -0,0 +1,118 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <vector>
+#include "MappedFile.hpp"
+
+// Binary snapshot of simulation state (.snap), read in place through mmap.
+//
+//   SnapshotHeader                 64 bytes at offset 0
+//   SnapshotChunk[numChunks]       32 bytes each, at chunksOffset
+//   chunk data                     64-byte aligned, at chunk.offset
+//
+// A chunk is one tagged run of bytes: a per-leaf array, or a small struct
+// of scalars.  Each class that has state to keep writes and reads its own
+// chunks (LeafBatch3D::save() / load() and so on), so the arrays of a big
+// particle pool go to the file and come back with one memcpy each.
+// Everything is little endian; endianTag catches a mismatch.  Snapshots
+// are for the same build of the program: structs go in as they are laid out.
+
+enum {
+    SNAPSHOT_VERSION = 1,
+    SNAPSHOT_ENDIAN_TAG = 0x01020304,
+    SNAPSHOT_TAG_SIZE = 16          // tags are at most 15 characters
+};
+
+struct SnapshotHeader {
+    char     magic[4];          // "LSNP"
+    uint32_t version;
+    uint32_t endianTag;
+    uint32_t headerSize;        // sizeof(SnapshotHeader)
+    uint32_t chunkSize;         // sizeof(SnapshotChunk)
+    uint32_t numChunks;
+    uint64_t chunksOffset;
+    uint64_t fileSize;
+    uint32_t reserved[6];
+};
+
+struct SnapshotChunk {
+    char     tag[SNAPSHOT_TAG_SIZE];    // zero padded
+    uint64_t offset;
+    uint64_t size;              // bytes
+};
+
+// Collects chunks and writes them out in one go.  add() keeps only a
+// pointer, so the data must stay as it is until write(); addCopy() is for
+// small values that won't.
+class SnapshotWriter {
+public:
+    void clear();
+    void add(const char* tag, const void* data, uint64_t bytes);
+    void addCopy(const char* tag, const void* data, uint64_t bytes);
+    template <class T>
+    void add(const char* tag, const std::vector<T>& values) { add(tag, values.data(), values.size() * sizeof(T)); }
+    template <class T>
+    void addValue(const char* tag, const T& value) { addCopy(tag, &value, sizeof(T)); }
+
+    bool write(const char* path) const;
+
+private:
+    struct Entry {
+        char tag[SNAPSHOT_TAG_SIZE];
+        const void* data;
+        uint64_t size;
+    };
+    std::vector<Entry> m_entries;
+    std::list<std::vector<unsigned char> > m_copies;    // addCopy() data; a list, so it never moves
+};
+
+// Read-only view of a .snap file.  find() points into the mapping, and
+// pages are only read when touched.
+class Snapshot {
+public:
+    Snapshot();
+    ~Snapshot();
+
+    bool open(const char* path);      // false (with a message) if missing or malformed
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+    size_t GetFileSize() const { return m_file.GetSize(); }
+
+    // The chunk with this tag, in place (64-byte aligned); NULL if there is none
+    const void* find(const char* tag, uint64_t* bytes) const;
+    // A whole number of Ts from the chunk, into values; false if it is missing or doesn't divide
+    template <class T>
+    bool read(const char* tag, std::vector<T>* values) const
+    {
+        uint64_t bytes = 0;
+        const T* data = (const T*)find(tag, &bytes);
+        if (data == NULL || bytes % sizeof(T) != 0) {
+            return false;
+        }
+        values->assign(data, data + bytes / sizeof(T));
+        return true;
+    }
+    // Exactly one T; false if the chunk is missing or another size
+    template <class T>
+    bool readValue(const char* tag, T* value) const
+    {
+        uint64_t bytes = 0;
+        const void* data = find(tag, &bytes);
+        if (data == NULL || bytes != sizeof(T)) {
+            return false;
+        }
+        std::memcpy(value, data, sizeof(T));
+        return true;
+    }
+
+private:
+    bool validate(const char* path);
+
+    MappedFile m_file;
+    const SnapshotHeader* m_header;
+    const SnapshotChunk* m_chunks;
+};
+
+#endif // SNAPSHOT_HPP
@@ -0,0 +1,205 @@
+// Test: make libjobs.a && g++ -std=c++11 -O2 -DTEST -o spatialhashtest LeafSim/SpatialHash.cpp -L. -ljobs -pthread
+#include "SpatialHash.hpp"
+
+// below this many points per part, handing it out costs more than it saves
+static const uint32_t MIN_POINTS_PER_PART = 4096;
+static const uint32_t MIN_BUCKETS = 1024;
+
+// f(t) for every part t in [0, parts), over the job system if there is one
+template <class F>
+static void ForParts(JobSystem* jobs, int parts, F f)
+{
+    if (jobs == NULL) {
+        for (int t = 0; t < parts; ++t) {
+            f(t);
+        }
+        return;
+    }
+    jobs->parallelFor(0, (uint32_t)parts, 1, [&f](uint32_t t0, uint32_t t1) {
+        for (uint32_t t = t0; t < t1; ++t) {
+            f((int)t);
+        }
+    });
+}
+
+SpatialHash::SpatialHash()
+    : m_jobs(NULL)
+{
+    setCellSize(1.f);
+}
+
+void SpatialHash::setCellSize(float size)
+{
+    m_cellSize = size;
+    m_invCellSize = 1.f / size;
+    m_mask = 0;
+    m_bucketStart.assign(2, 0);
+    m_sorted.clear();
+}
+
+void SpatialHash::build(const float* x, const float* y, const float* z, uint32_t n)
+{
+    // 1) Twice as many buckets as points, so most cells have a bucket to themselves
+    uint32_t buckets = MIN_BUCKETS;
+    while (buckets < 2 * n) {
+        buckets *= 2;
+    }
+    m_mask = buckets - 1;
+
+    // one part per thread of the job system, as long as they are not too small
+    int parts = (m_jobs != NULL) ? m_jobs->GetNumThreads() : 1;
+    parts = (int)std::max(1u, std::min((uint32_t)parts, n / MIN_POINTS_PER_PART));
+
+    m_keys.resize(n);
+    m_sorted.resize(n);
+    m_bucketStart.resize(buckets + 1);
+    m_histograms.resize((size_t)parts * buckets);
+    std::vector<uint32_t> rangeTotal(parts + 1, 0);
+
+    // the same slices of points in passes 2 and 4, so the sort is stable
+    auto slice = [n, parts](int t, uint32_t* begin, uint32_t* end) {
+        *begin = (uint32_t)((uint64_t)n * t / parts);
+        *end = (uint32_t)((uint64_t)n * (t + 1) / parts);
+    };
+    auto range = [buckets, parts](int t, uint32_t* begin, uint32_t* end) {
+        *begin = (uint32_t)((uint64_t)buckets * t / parts);
+        *end = (uint32_t)((uint64_t)buckets * (t + 1) / parts);
+    };
+
+    // 2) Bucket of every point, counted per part
+    ForParts(m_jobs, parts, [&](int t) {
+        uint32_t* hist = &m_histograms[(size_t)t * buckets];
+        std::fill(hist, hist + buckets, 0u);
+        uint32_t begin, end;
+        slice(t, &begin, &end);
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t key = GetBucket(x[i], y[i], z[i]);
+            m_keys[i] = key;
+            hist[key]++;
+        }
+    });
+
+    // 3) Where each part writes each bucket: bucket-major, part-minor
+    //    offsets.  Totals of each part's range of buckets first, then the
+    //    prefix over ranges, then the offsets within a range.
+    ForParts(m_jobs, parts, [&](int t) {
+        uint32_t begin, end, sum = 0;
+        range(t, &begin, &end);
+        for (int h = 0; h < parts; ++h) {
+            const uint32_t* hist = &m_histograms[(size_t)h * buckets];
+            for (uint32_t b = begin; b < end; ++b) {
+                sum += hist[b];
+            }
+        }
+        rangeTotal[t + 1] = sum;
+    });
+    for (int t = 0; t < parts; ++t) {
+        rangeTotal[t + 1] += rangeTotal[t];
+    }
+    ForParts(m_jobs, parts, [&](int t) {
+        uint32_t begin, end, offset = rangeTotal[t];
+        range(t, &begin, &end);
+        for (uint32_t b = begin; b < end; ++b) {
+            m_bucketStart[b] = offset;
+            for (int h = 0; h < parts; ++h) {
+                uint32_t& count = m_histograms[(size_t)h * buckets + b];
+                uint32_t c = count;
+                count = offset;
+                offset += c;
+            }
+        }
+    });
+    m_bucketStart[buckets] = n;
+
+    // 4) Scatter
+    ForParts(m_jobs, parts, [&](int t) {
+        uint32_t* offsets = &m_histograms[(size_t)t * buckets];
+        uint32_t begin, end;
+        slice(t, &begin, &end);
+        for (uint32_t i = begin; i < end; ++i) {
+            m_sorted[offsets[m_keys[i]]++] = i;
+        }
+    });
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <stdio.h>
+#include <random>
+#include <set>
+#include <utility>
+#include "../SelfTest.hpp"
+
+int
+main( int argc, char *argv[ ] )
+{
+	const uint32_t N = 20000;
+	const float R = 0.1f;
+	std::mt19937 rng( 5 );
+	std::uniform_real_distribution<float> u( -2.f, 2.f );
+	std::vector<float> x( N ), y( N ), z( N );
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		x[i] = u(rng);
+		y[i] = 0.5f * u(rng);		// flattened, and straddling 0 (negative cells)
+		z[i] = u(rng);
+	}
+
+	// 1) Every pair closer than R, by brute force
+	std::set< std::pair<uint32_t, uint32_t> > brute;
+	for( uint32_t i = 0; i < N; i++ )
+		for( uint32_t j = i + 1; j < N; j++ )
+		{
+			float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+			if( dx*dx + dy*dy + dz*dz < R*R )
+				brute.insert( std::make_pair( i, j ) );
+		}
+
+	// 2) The same through the hash, single and multi-threaded
+	for( int threads = 1; threads <= 4; threads *= 4 )
+	{
+		JobSystem jobs( threads );
+		SpatialHash hash;
+		hash.setCellSize( threads == 1 ? R : 2.f * R );	// 27 cells, then 8
+		hash.setJobs( &jobs );
+		hash.build( x.data( ), y.data( ), z.data( ), N );
+
+		std::set< std::pair<uint32_t, uint32_t> > found;
+		bool once = true;
+		for( uint32_t i = 0; i < N; i++ )
+		{
+			std::vector<uint32_t> seen;
+			hash.forNeighbours( x[i], y[i], z[i], R, [&]( uint32_t j ) {
+				seen.push_back( j );
+				float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+				if( j > i && dx*dx + dy*dy + dz*dz < R*R )
+					found.insert( std::make_pair( i, j ) );
+			} );
+			std::sort( seen.begin( ), seen.end( ) );
+			once = once && std::unique( seen.begin( ), seen.end( ) ) == seen.end( );
+		}
+
+		// every point sorted exactly once, in its own bucket
+		std::vector<uint32_t> sorted( hash.GetSorted( ), hash.GetSorted( ) + N );
+		bool inBucket = true;
+		for( uint32_t b = 0; b < hash.GetNumBuckets( ); b++ )
+			for( uint32_t s = hash.GetBucketStart( )[b]; s < hash.GetBucketStart( )[b+1]; s++ )
+			{
+				uint32_t i = hash.GetSorted( )[s];
+				inBucket = inBucket && hash.GetBucket( x[i], y[i], z[i] ) == b;
+			}
+		std::sort( sorted.begin( ), sorted.end( ) );
+		bool permutation = true;
+		for( uint32_t i = 0; i < N; i++ )
+			permutation = permutation && sorted[i] == i;
+
+		fprintf( stderr, "%d thread(s): %u close pairs (brute force %u)\n", threads, (uint32_t)found.size( ), (uint32_t)brute.size( ) );
+		Check( found == brute, "the hash finds every close pair" );
+		Check( once, "no point is visited twice by one query" );
+		Check( permutation && inBucket, "build() sorts every point into its bucket" );
+	}
+
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,116 @@
+#ifndef SPATIALHASH_HPP
+#define SPATIALHASH_HPP
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "../Jobs/JobSystem.hpp"
+
+// Broad phase for many moving points: a uniform grid of cubes of side
+// GetCellSize(), hashed into a power-of-two table (so the grid is unbounded),
+// rebuilt from scratch every tick.
+//
+// build() is a counting sort of the points by bucket, split into parts over
+// the job system in three passes: every part hashes a slice of the points
+// into its own histogram; the histograms are turned into per-part write
+// offsets, a range of buckets per part; and every part scatters its slice.
+// The result is one array of point indices grouped by bucket (in index order
+// within a bucket, however many threads ran it), plus where each bucket
+// starts, with no atomics and no per-point allocation.
+//
+// Two cells can share a bucket, so the points handed to a query are
+// candidates: the caller still checks the distance.
+class SpatialHash {
+public:
+    SpatialHash();
+
+    void setCellSize(float size);                           // clears
+    float GetCellSize() const { return m_cellSize; }
+    void setJobs(JobSystem* jobs) { m_jobs = jobs; }        // NULL = all on the calling thread
+
+    void build(const float* x, const float* y, const float* z, uint32_t n);
+
+    uint32_t GetNumBuckets() const { return (uint32_t)m_bucketStart.size() - 1; }
+    uint32_t GetBucket(float x, float y, float z) const;
+    // the points of bucket b: GetSorted()[GetBucketStart()[b] .. GetBucketStart()[b + 1])
+    const uint32_t* GetBucketStart() const { return m_bucketStart.data(); }
+    const uint32_t* GetSorted() const { return m_sorted.data(); }
+
+    // f(index) for every point in the cells the cube of half-side radius
+    // (at most GetCellSize()) about (x, y, z) touches, each once: everything
+    // within radius of it, and some more.  A radius of at most half the cell
+    // size touches at most 8 cells, at most the cell size 27.
+    template <class F> void forNeighbours(float x, float y, float z, float radius, F f) const;
+    // the same, but f(slot) with the point GetSorted()[slot], for callers
+    // that keep their data in sorted order too
+    template <class F> void forNeighbourSlots(float x, float y, float z, float radius, F f) const;
+
+private:
+    static uint32_t Hash(int32_t i, int32_t j, int32_t k)
+    {
+        return (uint32_t)i * 73856093u ^ (uint32_t)j * 19349663u ^ (uint32_t)k * 83492791u;
+    }
+    int32_t Cell(float v) const
+    {
+        // floor without the libm call (no SSE4.1 round at -O2)
+        float f = v * m_invCellSize;
+        int32_t c = (int32_t)f;
+        return c - (f < (float)c);
+    }
+
+    float m_cellSize, m_invCellSize;
+    JobSystem* m_jobs;
+    uint32_t m_mask;                        // number of buckets - 1
+
+    std::vector<uint32_t> m_bucketStart;    // per bucket, + 1 at the end
+    std::vector<uint32_t> m_sorted;         // point indices, grouped by bucket
+    std::vector<uint32_t> m_keys;           // bucket of every point
+    std::vector<uint32_t> m_histograms;     // per part, per bucket
+};
+
+inline uint32_t SpatialHash::GetBucket(float x, float y, float z) const
+{
+    return Hash(Cell(x), Cell(y), Cell(z)) & m_mask;
+}
+
+template <class F>
+void SpatialHash::forNeighbours(float x, float y, float z, float radius, F f) const
+{
+    const uint32_t* sorted = m_sorted.data();
+    forNeighbourSlots(x, y, z, radius, [sorted, &f](uint32_t s) { f(sorted[s]); });
+}
+
+template <class F>
+void SpatialHash::forNeighbourSlots(float x, float y, float z, float radius, F f) const
+{
+    // 1) The buckets of the cells touched, without repeats
+    int32_t i0 = Cell(x - radius), i1 = std::min(Cell(x + radius), i0 + 2);
+    int32_t j0 = Cell(y - radius), j1 = std::min(Cell(y + radius), j0 + 2);
+    int32_t k0 = Cell(z - radius), k1 = std::min(Cell(z + radius), k0 + 2);
+    uint32_t buckets[27];
+    int count = 0;
+    for (int32_t k = k0; k <= k1; ++k) {
+        for (int32_t j = j0; j <= j1; ++j) {
+            for (int32_t i = i0; i <= i1; ++i) {
+                // two cells in one bucket are rare: a linear check beats sorting
+                uint32_t b = Hash(i, j, k) & m_mask;
+                int c = 0;
+                while (c < count && buckets[c] != b) {
+                    ++c;
+                }
+                if (c == count) {
+                    buckets[count++] = b;
+                }
+            }
+        }
+    }
+
+    // 2) Their points
+    for (int b = 0; b < count; ++b) {
+        for (uint32_t s = m_bucketStart[buckets[b]]; s < m_bucketStart[buckets[b] + 1]; ++s) {
+            f(s);
+        }
+    }
+}
+
+#endif // SPATIALHASH_HPP
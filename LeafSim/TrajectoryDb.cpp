@@ -0,0 +1,465 @@
+// Self-test: g++ -std=c++11 -O2 -DTEST -o trajdbtest LeafSim/TrajectoryDb.cpp LeafSim/MappedFile.cpp LeafSim/TrajectorySpline.cpp LeafSim/FlutterModel.cpp
+#include "TrajectoryDb.hpp"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+static_assert(sizeof(TrajectoryDbHeader) == 64, "TrajectoryDbHeader layout changed");
+static_assert(sizeof(TrajectoryRecord) == 128, "TrajectoryRecord layout changed");
+
+static const char MAGIC[4] = { 'L', 'T', 'R', 'J' };
+
+static inline uint64_t AlignUp(uint64_t offset)
+{
+    return (offset + 15) & ~(uint64_t)15;
+}
+
+// ENCODING_SPLINE data: key counts, then the keys of each component in turn
+struct SplineBlock {
+    uint32_t keyCount[FLUTTER_DIM];
+    uint32_t reserved[2];
+};
+static_assert(sizeof(SplineBlock) == 32, "SplineBlock layout changed");
+
+// -------------------------------------
+// Writer
+// -------------------------------------
+TrajectoryDbWriter::TrajectoryDbWriter()
+{
+}
+
+void TrajectoryDbWriter::clear()
+{
+    m_records.clear();
+    m_states.clear();
+}
+
+void TrajectoryDbWriter::add(const FlutterParams& params, double rho, double g, double dt,
+                             const double* states, int numSamples)
+{
+    TrajectoryRecord rec;
+    std::memset(&rec, 0, sizeof(rec));
+    rec.mass = (float)params.mass;
+    rec.width = (float)params.width;
+    rec.height = (float)params.height;
+    rec.dragCoeffPerp = (float)params.dragCoeffPerp;
+    rec.dragCoeffPara = (float)params.dragCoeffPara;
+    rec.rho = (float)rho;
+    rec.g = (float)g;
+    rec.dt = (float)dt;
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        rec.initial[c] = (numSamples > 0) ? (float)states[c] : 0.f;
+    }
+    rec.numSamples = (uint32_t)numSamples;
+
+    m_records.push_back(rec);
+    m_states.push_back(std::vector<double>(states, states + (size_t)numSamples * FLUTTER_DIM));
+}
+
+bool TrajectoryDbWriter::write(const char* path, TrajectoryEncoding encoding) const
+{
+    size_t bytesPerValue = (encoding == ENCODING_UINT16) ? sizeof(uint16_t) : sizeof(float);
+
+    // 0) Curves first, for their sizes
+    std::vector<std::vector<SplineKey> > keys;
+    if (encoding == ENCODING_SPLINE) {
+        keys.resize(m_records.size() * FLUTTER_DIM);
+        for (size_t t = 0; t < m_records.size(); ++t) {
+            for (int c = 0; c < FLUTTER_DIM; ++c) {
+                FitSpline(m_states[t].data(), (int)m_records[t].numSamples, c, m_records[t].dt,
+                          m_splineTolerance.GetTolerance(c), &keys[t * FLUTTER_DIM + c]);
+            }
+        }
+    }
+
+    // 1) Lay out the file
+    TrajectoryDbHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = TRAJECTORY_DB_VERSION;
+    header.endianTag = TRAJECTORY_DB_ENDIAN_TAG;
+    header.headerSize = sizeof(TrajectoryDbHeader);
+    header.recordSize = sizeof(TrajectoryRecord);
+    header.numTrajectories = (uint32_t)m_records.size();
+    header.stateDim = FLUTTER_DIM;
+    header.encoding = encoding;
+    header.recordsOffset = sizeof(TrajectoryDbHeader);
+
+    std::vector<TrajectoryRecord> records(m_records);
+    uint64_t offset = AlignUp(header.recordsOffset + records.size() * sizeof(TrajectoryRecord));
+    for (size_t t = 0; t < records.size(); ++t) {
+        records[t].dataOffset = offset;
+        uint64_t bytes = (uint64_t)records[t].numSamples * FLUTTER_DIM * bytesPerValue;
+        if (encoding == ENCODING_SPLINE) {
+            bytes = sizeof(SplineBlock);
+            for (int c = 0; c < FLUTTER_DIM; ++c) {
+                bytes += keys[t * FLUTTER_DIM + c].size() * sizeof(SplineKey);
+            }
+        }
+        offset = AlignUp(offset + bytes);
+    }
+    header.fileSize = offset;
+
+    // 2) Encode
+    std::vector<unsigned char> data(header.fileSize, 0);
+    std::memcpy(&data[0], &header, sizeof(header));
+    for (size_t t = 0; t < records.size(); ++t) {
+        TrajectoryRecord& rec = records[t];
+        const double* src = m_states[t].empty() ? NULL : &m_states[t][0];
+        unsigned char* dst = &data[rec.dataOffset];
+        size_t n = rec.numSamples;
+
+        if (encoding == ENCODING_FLOAT32) {
+            for (size_t i = 0; i < n * FLUTTER_DIM; ++i) {
+                float v = (float)src[i];
+                std::memcpy(dst + i * sizeof(float), &v, sizeof(v));
+            }
+            continue;
+        }
+        if (encoding == ENCODING_SPLINE) {
+            SplineBlock block;
+            std::memset(&block, 0, sizeof(block));
+            unsigned char* k = dst + sizeof(block);
+            for (int c = 0; c < FLUTTER_DIM; ++c) {
+                const std::vector<SplineKey>& curve = keys[t * FLUTTER_DIM + c];
+                block.keyCount[c] = (uint32_t)curve.size();
+                if (!curve.empty()) {
+                    std::memcpy(k, &curve[0], curve.size() * sizeof(SplineKey));
+                }
+                k += curve.size() * sizeof(SplineKey);
+            }
+            std::memcpy(dst, &block, sizeof(block));
+            continue;
+        }
+
+        // per component range -> 16 bits
+        for (int c = 0; c < FLUTTER_DIM; ++c) {
+            double lo = 0., hi = 0.;
+            for (size_t i = 0; i < n; ++i) {
+                double v = src[i * FLUTTER_DIM + c];
+                lo = (i == 0) ? v : std::min(lo, v);
+                hi = (i == 0) ? v : std::max(hi, v);
+            }
+            rec.quantOffset[c] = (float)lo;
+            rec.quantScale[c] = (hi > lo) ? (float)((hi - lo) / 65535.) : 0.f;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            for (int c = 0; c < FLUTTER_DIM; ++c) {
+                double q = 0.;
+                if (rec.quantScale[c] > 0.f) {
+                    q = std::floor((src[i * FLUTTER_DIM + c] - rec.quantOffset[c]) / rec.quantScale[c] + 0.5);
+                }
+                uint16_t v = (uint16_t)std::max(0., std::min(q, 65535.));
+                std::memcpy(dst + (i * FLUTTER_DIM + c) * sizeof(uint16_t), &v, sizeof(v));
+            }
+        }
+    }
+    if (!records.empty()) {
+        std::memcpy(&data[header.recordsOffset], &records[0], records.size() * sizeof(TrajectoryRecord));
+    }
+
+    // 3) Write
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open '%s' for writing\n", path);
+        return false;
+    }
+    bool ok = fwrite(&data[0], 1, data.size(), fp) == data.size();
+    ok = (fclose(fp) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error writing '%s'\n", path);
+    }
+    return ok;
+}
+
+// -------------------------------------
+// Reader
+// -------------------------------------
+TrajectoryDb::TrajectoryDb()
+    : m_header(NULL)
+    , m_records(NULL)
+{
+}
+
+TrajectoryDb::~TrajectoryDb()
+{
+    close();
+}
+
+bool TrajectoryDb::open(const char* path)
+{
+    close();
+    if (!m_file.open(path, "trajectory database")) {
+        return false;
+    }
+
+    if (!validate(path)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool TrajectoryDb::validate(const char* path)
+{
+    const unsigned char* base = m_file.GetData();
+    size_t size = m_file.GetSize();
+    if (size < sizeof(TrajectoryDbHeader)) {
+        fprintf(stderr, "'%s' is too small to be a trajectory database\n", path);
+        return false;
+    }
+    const TrajectoryDbHeader* h = (const TrajectoryDbHeader*)base;
+    if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) {
+        fprintf(stderr, "'%s' is not a trajectory database\n", path);
+        return false;
+    }
+    if (h->endianTag != TRAJECTORY_DB_ENDIAN_TAG) {
+        fprintf(stderr, "'%s' was written with the other byte order\n", path);
+        return false;
+    }
+    if (h->version != TRAJECTORY_DB_VERSION) {
+        fprintf(stderr, "'%s' is version %u, expected %d\n", path, h->version, TRAJECTORY_DB_VERSION);
+        return false;
+    }
+    if (h->headerSize != sizeof(TrajectoryDbHeader) || h->recordSize != sizeof(TrajectoryRecord) ||
+        h->stateDim != FLUTTER_DIM || h->encoding > ENCODING_SPLINE || h->fileSize != size ||
+        h->recordsOffset % 8 != 0 ||
+        h->recordsOffset + (uint64_t)h->numTrajectories * sizeof(TrajectoryRecord) > size) {
+        fprintf(stderr, "'%s' has a damaged header\n", path);
+        return false;
+    }
+
+    const TrajectoryRecord* records = (const TrajectoryRecord*)(base + h->recordsOffset);
+    uint64_t bytesPerValue = (h->encoding == ENCODING_UINT16) ? sizeof(uint16_t) : sizeof(float);
+    for (uint32_t t = 0; t < h->numTrajectories; ++t) {
+        uint64_t bytes = (uint64_t)records[t].numSamples * FLUTTER_DIM * bytesPerValue;
+        if (h->encoding == ENCODING_SPLINE) {
+            bytes = sizeof(SplineBlock);
+            if (records[t].dataOffset <= size && bytes <= size - records[t].dataOffset) {
+                const SplineBlock* block = (const SplineBlock*)(base + records[t].dataOffset);
+                for (int c = 0; c < FLUTTER_DIM; ++c) {
+                    bytes += (uint64_t)block->keyCount[c] * sizeof(SplineKey);
+                }
+            }
+        }
+        if (records[t].dataOffset % 16 != 0 || records[t].dataOffset > size ||
+            bytes > size - records[t].dataOffset) {
+            fprintf(stderr, "'%s': trajectory %u points outside the file\n", path, t);
+            return false;
+        }
+    }
+
+    m_header = h;
+    m_records = records;
+    return true;
+}
+
+void TrajectoryDb::close()
+{
+    m_file.close();
+    m_header = NULL;
+    m_records = NULL;
+}
+
+FlutterParams TrajectoryDb::GetParams(int i) const
+{
+    const TrajectoryRecord& r = m_records[i];
+    FlutterParams p = { r.mass, r.width, r.height, r.dragCoeffPerp, r.dragCoeffPara };
+    return p;
+}
+
+const float* TrajectoryDb::GetStates(int i) const
+{
+    if (m_header->encoding != ENCODING_FLOAT32) {
+        return NULL;
+    }
+    return (const float*)(m_file.GetData() + m_records[i].dataOffset);
+}
+
+const uint16_t* TrajectoryDb::GetQuantizedStates(int i) const
+{
+    if (m_header->encoding != ENCODING_UINT16) {
+        return NULL;
+    }
+    return (const uint16_t*)(m_file.GetData() + m_records[i].dataOffset);
+}
+
+const SplineKey* TrajectoryDb::GetSplineKeys(int i, int component, uint32_t* count) const
+{
+    if (m_header->encoding != ENCODING_SPLINE) {
+        *count = 0;
+        return NULL;
+    }
+    const SplineBlock* block = (const SplineBlock*)(m_file.GetData() + m_records[i].dataOffset);
+    const SplineKey* keys = (const SplineKey*)(block + 1);
+    for (int c = 0; c < component; ++c) {
+        keys += block->keyCount[c];
+    }
+    *count = block->keyCount[component];
+    return keys;
+}
+
+void TrajectoryDb::getSample(int i, int sample, float* state) const
+{
+    const TrajectoryRecord& r = m_records[i];
+    if (m_header->encoding == ENCODING_SPLINE) {
+        evaluate(i, sample, state);
+        return;
+    }
+    if (m_header->encoding == ENCODING_FLOAT32) {
+        const float* s = GetStates(i) + (size_t)sample * FLUTTER_DIM;
+        for (int c = 0; c < FLUTTER_DIM; ++c) {
+            state[c] = s[c];
+        }
+        return;
+    }
+    const uint16_t* q = GetQuantizedStates(i) + (size_t)sample * FLUTTER_DIM;
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        state[c] = r.quantOffset[c] + r.quantScale[c] * (float)q[c];
+    }
+}
+
+void TrajectoryDb::evaluate(int i, double frame, float* state) const
+{
+    if (m_header->encoding == ENCODING_SPLINE) {
+        for (int c = 0; c < FLUTTER_DIM; ++c) {
+            uint32_t count, segment = 0;
+            const SplineKey* keys = GetSplineKeys(i, c, &count);
+            state[c] = EvaluateSpline(keys, count, (float)frame, &segment);
+        }
+        return;
+    }
+
+    // linear between the samples either side, held at the ends
+    int last = (int)m_records[i].numSamples - 1;
+    frame = std::max(0., std::min(frame, (double)std::max(last, 0)));
+    int f = std::min((int)frame, std::max(last - 1, 0));
+    float u = (float)(frame - f);
+    float a[FLUTTER_DIM], b[FLUTTER_DIM];
+    getSample(i, f, a);
+    getSample(i, std::min(f + 1, last), b);
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        state[c] = a[c] + u * (b[c] - a[c]);
+    }
+}
+
+// -------------------------------------
+// Cursor
+// -------------------------------------
+TrajectoryCursor::TrajectoryCursor()
+    : m_db(NULL)
+    , m_trajectory(0)
+{
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        m_keys[c] = NULL;
+        m_count[c] = 0;
+        m_segment[c] = 0;
+    }
+}
+
+void TrajectoryCursor::start(const TrajectoryDb* db, int trajectory)
+{
+    m_db = db;
+    m_trajectory = trajectory;
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        m_keys[c] = db->GetSplineKeys(trajectory, c, &m_count[c]);
+        m_segment[c] = 0;
+    }
+}
+
+void TrajectoryCursor::evaluate(double frame, float* state)
+{
+    if (m_keys[0] == NULL) {
+        m_db->evaluate(m_trajectory, frame, state);
+        return;
+    }
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        state[c] = EvaluateSpline(m_keys[c], m_count[c], (float)frame, &m_segment[c]);
+    }
+}
+
+//#define TEST
+#ifdef TEST
+
+#include "../SelfTest.hpp"
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *F32 = "trajdbtest_f32.bin";
+	const char *U16 = "trajdbtest_u16.bin";
+	const char *BAD = "trajdbtest_bad.bin";
+	const int SAMPLES[3] = { 500, 1, 0 };		// incl. degenerate ones
+
+	FlutterParams leaf = { 0.01, 0.1, 0.1, 4.1, 0.9 };
+	std::vector<double> states[3];
+	TrajectoryDbWriter writer;
+	for( int t = 0; t < 3; t++ )
+	{
+		double s[FLUTTER_DIM] = { 0., 0., 0.3 * t, 1., -1., 0.1 };
+		for( int n = 0; n < SAMPLES[t]; n++ )
+		{
+			states[t].insert( states[t].end( ), s, s + FLUTTER_DIM );
+			for( int k = 0; k < 100; k++ )
+				FlutterRk4Step( s, leaf, 1.225, 9.81, 1.e-4 );
+		}
+		writer.add( leaf, 1.225, 9.81, 0.01, states[t].empty( ) ? NULL : &states[t][0], SAMPLES[t] );
+	}
+	Check( writer.write( F32, ENCODING_FLOAT32 ) && writer.write( U16, ENCODING_UINT16 ), "write both encodings" );
+
+	// float32: exactly the rounded doubles
+	TrajectoryDb db;
+	Check( db.open( F32 ), "open float32" );
+	Check( db.GetNumTrajectories( ) == 3, "three trajectories" );
+	Check( db.GetRecord( 0 ).numSamples == 500 && db.GetRecord( 2 ).numSamples == 0, "sample counts" );
+	Check( db.GetRecord( 0 ).dt == 0.01f && db.GetParams( 0 ).mass == 0.01f, "metadata" );
+	Check( ( (uintptr_t)db.GetStates( 0 ) & 15 ) == 0, "state arrays are 16-byte aligned" );
+	bool same = true;
+	for( int n = 0; n < 500; n++ )
+	{
+		float s[FLUTTER_DIM];
+		db.getSample( 0, n, s );
+		for( int c = 0; c < FLUTTER_DIM; c++ )
+			same = same && s[c] == (float)states[0][n*FLUTTER_DIM + c];
+	}
+	Check( same, "float32 samples round-trip" );
+	Check( db.GetQuantizedStates( 0 ) == NULL, "no uint16 view of a float32 file" );
+
+	// uint16: within half a quantisation step of the range
+	TrajectoryDb qdb;
+	Check( qdb.open( U16 ), "open uint16" );
+	double worst = 0.;
+	for( int n = 0; n < 500; n++ )
+	{
+		float s[FLUTTER_DIM];
+		qdb.getSample( 0, n, s );
+		for( int c = 0; c < FLUTTER_DIM; c++ )
+		{
+			const TrajectoryRecord &r = qdb.GetRecord( 0 );
+			double step = r.quantScale[c] > 0.f ? r.quantScale[c] : 1.;
+			worst = std::max( worst, fabs( s[c] - states[0][n*FLUTTER_DIM + c] ) / step );
+		}
+	}
+	fprintf( stderr, "uint16 worst error: %.3f quantisation steps; file %zu vs %zu bytes\n", worst, qdb.GetFileSize( ), db.GetFileSize( ) );
+	Check( worst < 0.51, "uint16 within half a step" );
+	float one[FLUTTER_DIM];
+	qdb.getSample( 1, 0, one );
+	Check( fabs( one[2] - 0.3 ) < 1.e-6, "constant component decodes exactly" );
+
+	// damaged files are refused:
+	FILE *fp = fopen( BAD, "wb" );
+	fwrite( "LTRJ", 1, 4, fp );
+	fclose( fp );
+	TrajectoryDb bad;
+	Check( ! bad.open( BAD ) && ! bad.isOpen( ), "truncated file refused" );
+	Check( ! bad.open( "no_such_file.bin" ), "missing file refused" );
+
+	db.close( );
+	qdb.close( );
+	remove( F32 );
+	remove( U16 );
+	remove( BAD );
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef TRAJECTORYDB_HPP
+#define TRAJECTORYDB_HPP
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "FlutterModel.hpp"
+#include "MappedFile.hpp"
+#include "TrajectorySpline.hpp"
+
+// Binary trajectory database (.bin), read in place through mmap.
+//
+//   TrajectoryDbHeader                 64 bytes at offset 0
+//   TrajectoryRecord[numTrajectories]  128 bytes each, at recordsOffset
+//   state arrays                       16-byte aligned, at record.dataOffset
+//
+// States are FLUTTER_DIM values per sample, either float32 or uint16
+// quantised per trajectory and component (value = offset + scale * q), or
+// keyframe curves fitted to them (LeafSim/TrajectorySpline.hpp): then the
+// data is uint32 keyCount[FLUTTER_DIM], 8 bytes of padding and the
+// SplineKeys of each component in turn.
+// Everything is little endian; endianTag catches a mismatch.
+
+enum {
+    TRAJECTORY_DB_VERSION = 1,
+    TRAJECTORY_DB_ENDIAN_TAG = 0x01020304
+};
+
+enum TrajectoryEncoding {
+    ENCODING_FLOAT32 = 0,
+    ENCODING_UINT16  = 1,
+    ENCODING_SPLINE  = 2
+};
+
+struct TrajectoryDbHeader {
+    char     magic[4];          // "LTRJ"
+    uint32_t version;
+    uint32_t endianTag;
+    uint32_t headerSize;        // sizeof(TrajectoryDbHeader)
+    uint32_t recordSize;        // sizeof(TrajectoryRecord)
+    uint32_t numTrajectories;
+    uint32_t stateDim;          // FLUTTER_DIM
+    uint32_t encoding;          // TrajectoryEncoding
+    uint64_t recordsOffset;
+    uint64_t fileSize;
+    uint32_t reserved[4];
+};
+
+struct TrajectoryRecord {
+    float    mass, width, height, dragCoeffPerp, dragCoeffPara;
+    float    rho, g;
+    float    dt;                // sample interval (s)
+    float    initial[FLUTTER_DIM];
+    uint32_t numSamples;
+    uint32_t reserved0;
+    uint64_t dataOffset;
+    float    quantScale[FLUTTER_DIM];   // ENCODING_UINT16 only
+    float    quantOffset[FLUTTER_DIM];
+    uint32_t reserved[2];
+};
+
+// Collects trajectories in memory and writes them out in one go
+class TrajectoryDbWriter {
+public:
+    TrajectoryDbWriter();
+
+    void clear();
+    // states: numSamples * FLUTTER_DIM values, states[0..5] = the initial state
+    void add(const FlutterParams& params, double rho, double g, double dt,
+             const double* states, int numSamples);
+    int GetNumTrajectories() const { return (int)m_records.size(); }
+    void setSplineTolerance(const SplineTolerance& tolerance) { m_splineTolerance = tolerance; }
+
+    bool write(const char* path, TrajectoryEncoding encoding) const;
+
+private:
+    std::vector<TrajectoryRecord> m_records;
+    std::vector<std::vector<double> > m_states;
+    SplineTolerance m_splineTolerance;      // ENCODING_SPLINE
+};
+
+// Read-only view of a .bin file.  Nothing is copied: GetStates() points into
+// the mapping, and pages are only read when touched.
+class TrajectoryDb {
+public:
+    TrajectoryDb();
+    ~TrajectoryDb();
+
+    bool open(const char* path);      // false (with a message) if missing or malformed
+    void close();
+    bool isOpen() const { return m_file.isOpen(); }
+
+    int GetNumTrajectories() const { return m_header ? (int)m_header->numTrajectories : 0; }
+    TrajectoryEncoding GetEncoding() const { return (TrajectoryEncoding)m_header->encoding; }
+    const TrajectoryRecord& GetRecord(int i) const { return m_records[i]; }
+    FlutterParams GetParams(int i) const;
+    size_t GetFileSize() const { return m_file.GetSize(); }
+
+    // Raw arrays, numSamples * FLUTTER_DIM; NULL if the file uses another encoding
+    const float* GetStates(int i) const;
+    const uint16_t* GetQuantizedStates(int i) const;
+    const SplineKey* GetSplineKeys(int i, int component, uint32_t* count) const;
+
+    // One decoded sample, any encoding
+    void getSample(int i, int sample, float* state) const;
+    // At a fractional frame: the curve for ENCODING_SPLINE, linear between
+    // samples otherwise (see TrajectoryCursor for playing one back)
+    void evaluate(int i, double frame, float* state) const;
+
+private:
+    bool validate(const char* path);
+
+    MappedFile m_file;
+    const TrajectoryDbHeader* m_header;
+    const TrajectoryRecord* m_records;
+};
+
+// Plays one trajectory of a database at any frames, like evaluate(), but
+// remembers where it was in each component's keys: O(1) a call while the
+// frames move on by a key or less, a binary search after a jump.
+class TrajectoryCursor {
+public:
+    TrajectoryCursor();
+
+    void start(const TrajectoryDb* db, int trajectory);
+    void evaluate(double frame, float* state);
+
+    const TrajectoryDb* GetDb() const { return m_db; }
+    int GetTrajectory() const { return m_trajectory; }
+
+private:
+    const TrajectoryDb* m_db;
+    int m_trajectory;
+    const SplineKey* m_keys[FLUTTER_DIM];   // NULL: not ENCODING_SPLINE
+    uint32_t m_count[FLUTTER_DIM];
+    uint32_t m_segment[FLUTTER_DIM];
+};
+
+#endif // TRAJECTORYDB_HPP
@@ -0,0 +1,521 @@
+// Self-test: make libleafsim.a && g++ -std=c++11 -O2 -DTEST -o trajgentest LeafSim/TrajectoryGen.cpp -L. -lleafsim -pthread
+#include "TrajectoryGen.hpp"
+#include "Dopri45.hpp"
+#include "FlutterRhs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#ifndef _WIN32
+    #include <unistd.h>
+#else
+    #include <io.h>
+#endif
+
+TrajectorySettings::TrajectorySettings()
+    : dt(0.01)
+    , samples(1000)
+    , substeps(100)
+    , tolerance(0.)
+    , rho(1.225)
+    , g(9.81)
+{
+}
+
+TrajectorySweep::TrajectorySweep()
+    : theta(0.), vx(0.), vy(-1.), omega(0.)
+    , mass(0.01), width(0.1), height(0.1), dragCoeffPerp(4.1), dragCoeffPara(0.9)
+{
+}
+
+long TrajectorySweep::GetNumJobs() const
+{
+    const SweepRange* axes[] = { &theta, &vx, &vy, &omega, &mass, &width, &height, &dragCoeffPerp, &dragCoeffPara };
+    long n = 1;
+    for (size_t a = 0; a < sizeof(axes) / sizeof(axes[0]); ++a) {
+        n *= axes[a]->count;
+    }
+    return n;
+}
+
+// one value per axis, in the order of the axes[] lists below
+static TrajectoryJob MakeJob(const double* v)
+{
+    TrajectoryJob job;
+    job.initial[0] = 0.;
+    job.initial[1] = 0.;
+    job.initial[2] = v[0];
+    job.initial[3] = v[1];
+    job.initial[4] = v[2];
+    job.initial[5] = v[3];
+    job.params.mass = v[4];
+    job.params.width = v[5];
+    job.params.height = v[6];
+    job.params.dragCoeffPerp = v[7];
+    job.params.dragCoeffPara = v[8];
+    return job;
+}
+
+void TrajectorySweep::buildJobs(std::vector<TrajectoryJob>* jobs) const
+{
+    const SweepRange* axes[] = { &theta, &vx, &vy, &omega, &mass, &width, &height, &dragCoeffPerp, &dragCoeffPara };
+    const int NUM_AXES = sizeof(axes) / sizeof(axes[0]);
+    long n = GetNumJobs();
+    jobs->clear();
+    jobs->reserve(n);
+
+    // job j -> one index per axis, the last axis varying fastest
+    for (long j = 0; j < n; ++j) {
+        double v[NUM_AXES];
+        long rest = j;
+        for (int a = NUM_AXES - 1; a >= 0; --a) {
+            v[a] = axes[a]->at((int)(rest % axes[a]->count));
+            rest /= axes[a]->count;
+        }
+        jobs->push_back(MakeJob(v));
+    }
+}
+
+void TrajectorySweep::buildLatinHypercube(int samples, uint32_t seed, std::vector<TrajectoryJob>* jobs) const
+{
+    const SweepRange* axes[] = { &theta, &vx, &vy, &omega, &mass, &width, &height, &dragCoeffPerp, &dragCoeffPara };
+    const int NUM_AXES = sizeof(axes) / sizeof(axes[0]);
+    jobs->clear();
+    if (samples < 1) {
+        return;
+    }
+
+    // Per axis: the strata shuffled over the jobs, and a point inside each.
+    // mt19937 is the same everywhere (unlike the <random> distributions).
+    std::mt19937 rng(seed);
+    std::vector<double> v((size_t)samples * NUM_AXES);
+    std::vector<int> strata(samples);
+    for (int a = 0; a < NUM_AXES; ++a) {
+        for (int i = 0; i < samples; ++i) {
+            strata[i] = i;
+        }
+        for (int i = samples - 1; i > 0; --i) {
+            std::swap(strata[i], strata[rng() % (uint32_t)(i + 1)]);
+        }
+        for (int i = 0; i < samples; ++i) {
+            double u = (rng() >> 8) * (1. / 16777216.);     // [0, 1)
+            v[(size_t)i * NUM_AXES + a] = axes[a]->lo + (axes[a]->hi - axes[a]->lo) * (strata[i] + u) / samples;
+        }
+    }
+
+    jobs->reserve(samples);
+    for (int i = 0; i < samples; ++i) {
+        jobs->push_back(MakeJob(&v[(size_t)i * NUM_AXES]));
+    }
+}
+
+// -------------------------------------
+// Checkpoint
+//
+//   CheckpointHeader                   at offset 0
+//   CheckpointRecord + states          per finished job, in the order they finished
+// -------------------------------------
+struct CheckpointHeader {
+    char     magic[4];          // "LSWP"
+    uint32_t version;
+    uint32_t numJobs;
+    uint32_t reserved;
+    uint64_t sweepHash;         // of the jobs and settings
+};
+
+struct CheckpointRecord {
+    uint32_t job;
+    uint32_t numSamples;
+    uint32_t diverged;
+    uint32_t check;             // of the states
+};
+
+static const char CHECKPOINT_MAGIC[4] = { 'L', 'S', 'W', 'P' };
+
+// FNV-1a, 64 bit
+static uint64_t Hash(const void* data, size_t bytes, uint64_t h = 14695981039346656037ull)
+{
+    const unsigned char* p = (const unsigned char*)data;
+    for (size_t i = 0; i < bytes; ++i) {
+        h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+}
+
+static bool TruncateFile(FILE* fp, uint64_t size)
+{
+    fflush(fp);
+#ifndef _WIN32
+    return ftruncate(fileno(fp), (off_t)size) == 0;
+#else
+    return _chsize_s(_fileno(fp), (__int64)size) == 0;
+#endif
+}
+
+SweepCheckpoint::SweepCheckpoint()
+    : m_fp(NULL)
+    , m_numDone(0)
+{
+}
+
+SweepCheckpoint::~SweepCheckpoint()
+{
+    close();
+}
+
+void SweepCheckpoint::close()
+{
+    if (m_fp != NULL) {
+        fclose(m_fp);
+        m_fp = NULL;
+    }
+    m_offsets.clear();
+    m_numDone = 0;
+}
+
+bool SweepCheckpoint::open(const char* path, const std::vector<TrajectoryJob>& jobs,
+                           const TrajectorySettings& settings)
+{
+    close();
+
+    CheckpointHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = 1;
+    header.numJobs = (uint32_t)jobs.size();
+    double fields[5] = { settings.dt, (double)settings.samples, (double)settings.substeps, settings.rho, settings.g };
+    header.sweepHash = Hash(fields, sizeof(fields));
+    if (settings.tolerance > 0.) {      // so fixed-step checkpoints from before still match
+        header.sweepHash = Hash(&settings.tolerance, sizeof(double), header.sweepHash);
+    }
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        header.sweepHash = Hash(&jobs[j].params, sizeof(FlutterParams), header.sweepHash);
+        header.sweepHash = Hash(jobs[j].initial, sizeof(jobs[j].initial), header.sweepHash);
+    }
+    m_offsets.assign(jobs.size(), 0);
+
+    // 1) An earlier run of the same sweep: take its records up to the first bad one
+    m_fp = fopen(path, "r+b");
+    if (m_fp != NULL) {
+        CheckpointHeader old;
+        if (fread(&old, sizeof(old), 1, m_fp) != 1 || std::memcmp(&old, &header, sizeof(header)) != 0) {
+            fprintf(stderr, "Checkpoint '%s' is for another sweep; starting over\n", path);
+            fclose(m_fp);
+            m_fp = NULL;
+        }
+    }
+    if (m_fp != NULL) {
+        uint64_t end = sizeof(header);
+        CheckpointRecord rec;
+        std::vector<double> states;
+        while (fread(&rec, sizeof(rec), 1, m_fp) == 1 && rec.job < jobs.size() &&
+               rec.numSamples <= (uint32_t)settings.samples) {
+            states.resize((size_t)rec.numSamples * FLUTTER_DIM);
+            size_t bytes = states.size() * sizeof(double);
+            if ((bytes > 0 && fread(&states[0], bytes, 1, m_fp) != 1) ||
+                (uint32_t)Hash(states.data(), bytes) != rec.check) {
+                break;
+            }
+            if (m_offsets[rec.job] == 0) {
+                m_numDone++;
+            }
+            m_offsets[rec.job] = end;
+            end += sizeof(rec) + bytes;
+        }
+        if (!TruncateFile(m_fp, end) || fseek(m_fp, 0, SEEK_END) != 0) {
+            fprintf(stderr, "Cannot cut checkpoint '%s' back to its last whole record\n", path);
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // 2) A new one
+    m_fp = fopen(path, "w+b");
+    if (m_fp == NULL || fwrite(&header, sizeof(header), 1, m_fp) != 1 || fflush(m_fp) != 0) {
+        fprintf(stderr, "Cannot write checkpoint '%s'\n", path);
+        close();
+        return false;
+    }
+    return true;
+}
+
+bool SweepCheckpoint::read(size_t job, Trajectory* out)
+{
+    CheckpointRecord rec;
+    bool ok = m_fp != NULL && m_offsets[job] != 0 && fseek(m_fp, (long)m_offsets[job], SEEK_SET) == 0 &&
+              fread(&rec, sizeof(rec), 1, m_fp) == 1;
+    if (ok) {
+        out->states.resize((size_t)rec.numSamples * FLUTTER_DIM);
+        out->diverged = rec.diverged != 0;
+        ok = out->states.empty() || fread(&out->states[0], out->states.size() * sizeof(double), 1, m_fp) == 1;
+    }
+    fseek(m_fp, 0, SEEK_END);       // back to appending
+    return ok;
+}
+
+bool SweepCheckpoint::append(size_t job, const Trajectory& traj)
+{
+    if (m_fp == NULL) {
+        return false;
+    }
+    CheckpointRecord rec;
+    rec.job = (uint32_t)job;
+    rec.numSamples = (uint32_t)traj.GetNumSamples();
+    rec.diverged = traj.diverged ? 1 : 0;
+    size_t bytes = traj.states.size() * sizeof(double);
+    rec.check = (uint32_t)Hash(traj.states.data(), bytes);
+
+    long offset = ftell(m_fp);
+    bool ok = offset > 0 && fwrite(&rec, sizeof(rec), 1, m_fp) == 1 &&
+              (bytes == 0 || fwrite(&traj.states[0], bytes, 1, m_fp) == 1) && fflush(m_fp) == 0;
+    if (!ok) {
+        fprintf(stderr, "Error writing the sweep checkpoint\n");
+        return false;
+    }
+    if (m_offsets[job] == 0) {
+        m_numDone++;
+    }
+    m_offsets[job] = (uint64_t)offset;
+    return true;
+}
+
+// the adaptive steps one trajectory may take per sample, on average, before
+// it counts as diverged: the smoothed model needs some tens per sample where
+// the leaf slides along the switch
+static const long ADAPTIVE_STEPS_PER_SAMPLE = 1000;
+
+static bool IsFinite(const double* s)
+{
+    bool finite = true;
+    for (int i = 0; i < FLUTTER_DIM; ++i) {
+        finite = finite && std::isfinite(s[i]);
+    }
+    return finite;
+}
+
+static void GenerateAdaptive(const TrajectoryJob& job, const TrajectorySettings& settings, Trajectory* out)
+{
+    FlutterRhs rhs(job.params, settings.rho, settings.g);
+    Dopri45 dp(settings.tolerance, settings.tolerance * 1.e-2);
+    dp.setMaxSteps(ADAPTIVE_STEPS_PER_SAMPLE * settings.samples);
+    dp.reset(rhs, 0., job.initial);
+
+    const double tEnd = (settings.samples - 1) * settings.dt;
+    double s[FLUTTER_DIM];
+    for (int n = 0; n < settings.samples; ++n) {
+        double t = n * settings.dt;
+        while (dp.GetTime() < t) {
+            if (!dp.step(rhs, tEnd)) {
+                out->diverged = true;
+                return;
+            }
+        }
+        if (n == 0) {
+            std::copy(job.initial, job.initial + FLUTTER_DIM, s);
+        } else {
+            dp.interpolate(t, s);
+        }
+        if (!IsFinite(s)) {
+            out->diverged = true;
+            return;
+        }
+        out->states.insert(out->states.end(), s, s + FLUTTER_DIM);
+    }
+}
+
+void GenerateTrajectory(const TrajectoryJob& job, const TrajectorySettings& settings, Trajectory* out)
+{
+    out->states.clear();
+    out->states.reserve((size_t)settings.samples * FLUTTER_DIM);
+    out->diverged = false;
+    if (settings.tolerance > 0.) {
+        GenerateAdaptive(job, settings, out);
+        return;
+    }
+
+    const double h = settings.dt / settings.substeps;
+    double s[FLUTTER_DIM];
+    for (int i = 0; i < FLUTTER_DIM; ++i) {
+        s[i] = job.initial[i];
+    }
+
+    for (int n = 0; n < settings.samples; ++n) {
+        if (!IsFinite(s)) {
+            out->diverged = true;
+            return;
+        }
+        out->states.insert(out->states.end(), s, s + FLUTTER_DIM);
+
+        for (int k = 0; k < settings.substeps; ++k) {
+            FlutterRk4Step(s, job.params, settings.rho, settings.g, h);
+        }
+    }
+}
+
+void GenerateTrajectories(const std::vector<TrajectoryJob>& jobs, const TrajectorySettings& settings,
+                          int threads, std::vector<Trajectory>* out, SweepCheckpoint* checkpoint)
+{
+    out->resize(jobs.size());
+    for (size_t j = 0; checkpoint != NULL && j < jobs.size(); ++j) {
+        if (checkpoint->isDone(j) && !checkpoint->read(j, &(*out)[j])) {
+            GenerateTrajectory(jobs[j], settings, &(*out)[j]);      // unreadable after all
+        }
+    }
+
+    if (threads <= 0) {
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    threads = std::max(1, std::min(threads, (int)jobs.size()));
+
+    // Jobs are handed out one at a time: trajectories that diverge early are
+    // much cheaper than the rest, so fixed chunks would balance badly.
+    std::atomic<size_t> next(0);
+    std::mutex saving;
+    auto worker = [&]() {
+        for (;;) {
+            size_t j = next.fetch_add(1);
+            if (j >= jobs.size()) {
+                return;
+            }
+            if (checkpoint == NULL) {
+                GenerateTrajectory(jobs[j], settings, &(*out)[j]);
+            } else if (!checkpoint->isDone(j)) {
+                GenerateTrajectory(jobs[j], settings, &(*out)[j]);
+                std::lock_guard<std::mutex> lock(saving);
+                checkpoint->append(j, (*out)[j]);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.push_back(std::thread(worker));
+    }
+    worker();           // the calling thread works too
+    for (size_t t = 0; t < pool.size(); ++t) {
+        pool[t].join();
+    }
+}
+
+//#define TEST
+#ifdef TEST
+
+#include "../SelfTest.hpp"
+
+static bool
+Same( const std::vector<Trajectory> &a, const std::vector<Trajectory> &b )
+{
+	if( a.size( ) != b.size( ) )
+		return false;
+	for( size_t i = 0; i < a.size( ); i++ )
+		if( a[i].states != b[i].states || a[i].diverged != b[i].diverged )
+			return false;
+	return true;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *CKPT = "trajgentest.ckpt";
+	remove( CKPT );
+
+	// 1) Latin hypercube: every stratum of every swept axis once, the rest fixed
+	TrajectorySweep sweep;
+	sweep.theta = SweepRange( -1., 1., 2 );
+	sweep.mass = SweepRange( 0.005, 0.02, 2 );
+	sweep.dragCoeffPerp = SweepRange( 2., 6., 2 );
+	const int N = 40;
+	std::vector<TrajectoryJob> jobs, again;
+	sweep.buildLatinHypercube( N, 7, &jobs );
+	bool strata = jobs.size( ) == N;
+	std::vector<int> hits[3] = { std::vector<int>( N ), std::vector<int>( N ), std::vector<int>( N ) };
+	for( int i = 0; strata && i < N; i++ )
+	{
+		double u[3] = { ( jobs[i].initial[2] + 1. ) / 2., ( jobs[i].params.mass - 0.005 ) / 0.015,
+			( jobs[i].params.dragCoeffPerp - 2. ) / 4. };
+		for( int a = 0; a < 3; a++ )
+			hits[a][std::min( N - 1, (int)( u[a] * N ) )]++;
+		strata = strata && jobs[i].initial[3] == 0. && jobs[i].initial[4] == -1. && jobs[i].params.width == 0.1;
+	}
+	for( int a = 0; a < 3; a++ )
+		for( int k = 0; k < N; k++ )
+			strata = strata && hits[a][k] == 1;
+	Check( strata, "Latin hypercube: one job per stratum on every swept axis, fixed axes untouched" );
+	sweep.buildLatinHypercube( N, 7, &again );
+	bool same = again.size( ) == jobs.size( );
+	for( int i = 0; same && i < N; i++ )
+		same = memcmp( &again[i], &jobs[i], sizeof( TrajectoryJob ) ) == 0;
+	Check( same, "the same seed gives the same hypercube" );
+
+	// 2) A sweep stopped partway: 15 of 40 done, the last record cut short
+	TrajectorySettings settings;
+	settings.samples = 200;
+	settings.substeps = 20;
+	std::vector<Trajectory> reference;
+	GenerateTrajectories( jobs, settings, 4, &reference );
+	{
+		SweepCheckpoint checkpoint;
+		Check( checkpoint.open( CKPT, jobs, settings ) && checkpoint.GetNumDone( ) == 0, "new checkpoint is empty" );
+		for( int j = 0; j < 16; j++ )
+			checkpoint.append( (size_t)( j * 7 % N ), reference[j * 7 % N] );
+	}
+	FILE *fp = fopen( CKPT, "r+b" );
+	fseek( fp, 0, SEEK_END );
+	TruncateFile( fp, (uint64_t)( ftell( fp ) - 1000 ) );
+	fclose( fp );
+
+	SweepCheckpoint checkpoint;
+	Check( checkpoint.open( CKPT, jobs, settings ) && checkpoint.GetNumDone( ) == 15,
+		"reopened: the whole records kept, the cut one dropped" );
+	std::vector<Trajectory> resumed;
+	GenerateTrajectories( jobs, settings, 4, &resumed, &checkpoint );
+	Check( checkpoint.GetNumDone( ) == N && Same( resumed, reference ), "resumed sweep: all done, same as in one go" );
+	checkpoint.close( );
+
+	SweepCheckpoint reopened;
+	std::vector<Trajectory> fromFile;
+	reopened.open( CKPT, jobs, settings );
+	GenerateTrajectories( jobs, settings, 1, &fromFile, &reopened );
+	Check( reopened.GetNumDone( ) == N && Same( fromFile, reference ), "finished sweep: everything read back" );
+	reopened.close( );
+
+	settings.substeps = 10;
+	Check( reopened.open( CKPT, jobs, settings ) && reopened.GetNumDone( ) == 0,
+		"other settings: the checkpoint starts over" );
+	reopened.close( );
+
+	// 3) Adaptive steps: every sample there, and close to the sharp model
+	// (RK4 steps of 0.1ms) over the first second
+	settings.samples = 101;
+	settings.substeps = 100;
+	std::vector<Trajectory> fine, adaptive;
+	GenerateTrajectories( jobs, settings, 4, &fine );
+	settings.tolerance = 1.e-6;
+	GenerateTrajectories( jobs, settings, 4, &adaptive );
+	int whole = 0;
+	double worst = 0.;
+	for( int j = 0; j < N; j++ )
+	{
+		if( adaptive[j].diverged || adaptive[j].GetNumSamples( ) != settings.samples )
+			continue;
+		whole++;
+		if( fine[j].GetNumSamples( ) == settings.samples )
+			for( int i = 0; i < 2; i++ )
+				worst = std::max( worst, fabs( adaptive[j].GetSample( 100 )[i] - fine[j].GetSample( 100 )[i] ) );
+	}
+	fprintf( stderr, "adaptive: %d of %d whole, position at 1s within %.2e m of the sharp model\n", whole, N, worst );
+	Check( whole == N, "adaptive: no trajectory diverges" );
+	Check( worst < 0.01, "adaptive: within 1cm of the sharp model at 1s" );
+	Check( reopened.open( CKPT, jobs, settings ) && reopened.GetNumDone( ) == 0,
+		"adaptive: the fixed-step checkpoint starts over" );
+	reopened.close( );
+
+	remove( CKPT );
+	return CheckResult( );
+}
+#endif
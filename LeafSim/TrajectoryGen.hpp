@@ -0,0 +1,97 @@
+#ifndef TRAJECTORYGEN_HPP
+#define TRAJECTORYGEN_HPP
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "FlutterModel.hpp"
+
+// Offline trajectory generation for the motion database: many independent
+// leaves (object parameters + initial state), integrated with the flutter
+// model and sampled at a fixed interval, spread over worker threads.
+//
+// By default every sample interval is cut into substeps RK4 steps of the
+// sharp model.  With a tolerance, Dopri45 picks the steps instead, on the
+// smoothed model (FlutterRhs), and the samples come from its dense output.
+
+struct TrajectorySettings {
+    double dt;          // sample interval (s)
+    int    samples;     // states per trajectory, including the initial one
+    int    substeps;    // RK4 steps per sample
+    double tolerance;   // > 0: adaptive steps to this relative tolerance instead
+    double rho, g;
+
+    TrajectorySettings();
+};
+
+struct TrajectoryJob {
+    FlutterParams params;
+    double initial[FLUTTER_DIM];    // [x, y, theta, vx, vy, omega]
+};
+
+struct Trajectory {
+    std::vector<double> states;     // FLUTTER_DIM per sample
+    bool diverged;                  // stopped early on a non-finite state (or out of adaptive steps)
+
+    int GetNumSamples() const { return (int)states.size() / FLUTTER_DIM; }
+    const double* GetSample(int i) const { return &states[i * FLUTTER_DIM]; }
+};
+
+// lo..hi in count evenly spaced values (count == 1 gives lo)
+struct SweepRange {
+    double lo, hi;
+    int count;
+
+    SweepRange(double value = 0.) : lo(value), hi(value), count(1) {}
+    SweepRange(double l, double h, int n) : lo(l), hi(h), count(n) {}
+    double at(int i) const { return count > 1 ? lo + (hi - lo) * i / (count - 1) : lo; }
+};
+
+// Initial conditions and object parameters to sweep (x, y start at 0): a
+// full grid over every axis, or a Latin hypercube of 'samples' jobs, where
+// each axis with hi != lo is cut into 'samples' equal strata and every
+// stratum of every axis is used once (the counts are ignored).  The
+// hypercube comes from the seed alone, so it is the same on every run.
+struct TrajectorySweep {
+    SweepRange theta, vx, vy, omega;
+    SweepRange mass, width, height, dragCoeffPerp, dragCoeffPara;
+
+    TrajectorySweep();      // one job: the ComputeTrajectory.py leaf, falling straight down
+    long GetNumJobs() const;
+    void buildJobs(std::vector<TrajectoryJob>* jobs) const;
+    void buildLatinHypercube(int samples, uint32_t seed, std::vector<TrajectoryJob>* jobs) const;
+};
+
+// Finished trajectories of a sweep, appended to a file as they come in, so
+// a sweep that was stopped picks up where it was.  The file starts with a
+// hash of the jobs and settings; open() keeps what is in it only if that
+// matches, and drops a last record cut short by the stop.
+class SweepCheckpoint {
+public:
+    SweepCheckpoint();
+    ~SweepCheckpoint();
+
+    bool open(const char* path, const std::vector<TrajectoryJob>& jobs, const TrajectorySettings& settings);
+    void close();
+
+    long GetNumDone() const { return m_numDone; }
+    bool isDone(size_t job) const { return m_offsets[job] != 0; }
+    bool read(size_t job, Trajectory* out);         // a done job's trajectory
+    bool append(size_t job, const Trajectory& traj);  // and flush; not thread safe
+
+private:
+    FILE* m_fp;
+    std::vector<uint64_t> m_offsets;    // per job, of its record; 0 = not done
+    long m_numDone;
+};
+
+// One trajectory.  Stops at the first non-finite state (the model can blow up
+// if the steps are too big), or, adaptive, when the steps run out.
+void GenerateTrajectory(const TrajectoryJob& job, const TrajectorySettings& settings, Trajectory* out);
+
+// All of them, on 'threads' threads (0 = one per hardware thread).  out[i]
+// belongs to jobs[i] whatever order they finish in.  With a checkpoint, the
+// jobs done in it are read back instead, and the rest are added to it.
+void GenerateTrajectories(const std::vector<TrajectoryJob>& jobs, const TrajectorySettings& settings,
+                          int threads, std::vector<Trajectory>* out, SweepCheckpoint* checkpoint = NULL);
+
+#endif // TRAJECTORYGEN_HPP
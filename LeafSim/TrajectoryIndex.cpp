@@ -0,0 +1,398 @@
+// Benchmark + check: make libleafsim.a && g++ -std=c++11 -O2 -DBENCH -o indexbench LeafSim/TrajectoryIndex.cpp -L. -lleafsim -pthread
+#include "TrajectoryIndex.hpp"
+#include "TrajectoryDb.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const float PI = 3.14159265358979f;
+static const int LEAF_SIZE = 8;         // ranges this small are scanned
+static const int MAX_K = 32;
+
+// to [-pi/2, pi/2)
+static inline float WrapTheta(float theta)
+{
+    return theta - PI * std::floor(theta / PI + 0.5f);
+}
+
+void MakeTrajectoryKey(const float* state, const FlutterParams& params, float* key)
+{
+    key[KEY_THETA] = state[2];
+    key[KEY_VX] = state[3];
+    key[KEY_VY] = state[4];
+    key[KEY_OMEGA] = state[5];
+    key[KEY_MASS] = (float)params.mass;
+    key[KEY_WIDTH] = (float)params.width;
+    key[KEY_HEIGHT] = (float)params.height;
+    key[KEY_PERP] = (float)params.dragCoeffPerp;
+    key[KEY_PARA] = (float)params.dragCoeffPara;
+}
+
+// The k best so far, closest first
+struct TrajectoryIndex::Best {
+    int k, count;
+    int ids[MAX_K];
+    float d2[MAX_K];
+
+    explicit Best(int wanted) : k(std::max(1, std::min(wanted, MAX_K))), count(0) {}
+
+    float worst() const { return count < k ? 3.4e38f : d2[count - 1]; }
+
+    void offer(int id, float dist2)
+    {
+        if (dist2 >= worst()) {
+            return;
+        }
+        // the same trajectory can come in twice, once per theta image
+        for (int i = 0; i < count; ++i) {
+            if (ids[i] == id) {
+                if (dist2 >= d2[i]) {
+                    return;
+                }
+                for (int j = i; j + 1 < count; ++j) {
+                    ids[j] = ids[j + 1];
+                    d2[j] = d2[j + 1];
+                }
+                count--;
+                break;
+            }
+        }
+        int i = (count < k) ? count++ : count - 1;
+        while (i > 0 && d2[i - 1] > dist2) {
+            ids[i] = ids[i - 1];
+            d2[i] = d2[i - 1];
+            --i;
+        }
+        ids[i] = id;
+        d2[i] = dist2;
+    }
+};
+
+TrajectoryIndex::TrajectoryIndex()
+{
+    for (int d = 0; d < TRAJECTORY_KEY_DIM; ++d) {
+        m_scale[d] = 1.f;
+    }
+}
+
+void TrajectoryIndex::build(const TrajectoryDb& db)
+{
+    int n = db.GetNumTrajectories();
+    std::vector<float> keys((size_t)n * TRAJECTORY_KEY_DIM);
+    for (int i = 0; i < n; ++i) {
+        MakeTrajectoryKey(db.GetRecord(i).initial, db.GetParams(i), &keys[(size_t)i * TRAJECTORY_KEY_DIM]);
+    }
+    build(n > 0 ? &keys[0] : NULL, n);
+}
+
+void TrajectoryIndex::build(const float* keys, int count)
+{
+    m_rawKeys.assign(keys, keys + (size_t)count * TRAJECTORY_KEY_DIM);
+
+    // 1) Default scale: 1 / standard deviation, 0 where the keys don't vary
+    for (int d = 0; d < TRAJECTORY_KEY_DIM; ++d) {
+        double sum = 0., sum2 = 0.;
+        for (int i = 0; i < count; ++i) {
+            double v = keys[i * TRAJECTORY_KEY_DIM + d];
+            if (d == KEY_THETA) {
+                v = WrapTheta((float)v);
+            }
+            sum += v;
+            sum2 += v * v;
+        }
+        double mean = (count > 0) ? sum / count : 0.;
+        double var = (count > 0) ? std::max(0., sum2 / count - mean * mean) : 0.;
+        m_scale[d] = (var > 1.e-12) ? (float)(1. / std::sqrt(var)) : 0.f;
+    }
+    setScale(m_scale);
+}
+
+void TrajectoryIndex::setScale(const float* scale)
+{
+    if (scale != m_scale) {
+        std::memcpy(m_scale, scale, sizeof(m_scale));
+    }
+
+    int count = (int)(m_rawKeys.size() / TRAJECTORY_KEY_DIM);
+    m_keys.resize(m_rawKeys.size());
+    m_ids.resize(count);
+    m_split.assign(count, 0);
+    for (int i = 0; i < count; ++i) {
+        scaleKey(&m_rawKeys[(size_t)i * TRAJECTORY_KEY_DIM], &m_keys[(size_t)i * TRAJECTORY_KEY_DIM]);
+        m_ids[i] = i;
+    }
+    buildTree(0, count);
+
+    // 2) Keys into tree order so the search reads them sequentially
+    std::vector<float> ordered(m_keys.size());
+    for (int i = 0; i < count; ++i) {
+        std::memcpy(&ordered[(size_t)i * TRAJECTORY_KEY_DIM], &m_keys[(size_t)m_ids[i] * TRAJECTORY_KEY_DIM],
+                    TRAJECTORY_KEY_DIM * sizeof(float));
+    }
+    m_keys.swap(ordered);
+}
+
+void TrajectoryIndex::scaleKey(const float* key, float* scaled) const
+{
+    for (int d = 0; d < TRAJECTORY_KEY_DIM; ++d) {
+        float v = (d == KEY_THETA) ? WrapTheta(key[d]) : key[d];
+        scaled[d] = v * m_scale[d];
+    }
+}
+
+// Median split along the widest dimension.  While building, m_ids is the
+// permutation and m_keys is still in id order.
+void TrajectoryIndex::buildTree(int lo, int hi)
+{
+    if (hi - lo <= LEAF_SIZE) {
+        return;
+    }
+    const float* keys = &m_keys[0];
+
+    int dim = 0;
+    float widest = -1.f;
+    for (int d = 0; d < TRAJECTORY_KEY_DIM; ++d) {
+        float mn = 3.4e38f, mx = -3.4e38f;
+        for (int i = lo; i < hi; ++i) {
+            float v = keys[(size_t)m_ids[i] * TRAJECTORY_KEY_DIM + d];
+            mn = std::min(mn, v);
+            mx = std::max(mx, v);
+        }
+        if (mx - mn > widest) {
+            widest = mx - mn;
+            dim = d;
+        }
+    }
+
+    int mid = (lo + hi) / 2;
+    std::nth_element(m_ids.begin() + lo, m_ids.begin() + mid, m_ids.begin() + hi, [keys, dim](int a, int b) {
+        return keys[(size_t)a * TRAJECTORY_KEY_DIM + dim] < keys[(size_t)b * TRAJECTORY_KEY_DIM + dim];
+    });
+    m_split[mid] = (unsigned char)dim;
+    buildTree(lo, mid);
+    buildTree(mid + 1, hi);
+}
+
+// rd is the squared distance from q to the current cell and off[d] its part
+// along d, so a far side is pruned by its true cell distance, not just the
+// distance to one splitting plane (Arya & Mount)
+void TrajectoryIndex::search(const float* q, int lo, int hi, float rd, float* off, Best& best) const
+{
+    if (hi - lo <= LEAF_SIZE) {
+        for (int i = lo; i < hi; ++i) {
+            const float* k = &m_keys[(size_t)i * TRAJECTORY_KEY_DIM];
+            float d2 = 0.f;
+            for (int d = 0; d < TRAJECTORY_KEY_DIM; ++d) {
+                float diff = q[d] - k[d];
+                d2 += diff * diff;
+            }
+            best.offer(m_ids[i], d2);
+        }
+        return;
+    }
+
+    int mid = (lo + hi) / 2;
+    int dim = m_split[mid];
+    const float* k = &m_keys[(size_t)mid * TRAJECTORY_KEY_DIM];
+    float d2 = 0.f;
+    for (int d = 0; d < TRAJECTORY_KEY_DIM; ++d) {
+        float diff = q[d] - k[d];
+        d2 += diff * diff;
+    }
+    best.offer(m_ids[mid], d2);
+
+    // near side first, then the far side if its cell can still hold a closer key
+    float plane = q[dim] - k[dim];
+    bool left = plane < 0.f;
+    search(q, left ? lo : mid + 1, left ? mid : hi, rd, off, best);
+
+    float oldOff = off[dim];
+    float farRd = rd - oldOff * oldOff + plane * plane;
+    if (farRd < best.worst()) {
+        off[dim] = plane;
+        search(q, left ? mid + 1 : lo, left ? hi : mid, farRd, off, best);
+        off[dim] = oldOff;
+    }
+}
+
+int TrajectoryIndex::findNearest(const float* key, int k, int* ids, float* distances) const
+{
+    if (m_ids.empty() || k <= 0) {
+        return 0;
+    }
+    float q[TRAJECTORY_KEY_DIM];
+    scaleKey(key, q);
+
+    Best best(k);
+    float off[TRAJECTORY_KEY_DIM] = { 0.f };
+    search(q, 0, (int)m_ids.size(), 0.f, off, best);
+
+    // the image of the query across the theta wrap, if anything that far
+    // round can still be closer
+    if (m_scale[KEY_THETA] > 0.f) {
+        float period = PI * m_scale[KEY_THETA];
+        float toWrap = 0.5f * period - std::fabs(q[KEY_THETA]);
+        if (toWrap * toWrap < best.worst()) {
+            q[KEY_THETA] += (q[KEY_THETA] >= 0.f) ? -period : period;
+            search(q, 0, (int)m_ids.size(), 0.f, off, best);
+        }
+    }
+
+    for (int i = 0; i < best.count; ++i) {
+        ids[i] = best.ids[i];
+        distances[i] = std::sqrt(best.d2[i]);
+    }
+    return best.count;
+}
+
+TrajectoryIndex::Match TrajectoryIndex::findNearest(const float* key) const
+{
+    Match m;
+    int ids[2];
+    float dist[2];
+    int found = findNearest(key, 2, ids, dist);
+
+    m.nearest = (found > 0) ? ids[0] : -1;
+    m.second = (found > 1) ? ids[1] : -1;
+    m.distance = (found > 0) ? dist[0] : 0.f;
+    m.weight = 1.f;
+    if (found > 1 && dist[0] > 0.f) {
+        // inverse distance: equally far -> 0.5
+        m.weight = dist[1] / (dist[0] + dist[1]);
+    }
+    return m;
+}
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include "../SelfTest.hpp"
+
+static double
+Us( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::micro>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+}
+
+// every key, with the same scaling and theta wrap as the index:
+static int
+BruteNearest( const std::vector<float> &keys, const float *scale, const float *key )
+{
+	int best = -1;
+	float bestD2 = 3.4e38f;
+	for( size_t i = 0; i < keys.size( ) / TRAJECTORY_KEY_DIM; i++ )
+	{
+		float d2 = 0.f;
+		for( int d = 0; d < TRAJECTORY_KEY_DIM; d++ )
+		{
+			float diff = key[d] - keys[i*TRAJECTORY_KEY_DIM + d];
+			if( d == KEY_THETA )
+				diff = WrapTheta( diff );
+			diff *= scale[d];
+			d2 += diff * diff;
+		}
+		if( d2 < bestD2 )
+		{
+			bestD2 = d2;
+			best = (int)i;
+		}
+	}
+	return best;
+}
+
+// index vs brute force on one database; returns false on a wrong answer
+static bool
+RunCase( const char *name, const std::vector<float> &keys, const std::vector<float> &queries )
+{
+	const int CHECKS = 2000;
+	int n = (int)( keys.size( ) / TRAJECTORY_KEY_DIM );
+	int nq = (int)( queries.size( ) / TRAJECTORY_KEY_DIM );
+
+	TrajectoryIndex index;
+	auto t0 = std::chrono::high_resolution_clock::now( );
+	index.build( &keys[0], n );
+	double buildUs = Us( t0 );
+
+	t0 = std::chrono::high_resolution_clock::now( );
+	long sum = 0;
+	for( int i = 0; i < nq; i++ )
+		sum += index.findNearest( &queries[(size_t)i*TRAJECTORY_KEY_DIM] ).nearest;
+	double queryUs = Us( t0 ) / nq;
+
+	t0 = std::chrono::high_resolution_clock::now( );
+	for( int i = 0; i < CHECKS; i++ )
+		sum += BruteNearest( keys, index.GetScale( ), &queries[(size_t)i*TRAJECTORY_KEY_DIM] );
+	double bruteUs = Us( t0 ) / CHECKS;
+
+	int wrong = 0, flipped = 0;
+	for( int i = 0; i < CHECKS; i++ )
+	{
+		float q[TRAJECTORY_KEY_DIM];
+		memcpy( q, &queries[(size_t)i*TRAJECTORY_KEY_DIM], sizeof(q) );
+		int a = index.findNearest( q ).nearest;
+		if( a != BruteNearest( keys, index.GetScale( ), q ) )
+			wrong++;
+
+		// theta and theta + pi are the same leaf:
+		q[KEY_THETA] += PI;
+		if( index.findNearest( q ).nearest != a )
+			flipped++;
+	}
+
+	TrajectoryIndex::Match m = index.findNearest( &queries[0] );
+	fprintf( stderr, "%s, %d trajectories: build %.1f ms, lookup %.2f us (brute force %.0f us)   (%ld)\n",
+		name, n, buildUs / 1000., queryUs, bruteUs, sum );
+	fprintf( stderr, "  example: nearest %d, second %d, weight %.3f;  %d / %d differ from brute force, %d change when theta += pi\n",
+		m.nearest, m.second, m.weight, wrong, CHECKS, flipped );
+	return wrong == 0 && flipped == 0 && m.weight >= 0.5f && m.weight <= 1.f;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const int QUERIES = 100000;
+	std::mt19937 rng( 3 );
+	std::uniform_real_distribution<float> u( 0.f, 1.f );
+
+	// detach states anywhere, leaves around the defaults
+	std::vector<float> queries( (size_t)QUERIES * TRAJECTORY_KEY_DIM );
+	for( int i = 0; i < QUERIES; i++ )
+	{
+		float state[6] = { 0.f, 0.f, 6.f*u(rng) - 3.f, 2.f*u(rng) - 1.f, -2.f*u(rng), 2.f*u(rng) - 1.f };
+		FlutterParams p = { 0.005 + 0.015*u(rng), 0.05 + 0.1*u(rng), 0.05 + 0.1*u(rng), 4.1, 0.9 };
+		MakeTrajectoryKey( state, p, &queries[(size_t)i*TRAJECTORY_KEY_DIM] );
+	}
+
+	// 1. a GenerateTrajectories grid: theta 16, vx 9, vy 5, omega 5, mass 4
+	std::vector<float> grid;
+	for( int a = 0; a < 16; a++ )
+	for( int b = 0; b < 9; b++ )
+	for( int c = 0; c < 5; c++ )
+	for( int d = 0; d < 5; d++ )
+	for( int e = 0; e < 4; e++ )
+	{
+		float state[6] = { 0.f, 0.f, -PI/2.f + PI*a/16.f, -1.f + 0.25f*b, -0.5f*c, -1.f + 0.5f*d };
+		FlutterParams p = { 0.005 + 0.005*e, 0.1, 0.1, 4.1, 0.9 };
+		float key[TRAJECTORY_KEY_DIM];
+		MakeTrajectoryKey( state, p, key );
+		grid.insert( grid.end( ), key, key + TRAJECTORY_KEY_DIM );
+	}
+
+	// 2. the worst case: 100000 random trajectories varying in 7 dimensions
+	const int N = 100000;
+	std::vector<float> scattered( (size_t)N * TRAJECTORY_KEY_DIM );
+	for( int i = 0; i < N; i++ )
+	{
+		float state[6] = { 0.f, 0.f, PI*u(rng) - PI/2.f, 2.f*u(rng) - 1.f, -2.f*u(rng), 2.f*u(rng) - 1.f };
+		FlutterParams p = { 0.005 + 0.015*u(rng), 0.05 + 0.1*u(rng), 0.05 + 0.1*u(rng), 4.1, 0.9 };
+		MakeTrajectoryKey( state, p, &scattered[(size_t)i*TRAJECTORY_KEY_DIM] );
+	}
+
+	Check( RunCase( "sweep grid", grid, queries ), "sweep grid: same nearest as brute force" );
+	Check( RunCase( "random", scattered, queries ), "random: same nearest as brute force" );
+	return CheckResult( );
+}
+#endif
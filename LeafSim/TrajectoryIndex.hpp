@@ -0,0 +1,64 @@
+#ifndef TRAJECTORYINDEX_HPP
+#define TRAJECTORYINDEX_HPP
+#include <vector>
+#include "FlutterModel.hpp"
+
+class TrajectoryDb;
+
+// Key of a trajectory: its initial condition and leaf, with x and y left out
+// (the motion is the same wherever it starts)
+enum {
+    KEY_THETA, KEY_VX, KEY_VY, KEY_OMEGA,
+    KEY_MASS, KEY_WIDTH, KEY_HEIGHT, KEY_PERP, KEY_PARA,
+    TRAJECTORY_KEY_DIM
+};
+
+// key[TRAJECTORY_KEY_DIM] from a state [x, y, theta, vx, vy, omega] and a leaf
+void MakeTrajectoryKey(const float* state, const FlutterParams& params, float* key);
+
+// Nearest-trajectory lookup for spawning leaves without integrating.
+//
+// A k-d tree over the keys of every stored trajectory, each dimension scaled
+// (by default by 1 / its standard deviation over the database, and dimensions
+// the database doesn't vary in are ignored).  The model is pi-periodic in
+// theta (a plate turned over is the same plate), so theta is wrapped to
+// [-pi/2, pi/2) and compared around the wrap.
+class TrajectoryIndex {
+public:
+    struct Match {
+        int   nearest;      // trajectory id, -1 if the index is empty
+        int   second;       // runner-up, -1 if there is only one
+        float weight;       // of 'nearest' when blending with 'second', in [0.5, 1]
+        float distance;     // scaled distance to 'nearest'
+    };
+
+    TrajectoryIndex();
+
+    // Index all trajectories of a database (ids = database indices)
+    void build(const TrajectoryDb& db);
+    // or raw keys, TRAJECTORY_KEY_DIM floats each (ids = 0..count-1)
+    void build(const float* keys, int count);
+    // Override the per-dimension scale (rebuilds); 0 ignores a dimension
+    void setScale(const float* scale);
+
+    int GetSize() const { return (int)m_ids.size(); }
+    const float* GetScale() const { return m_scale; }
+
+    Match findNearest(const float* key) const;
+    // Up to k nearest, closest first; returns how many were found
+    int findNearest(const float* key, int k, int* ids, float* distances) const;
+
+private:
+    struct Best;
+    void buildTree(int lo, int hi);
+    void search(const float* q, int lo, int hi, float rd, float* off, Best& best) const;
+    void scaleKey(const float* key, float* scaled) const;
+
+    float m_scale[TRAJECTORY_KEY_DIM];
+    std::vector<float> m_rawKeys;       // as given, in id order
+    std::vector<float> m_keys;          // scaled, in tree order
+    std::vector<int> m_ids;             // tree order -> id
+    std::vector<unsigned char> m_split; // split dimension of the node at each median
+};
+
+#endif // TRAJECTORYINDEX_HPP
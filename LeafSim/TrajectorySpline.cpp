@@ -0,0 +1,247 @@
+// Benchmark + check: make libleafsim.a && g++ -std=c++11 -O2 -DBENCH -o splinebench LeafSim/TrajectorySpline.cpp -L. -lleafsim -pthread
+#include "TrajectorySpline.hpp"
+#include "FlutterModel.hpp"
+#include <algorithm>
+#include <cmath>
+
+static const int MAX_SPAN = 4096;          // frames between two keys
+
+SplineTolerance::SplineTolerance()
+    : position(0.002f)
+    , angle(0.01f)
+    , velocity(0.02f)
+    , spin(0.1f)
+{
+}
+
+float SplineTolerance::GetTolerance(int component) const
+{
+    switch (component) {
+    case 0: case 1: return position;
+    case 2:         return angle;
+    case 3: case 4: return velocity;
+    default:        return spin;
+    }
+}
+
+static inline float Hermite(const SplineKey& a, const SplineKey& b, float frame)
+{
+    float h = b.frame - a.frame;
+    float u = (h > 0.f) ? (frame - a.frame) / h : 0.f;
+    u = std::max(0.f, std::min(u, 1.f));
+    float u2 = u * u, u3 = u2 * u;
+    return (2.f * u3 - 3.f * u2 + 1.f) * a.value + (u3 - 2.f * u2 + u) * h * a.slope +
+           (3.f * u2 - 2.f * u3) * b.value + (u3 - u2) * h * b.slope;
+}
+
+void FitSpline(const double* states, int numSamples, int component, double dt, float tolerance,
+               std::vector<SplineKey>* keys)
+{
+    keys->clear();
+    if (numSamples <= 0) {
+        return;
+    }
+
+    // 1) A key candidate at every sample
+    std::vector<SplineKey> at(numSamples);
+    for (int i = 0; i < numSamples; ++i) {
+        double slope;
+        if (component < 3) {
+            slope = states[i * FLUTTER_DIM + component + 3] * dt;
+        } else {
+            int a = std::max(i - 1, 0), b = std::min(i + 1, numSamples - 1);
+            slope = (b > a) ? (states[b * FLUTTER_DIM + component] - states[a * FLUTTER_DIM + component]) / (b - a) : 0.;
+        }
+        at[i].frame = (float)i;
+        at[i].value = (float)states[i * FLUTTER_DIM + component];
+        at[i].slope = (float)slope;
+    }
+
+    // 2) From each key, the furthest next one that still fits every sample between
+    keys->push_back(at[0]);
+    int a = 0;
+    while (a < numSamples - 1) {
+        int best = a + 1;
+        for (int b = a + 2; b < numSamples && b - a <= MAX_SPAN; ++b) {
+            bool fits = true;
+            for (int i = a + 1; i < b && fits; ++i) {
+                float err = std::fabs(Hermite(at[a], at[b], (float)i) - (float)states[i * FLUTTER_DIM + component]);
+                fits = err <= tolerance;
+            }
+            if (!fits) {
+                break;
+            }
+            best = b;
+        }
+        keys->push_back(at[best]);
+        a = best;
+    }
+}
+
+float EvaluateSpline(const SplineKey* keys, uint32_t count, float frame, uint32_t* segment)
+{
+    if (count < 2) {
+        return (count == 1) ? keys[0].value : 0.f;
+    }
+    uint32_t s = std::min(*segment, count - 2);
+    if (frame < keys[s].frame || frame >= keys[s + 1].frame) {
+        if (s + 2 < count && frame >= keys[s + 1].frame && frame < keys[s + 2].frame) {
+            s++;            // the usual case in playback
+        } else {
+            // the last key at or before frame (0 before the first, count - 2 after the last)
+            const SplineKey* k = std::upper_bound(keys + 1, keys + count - 1, frame,
+                                                  [](float f, const SplineKey& key) { return f < key.frame; });
+            s = (uint32_t)(k - keys) - 1;
+        }
+    }
+    *segment = s;
+    return Hermite(keys[s], keys[s + 1], frame);
+}
+
+//#define BENCH
+#ifdef BENCH
+
+#include <chrono>
+#include <cstdio>
+#include "TrajectoryDb.hpp"
+#include "TrajectoryGen.hpp"
+#include "../SelfTest.hpp"
+
+static double
+Ns( std::chrono::steady_clock::time_point t0, double count )
+{
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now( ) - t0 ).count( ) / count;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *F32 = "splinebench_f32.bin";
+	const char *SPL = "splinebench_spline.bin";
+
+	// 1) A GenerateTrajectories-style sweep: 10 s clips at 100 Hz
+	TrajectorySweep sweep;
+	sweep.theta = SweepRange( -1.2, 1.2, 7 );
+	sweep.vx = SweepRange( -0.5, 0.5, 3 );
+	sweep.mass = SweepRange( 0.007, 0.015, 3 );
+	std::vector<TrajectoryJob> jobs;
+	sweep.buildJobs( &jobs );
+	TrajectorySettings settings;
+	std::vector<Trajectory> clips;
+	GenerateTrajectories( jobs, settings, 0, &clips );
+
+	TrajectoryDbWriter writer;
+	long samples = 0;
+	for( size_t i = 0; i < clips.size( ); i++ )
+	{
+		writer.add( jobs[i].params, settings.rho, settings.g, settings.dt, clips[i].states.data( ), clips[i].GetNumSamples( ) );
+		samples += clips[i].GetNumSamples( );
+	}
+	auto t0 = std::chrono::steady_clock::now( );
+	Check( writer.write( F32, ENCODING_FLOAT32 ), "float32 database written" );
+	double f32Ms = Ns( t0, 1.e6 );
+	t0 = std::chrono::steady_clock::now( );
+	Check( writer.write( SPL, ENCODING_SPLINE ), "spline database written" );
+	double splMs = Ns( t0, 1.e6 );
+
+	TrajectoryDb f32, spl;
+	Check( f32.open( F32 ) && spl.open( SPL ), "both open" );
+	double doubles = (double)samples * FLUTTER_DIM * sizeof( double );
+	fprintf( stderr, "%d clips, %ld samples: doubles %.0f KB, float32 %.0f KB (%.1f ms), spline %.0f KB (%.1f ms)\n",
+		(int)clips.size( ), samples, doubles / 1024., f32.GetFileSize( ) / 1024., f32Ms, spl.GetFileSize( ) / 1024., splMs );
+	fprintf( stderr, "  %.1fx smaller than the doubles, %.1fx than float32\n",
+		doubles / spl.GetFileSize( ), (double)f32.GetFileSize( ) / spl.GetFileSize( ) );
+	Check( doubles / spl.GetFileSize( ) > 10., "spline more than 10x smaller than the doubles" );
+	Check( spl.GetFileSize( ) < f32.GetFileSize( ), "spline smaller than float32" );
+
+	// 2) Every sample within tolerance, through getSample() and a cursor
+	SplineTolerance tol;
+	bool within = true, same = true;
+	double worst[FLUTTER_DIM] = { 0. };
+	for( int c = 0; c < spl.GetNumTrajectories( ); c++ )
+	{
+		TrajectoryCursor cursor;
+		cursor.start( &spl, c );
+		for( int n = 0; n < (int)spl.GetRecord( c ).numSamples; n++ )
+		{
+			float s[FLUTTER_DIM], t[FLUTTER_DIM];
+			spl.getSample( c, n, s );
+			cursor.evaluate( n, t );
+			for( int k = 0; k < FLUTTER_DIM; k++ )
+			{
+				double err = std::fabs( s[k] - clips[c].states[(size_t)n * FLUTTER_DIM + k] );
+				worst[k] = std::max( worst[k], err / tol.GetTolerance( k ) );
+				within = within && err <= tol.GetTolerance( k ) * 1.0001;
+				same = same && s[k] == t[k];
+			}
+		}
+	}
+	Check( within, "every sample within tolerance" );
+	Check( same, "cursor and getSample() agree" );
+	fprintf( stderr, "  worst error / tolerance:" );
+	for( int k = 0; k < FLUTTER_DIM; k++ )
+		fprintf( stderr, " %.2f", worst[k] );
+	fprintf( stderr, "\n" );
+
+	// a cursor jumping about (binary searches) gives the same as one moving on
+	TrajectoryCursor jumpy, steady;
+	jumpy.start( &spl, 5 );
+	steady.start( &spl, 5 );
+	bool agree = true;
+	for( int n = 0; n < 2000; n++ )
+	{
+		double frame = ( n * 7919 ) % 1000 + 0.37;
+		float a[FLUTTER_DIM], b[FLUTTER_DIM];
+		jumpy.evaluate( frame, a );
+		spl.evaluate( 5, frame, b );
+		for( int k = 0; k < FLUTTER_DIM; k++ )
+			agree = agree && a[k] == b[k];
+	}
+	Check( agree, "random access agrees with evaluate()" );
+
+	// 3) Playback cost per leaf and frame, against integrating the frame
+	const int LEAVES = 1000, FRAMES = 600;		// 10 s at 60 Hz
+	std::vector<TrajectoryCursor> cursors( LEAVES ), linear( LEAVES );
+	for( int l = 0; l < LEAVES; l++ )
+	{
+		cursors[l].start( &spl, l % spl.GetNumTrajectories( ) );
+		linear[l].start( &f32, l % f32.GetNumTrajectories( ) );
+	}
+	float sink = 0.f;
+	double frameStep = ( 1. / 60. ) / settings.dt;
+	t0 = std::chrono::steady_clock::now( );
+	for( int f = 0; f < FRAMES; f++ )
+		for( int l = 0; l < LEAVES; l++ )
+		{
+			float s[FLUTTER_DIM];
+			cursors[l].evaluate( f * frameStep, s );
+			sink += s[0];
+		}
+	double splineNs = Ns( t0, (double)LEAVES * FRAMES );
+	t0 = std::chrono::steady_clock::now( );
+	for( int f = 0; f < FRAMES; f++ )
+		for( int l = 0; l < LEAVES; l++ )
+		{
+			float s[FLUTTER_DIM];
+			linear[l].evaluate( f * frameStep, s );
+			sink += s[0];
+		}
+	double linearNs = Ns( t0, (double)LEAVES * FRAMES );
+	double state[FLUTTER_DIM] = { 0., 0., 0.3, 0.5, -1., 0. };
+	const int STEPS = 100000;
+	t0 = std::chrono::steady_clock::now( );
+	for( int k = 0; k < STEPS; k++ )
+		FlutterRk4Step( state, jobs[0].params, settings.rho, settings.g, 1.e-4 );
+	double rk4Ns = Ns( t0, STEPS );
+	// a 60 Hz frame is 1/60 s of 1e-4 s steps (the step the model needs)
+	fprintf( stderr, "\nper leaf and 60 Hz frame: spline cursor %.1f ns, float32 lerp %.1f ns, integrating %.0f ns (%.1f ns a step)  [%g]\n",
+		splineNs, linearNs, rk4Ns * ( 1. / 60. ) / 1.e-4, rk4Ns, sink + state[0] );
+	Check( splineNs < rk4Ns, "spline playback costs less than one integration step" );
+
+	f32.close( );
+	spl.close( );
+	remove( F32 );
+	remove( SPL );
+	return CheckResult( );
+}
+#endif
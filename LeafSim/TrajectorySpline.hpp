@@ -0,0 +1,43 @@
+#ifndef TRAJECTORYSPLINE_HPP
+#define TRAJECTORYSPLINE_HPP
+#include <cstdint>
+#include <vector>
+
+// Piecewise cubic Hermite curves through keyframes: the ENCODING_SPLINE
+// trajectory database (LeafSim/TrajectoryDb.hpp).
+//
+// Every state component has keys of its own, so a smooth x needs a few and a
+// spinning omega as many as it takes.  A key is a frame (sample index), the
+// value there and the slope per frame; between two keys the curve is the
+// cubic Hermite through both.  FitSpline() picks keys among the samples
+// greedily: from each key, the next is as far on as it can be with every
+// sample in between still within tolerance.  x, y and theta take their
+// slopes from vx, vy and omega (exact derivatives), the velocities from
+// central differences.
+
+struct SplineKey {
+    float frame;
+    float value;
+    float slope;            // per frame
+};
+
+struct SplineTolerance {
+    float position;         // m, x and y
+    float angle;            // rad, theta
+    float velocity;         // m/s, vx and vy
+    float spin;             // rad/s, omega
+
+    SplineTolerance();
+    float GetTolerance(int component) const;
+};
+
+// Keys for one component of states (numSamples * FLUTTER_DIM)
+void FitSpline(const double* states, int numSamples, int component, double dt, float tolerance,
+               std::vector<SplineKey>* keys);
+
+// The curve at 'frame', held at the end keys outside them.  *segment is where
+// the key search starts and is left at the segment used: moving on by up to a
+// key a call it is O(1), anything else a binary search.
+float EvaluateSpline(const SplineKey* keys, uint32_t count, float frame, uint32_t* segment);
+
+#endif // TRAJECTORYSPLINE_HPP
@@ -0,0 +1,535 @@
+// Benchmark + check: g++ -std=c++11 -O2 -DBENCH -o streambench LeafSim/TrajectoryStream.cpp LeafSim/FlutterModel.cpp -pthread
+#include "TrajectoryStream.hpp"
+#include "TrajectoryDb.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static_assert(sizeof(TrajectoryStreamHeader) == 80, "TrajectoryStreamHeader layout changed");
+static_assert(sizeof(TrajectoryChunkHeader) == 16, "TrajectoryChunkHeader layout changed");
+
+static const char MAGIC[4] = { 'L', 'T', 'R', 'S' };
+
+static const double DELTA_STEPS = 32000.;  // largest step -> this many units (int16 has 32767)
+static const int16_t NAN_STEP = -32768;     // this sample is not finite; the next steps on from the last
+
+static size_t PayloadBytes(uint32_t encoding, uint32_t numSamples)
+{
+    if (numSamples == 0) {
+        return 0;
+    }
+    if (encoding == STREAM_FLOAT32) {
+        return (size_t)numSamples * FLUTTER_DIM * sizeof(float);
+    }
+    return FLUTTER_DIM * 2 * sizeof(double) +
+           (size_t)(numSamples - 1) * FLUTTER_DIM * sizeof(int16_t);
+}
+
+// -------------------------------------
+// Writer
+// -------------------------------------
+TrajectoryStreamWriter::TrajectoryStreamWriter()
+    : m_fp(NULL)
+    , m_fill(NULL)
+    , m_numSamples(0)
+    , m_quit(false)
+    , m_ok(true)
+    , m_bytesWritten(0)
+{
+    std::memset(&m_header, 0, sizeof(m_header));
+}
+
+TrajectoryStreamWriter::~TrajectoryStreamWriter()
+{
+    close();
+}
+
+bool TrajectoryStreamWriter::open(const char* path, const FlutterParams& params, double rho, double g,
+                                  double dt, TrajectoryStreamEncoding encoding, uint32_t chunkSamples)
+{
+    close();
+
+    m_fp = fopen(path, "wb");
+    if (m_fp == NULL) {
+        fprintf(stderr, "Cannot open '%s' for writing\n", path);
+        return false;
+    }
+
+    std::memset(&m_header, 0, sizeof(m_header));
+    std::memcpy(m_header.magic, MAGIC, sizeof(MAGIC));
+    m_header.version = TRAJECTORY_STREAM_VERSION;
+    m_header.endianTag = TRAJECTORY_DB_ENDIAN_TAG;
+    m_header.headerSize = sizeof(TrajectoryStreamHeader);
+    m_header.stateDim = FLUTTER_DIM;
+    m_header.encoding = encoding;
+    m_header.chunkSamples = std::max(chunkSamples, 1u);
+    m_header.dt = (float)dt;
+    m_header.mass = (float)params.mass;
+    m_header.width = (float)params.width;
+    m_header.height = (float)params.height;
+    m_header.dragCoeffPerp = (float)params.dragCoeffPerp;
+    m_header.dragCoeffPara = (float)params.dragCoeffPara;
+    m_header.rho = (float)rho;
+    m_header.g = (float)g;
+    m_ok = fwrite(&m_header, sizeof(m_header), 1, m_fp) == 1;
+    m_bytesWritten = sizeof(m_header);
+    m_numSamples = 0;
+
+    for (int b = 0; b < MAX_BUFFERS; ++b) {
+        Chunk* chunk = new Chunk;
+        chunk->states.reserve((size_t)m_header.chunkSamples * FLUTTER_DIM);
+        chunk->firstSample = 0;
+        m_buffers.push_back(chunk);
+        m_free.push_back(chunk);
+    }
+    m_fill = m_free.front();
+    m_free.pop_front();
+    m_quit = false;
+    m_flusher = std::thread(&TrajectoryStreamWriter::flushLoop, this);
+    return true;
+}
+
+void TrajectoryStreamWriter::push(const double* state)
+{
+    m_fill->states.insert(m_fill->states.end(), state, state + FLUTTER_DIM);
+    m_numSamples++;
+    if (m_fill->states.size() == (size_t)m_header.chunkSamples * FLUTTER_DIM) {
+        handOff();
+    }
+}
+
+void TrajectoryStreamWriter::handOff()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_full.push_back(m_fill);
+    m_wake.notify_all();
+    m_wake.wait(lock, [this]() { return !m_free.empty(); });
+    m_fill = m_free.front();
+    m_free.pop_front();
+    m_fill->states.clear();
+    m_fill->firstSample = m_numSamples;
+}
+
+bool TrajectoryStreamWriter::close()
+{
+    if (m_fp == NULL) {
+        return false;
+    }
+
+    // 1) The partial chunk, then let the flusher drain the queue
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_fill->states.empty()) {
+            m_full.push_back(m_fill);
+        }
+        m_fill = NULL;
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    m_flusher.join();
+
+    // 2) Now the totals are known
+    m_header.numSamples = m_numSamples;
+    bool ok = m_ok && fseek(m_fp, 0, SEEK_SET) == 0 && fwrite(&m_header, sizeof(m_header), 1, m_fp) == 1;
+    ok = (fclose(m_fp) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Error writing trajectory stream\n");
+    }
+    m_fp = NULL;
+
+    for (size_t b = 0; b < m_buffers.size(); ++b) {
+        delete m_buffers[b];
+    }
+    m_buffers.clear();
+    m_full.clear();
+    m_free.clear();
+    return ok;
+}
+
+void TrajectoryStreamWriter::flushLoop()
+{
+    std::vector<unsigned char> bytes;
+    for (;;) {
+        Chunk* chunk;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() { return m_quit || !m_full.empty(); });
+            if (m_full.empty()) {
+                return;         // quit, and nothing left
+            }
+            chunk = m_full.front();
+            m_full.pop_front();
+        }
+
+        encode(*chunk, &bytes);
+        if (m_ok) {
+            m_ok = fwrite(&bytes[0], 1, bytes.size(), m_fp) == bytes.size();
+            m_bytesWritten += bytes.size();
+            m_header.numChunks++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(chunk);
+        }
+        m_wake.notify_all();
+    }
+}
+
+void TrajectoryStreamWriter::encode(const Chunk& chunk, std::vector<unsigned char>* out) const
+{
+    const double* s = &chunk.states[0];
+    uint32_t n = (uint32_t)(chunk.states.size() / FLUTTER_DIM);
+
+    TrajectoryChunkHeader header;
+    header.numSamples = n;
+    header.payloadBytes = (uint32_t)PayloadBytes(m_header.encoding, n);
+    header.firstSample = chunk.firstSample;
+    out->resize(sizeof(header) + header.payloadBytes);
+    unsigned char* dst = &(*out)[0];
+    std::memcpy(dst, &header, sizeof(header));
+    dst += sizeof(header);
+
+    if (m_header.encoding == STREAM_FLOAT32) {
+        for (size_t i = 0; i < (size_t)n * FLUTTER_DIM; ++i) {
+            float v = (float)s[i];
+            std::memcpy(dst + i * sizeof(float), &v, sizeof(v));
+        }
+        return;
+    }
+
+    // 1) Per component: the step size, and the first sample exactly.  Steps
+    //    go from the last finite value (0 before there is one).
+    double scale[FLUTTER_DIM];
+    double decoded[FLUTTER_DIM];
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        double largest = 0., last = std::isfinite(s[c]) ? s[c] : 0.;
+        for (uint32_t i = 1; i < n; ++i) {
+            double x = s[i * FLUTTER_DIM + c];
+            if (std::isfinite(x)) {
+                largest = std::max(largest, std::fabs(x - last));
+                last = x;
+            }
+        }
+        scale[c] = largest / DELTA_STEPS;
+        decoded[c] = s[c];
+    }
+    std::memcpy(dst, scale, sizeof(scale));
+    std::memcpy(dst + sizeof(scale), decoded, sizeof(decoded));
+    dst += sizeof(scale) + sizeof(decoded);
+    for (int c = 0; c < FLUTTER_DIM; ++c) {
+        decoded[c] = std::isfinite(decoded[c]) ? decoded[c] : 0.;
+    }
+
+    // 2) Steps from the decoded previous sample, decoded the way the reader will
+    for (uint32_t i = 1; i < n; ++i) {
+        for (int c = 0; c < FLUTTER_DIM; ++c) {
+            double x = s[i * FLUTTER_DIM + c], q = 0.;
+            if (!std::isfinite(x)) {
+                std::memcpy(dst, &NAN_STEP, sizeof(NAN_STEP));
+                dst += sizeof(NAN_STEP);
+                continue;
+            }
+            if (scale[c] > 0.) {
+                q = std::floor((x - decoded[c]) / scale[c] + 0.5);
+                q = std::max(-32767., std::min(q, 32767.));
+            }
+            int16_t v = (int16_t)q;
+            decoded[c] += scale[c] * v;
+            std::memcpy(dst, &v, sizeof(v));
+            dst += sizeof(v);
+        }
+    }
+}
+
+// -------------------------------------
+// Reader
+// -------------------------------------
+TrajectoryStreamReader::TrajectoryStreamReader()
+    : m_fp(NULL)
+    , m_samplesRead(0)
+{
+    std::memset(&m_header, 0, sizeof(m_header));
+}
+
+TrajectoryStreamReader::~TrajectoryStreamReader()
+{
+    close();
+}
+
+bool TrajectoryStreamReader::open(const char* path)
+{
+    close();
+    m_fp = fopen(path, "rb");
+    if (m_fp == NULL) {
+        fprintf(stderr, "Cannot open trajectory stream '%s'\n", path);
+        return false;
+    }
+    bool ok = fread(&m_header, sizeof(m_header), 1, m_fp) == 1 &&
+              std::memcmp(m_header.magic, MAGIC, sizeof(MAGIC)) == 0;
+    if (ok && (m_header.version != TRAJECTORY_STREAM_VERSION || m_header.endianTag != TRAJECTORY_DB_ENDIAN_TAG ||
+               m_header.headerSize < sizeof(m_header) || m_header.stateDim != FLUTTER_DIM ||
+               m_header.encoding > STREAM_DELTA16)) {
+        fprintf(stderr, "Trajectory stream '%s': unsupported version, byte order or layout\n", path);
+        close();
+        return false;
+    }
+    if (!ok || fseek(m_fp, m_header.headerSize, SEEK_SET) != 0) {
+        fprintf(stderr, "'%s' is not a trajectory stream\n", path);
+        close();
+        return false;
+    }
+    m_samplesRead = 0;
+    return true;
+}
+
+void TrajectoryStreamReader::close()
+{
+    if (m_fp != NULL) {
+        fclose(m_fp);
+        m_fp = NULL;
+    }
+}
+
+FlutterParams TrajectoryStreamReader::GetParams() const
+{
+    FlutterParams p = { m_header.mass, m_header.width, m_header.height,
+                        m_header.dragCoeffPerp, m_header.dragCoeffPara };
+    return p;
+}
+
+uint32_t TrajectoryStreamReader::readChunk(std::vector<double>* states)
+{
+    states->clear();
+    if (m_fp == NULL || (m_header.numSamples > 0 && m_samplesRead >= m_header.numSamples)) {
+        return 0;
+    }
+
+    // 1) Header and payload; anything short is the end of the stream
+    TrajectoryChunkHeader chunk;
+    if (fread(&chunk, sizeof(chunk), 1, m_fp) != 1 || chunk.numSamples == 0 ||
+        chunk.payloadBytes != PayloadBytes(m_header.encoding, chunk.numSamples)) {
+        return 0;
+    }
+    m_payload.resize(chunk.payloadBytes);
+    if (fread(&m_payload[0], 1, m_payload.size(), m_fp) != m_payload.size()) {
+        return 0;
+    }
+
+    // 2) Decode
+    uint32_t n = chunk.numSamples;
+    states->resize((size_t)n * FLUTTER_DIM);
+    double* s = &(*states)[0];
+    const unsigned char* src = &m_payload[0];
+    if (m_header.encoding == STREAM_FLOAT32) {
+        for (size_t i = 0; i < (size_t)n * FLUTTER_DIM; ++i) {
+            float v;
+            std::memcpy(&v, src + i * sizeof(float), sizeof(v));
+            s[i] = v;
+        }
+    } else {
+        double scale[FLUTTER_DIM], decoded[FLUTTER_DIM];
+        std::memcpy(scale, src, sizeof(scale));
+        std::memcpy(decoded, src + sizeof(scale), sizeof(decoded));
+        src += sizeof(scale) + sizeof(decoded);
+        std::memcpy(s, decoded, sizeof(decoded));
+        for (int c = 0; c < FLUTTER_DIM; ++c) {
+            decoded[c] = std::isfinite(decoded[c]) ? decoded[c] : 0.;
+        }
+        for (uint32_t i = 1; i < n; ++i) {
+            for (int c = 0; c < FLUTTER_DIM; ++c) {
+                int16_t v;
+                std::memcpy(&v, src, sizeof(v));
+                src += sizeof(v);
+                if (v == NAN_STEP) {
+                    s[i * FLUTTER_DIM + c] = NAN;
+                    continue;
+                }
+                decoded[c] += scale[c] * v;
+                s[i * FLUTTER_DIM + c] = decoded[c];
+            }
+        }
+    }
+    m_samplesRead += n;
+    return n;
+}
+
+uint64_t TrajectoryStreamReader::readAll(std::vector<double>* states)
+{
+    uint64_t total = 0;
+    std::vector<double> chunk;
+    while (uint32_t n = readChunk(&chunk)) {
+        states->insert(states->end(), chunk.begin(), chunk.end());
+        total += n;
+    }
+    return total;
+}
+
+//#define BENCH
+#ifdef BENCH
+
+#include <cfloat>
+#include <chrono>
+#include <fstream>
+#include "../SelfTest.hpp"
+
+static double
+Ms( std::chrono::steady_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::steady_clock::now( ) - t0 ).count( );
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const char *F32 = "streambench_f32.trs";
+	const char *D16 = "streambench_d16.trs";
+	const char *BAD = "streambench_bad.trs";
+	const char *TXT = "streambench.txt";
+	const int N = 1000000;				// 1000 s of fall at 1 ms
+	const double DT = 0.001;
+
+	// a real fall: the default leaf, started sideways
+	FlutterParams leaf = { 0.01, 0.1, 0.1, 4.1, 0.9 };
+	std::vector<double> states( (size_t)N * FLUTTER_DIM );
+	double s[FLUTTER_DIM] = { 0., 0., 0.3, 0.5, -1., 0. };
+	for( int i = 0; i < N; i++ )
+	{
+		std::memcpy( &states[(size_t)i * FLUTTER_DIM], s, sizeof( s ) );
+		for( int k = 0; k < 10; k++ )
+			FlutterRk4Step( s, leaf, 1.225, 9.81, DT / 10. );
+	}
+
+	// 1) Both encodings, written sample by sample and timed
+	const char *paths[2] = { F32, D16 };
+	double writeMs[2];
+	uint64_t bytes[2];
+	for( int e = 0; e < 2; e++ )
+	{
+		auto t0 = std::chrono::steady_clock::now( );
+		TrajectoryStreamWriter writer;
+		writer.open( paths[e], leaf, 1.225, 9.81, DT, (TrajectoryStreamEncoding)e, 4000 );
+		for( int i = 0; i < N; i++ )
+			writer.push( &states[(size_t)i * FLUTTER_DIM] );
+		Check( writer.close( ), "close() reports a good write" );
+		writeMs[e] = Ms( t0 );
+		bytes[e] = writer.GetBytesWritten( );
+	}
+
+	// the text it replaces: x y theta per line through ofstream
+	auto t0 = std::chrono::steady_clock::now( );
+	{
+		std::ofstream out( TXT );
+		for( int i = 0; i < N; i++ )
+			out << states[(size_t)i * FLUTTER_DIM] << " " << states[(size_t)i * FLUTTER_DIM + 1] << " "
+			    << states[(size_t)i * FLUTTER_DIM + 2] << "\n";
+	}
+	double textMs = Ms( t0 );
+
+	// 2) Read back
+	TrajectoryStreamReader reader;
+	std::vector<double> back;
+	Check( reader.open( F32 ) && reader.readAll( &back ) == (uint64_t)N &&
+		reader.GetHeader( ).numSamples == (uint64_t)N && reader.GetHeader( ).numChunks == 250,
+		"float32: every sample back, header totals filled in" );
+	bool same = back.size( ) == states.size( );
+	for( size_t i = 0; same && i < back.size( ); i++ )
+		same = back[i] == (double)(float)states[i];
+	Check( same, "float32: exactly the float32 values" );
+	Check( reader.GetParams( ).mass == (double)(float)leaf.mass && reader.GetHeader( ).dt == (float)DT,
+		"the leaf and dt come back from the header" );
+
+	back.clear( );
+	Check( reader.open( D16 ) && reader.readAll( &back ) == (uint64_t)N, "delta16: every sample back" );
+	double worst[FLUTTER_DIM] = { 0. };
+	bool within = back.size( ) == states.size( );
+	for( int chunk = 0; within && chunk < N / 4000; chunk++ )
+	{
+		// the documented bound, per chunk and component
+		for( int c = 0; c < FLUTTER_DIM; c++ )
+		{
+			double largest = 0.;
+			for( int i = chunk * 4000 + 1; i < ( chunk + 1 ) * 4000; i++ )
+				largest = std::max( largest, std::fabs( states[(size_t)i * FLUTTER_DIM + c] - states[(size_t)( i - 1 ) * FLUTTER_DIM + c] ) );
+			double b = 0.5 * largest / 32000. * 1.0001;
+			for( int i = chunk * 4000; i < ( chunk + 1 ) * 4000; i++ )
+			{
+				double v = states[(size_t)i * FLUTTER_DIM + c];
+				double err = std::fabs( back[(size_t)i * FLUTTER_DIM + c] - v );
+				worst[c] = std::max( worst[c], err );
+				within = within && err <= b + 4. * DBL_EPSILON * std::fabs( v );
+			}
+		}
+	}
+	Check( within, "delta16: every value within scale / 2 (or a few ulp) of the original" );
+	fprintf( stderr, "  worst error per component:" );
+	for( int c = 0; c < FLUTTER_DIM; c++ )
+		fprintf( stderr, " %.2g", worst[c] );
+	fprintf( stderr, "\n" );
+
+	// 3) A blow-up in the middle of a chunk only costs the samples that are not finite
+	{
+		TrajectoryStreamWriter writer;
+		writer.open( BAD, leaf, 1.225, 9.81, DT, STREAM_DELTA16, 100 );
+		for( int i = 0; i < 100; i++ )
+		{
+			double bad[FLUTTER_DIM];
+			std::memcpy( bad, &states[(size_t)i * FLUTTER_DIM], sizeof( bad ) );
+			if( i == 0 || i == 40 )
+				bad[3] = INFINITY;
+			if( i >= 90 )
+				bad[4] = NAN;
+			writer.push( bad );
+		}
+		writer.close( );
+		back.clear( );
+		reader.open( BAD );
+		reader.readAll( &back );
+		bool kept = back.size( ) == 100 * FLUTTER_DIM;
+		for( int i = 0; kept && i < 100; i++ )
+			for( int c = 0; c < FLUTTER_DIM; c++ )
+			{
+				bool bad = ( c == 3 && ( i == 0 || i == 40 ) ) || ( c == 4 && i >= 90 );
+				double err = std::fabs( back[(size_t)i * FLUTTER_DIM + c] - states[(size_t)i * FLUTTER_DIM + c] );
+				kept = kept && ( bad ? !std::isfinite( back[(size_t)i * FLUTTER_DIM + c] ) : err < 1.e-4 );
+			}
+		Check( kept, "delta16: non-finite values come back not finite, the rest as before" );
+	}
+
+	// 4) A writer that never closed: everything up to its last whole chunk
+	{
+		FILE *fp = fopen( D16, "r+b" );
+		fseek( fp, 0, SEEK_END );
+		long size = ftell( fp );
+		fclose( fp );
+		std::vector<unsigned char> file( size );
+		fp = fopen( D16, "rb" );
+		fread( &file[0], 1, size, fp );
+		fclose( fp );
+		TrajectoryStreamHeader h;
+		std::memcpy( &h, &file[0], sizeof( h ) );
+		h.numSamples = h.numChunks = 0;
+		std::memcpy( &file[0], &h, sizeof( h ) );
+		fp = fopen( D16, "wb" );
+		fwrite( &file[0], 1, size - 100, fp );		// and cut into the last chunk
+		fclose( fp );
+		back.clear( );
+		Check( reader.open( D16 ) && reader.readAll( &back ) == (uint64_t)( N - 4000 ),
+			"an unclosed, cut stream reads up to its last whole chunk" );
+	}
+	reader.close( );
+
+	fprintf( stderr, "\n%-22s %10s %12s %10s\n", "", "write ms", "bytes", "B/sample" );
+	fprintf( stderr, "%-22s %10.1f %12s %10s\n", "text x y theta", textMs, "", "" );
+	fprintf( stderr, "%-22s %10.1f %12llu %10.1f\n", "stream float32", writeMs[0], (unsigned long long)bytes[0], (double)bytes[0] / N );
+	fprintf( stderr, "%-22s %10.1f %12llu %10.1f\n", "stream delta16", writeMs[1], (unsigned long long)bytes[1], (double)bytes[1] / N );
+	fprintf( stderr, "buffers: at most %d chunks of 4000 samples (%.1f MB)\n", (int)TrajectoryStreamWriter::MAX_BUFFERS,
+		TrajectoryStreamWriter::MAX_BUFFERS * 4000. * FLUTTER_DIM * sizeof( double ) / 1.e6 );
+
+	remove( F32 );
+	remove( D16 );
+	remove( BAD );
+	remove( TXT );
+	return CheckResult( );
+}
+#endif
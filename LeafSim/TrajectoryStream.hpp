@@ -0,0 +1,137 @@
+#ifndef TRAJECTORYSTREAM_HPP
+#define TRAJECTORYSTREAM_HPP
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "FlutterModel.hpp"
+
+// One trajectory as a stream of binary chunks (.trs), for runs too long to
+// keep in memory.  Written sample by sample, read back chunk by chunk, and
+// turned into a database by ConvertTrajectories.
+//
+//   TrajectoryStreamHeader             80 bytes at offset 0
+//   chunk*                             TrajectoryChunkHeader + payload, to the end
+//
+// STREAM_FLOAT32 payload: numSamples * stateDim float32.
+// STREAM_DELTA16 payload: scale[stateDim] and the first sample as
+// float64[stateDim] each, then (numSamples - 1) * stateDim int16 steps.  The steps are taken from the
+// decoded previous sample, not the exact one, so the error does not build up
+// along the chunk: every decoded value is within scale / 2 of the original,
+// with scale = (largest step of that component in the chunk) / 32000, or
+// within the rounding of a double where that is larger (a component that
+// hardly moves).  A step of -32768 marks a value that was not finite; it
+// decodes as NaN and the steps after it go on from the last finite one.  (A
+// leaf blowing up makes huge steps, and so a coarse scale for its chunk.)
+//
+// numSamples in the header is only filled in by close(); a stream whose
+// writer died reads up to its last whole chunk.  Little endian throughout.
+
+enum {
+    TRAJECTORY_STREAM_VERSION = 1
+};
+
+enum TrajectoryStreamEncoding {
+    STREAM_FLOAT32 = 0,
+    STREAM_DELTA16 = 1
+};
+
+struct TrajectoryStreamHeader {
+    char     magic[4];          // "LTRS"
+    uint32_t version;
+    uint32_t endianTag;         // TRAJECTORY_DB_ENDIAN_TAG
+    uint32_t headerSize;        // sizeof(TrajectoryStreamHeader)
+    uint32_t stateDim;          // FLUTTER_DIM
+    uint32_t encoding;          // TrajectoryStreamEncoding
+    uint32_t chunkSamples;      // samples per chunk (the last one may be short)
+    float    dt;                // sample interval (s)
+    float    mass, width, height, dragCoeffPerp, dragCoeffPara;
+    float    rho, g;
+    uint32_t reserved0;
+    uint64_t numSamples;        // 0 until close()
+    uint64_t numChunks;
+};
+
+struct TrajectoryChunkHeader {
+    uint32_t numSamples;
+    uint32_t payloadBytes;
+    uint64_t firstSample;       // index of the chunk's first sample in the stream
+};
+
+// Samples go into a chunk buffer; a full chunk is handed to a background
+// thread that encodes and writes it.  There are at most MAX_BUFFERS chunk
+// buffers, so if the disk falls behind push() waits for one instead of
+// growing: memory stays at MAX_BUFFERS * chunkSamples * stateDim doubles.
+class TrajectoryStreamWriter {
+public:
+    enum { MAX_BUFFERS = 4 };
+
+    TrajectoryStreamWriter();
+    ~TrajectoryStreamWriter();          // close()s
+
+    bool open(const char* path, const FlutterParams& params, double rho, double g, double dt,
+              TrajectoryStreamEncoding encoding, uint32_t chunkSamples = 4096);
+    void push(const double* state);     // FLUTTER_DIM values
+    bool close();                       // false if anything failed to write
+    bool isOpen() const { return m_fp != NULL; }
+
+    uint64_t GetNumSamples() const { return m_numSamples; }
+    uint64_t GetBytesWritten() const { return m_bytesWritten; }
+
+private:
+    TrajectoryStreamWriter(const TrajectoryStreamWriter&);
+    TrajectoryStreamWriter& operator=(const TrajectoryStreamWriter&);
+
+    struct Chunk {
+        std::vector<double> states;
+        uint64_t firstSample;
+    };
+    void handOff();                     // queue m_fill, take an empty buffer
+    void flushLoop();
+    void encode(const Chunk& chunk, std::vector<unsigned char>* out) const;
+
+    FILE* m_fp;
+    TrajectoryStreamHeader m_header;
+    Chunk* m_fill;                      // being filled by push()
+    uint64_t m_numSamples;
+
+    std::thread m_flusher;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;     // a chunk was queued, a buffer freed, or quit
+    std::deque<Chunk*> m_full, m_free;
+    std::vector<Chunk*> m_buffers;      // all of them, for the destructor
+    bool m_quit;
+    bool m_ok;                          // flusher side; read after join
+    std::atomic<uint64_t> m_bytesWritten;
+};
+
+// Reads a .trs chunk by chunk, without holding more than one in memory
+class TrajectoryStreamReader {
+public:
+    TrajectoryStreamReader();
+    ~TrajectoryStreamReader();
+
+    bool open(const char* path);        // false (with a message) if missing or malformed
+    void close();
+
+    const TrajectoryStreamHeader& GetHeader() const { return m_header; }
+    FlutterParams GetParams() const;
+
+    // The next chunk's states (numSamples * FLUTTER_DIM); 0 at the end, or at
+    // a chunk cut short by a writer that never closed
+    uint32_t readChunk(std::vector<double>* states);
+    // Everything left, appended
+    uint64_t readAll(std::vector<double>* states);
+
+private:
+    FILE* m_fp;
+    TrajectoryStreamHeader m_header;
+    std::vector<unsigned char> m_payload;
+    uint64_t m_samplesRead;
+};
+
+#endif // TRAJECTORYSTREAM_HPP
@@ -0,0 +1,485 @@
+// Benchmark + check: make libjobs.a && g++ -std=c++11 -O2 -DBENCH -o windbench LeafSim/WindField.cpp LeafSim/Snapshot.cpp LeafSim/MappedFile.cpp -L. -ljobs -pthread
+#include "WindField.hpp"
+#include "Snapshot.hpp"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    #define WINDFIELD_X86 1
+    #include <immintrin.h>
+#endif
+
+// below this many nodes per job, handing it out costs more than it saves
+static const int MIN_NODES_PER_JOB = 512;
+
+WindSettings::WindSettings()
+    : direction(0.f)
+    , speed(5.f)
+    , gustiness(0.5f)
+    , gustFrequency(0.5f)
+    , gustSize(50.f)
+    , turbulence(0.5f)
+{
+}
+
+WindField::WindField()
+    : m_jobs(NULL)
+    , m_time(0.)
+    , m_gustPhase(0.)
+{
+    m_drift[0] = m_drift[1] = m_drift[2] = 0.;
+    const float lo[3] = { -1.f, -1.f, -1.f };
+    const float hi[3] = { 1.f, 1.f, 1.f };
+    setGrid(lo, hi, 2, 2, 2);
+}
+
+void WindField::setGrid(const float* lo, const float* hi, int nx, int ny, int nz)
+{
+    m_n[0] = std::max(2, nx);
+    m_n[1] = std::max(2, ny);
+    m_n[2] = std::max(2, nz);
+    for (int a = 0; a < 3; ++a) {
+        m_lo[a] = lo[a];
+        m_cell[a] = (hi[a] - lo[a]) / (m_n[a] - 1);
+        m_invCell[a] = (m_cell[a] > 0.f) ? 1.f / m_cell[a] : 0.f;
+    }
+    size_t nodes = (size_t)GetNumNodes();
+    m_u.assign(nodes, 0.f);
+    m_v.assign(nodes, 0.f);
+    m_w.assign(nodes, 0.f);
+}
+
+void WindField::getMean(float* u) const
+{
+    u[0] = m_settings.speed * std::cos(m_settings.direction);
+    u[1] = 0.f;
+    u[2] = m_settings.speed * std::sin(m_settings.direction);
+}
+
+// -------------------------------------
+// Snapshots
+// -------------------------------------
+struct WindSnapshot {
+    WindSettings settings;
+    double time;
+    double gustPhase;
+    double drift[3];
+    float lo[3];
+    float cell[3];
+    int32_t n[3];
+};
+
+void WindField::save(SnapshotWriter& out) const
+{
+    WindSnapshot w;
+    w.settings = m_settings;
+    w.time = m_time;
+    w.gustPhase = m_gustPhase;
+    for (int a = 0; a < 3; ++a) {
+        w.drift[a] = m_drift[a];
+        w.lo[a] = m_lo[a];
+        w.cell[a] = m_cell[a];
+        w.n[a] = m_n[a];
+    }
+    out.addValue("wind", w);
+    out.add("wind.u", m_u);
+    out.add("wind.v", m_v);
+    out.add("wind.w", m_w);
+}
+
+bool WindField::load(const Snapshot& in)
+{
+    WindSnapshot w;
+    if (!in.readValue("wind", &w) || w.n[0] < 2 || w.n[1] < 2 || w.n[2] < 2) {
+        return false;
+    }
+    uint64_t nodes = (uint64_t)w.n[0] * w.n[1] * w.n[2];
+    uint64_t bytes[3] = { 0, 0, 0 };
+    const float* u = (const float*)in.find("wind.u", &bytes[0]);
+    const float* v = (const float*)in.find("wind.v", &bytes[1]);
+    const float* wz = (const float*)in.find("wind.w", &bytes[2]);
+    if (u == NULL || v == NULL || wz == NULL ||
+        bytes[0] != nodes * sizeof(float) || bytes[1] != bytes[0] || bytes[2] != bytes[0]) {
+        return false;
+    }
+
+    m_settings = w.settings;
+    m_time = w.time;
+    m_gustPhase = w.gustPhase;
+    for (int a = 0; a < 3; ++a) {
+        m_drift[a] = w.drift[a];
+        m_lo[a] = w.lo[a];
+        m_cell[a] = w.cell[a];
+        m_invCell[a] = (m_cell[a] > 0.f) ? 1.f / m_cell[a] : 0.f;
+        m_n[a] = w.n[a];
+    }
+    m_u.assign(u, u + nodes);
+    m_v.assign(v, v + nodes);
+    m_w.assign(wz, wz + nodes);
+    return true;
+}
+
+// -------------------------------------
+// Gust noise
+// -------------------------------------
+
+// Three values in [-1, 1] for one lattice point of the 4D noise
+static inline void LatticeValues(int32_t x, int32_t y, int32_t z, int32_t t, float* v)
+{
+    uint32_t h = (uint32_t)x * 0x8da6b343u ^ (uint32_t)y * 0xd8163841u ^
+                 (uint32_t)z * 0xcb1ab31fu ^ (uint32_t)t * 0x165667b1u;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    const float scale = 2.f / 1023.f;
+    v[0] = (float)(h & 1023u) * scale - 1.f;
+    v[1] = (float)((h >> 10) & 1023u) * scale - 1.f;
+    v[2] = (float)((h >> 20) & 1023u) * scale - 1.f;
+}
+
+static inline float Fade(float t)
+{
+    return t * t * (3.f - 2.f * t);
+}
+
+// Three independent channels of 4D value noise, smooth-stepped between lattice points
+static void ValueNoise4(float x, float y, float z, float t, float* out)
+{
+    float fx = std::floor(x), fy = std::floor(y), fz = std::floor(z), ft = std::floor(t);
+    int32_t ix = (int32_t)fx, iy = (int32_t)fy, iz = (int32_t)fz, it = (int32_t)ft;
+    float w[4] = { Fade(x - fx), Fade(y - fy), Fade(z - fz), Fade(t - ft) };
+
+    out[0] = out[1] = out[2] = 0.f;
+    for (int corner = 0; corner < 16; ++corner) {
+        int cx = corner & 1, cy = (corner >> 1) & 1, cz = (corner >> 2) & 1, ct = corner >> 3;
+        float weight = (cx ? w[0] : 1.f - w[0]) * (cy ? w[1] : 1.f - w[1]) *
+                       (cz ? w[2] : 1.f - w[2]) * (ct ? w[3] : 1.f - w[3]);
+        float v[3];
+        LatticeValues(ix + cx, iy + cy, iz + cz, it + ct, v);
+        out[0] += weight * v[0];
+        out[1] += weight * v[1];
+        out[2] += weight * v[2];
+    }
+}
+
+void WindField::evaluate(const float* p, float* u) const
+{
+    const WindSettings& s = m_settings;
+    float invSize = (s.gustSize > 0.f) ? 1.f / s.gustSize : 0.f;
+    float qx = (float)((p[0] - m_drift[0]) * invSize);
+    float qy = (float)((p[1] - m_drift[1]) * invSize);
+    float qz = (float)((p[2] - m_drift[2]) * invSize);
+    float tau = (float)m_gustPhase;
+
+    // 1) Two octaves; the second is shifted so the lattices don't line up
+    float n[3], fine[3];
+    ValueNoise4(qx, qy, qz, tau, n);
+    ValueNoise4(2.f * qx + 17.3f, 2.f * qy + 5.1f, 2.f * qz + 11.7f, 2.f * tau, fine);
+    for (int c = 0; c < 3; ++c) {
+        n[c] = (n[c] + 0.5f * fine[c]) * (1.f / 1.5f);
+    }
+
+    // 2) Along-wind gusts scale the mean wind; cross and vertical ones are added
+    float dx = std::cos(s.direction), dz = std::sin(s.direction);
+    float along = s.speed * (1.f + s.gustiness * n[0]);
+    float cross = s.speed * s.gustiness * s.turbulence;
+    u[0] = along * dx - cross * n[1] * dz;
+    u[1] = 0.5f * cross * n[2];
+    u[2] = along * dz + cross * n[1] * dx;
+}
+
+// -------------------------------------
+// Grid update
+// -------------------------------------
+void WindField::update(double time)
+{
+    // 1) Integrate the gust phase and the drift of the gust pattern
+    double dt = (time > m_time) ? time - m_time : 0.;
+    float mean[3];
+    getMean(mean);
+    m_gustPhase += m_settings.gustFrequency * dt;
+    for (int a = 0; a < 3; ++a) {
+        m_drift[a] += mean[a] * dt;
+    }
+    m_time = time;
+
+    // 2) Re-evaluate the nodes, a z slab at a time
+    if (m_jobs == NULL || GetNumNodes() < 2 * MIN_NODES_PER_JOB) {
+        updateSlabs(0, m_n[2]);
+        return;
+    }
+    int slabNodes = m_n[0] * m_n[1];
+    uint32_t grain = (uint32_t)std::max(1, MIN_NODES_PER_JOB / slabNodes);
+    m_jobs->parallelFor(0, (uint32_t)m_n[2], grain, [this](uint32_t k0, uint32_t k1) {
+        updateSlabs((int)k0, (int)k1);
+    });
+}
+
+void WindField::updateSlabs(int k0, int k1)
+{
+    for (int k = k0; k < k1; ++k) {
+        for (int j = 0; j < m_n[1]; ++j) {
+            size_t row = ((size_t)k * m_n[1] + j) * m_n[0];
+            for (int i = 0; i < m_n[0]; ++i) {
+                float p[3] = { m_lo[0] + i * m_cell[0], m_lo[1] + j * m_cell[1], m_lo[2] + k * m_cell[2] };
+                float u[3];
+                evaluate(p, u);
+                m_u[row + i] = u[0];
+                m_v[row + i] = u[1];
+                m_w[row + i] = u[2];
+            }
+        }
+    }
+}
+
+// -------------------------------------
+// Scalar sampling
+// -------------------------------------
+
+// Cell index along one axis (clamped to the grid) and the position in it
+static inline int CellCoord(float p, float lo, float invCell, int n, float* t)
+{
+    float f = (p - lo) * invCell;
+    f = std::min(std::max(f, 0.f), (float)(n - 1));
+    int i = std::min((int)f, n - 2);
+    *t = f - (float)i;
+    return i;
+}
+
+void WindField::sampleRange(const float* x, const float* y, const float* z, uint32_t begin, uint32_t end,
+                            float* ux, float* uy, float* uz) const
+{
+    const int nx = m_n[0];
+    const size_t nxy = (size_t)m_n[0] * m_n[1];
+    const float* arrays[3] = { m_u.data(), m_v.data(), m_w.data() };
+    float* outs[3] = { ux, uy, uz };
+
+    for (uint32_t p = begin; p < end; ++p) {
+        float tx, ty, tz;
+        int i = CellCoord(x[p], m_lo[0], m_invCell[0], m_n[0], &tx);
+        int j = CellCoord(y[p], m_lo[1], m_invCell[1], m_n[1], &ty);
+        int k = CellCoord(z[p], m_lo[2], m_invCell[2], m_n[2], &tz);
+        size_t base = (size_t)k * nxy + (size_t)j * nx + i;
+
+        for (int c = 0; c < 3; ++c) {
+            const float* a = arrays[c] + base;
+            float x00 = a[0] + tx * (a[1] - a[0]);
+            float x10 = a[nx] + tx * (a[nx + 1] - a[nx]);
+            float x01 = a[nxy] + tx * (a[nxy + 1] - a[nxy]);
+            float x11 = a[nxy + nx] + tx * (a[nxy + nx + 1] - a[nxy + nx]);
+            float y0 = x00 + ty * (x10 - x00);
+            float y1 = x01 + ty * (x11 - x01);
+            outs[c][p] = y0 + tz * (y1 - y0);
+        }
+    }
+}
+
+void WindField::sampleScalar(const float* x, const float* y, const float* z, uint32_t n,
+                             float* ux, float* uy, float* uz) const
+{
+    sampleRange(x, y, z, 0, n, ux, uy, uz);
+}
+
+void WindField::sample(const float* p, float* u) const
+{
+    sampleRange(&p[0], &p[1], &p[2], 0, 1, &u[0], &u[1], &u[2]);
+}
+
+// -------------------------------------
+// AVX2 sampling
+// -------------------------------------
+#ifdef WINDFIELD_X86
+
+bool WindField::HasAvx2()
+{
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+}
+
+#define AVX2_FN __attribute__((target("avx2,fma"))) static inline
+
+AVX2_FN __m256i CellCoord8(__m256 p, float lo, float invCell, int n, __m256* t)
+{
+    __m256 f = _mm256_mul_ps(_mm256_sub_ps(p, _mm256_set1_ps(lo)), _mm256_set1_ps(invCell));
+    f = _mm256_min_ps(_mm256_max_ps(f, _mm256_setzero_ps()), _mm256_set1_ps((float)(n - 1)));
+    __m256i i = _mm256_min_epi32(_mm256_cvttps_epi32(f), _mm256_set1_epi32(n - 2));
+    *t = _mm256_sub_ps(f, _mm256_cvtepi32_ps(i));
+    return i;
+}
+
+AVX2_FN __m256 Lerp8(__m256 a, __m256 b, __m256 t)
+{
+    return _mm256_fmadd_ps(t, _mm256_sub_ps(b, a), a);
+}
+
+// Trilinear interpolation of one node array at eight cells
+AVX2_FN __m256 Trilinear8(const float* a, __m256i base, int nx, int nxy, __m256 tx, __m256 ty, __m256 tz)
+{
+    __m256i dy = _mm256_set1_epi32(nx), dz = _mm256_set1_epi32(nxy);
+    __m256i b10 = _mm256_add_epi32(base, dy);
+    __m256i b01 = _mm256_add_epi32(base, dz);
+    __m256i b11 = _mm256_add_epi32(b10, dz);
+    __m256i one = _mm256_set1_epi32(1);
+
+    __m256 x00 = Lerp8(_mm256_i32gather_ps(a, base, 4), _mm256_i32gather_ps(a, _mm256_add_epi32(base, one), 4), tx);
+    __m256 x10 = Lerp8(_mm256_i32gather_ps(a, b10, 4), _mm256_i32gather_ps(a, _mm256_add_epi32(b10, one), 4), tx);
+    __m256 x01 = Lerp8(_mm256_i32gather_ps(a, b01, 4), _mm256_i32gather_ps(a, _mm256_add_epi32(b01, one), 4), tx);
+    __m256 x11 = Lerp8(_mm256_i32gather_ps(a, b11, 4), _mm256_i32gather_ps(a, _mm256_add_epi32(b11, one), 4), tx);
+    return Lerp8(Lerp8(x00, x10, ty), Lerp8(x01, x11, ty), tz);
+}
+
+__attribute__((target("avx2,fma")))
+void WindField::sampleAvx2(const float* x, const float* y, const float* z, uint32_t n,
+                           float* ux, float* uy, float* uz) const
+{
+    const int nx = m_n[0];
+    const int nxy = m_n[0] * m_n[1];
+    uint32_t blocks = n / 8;
+
+    for (uint32_t b = 0; b < blocks; ++b) {
+        uint32_t p = b * 8;
+        __m256 tx, ty, tz;
+        __m256i i = CellCoord8(_mm256_loadu_ps(&x[p]), m_lo[0], m_invCell[0], m_n[0], &tx);
+        __m256i j = CellCoord8(_mm256_loadu_ps(&y[p]), m_lo[1], m_invCell[1], m_n[1], &ty);
+        __m256i k = CellCoord8(_mm256_loadu_ps(&z[p]), m_lo[2], m_invCell[2], m_n[2], &tz);
+        __m256i base = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(k, _mm256_set1_epi32(nxy)),
+                                                         _mm256_mullo_epi32(j, _mm256_set1_epi32(nx))), i);
+
+        _mm256_storeu_ps(&ux[p], Trilinear8(m_u.data(), base, nx, nxy, tx, ty, tz));
+        _mm256_storeu_ps(&uy[p], Trilinear8(m_v.data(), base, nx, nxy, tx, ty, tz));
+        _mm256_storeu_ps(&uz[p], Trilinear8(m_w.data(), base, nx, nxy, tx, ty, tz));
+    }
+}
+
+void WindField::sample(const float* x, const float* y, const float* z, uint32_t n,
+                       float* ux, float* uy, float* uz) const
+{
+    uint32_t done = 0;
+    if (HasAvx2()) {
+        sampleAvx2(x, y, z, n, ux, uy, uz);
+        done = n / 8 * 8;
+    }
+    sampleRange(x, y, z, done, n, ux, uy, uz);      // the tail (or everything)
+}
+
+#else
+
+bool WindField::HasAvx2()
+{
+    return false;
+}
+
+void WindField::sample(const float* x, const float* y, const float* z, uint32_t n,
+                       float* ux, float* uy, float* uz) const
+{
+    sampleRange(x, y, z, 0, n, ux, uy, uz);
+}
+
+#endif
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include "../SelfTest.hpp"
+
+static double
+Ms( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	// roughly the FinalProject tree: 400 x 300 x 400 units
+	const float lo[3] = { -200.f, -10.f, -200.f };
+	const float hi[3] = {  200.f, 290.f,  200.f };
+	WindField wind;
+	wind.setGrid( lo, hi, 17, 13, 17 );
+	WindSettings settings;
+	settings.direction = 0.6f;
+	wind.setSettings( settings );
+
+	// 1) Grid update, one thread and all of them
+	const int UPDATES = 50;
+	double ms[2];
+	JobSystem jobs;
+	for( int pass = 0; pass < 2; pass++ )
+	{
+		wind.setJobs( pass == 0 ? NULL : &jobs );
+		auto t0 = std::chrono::high_resolution_clock::now( );
+		for( int u = 0; u < UPDATES; u++ )
+			wind.update( ( pass * UPDATES + u ) / 60. );
+		ms[pass] = Ms( t0 ) / UPDATES;
+	}
+	fprintf( stderr, "update %d nodes: %.3f ms on 1 thread, %.3f ms on %d\n",
+		wind.GetNumNodes( ), ms[0], ms[1], jobs.GetNumThreads( ) );
+
+	// 2) Random points, some outside the grid
+	const uint32_t N = 100003;		// not a multiple of 8
+	std::mt19937 rng( 7 );
+	std::uniform_real_distribution<float> px( -250.f, 250.f ), py( -50.f, 330.f );
+	std::vector<float> x( N ), y( N ), z( N );
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		x[i] = px( rng );
+		y[i] = py( rng );
+		z[i] = px( rng );
+	}
+	std::vector<float> u0( N ), v0( N ), w0( N ), u1( N ), v1( N ), w1( N );
+
+	const int REPS = 20;
+	auto t0 = std::chrono::high_resolution_clock::now( );
+	for( int r = 0; r < REPS; r++ )
+		wind.sampleScalar( x.data( ), y.data( ), z.data( ), N, u0.data( ), v0.data( ), w0.data( ) );
+	double scalarNs = Ms( t0 ) * 1.e6 / ( (double)REPS * N );
+	t0 = std::chrono::high_resolution_clock::now( );
+	for( int r = 0; r < REPS; r++ )
+		wind.sample( x.data( ), y.data( ), z.data( ), N, u1.data( ), v1.data( ), w1.data( ) );
+	double bestNs = Ms( t0 ) * 1.e6 / ( (double)REPS * N );
+
+	float maxDiff = 0.f;
+	for( uint32_t i = 0; i < N; i++ )
+		maxDiff = std::max( maxDiff, std::max( std::fabs( u0[i] - u1[i] ),
+			std::max( std::fabs( v0[i] - v1[i] ), std::fabs( w0[i] - w1[i] ) ) ) );
+	fprintf( stderr, "sample: %.2f ns per point scalar, %.2f ns %s, max difference %g\n",
+		scalarNs, bestNs, WindField::HasAvx2( ) ? "AVX2" : "(no AVX2)", maxDiff );
+	Check( maxDiff <= 1.e-5f, "sample( ) matches sampleScalar( )" );
+
+	// 3) The grid against the procedural wind it was built from, and the mean
+	double err = 0., meanU = 0., meanW = 0.;
+	int inside = 0;
+	float mean[3];
+	wind.getMean( mean );
+	for( uint32_t i = 0; i < N; i++ )
+	{
+		float p[3] = { x[i], y[i], z[i] }, exact[3];
+		if( std::fabs( p[0] ) > 200.f || p[1] < -10.f || p[1] > 290.f || std::fabs( p[2] ) > 200.f )
+			continue;
+		wind.evaluate( p, exact );
+		err += std::fabs( exact[0] - u0[i] ) + std::fabs( exact[2] - w0[i] );
+		meanU += u0[i];
+		meanW += w0[i];
+		inside++;
+	}
+	fprintf( stderr, "mean wind (%.2f, %.2f), sampled average (%.2f, %.2f), mean interpolation error %.3f m/s\n",
+		mean[0], mean[2], meanU / inside, meanW / inside, err / inside / 2. );
+
+	// 4) Gusts travel with the wind: what is at p now is near p + mean * dt later
+	wind.update( 10. );
+	float p0[3] = { 0.f, 100.f, 0.f }, a[3], b[3];
+	wind.evaluate( p0, a );
+	wind.setSettings( settings );
+	wind.update( 10.1 );
+	float p1[3] = { p0[0] + 0.1f * mean[0], p0[1], p0[2] + 0.1f * mean[2] };
+	wind.evaluate( p1, b );
+	fprintf( stderr, "gust carried 0.1 s downwind: %.3f -> %.3f m/s\n", a[0], b[0] );
+
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,99 @@
+#ifndef WINDFIELD_HPP
+#define WINDFIELD_HPP
+#include <cstdint>
+#include <vector>
+#include "../Jobs/JobSystem.hpp"
+
+class SnapshotWriter;
+class Snapshot;
+
+// Knobs of the wind; the scene drives speed, gustiness and gustFrequency from
+// its Kspeed, Kamp and Kfreq keytimes.
+struct WindSettings {
+    float direction;        // radians about +y, 0 = blowing towards +x
+    float speed;            // mean wind, m/s
+    float gustiness;        // gust amplitude as a fraction of speed
+    float gustFrequency;    // how fast the gust pattern changes, 1/s
+    float gustSize;         // size of a gust, in grid units
+    float turbulence;       // cross and vertical gusts, as a fraction of the along-wind ones
+
+    WindSettings();
+};
+
+// Air velocity over a box, for everything in the scene that feels the wind
+// (branch and leaf sway, falling leaves).
+//
+// The wind is a global direction and speed plus procedural gusts: 4D value
+// noise (two octaves) over space and time, carried along with the mean wind
+// so gusts visibly travel through the tree.  It is evaluated once per tick on
+// a coarse grid by update(), split over the job system in z slabs, and everything
+// else reads the grid with trilinear interpolation.  Points outside the box
+// get the value at the nearest face.
+//
+// sample() over many points runs eight at a time with AVX2 gathers when the
+// CPU has them (checked at run time, as in LeafBatch).
+class WindField {
+public:
+    WindField();
+
+    // nx * ny * nz nodes (each at least 2) spanning lo..hi
+    void setGrid(const float* lo, const float* hi, int nx, int ny, int nz);
+    void setSettings(const WindSettings& settings) { m_settings = settings; }
+    const WindSettings& GetSettings() const { return m_settings; }
+    void setJobs(JobSystem* jobs) { m_jobs = jobs; }        // NULL = all on the calling thread
+
+    // Advance the gusts to this time and re-evaluate every node.  The gust
+    // phase and drift are integrated, so changing the settings between calls
+    // doesn't make the pattern jump.
+    void update(double time);
+    double GetTime() const { return m_time; }
+
+    // Mean wind without the gusts
+    void getMean(float* u) const;
+    // The procedural wind at p at the last update(), without the grid
+    void evaluate(const float* p, float* u) const;
+
+    // Air velocity at p (3 floats), from the grid
+    void sample(const float* p, float* u) const;
+    // Structure-of-arrays version for n points
+    void sample(const float* x, const float* y, const float* z, uint32_t n,
+                float* ux, float* uy, float* uz) const;
+    // Always the plain loop (reference / tests)
+    void sampleScalar(const float* x, const float* y, const float* z, uint32_t n,
+                      float* ux, float* uy, float* uz) const;
+    static bool HasAvx2();
+
+    int GetNumNodes() const { return m_n[0] * m_n[1] * m_n[2]; }
+
+    // Snapshots (Snapshot.hpp): the settings, grid, gust phase and drift and
+    // the node values as of the last update(), so sample() works straight
+    // after load() and the next update() carries on where this one left off.
+    // save() adds the nodes by reference; load() is false (and the field
+    // untouched) if the snapshot has no wind or it is damaged.
+    void save(SnapshotWriter& out) const;
+    bool load(const Snapshot& in);
+
+private:
+    void updateSlabs(int k0, int k1);
+    void sampleRange(const float* x, const float* y, const float* z, uint32_t begin, uint32_t end,
+                     float* ux, float* uy, float* uz) const;
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+    void sampleAvx2(const float* x, const float* y, const float* z, uint32_t n,
+                    float* ux, float* uy, float* uz) const;   // returns after the last full block of 8
+#endif
+
+    WindSettings m_settings;
+    JobSystem* m_jobs;
+    double m_time;
+    double m_gustPhase;             // integral of gustFrequency
+    double m_drift[3];              // integral of the mean wind
+
+    float m_lo[3];
+    float m_cell[3];                // node spacing
+    float m_invCell[3];
+    int m_n[3];
+    // node values, x fastest: (k * ny + j) * nx + i
+    std::vector<float> m_u, m_v, m_w;
+};
+
+#endif // WINDFIELD_HPP
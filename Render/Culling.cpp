@@ -0,0 +1,120 @@
+#include "Culling.hpp"
+#include <cmath>
+
+// items per job in cull(); fewer than two jobs' worth are culled in place
+static const uint32_t ITEMS_PER_JOB = 2048;
+
+// -------------------------------------
+// Frustum helpers
+// -------------------------------------
+Frustum extractFrustum(const glm::mat4& m)
+{
+    // glm is column-major: m[col][row]
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum f;
+    f.planes[0] = row3 + row0;  // left
+    f.planes[1] = row3 - row0;  // right
+    f.planes[2] = row3 + row1;  // bottom
+    f.planes[3] = row3 - row1;  // top
+    f.planes[4] = row3 + row2;  // near
+    f.planes[5] = row3 - row2;  // far
+
+    for (int i = 0; i < 6; ++i) {
+        float len = glm::length(glm::vec3(f.planes[i]));
+        if (len > 0.0f) {
+            f.planes[i] /= len;
+        }
+    }
+    return f;
+}
+
+bool sphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius)
+{
+    for (int i = 0; i < 6; ++i) {
+        const glm::vec4& p = frustum.planes[i];
+        if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t boundsVersion(const glm::vec3& center, float radius)
+{
+    // Quantize to 1/1000 of a unit so float noise from regeneration does not
+    // look like movement, then FNV-1a the integers.
+    int32_t q[4] = {
+        (int32_t)std::lround(center.x * 1000.0f),
+        (int32_t)std::lround(center.y * 1000.0f),
+        (int32_t)std::lround(center.z * 1000.0f),
+        (int32_t)std::lround(radius   * 1000.0f)
+    };
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 4; ++i) {
+        uint32_t v = (uint32_t)q[i];
+        for (int b = 0; b < 4; ++b) {
+            h ^= (v >> (8 * b)) & 0xffu;
+            h *= 16777619u;
+        }
+    }
+    return h;
+}
+
+// -------------------------------------
+// SceneCuller
+// -------------------------------------
+SceneCuller::SceneCuller()
+    : m_jobs(NULL)
+{
+}
+
+void SceneCuller::clear()
+{
+    m_items.clear();
+    m_visible.clear();
+}
+
+void SceneCuller::addItem(const glm::vec3& center, float radius, uint32_t id, uint32_t pose)
+{
+    CullItem item;
+    item.center  = center;
+    item.radius  = radius;
+    item.id      = id;
+    item.version = (boundsVersion(center, radius) ^ pose) * 16777619u;
+    m_items.push_back(item);
+}
+
+void SceneCuller::cull(const glm::mat4& viewProj)
+{
+    Frustum frustum = extractFrustum(viewProj);
+    uint32_t n = (uint32_t)m_items.size();
+    m_visible.clear();
+    m_visible.reserve(n);
+    if (m_jobs == NULL || n < 2 * ITEMS_PER_JOB) {
+        for (uint32_t i = 0; i < n; ++i) {
+            if (sphereInFrustum(frustum, m_items[i].center, m_items[i].radius)) {
+                m_visible.push_back(i);
+            }
+        }
+        return;
+    }
+
+    // 1) In or out, per item, over the job system
+    m_inside.resize(n);
+    m_jobs->parallelFor(0, n, ITEMS_PER_JOB, [this, &frustum](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; ++i) {
+            m_inside[i] = sphereInFrustum(frustum, m_items[i].center, m_items[i].radius);
+        }
+    });
+
+    // 2) The visible ones, in item order as before
+    for (uint32_t i = 0; i < n; ++i) {
+        if (m_inside[i]) {
+            m_visible.push_back(i);
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+#include <vector>
+#include <cstdint>
+#include "../glm/glm.hpp"
+#include "../Jobs/JobSystem.hpp"
+
+// One cullable object as seen by the culling stage: a bounding sphere plus an
+// id the caller can map back to its own geometry, and a version that must change
+// whenever the object moves or changes shape (used by the shadow cache).
+struct CullItem {
+    glm::vec3 center;
+    float     radius;
+    uint32_t  id;
+    uint32_t  version;
+};
+
+// Six inward-facing planes (a,b,c,d) with a*x + b*y + c*z + d >= 0 inside.
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// Extract the frustum planes from a combined projection * view matrix
+// (Gribb/Hartmann).  Works for both perspective and orthographic matrices.
+Frustum extractFrustum(const glm::mat4& viewProj);
+
+bool sphereInFrustum(const Frustum& frustum, const glm::vec3& center, float radius);
+
+// Hash a position/radius into a version number.  Objects that are rebuilt every
+// frame but end up in the same place keep the same version.
+uint32_t boundsVersion(const glm::vec3& center, float radius);
+
+class SceneCuller {
+public:
+    SceneCuller();
+
+    // cull() over the job system (NULL = all on the calling thread)
+    void setJobs(JobSystem* jobs) { m_jobs = jobs; }
+
+    // Rebuild the item list (call whenever geometry is regenerated or moves)
+    void clear();
+    // pose: anything else that changes how the object casts a shadow (e.g. a
+    // quantized sway angle); it is folded into the version
+    void addItem(const glm::vec3& center, float radius, uint32_t id, uint32_t pose = 0);
+    const std::vector<CullItem>& GetItems() const { return m_items; }
+
+    // Camera pass: indices into GetItems() that intersect the view frustum
+    void cull(const glm::mat4& viewProj);
+    const std::vector<uint32_t>& GetVisible() const { return m_visible; }
+
+private:
+    JobSystem* m_jobs;
+    std::vector<CullItem> m_items;
+    std::vector<uint32_t> m_visible;
+    std::vector<uint8_t> m_inside;      // cull() scratch, per item
+};
+
+#endif // CULLING_HPP
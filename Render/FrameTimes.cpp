@@ -0,0 +1,155 @@
+// Self-test: g++ -std=c++11 -DTEST -o frametimestest Render/FrameTimes.cpp
+#include "FrameTimes.hpp"
+#include <algorithm>
+#include <cmath>
+
+const char* FrameTimes::StageName(int stage)
+{
+    static const char* names[NUM_STAGES + 1] = {
+        "sim", "lsystem", "turtle", "leaves", "shadows", "submit", "gpu_wait", "total"
+    };
+    if (stage < 0 || stage > NUM_STAGES) {
+        return "?";
+    }
+    return names[stage];
+}
+
+FrameTimes::FrameTimes()
+{
+    clear();
+}
+
+void FrameTimes::clear()
+{
+    m_ms.clear();
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        m_current[s] = 0.;
+    }
+    m_lap = std::chrono::steady_clock::now();
+}
+
+void FrameTimes::beginFrame()
+{
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        m_current[s] = 0.;
+    }
+    m_lap = std::chrono::steady_clock::now();
+}
+
+void FrameTimes::endStage(Stage stage)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    m_current[stage] += std::chrono::duration<double, std::milli>(now - m_lap).count();
+    m_lap = now;
+}
+
+void FrameTimes::endFrame()
+{
+    m_ms.insert(m_ms.end(), m_current, m_current + NUM_STAGES);
+}
+
+double FrameTimes::GetTotalMs(int frame) const
+{
+    double total = 0.;
+    for (int s = 0; s < NUM_STAGES; ++s) {
+        total += GetMs(frame, s);
+    }
+    return total;
+}
+
+void FrameTimes::summarize(int stage, double* mean, double* median, double* p95, double* max) const
+{
+    int n = GetNumFrames();
+    *mean = *median = *p95 = *max = 0.;
+    if (n == 0) {
+        return;
+    }
+
+    std::vector<double> values(n);
+    double sum = 0.;
+    for (int f = 0; f < n; ++f) {
+        values[f] = (stage == NUM_STAGES) ? GetTotalMs(f) : GetMs(f, stage);
+        sum += values[f];
+    }
+    std::sort(values.begin(), values.end());
+
+    // nearest-rank percentiles
+    *mean = sum / n;
+    *median = values[(n - 1) / 2];
+    int rank95 = (int)std::ceil(0.95 * n);
+    *p95 = values[std::max(1, rank95) - 1];
+    *max = values[n - 1];
+}
+
+void FrameTimes::printSummary(FILE* fp) const
+{
+    fprintf(fp, "%d frames, CPU ms per frame:\n", GetNumFrames());
+    fprintf(fp, "  %-10s %9s %9s %9s %9s\n", "stage", "mean", "median", "p95", "max");
+    for (int s = 0; s <= NUM_STAGES; ++s) {
+        double mean, median, p95, max;
+        summarize(s, &mean, &median, &p95, &max);
+        fprintf(fp, "  %-10s %9.3f %9.3f %9.3f %9.3f\n", StageName(s), mean, median, p95, max);
+    }
+}
+
+bool FrameTimes::writeCsv(const char* path) const
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL) {
+        return false;
+    }
+    fprintf(fp, "frame");
+    for (int s = 0; s <= NUM_STAGES; ++s) {
+        fprintf(fp, ",%s_ms", StageName(s));
+    }
+    fprintf(fp, "\n");
+    for (int f = 0; f < GetNumFrames(); ++f) {
+        fprintf(fp, "%d", f);
+        for (int s = 0; s < NUM_STAGES; ++s) {
+            fprintf(fp, ",%.4f", GetMs(f, s));
+        }
+        fprintf(fp, ",%.4f\n", GetTotalMs(f));
+    }
+    fclose(fp);
+    return true;
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <thread>
+#include "../SelfTest.hpp"
+
+int
+main( int argc, char *argv[ ] )
+{
+	FrameTimes times;
+	Check( times.GetNumFrames( ) == 0, "starts empty" );
+
+	// 3 frames: the turtle stage sleeps 2, 4, 6 ms
+	for( int f = 1; f <= 3; f++ )
+	{
+		times.beginFrame( );
+		times.endStage( FrameTimes::STAGE_LSYSTEM );
+		std::this_thread::sleep_for( std::chrono::milliseconds( 2 * f ) );
+		times.endStage( FrameTimes::STAGE_TURTLE );
+		times.endFrame( );
+	}
+	Check( times.GetNumFrames( ) == 3, "three frames kept" );
+	Check( times.GetMs( 0, FrameTimes::STAGE_TURTLE ) >= 2. && times.GetMs( 2, FrameTimes::STAGE_TURTLE ) >= 6., "stage time charged to the stage" );
+	Check( times.GetMs( 1, FrameTimes::STAGE_SUBMIT ) == 0., "untouched stages are zero" );
+
+	double mean, median, p95, max;
+	times.summarize( FrameTimes::STAGE_TURTLE, &mean, &median, &p95, &max );
+	Check( median >= 4. && median < max, "median is the middle frame" );
+	Check( p95 == max, "p95 of three frames is the max" );
+	times.summarize( FrameTimes::NUM_STAGES, &mean, &median, &p95, &max );
+	Check( max >= times.GetMs( 2, FrameTimes::STAGE_TURTLE ), "total includes every stage" );
+
+	times.printSummary( stderr );
+	times.clear( );
+	Check( times.GetNumFrames( ) == 0, "clear( ) drops the frames" );
+
+	return CheckResult( );
+}
+#endif
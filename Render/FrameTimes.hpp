@@ -0,0 +1,48 @@
+#ifndef FRAMETIMES_HPP
+#define FRAMETIMES_HPP
+#include <vector>
+#include <chrono>
+#include <cstdio>
+
+// CPU time per frame, split by stage.
+//
+// The frame loop calls beginFrame(), then endStage() after each stage (the
+// time since the previous call is charged to that stage), then endFrame().  The
+// summary gives mean / median / 95th percentile / max over all kept frames.
+class FrameTimes {
+public:
+    enum Stage {
+        STAGE_SIM,          // fixed-step simulation updates
+        STAGE_LSYSTEM,      // L-system string rewriting (when the tree is rebuilt)
+        STAGE_TURTLE,       // turtle interpretation -> segments + leaves
+        STAGE_LEAVES,       // cull items, frustum culling, leaf depth sort
+        STAGE_SHADOWS,      // cascade fitting + shadow map draws
+        STAGE_SUBMIT,       // uniforms, render queue record / sort / flush
+        STAGE_GPU_WAIT,     // glFinish() (headless only)
+        NUM_STAGES
+    };
+    static const char* StageName(int stage);
+
+    FrameTimes();
+
+    void beginFrame();
+    void endStage(Stage stage);
+    void endFrame();
+    void clear();
+
+    int GetNumFrames() const { return (int)(m_ms.size() / NUM_STAGES); }
+    double GetMs(int frame, int stage) const { return m_ms[frame * NUM_STAGES + stage]; }
+    double GetTotalMs(int frame) const;
+
+    // stage == NUM_STAGES summarizes the frame total
+    void summarize(int stage, double* mean, double* median, double* p95, double* max) const;
+    void printSummary(FILE* fp) const;
+    bool writeCsv(const char* path) const;
+
+private:
+    std::chrono::steady_clock::time_point m_lap;
+    double m_current[NUM_STAGES];
+    std::vector<double> m_ms;       // NUM_STAGES values per frame
+};
+
+#endif // FRAMETIMES_HPP
@@ -0,0 +1,300 @@
+#include "Headless.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __APPLE__
+    #include <OpenGL/OpenGL.h>
+    #include <OpenGL/gl.h>
+#else
+    #include "../glew.h"
+    #include <GL/gl.h>
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+#endif
+
+// -------------------------------------
+// Command line
+// -------------------------------------
+static void PrintUsage(const char* program)
+{
+    fprintf(stderr,
+        "usage: %s --headless [--frames N] [--warmup N] [--size WxH] [--fps F]\n"
+        "          [--shadows] [--alpha A] [--rebuild-tree] [--csv FILE]\n"
+        "          [--dump DIR] [--dump-every K] [--load-snapshot FILE]\n"
+        "          [--save-snapshot FILE] [--check-snapshot FILE]\n",
+        program);
+}
+
+bool ParseHeadlessArgs(int argc, char* argv[], HeadlessOptions* opts)
+{
+    opts->enabled = false;
+    opts->frames = 120;
+    opts->warmup = 5;
+    opts->width = opts->height = 800;
+    opts->fps = 60.f;
+    opts->shadows = false;
+    opts->rebuildTree = false;
+    opts->alpha = 1.f;
+    opts->csvPath.clear();
+    opts->dumpDir.clear();
+    opts->dumpEvery = 1;
+    opts->loadSnapshot.clear();
+    opts->saveSnapshot.clear();
+    opts->checkSnapshot.clear();
+
+    for (int i = 1; i < argc; ++i) {
+        const char* arg = argv[i];
+        const char* value = (i + 1 < argc) ? argv[i + 1] : NULL;
+        bool ok = true;
+
+        if (strcmp(arg, "--headless") == 0) {
+            opts->enabled = true;
+            continue;
+        } else if (strcmp(arg, "--shadows") == 0) {
+            opts->shadows = true;
+            continue;
+        } else if (strcmp(arg, "--rebuild-tree") == 0) {
+            opts->rebuildTree = true;
+            continue;
+        }
+
+        // everything else takes a value
+        if (value == NULL) {
+            ok = false;
+        } else if (strcmp(arg, "--frames") == 0) {
+            opts->frames = atoi(value);
+            ok = opts->frames > 0;
+        } else if (strcmp(arg, "--warmup") == 0) {
+            opts->warmup = atoi(value);
+            ok = opts->warmup >= 0;
+        } else if (strcmp(arg, "--size") == 0) {
+            ok = sscanf(value, "%dx%d", &opts->width, &opts->height) == 2 &&
+                 opts->width > 0 && opts->height > 0;
+        } else if (strcmp(arg, "--fps") == 0) {
+            opts->fps = (float)atof(value);
+            ok = opts->fps > 0.f;
+        } else if (strcmp(arg, "--alpha") == 0) {
+            opts->alpha = (float)atof(value);
+            ok = opts->alpha > 0.f && opts->alpha <= 1.f;
+        } else if (strcmp(arg, "--csv") == 0) {
+            opts->csvPath = value;
+        } else if (strcmp(arg, "--dump") == 0) {
+            opts->dumpDir = value;
+        } else if (strcmp(arg, "--dump-every") == 0) {
+            opts->dumpEvery = atoi(value);
+            ok = opts->dumpEvery > 0;
+        } else if (strcmp(arg, "--load-snapshot") == 0) {
+            opts->loadSnapshot = value;
+        } else if (strcmp(arg, "--save-snapshot") == 0) {
+            opts->saveSnapshot = value;
+        } else if (strcmp(arg, "--check-snapshot") == 0) {
+            opts->checkSnapshot = value;
+        } else {
+            fprintf(stderr, "Unknown option '%s'\n", arg);
+            PrintUsage(argv[0]);
+            return false;
+        }
+
+        if (!ok) {
+            fprintf(stderr, "Bad or missing value for '%s'\n", arg);
+            PrintUsage(argv[0]);
+            return false;
+        }
+        ++i;
+    }
+    return true;
+}
+
+// -------------------------------------
+// Offscreen context
+// -------------------------------------
+#ifdef __APPLE__
+struct OffscreenContext::Platform {
+    CGLContextObj context;
+};
+#else
+struct OffscreenContext::Platform {
+    EGLDisplay display;
+    EGLContext context;
+};
+#endif
+
+OffscreenContext::OffscreenContext()
+    : m_platform(NULL)
+    , m_fbo(0), m_color(0), m_depth(0)
+    , m_width(0), m_height(0)
+{
+}
+
+OffscreenContext::~OffscreenContext()
+{
+    destroy();
+}
+
+bool OffscreenContext::create(int width, int height)
+{
+    destroy();
+    m_platform = new Platform;
+
+#ifdef __APPLE__
+    // 1) Legacy (2.1) profile, so fixed function and GLSL 1.20 still work
+    CGLPixelFormatAttribute attribs[] = {
+        kCGLPFAColorSize, (CGLPixelFormatAttribute)24,
+        kCGLPFADepthSize, (CGLPixelFormatAttribute)24,
+        kCGLPFAAllowOfflineRenderers,
+        (CGLPixelFormatAttribute)0
+    };
+    CGLPixelFormatObj format = NULL;
+    GLint numFormats = 0;
+    m_platform->context = NULL;
+    if (CGLChoosePixelFormat(attribs, &format, &numFormats) != kCGLNoError || format == NULL) {
+        fprintf(stderr, "CGLChoosePixelFormat failed\n");
+        destroy();
+        return false;
+    }
+    CGLError err = CGLCreateContext(format, NULL, &m_platform->context);
+    CGLDestroyPixelFormat(format);
+    if (err != kCGLNoError || CGLSetCurrentContext(m_platform->context) != kCGLNoError) {
+        fprintf(stderr, "CGL context creation failed\n");
+        destroy();
+        return false;
+    }
+#else
+    // 1) Surfaceless display: no window system needed (Mesa llvmpipe is fine)
+    m_platform->context = EGL_NO_CONTEXT;
+    m_platform->display = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (getPlatformDisplay != NULL) {
+        m_platform->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (m_platform->display == EGL_NO_DISPLAY) {
+        m_platform->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    EGLint major, minor;
+    if (m_platform->display == EGL_NO_DISPLAY || !eglInitialize(m_platform->display, &major, &minor)) {
+        fprintf(stderr, "eglInitialize failed (0x%x)\n", eglGetError());
+        destroy();
+        return false;
+    }
+
+    // 2) Desktop GL (compatibility profile is the default), no surface
+    eglBindAPI(EGL_OPENGL_API);
+    EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,      // the default (window) has no match here
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(m_platform->display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        fprintf(stderr, "eglChooseConfig found no desktop GL config\n");
+        destroy();
+        return false;
+    }
+    m_platform->context = eglCreateContext(m_platform->display, config, EGL_NO_CONTEXT, NULL);
+    if (m_platform->context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(m_platform->display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_platform->context)) {
+        fprintf(stderr, "EGL context creation failed (0x%x)\n", eglGetError());
+        destroy();
+        return false;
+    }
+
+    // glew needs a current context
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) {
+        fprintf(stderr, "glewInit failed\n");
+    }
+#endif
+
+    // 3) Framebuffer with color + depth renderbuffers
+    m_width = width;
+    m_height = height;
+    glGenFramebuffers(1, &m_fbo);
+    glGenRenderbuffers(1, &m_color);
+    glGenRenderbuffers(1, &m_depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, m_depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depth);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Offscreen framebuffer is incomplete\n");
+        destroy();
+        return false;
+    }
+
+    fprintf(stderr, "Offscreen %dx%d: %s, GL %s\n", width, height,
+        (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+    return true;
+}
+
+void OffscreenContext::destroy()
+{
+    if (m_platform == NULL) {
+        return;
+    }
+    if (m_fbo != 0) {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &m_fbo);
+        glDeleteRenderbuffers(1, &m_color);
+        glDeleteRenderbuffers(1, &m_depth);
+        m_fbo = m_color = m_depth = 0;
+    }
+#ifdef __APPLE__
+    if (m_platform->context != NULL) {
+        CGLSetCurrentContext(NULL);
+        CGLDestroyContext(m_platform->context);
+    }
+#else
+    if (m_platform->display != EGL_NO_DISPLAY) {
+        eglMakeCurrent(m_platform->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (m_platform->context != EGL_NO_CONTEXT) {
+            eglDestroyContext(m_platform->display, m_platform->context);
+        }
+        eglTerminate(m_platform->display);
+    }
+#endif
+    delete m_platform;
+    m_platform = NULL;
+}
+
+void OffscreenContext::readPixels(std::vector<unsigned char>& rgb) const
+{
+    rgb.resize((size_t)m_width * m_height * 3);
+    glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, &rgb[0]);
+
+    // GL rows start at the bottom
+    size_t rowBytes = (size_t)m_width * 3;
+    std::vector<unsigned char> row(rowBytes);
+    for (int y = 0; y < m_height / 2; ++y) {
+        unsigned char* top = &rgb[y * rowBytes];
+        unsigned char* bottom = &rgb[(m_height - 1 - y) * rowBytes];
+        memcpy(&row[0], top, rowBytes);
+        memcpy(top, bottom, rowBytes);
+        memcpy(bottom, &row[0], rowBytes);
+    }
+}
+
+bool WritePPM(const char* path, int width, int height, const std::vector<unsigned char>& rgb)
+{
+    FILE* fp = fopen(path, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot write '%s'\n", path);
+        return false;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    size_t bytes = (size_t)width * height * 3;
+    bool ok = fwrite(&rgb[0], 1, bytes, fp) == bytes;
+    fclose(fp);
+    return ok;
+}
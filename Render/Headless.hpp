@@ -0,0 +1,64 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+#include <string>
+#include <vector>
+
+// Command line for the offscreen benchmark mode:
+//   FinalProject --headless [--frames N] [--warmup N] [--size WxH] [--fps F]
+//                [--shadows] [--alpha A] [--rebuild-tree] [--csv FILE]
+//                [--dump DIR] [--dump-every K] [--load-snapshot FILE]
+//                [--save-snapshot FILE] [--check-snapshot FILE]
+// --load-snapshot also works without --headless, to resume in the window.
+// --check-snapshot saves to FILE after the last frame, steps on, restores
+// and steps again, and fails if the falling leaves come out different.
+struct HeadlessOptions {
+    bool enabled;
+    int frames;             // timed frames along the camera path
+    int warmup;             // untimed frames rendered first
+    int width, height;
+    float fps;              // simulated frame rate (sim time per frame = 1/fps)
+    bool shadows;
+    bool rebuildTree;       // regenerate the tree every frame, as Display() used to
+    float alpha;            // leaf alpha (< 1 exercises the sorted path)
+    std::string csvPath;    // per-frame stage times, empty = none
+    std::string dumpDir;    // PPM images, empty = none
+    int dumpEvery;          // dump every K-th timed frame
+    std::string loadSnapshot;   // .snap to start from, empty = a fresh sim
+    std::string saveSnapshot;   // .snap written after the last frame, empty = none
+    std::string checkSnapshot;  // .snap for the restore check, empty = no check
+};
+
+// Fills in defaults, then reads the flags above.  Returns false (after
+// printing usage) on an unknown flag or a bad value.
+bool ParseHeadlessArgs(int argc, char* argv[], HeadlessOptions* opts);
+
+// A GL context with no window: EGL (surfaceless, works with software Mesa)
+// everywhere but macOS, CGL on macOS.  Rendering goes to a framebuffer object
+// with an RGBA color and a depth renderbuffer.
+class OffscreenContext {
+public:
+    OffscreenContext();
+    ~OffscreenContext();
+
+    // Creates the context, makes it current and binds the framebuffer
+    bool create(int width, int height);
+    void destroy();
+
+    unsigned int GetFramebuffer() const { return m_fbo; }
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+
+    // Color buffer as tightly packed RGB, top row first
+    void readPixels(std::vector<unsigned char>& rgb) const;
+
+private:
+    struct Platform;
+    Platform* m_platform;
+    unsigned int m_fbo, m_color, m_depth;
+    int m_width, m_height;
+};
+
+// Binary PPM (P6), easy to diff in regression scripts
+bool WritePPM(const char* path, int width, int height, const std::vector<unsigned char>& rgb);
+
+#endif // HEADLESS_HPP
@@ -0,0 +1,241 @@
+// Benchmark + check: g++ -std=c++11 -O2 -DBENCH -o leafsortbench Render/LeafSort.cpp
+#include "LeafSort.hpp"
+#include <cstring>
+
+// Map a float to a uint32 that sorts *descending* by the float value, so an
+// ascending sort of the keys gives farthest-first.
+static inline uint32_t backToFrontKey(float depth)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    // the usual float flip makes the bits sort ascending ...
+    uint32_t ascending = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+    // ... and inverting them sorts descending
+    return ~ascending;
+}
+
+DepthSorter::DepthSorter()
+    : m_lastMethod(SORT_NONE)
+{
+}
+
+void DepthSorter::reset()
+{
+    m_order.clear();
+    m_keys.clear();
+}
+
+const std::vector<uint32_t>& DepthSorter::sortBackToFront(const float* depth, uint32_t n)
+{
+    bool coherent = (m_order.size() == n);
+    if (!coherent) {
+        m_order.resize(n);
+        for (uint32_t i = 0; i < n; ++i) {
+            m_order[i] = i;
+        }
+    }
+
+    // 1) Keys in last frame's order, counting how many neighbours are swapped
+    m_keys.resize(n);
+    uint32_t descents = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        m_keys[i] = backToFrontKey(depth[m_order[i]]);
+        if (i > 0 && m_keys[i] < m_keys[i - 1]) {
+            descents++;
+        }
+    }
+
+    if (descents == 0) {
+        m_lastMethod = SORT_NONE;
+        return m_order;
+    }
+
+    // 2) Nearly sorted: insertion sort, but give up once it has done a few
+    //    passes' worth of moves and let the radix sort finish the job
+    if (coherent && descents <= n / 4 + 16) {
+        if (insertionSort(n, 4ull * n)) {
+            m_lastMethod = SORT_INSERTION;
+            return m_order;
+        }
+    }
+
+    // 3) Full radix sort
+    radixSort(n);
+    m_lastMethod = SORT_RADIX;
+    return m_order;
+}
+
+bool DepthSorter::insertionSort(uint32_t n, uint64_t maxMoves)
+{
+    uint32_t* keys = m_keys.data();
+    uint32_t* order = m_order.data();
+    uint64_t moves = 0;
+    for (uint32_t i = 1; i < n; ++i) {
+        uint32_t key = keys[i];
+        if (key >= keys[i - 1]) {
+            continue;
+        }
+        uint32_t idx = order[i];
+        uint32_t j = i;
+        while (j > 0 && keys[j - 1] > key) {
+            keys[j] = keys[j - 1];
+            order[j] = order[j - 1];
+            --j;
+        }
+        keys[j] = key;
+        order[j] = idx;
+
+        moves += i - j;
+        if (moves > maxMoves) {
+            return false;     // arrays are still a valid permutation
+        }
+    }
+    return true;
+}
+
+void DepthSorter::radixSort(uint32_t n)
+{
+    const int RADIX_BITS = 11;
+    const uint32_t BUCKETS = 1u << RADIX_BITS;
+    const uint32_t MASK = BUCKETS - 1;
+
+    m_tmpKeys.resize(n);
+    m_tmpOrder.resize(n);
+
+    // 1) All three histograms in one read of the keys
+    std::vector<uint32_t> histograms(3 * BUCKETS, 0);
+    uint32_t* h0 = &histograms[0];
+    uint32_t* h1 = &histograms[BUCKETS];
+    uint32_t* h2 = &histograms[2 * BUCKETS];
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t k = m_keys[i];
+        h0[k & MASK]++;
+        h1[(k >> 11) & MASK]++;
+        h2[k >> 22]++;
+    }
+
+    uint32_t* srcKeys = m_keys.data();
+    uint32_t* srcOrder = m_order.data();
+    uint32_t* dstKeys = m_tmpKeys.data();
+    uint32_t* dstOrder = m_tmpOrder.data();
+
+    for (int pass = 0; pass < 3; ++pass) {
+        uint32_t* hist = &histograms[pass * BUCKETS];
+        int shift = pass * RADIX_BITS;
+
+        // 2) A digit that is the same for every key would just copy the data
+        //    (typical for the top bits when all leaves are at similar depths)
+        if (hist[(srcKeys[0] >> shift) & MASK] == n) {
+            continue;
+        }
+
+        // 3) Exclusive prefix sum -> bucket start offsets
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < BUCKETS; ++b) {
+            uint32_t count = hist[b];
+            hist[b] = sum;
+            sum += count;
+        }
+
+        // 4) Stable scatter
+        for (uint32_t i = 0; i < n; ++i) {
+            uint32_t k = srcKeys[i];
+            uint32_t dst = hist[(k >> shift) & MASK]++;
+            dstKeys[dst] = k;
+            dstOrder[dst] = srcOrder[i];
+        }
+
+        uint32_t* t;
+        t = srcKeys;  srcKeys = dstKeys;   dstKeys = t;
+        t = srcOrder; srcOrder = dstOrder; dstOrder = t;
+    }
+
+    // 5) Odd number of executed passes leaves the result in the scratch arrays
+    if (srcKeys != m_keys.data()) {
+        m_keys.swap(m_tmpKeys);
+        m_order.swap(m_tmpOrder);
+    }
+}
+
+//#define BENCH
+#ifdef BENCH
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include "../SelfTest.hpp"
+
+static double
+Ms( std::chrono::high_resolution_clock::time_point t0 )
+{
+	return std::chrono::duration<double, std::milli>( std::chrono::high_resolution_clock::now( ) - t0 ).count( );
+}
+
+static bool
+IsBackToFront( const std::vector<uint32_t> &order, const std::vector<float> &depth )
+{
+	for( size_t i = 1; i < order.size( ); i++ )
+		if( depth[ order[i] ] > depth[ order[i-1] ] )
+			return false;
+	return true;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	const int FRAMES = 20;
+	const char *names[ ] = { "none", "insertion", "radix" };
+	std::mt19937 rng( 12345 );
+	std::uniform_real_distribution<float> place( 0.f, 200.f );
+	std::uniform_real_distribution<float> jitter( -0.005f, 0.005f );
+
+	uint32_t sizes[ ] = { 10000, 100000, 1000000 };
+	fprintf( stderr, "%10s %12s %12s %12s   %s\n", "leaves", "std::sort", "first frame", "per frame", "method" );
+	for( int s = 0; s < 3; s++ )
+	{
+		uint32_t n = sizes[s];
+		std::vector<float> depth( n );
+		for( uint32_t i = 0; i < n; i++ )
+			depth[i] = place( rng );
+
+		// baseline: sort an index array with std::sort every frame
+		std::vector<uint32_t> idx( n );
+		for( uint32_t i = 0; i < n; i++ )
+			idx[i] = i;
+		auto t0 = std::chrono::high_resolution_clock::now( );
+		std::sort( idx.begin( ), idx.end( ), [&depth]( uint32_t a, uint32_t b ) { return depth[a] > depth[b]; } );
+		double stdMs = Ms( t0 );
+
+		DepthSorter sorter;
+		t0 = std::chrono::high_resolution_clock::now( );
+		sorter.sortBackToFront( depth.data( ), n );
+		double firstMs = Ms( t0 );
+		bool ok = IsBackToFront( sorter.GetOrder( ), depth );
+
+		// later frames: the camera dollies in a little and the leaves flutter,
+		// so the order only changes locally
+		double frameMs = 0.;
+		int methodCount[3] = { 0, 0, 0 };
+		for( int f = 0; f < FRAMES; f++ )
+		{
+			for( uint32_t i = 0; i < n; i++ )
+				depth[i] += -0.1f + jitter( rng );
+			t0 = std::chrono::high_resolution_clock::now( );
+			sorter.sortBackToFront( depth.data( ), n );
+			frameMs += Ms( t0 );
+			methodCount[ sorter.GetLastMethod( ) ]++;
+			ok = ok && IsBackToFront( sorter.GetOrder( ), depth );
+		}
+
+		int used = 0;
+		for( int m = 1; m < 3; m++ )
+			if( methodCount[m] > methodCount[used] )
+				used = m;
+		fprintf( stderr, "%10u %10.3fms %10.3fms %10.3fms   %s\n", n, stdMs, firstMs, frameMs / FRAMES,
+			names[used] );
+		Check( ok, "back to front every frame" );
+	}
+	return CheckResult( );
+}
+#endif
@@ -0,0 +1,42 @@
+#ifndef LEAFSORT_HPP
+#define LEAFSORT_HPP
+#include <vector>
+#include <cstdint>
+
+// Back-to-front ordering of leaf instances for alpha blending.
+//
+// The order from the previous frame is kept.  Since the camera and the leaves
+// move only a little between frames, that order is usually almost right, so
+// each frame first tries an insertion sort over it (linear when nearly sorted)
+// and only falls back to a full 3-pass LSD radix sort when too much has
+// changed.  Radix passes whose digit is the same for every key are skipped.
+class DepthSorter {
+public:
+    enum Method {
+        SORT_NONE,        // already in order
+        SORT_INSERTION,
+        SORT_RADIX
+    };
+
+    DepthSorter();
+
+    // depth[i] = view distance of instance i (bigger = farther)
+    // returns instance indices, farthest first
+    const std::vector<uint32_t>& sortBackToFront(const float* depth, uint32_t n);
+
+    const std::vector<uint32_t>& GetOrder() const { return m_order; }
+    Method GetLastMethod() const { return m_lastMethod; }
+    void reset();     // forget the previous order (e.g. after the leaves are rebuilt)
+
+private:
+    bool insertionSort(uint32_t n, uint64_t maxMoves);
+    void radixSort(uint32_t n);
+
+    std::vector<uint32_t> m_order;
+    std::vector<uint32_t> m_keys;      // sort keys, parallel to m_order
+    std::vector<uint32_t> m_tmpOrder;  // radix scratch
+    std::vector<uint32_t> m_tmpKeys;
+    Method m_lastMethod;
+};
+
+#endif // LEAFSORT_HPP
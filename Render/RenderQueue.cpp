@@ -0,0 +1,175 @@
+// Self-test: g++ -std=c++11 -DTEST -o queuetest Render/RenderQueue.cpp
+#include "RenderQueue.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+// -------------------------------------
+// Key packing
+// -------------------------------------
+uint64_t RenderQueue::makeKey(unsigned pass, uint32_t shader, uint32_t texture, float depth)
+{
+    // Non-negative floats order the same as their bit patterns
+    if (!(depth > 0.f)) {
+        depth = 0.f;
+    }
+    uint32_t depthBits;
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+
+    uint64_t p = (uint64_t)(pass & 0xf);
+    uint64_t s = (uint64_t)(shader & 0xfff);
+    uint64_t t = (uint64_t)(texture & 0xffff);
+    if (pass == PASS_TRANSPARENT) {
+        // farthest first, state changes are secondary
+        return (p << 60) | ((uint64_t)(~depthBits) << 28) | (s << 16) | t;
+    }
+    return (p << 60) | (s << 48) | (t << 32) | (uint64_t)depthBits;
+}
+
+RenderQueue::RenderQueue()
+    : m_sorted(true)
+{
+    std::memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void RenderQueue::begin()
+{
+    m_items.clear();
+    m_order.clear();
+    m_sorted = true;
+    std::memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void RenderQueue::submit(const DrawItem& item)
+{
+    m_items.push_back(item);
+    DrawItem& added = m_items.back();
+    added.key = makeKey(added.pass, added.shader, added.texture, added.depth);
+    m_sorted = false;
+}
+
+void RenderQueue::sort()
+{
+    uint32_t n = (uint32_t)m_items.size();
+    m_order.resize(n);
+    m_sortKeys.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        m_order[i] = i;
+        m_sortKeys[i] = m_items[i].key;
+    }
+    // Ties keep submission order so equal keys draw deterministically
+    const std::vector<uint64_t>& keys = m_sortKeys;
+    std::sort(m_order.begin(), m_order.end(), [&keys](uint32_t a, uint32_t b) {
+        return keys[a] < keys[b] || (keys[a] == keys[b] && a < b);
+    });
+    m_sorted = true;
+}
+
+void RenderQueue::flush(RenderBackend& backend)
+{
+    if (!m_sorted || m_order.size() != m_items.size()) {
+        sort();
+    }
+
+    // Nothing is known about the GL state coming in, so the first item binds
+    // everything.
+    const uint32_t UNKNOWN = 0xffffffffu;
+    unsigned currentPass = UNKNOWN;
+    uint32_t currentShader = UNKNOWN;
+    uint32_t currentTexture = UNKNOWN;
+    uint32_t currentUnit = UNKNOWN;
+
+    for (size_t k = 0; k < m_order.size(); ++k) {
+        const DrawItem& item = m_items[m_order[k]];
+
+        if (item.pass != currentPass) {
+            backend.setPass(item.pass);
+            currentPass = item.pass;
+            m_stats.passChanges++;
+        }
+        if (item.shader != currentShader) {
+            backend.bindShader(item.shader);
+            currentShader = item.shader;
+            m_stats.shaderChanges++;
+        }
+        if (item.texture != 0 &&
+            (item.texture != currentTexture || item.textureUnit != currentUnit)) {
+            backend.bindTexture(item.textureUnit, item.texture);
+            currentTexture = item.texture;
+            currentUnit = item.textureUnit;
+            m_stats.textureChanges++;
+        }
+        backend.draw(item);
+        m_stats.draws++;
+    }
+}
+
+//#define TEST
+#ifdef TEST
+
+#include <string>
+#include "../SelfTest.hpp"
+
+// records every call instead of talking to GL:
+class MockBackend : public RenderBackend
+{
+  public:
+	std::string log;
+
+	void setPass( unsigned pass )			{ log += "P" + std::to_string( pass ) + " "; }
+	void bindShader( uint32_t shader )		{ log += "S" + std::to_string( shader ) + " "; }
+	void bindTexture( uint32_t unit, uint32_t tex )	{ log += "T" + std::to_string( unit ) + ":" + std::to_string( tex ) + " "; }
+	void draw( const DrawItem &item )		{ log += "d" + std::to_string( item.index ) + " "; }
+};
+
+static DrawItem
+Item( unsigned pass, uint32_t shader, uint32_t texture, float depth, uint32_t index )
+{
+	DrawItem item;
+	memset( &item, 0, sizeof(item) );
+	item.pass = pass;
+	item.shader = shader;
+	item.texture = texture;
+	item.textureUnit = 3;
+	item.depth = depth;
+	item.index = index;
+	return item;
+}
+
+int
+main( int argc, char *argv[ ] )
+{
+	RenderQueue queue;
+	MockBackend mock;
+
+	// interleaved the way Display( ) used to run: bark, leaf, leaf, bark, ...
+	queue.begin( );
+	queue.submit( Item( RenderQueue::PASS_OPAQUE, 1, 7, 20.f, 0 ) );
+	queue.submit( Item( RenderQueue::PASS_OPAQUE, 2, 0, 30.f, 1 ) );
+	queue.submit( Item( RenderQueue::PASS_OPAQUE, 2, 0, 10.f, 2 ) );
+	queue.submit( Item( RenderQueue::PASS_OPAQUE, 1, 7,  5.f, 3 ) );
+	queue.submit( Item( RenderQueue::PASS_TRANSPARENT, 2, 0,  4.f, 4 ) );
+	queue.submit( Item( RenderQueue::PASS_TRANSPARENT, 2, 0, 40.f, 5 ) );
+	queue.flush( mock );
+
+	fprintf( stderr, "%s\n", mock.log.c_str( ) );
+	Check( mock.log == "P1 S1 T3:7 d3 d0 S2 d2 d1 P2 d5 d4 ", "sorted by pass, shader, texture, then depth" );
+
+	const RenderStats &stats = queue.GetStats( );
+	Check( stats.shaderChanges == 2, "two shader binds" );
+	Check( stats.textureChanges == 1, "one texture bind" );
+	Check( stats.passChanges == 2, "two pass changes" );
+	Check( stats.draws == 6, "six draws" );
+
+	// keys:
+	Check( RenderQueue::makeKey( 1, 1, 0, 1.f ) < RenderQueue::makeKey( 1, 1, 0, 2.f ), "opaque: nearer first" );
+	Check( RenderQueue::makeKey( 2, 1, 0, 2.f ) < RenderQueue::makeKey( 2, 1, 0, 1.f ), "transparent: farther first" );
+	Check( RenderQueue::makeKey( 1, 9, 9, 1000.f ) < RenderQueue::makeKey( 2, 0, 0, 0.f ), "pass dominates" );
+
+	// a new frame starts from scratch:
+	queue.begin( );
+	Check( queue.GetStats( ).draws == 0 && queue.GetItems( ).empty( ), "begin( ) clears items and stats" );
+
+	return CheckResult( );
+}
+#endif
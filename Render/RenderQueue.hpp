@@ -0,0 +1,78 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+#include <vector>
+#include <cstdint>
+
+// One recorded draw.  'kind' and 'index' are opaque to the queue: the backend
+// uses them to find the geometry (e.g. kind = leaf, index = leaf number).
+struct DrawItem {
+    uint64_t key;          // filled in by RenderQueue::submit()
+    unsigned pass;
+    uint32_t shader;       // backend shader id, 0 = fixed function
+    uint32_t texture;      // backend texture name, 0 = none
+    uint32_t textureUnit;
+    float    depth;        // view-space distance, >= 0
+    uint32_t kind;
+    uint32_t index;
+    float    color[3];
+};
+
+// Per-frame counters
+struct RenderStats {
+    int passChanges;
+    int shaderChanges;
+    int textureChanges;
+    int draws;
+};
+
+// Everything the queue needs from GL.  FinalProject implements it with real
+// GL calls; tests implement it with a recorder.
+class RenderBackend {
+public:
+    virtual ~RenderBackend() {}
+    virtual void setPass(unsigned pass) = 0;
+    virtual void bindShader(uint32_t shader) = 0;
+    virtual void bindTexture(uint32_t unit, uint32_t texture) = 0;
+    virtual void draw(const DrawItem& item) = 0;
+};
+
+// Sort-and-batch render queue.
+//
+// Draws are recorded with submit(), sorted by a 64-bit key and issued by
+// flush() with redundant pass / shader / texture changes dropped.
+//
+// Key layout (most significant first):
+//   opaque passes:       pass:4 | shader:12 | texture:16 | depth:32  (front to back)
+//   transparent passes:  pass:4 | ~depth:32 | shader:12 | texture:16 (back to front)
+class RenderQueue {
+public:
+    enum Pass {
+        PASS_SHADOW      = 0,
+        PASS_OPAQUE      = 1,
+        PASS_TRANSPARENT = 2,
+        PASS_OVERLAY     = 3
+    };
+
+    static uint64_t makeKey(unsigned pass, uint32_t shader, uint32_t texture, float depth);
+
+    RenderQueue();
+
+    void begin();                       // start a new frame
+    void submit(const DrawItem& item);  // computes item.key
+    void sort();
+    void flush(RenderBackend& backend); // sort (if needed) and issue
+
+    const std::vector<DrawItem>& GetItems() const { return m_items; }
+    // Item indices in issue order, valid after sort()
+    const std::vector<uint32_t>& GetOrder() const { return m_order; }
+    const RenderStats& GetStats() const { return m_stats; }
+
+private:
+    std::vector<DrawItem> m_items;
+    std::vector<uint32_t> m_order;
+    std::vector<uint64_t> m_sortKeys;   // scratch for sort()
+    bool m_sorted;
+    RenderStats m_stats;
+};
+
+#endif // RENDERQUEUE_HPP
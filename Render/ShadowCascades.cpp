@@ -0,0 +1,276 @@
+// Self-test: make libjobs.a && g++ -std=c++11 -DTEST -o shadowtest Render/ShadowCascades.cpp Render/Culling.cpp -L. -ljobs -pthread
+#include "ShadowCascades.hpp"
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include "../glm/gtc/matrix_transform.hpp"
+
+const int ShadowCascades::MAX_CASCADES;
+
+ShadowCascades::ShadowCascades(int numCascades, int resolution)
+    : m_resolution(resolution)
+    , m_splitLambda(0.75f)
+    , m_shadowDistance(150.f)
+{
+    numCascades = std::max(1, std::min(numCascades, MAX_CASCADES));
+    m_cascades.resize(numCascades);
+    m_renderedMatrix.resize(numCascades, glm::mat4(1.f));
+    m_renderedHash.resize(numCascades, 0);
+    m_renderedValid.resize(numCascades, false);
+    for (int i = 0; i < numCascades; ++i) {
+        m_cascades[i].nearDist = m_cascades[i].farDist = 0.f;
+        m_cascades[i].casterHash = 0;
+        m_cascades[i].dirty = true;
+    }
+}
+
+void ShadowCascades::setSplitLambda(float lambda)
+{
+    m_splitLambda = std::max(0.f, std::min(lambda, 1.f));
+}
+
+void ShadowCascades::setShadowDistance(float distance)
+{
+    m_shadowDistance = distance;
+}
+
+// ---------------------------------------------------------
+// "Practical" split scheme: blend of logarithmic and uniform
+// splits.  Log splits keep the texel density even with depth,
+// uniform splits stop the first cascade from being tiny.
+// ---------------------------------------------------------
+void ShadowCascades::computeSplits(float zNear, float zFar)
+{
+    float farDist = std::min(zFar, m_shadowDistance);
+    int n = GetNumCascades();
+    float prev = zNear;
+    for (int i = 0; i < n; ++i) {
+        float p = (float)(i + 1) / (float)n;
+        float logSplit = zNear * std::pow(farDist / zNear, p);
+        float uniSplit = zNear + (farDist - zNear) * p;
+        float split = m_splitLambda * logSplit + (1.f - m_splitLambda) * uniSplit;
+        m_cascades[i].nearDist = prev;
+        m_cascades[i].farDist  = split;
+        prev = split;
+    }
+}
+
+void ShadowCascades::update(const glm::mat4& cameraView, const glm::mat4& cameraProj,
+                            float zNear, float zFar,
+                            const glm::vec3& lightDir,
+                            const std::vector<CullItem>& casters)
+{
+    computeSplits(zNear, zFar);
+
+    // 1) Corners of the whole camera frustum in world space
+    glm::mat4 invViewProj = glm::inverse(cameraProj * cameraView);
+    static const float ndc[4][2] = { {-1.f, -1.f}, {1.f, -1.f}, {1.f, 1.f}, {-1.f, 1.f} };
+    glm::vec3 nearCorners[4], farCorners[4];
+    for (int c = 0; c < 4; ++c) {
+        glm::vec4 pn = invViewProj * glm::vec4(ndc[c][0], ndc[c][1], -1.f, 1.f);
+        glm::vec4 pf = invViewProj * glm::vec4(ndc[c][0], ndc[c][1],  1.f, 1.f);
+        nearCorners[c] = glm::vec3(pn) / pn.w;
+        farCorners[c]  = glm::vec3(pf) / pf.w;
+    }
+
+    // 2) One fixed light rotation for all cascades.  Translation is folded into
+    //    the ortho bounds so that it can be snapped to whole texels.
+    glm::vec3 dir = glm::normalize(lightDir);
+    glm::vec3 up(0.f, 1.f, 0.f);
+    if (std::fabs(glm::dot(dir, up)) > 0.99f) {
+        up = glm::vec3(0.f, 0.f, 1.f);   // light looking straight down
+    }
+    glm::mat4 lightRotation = glm::lookAt(glm::vec3(0.f), dir, up);
+
+    for (int i = 0; i < GetNumCascades(); ++i) {
+        fitCascade(m_cascades[i], nearCorners, farCorners, zNear, zFar, lightRotation, casters);
+
+        ShadowCascade& cascade = m_cascades[i];
+        cascade.dirty = !m_renderedValid[i]
+                     || cascade.casterHash != m_renderedHash[i]
+                     || cascade.lightSpaceMatrix != m_renderedMatrix[i];
+    }
+}
+
+void ShadowCascades::fitCascade(ShadowCascade& cascade,
+                                const glm::vec3 nearCorners[4], const glm::vec3 farCorners[4],
+                                float zNear, float zFar,
+                                const glm::mat4& lightRotation,
+                                const std::vector<CullItem>& casters)
+{
+    // 1) Corners of this slice: view depth is linear along each frustum edge
+    float t0 = (cascade.nearDist - zNear) / (zFar - zNear);
+    float t1 = (cascade.farDist  - zNear) / (zFar - zNear);
+    glm::vec3 corners[8];
+    for (int c = 0; c < 4; ++c) {
+        glm::vec3 edge = farCorners[c] - nearCorners[c];
+        corners[c]     = nearCorners[c] + edge * t0;
+        corners[c + 4] = nearCorners[c] + edge * t1;
+    }
+
+    // 2) Bounding sphere of the slice.  Its radius does not change when the
+    //    camera turns, so the cascade size stays put and edges don't shimmer.
+    glm::vec3 center(0.f);
+    for (int c = 0; c < 8; ++c) {
+        center += corners[c];
+    }
+    center /= 8.f;
+    float radius = 0.f;
+    for (int c = 0; c < 8; ++c) {
+        radius = std::max(radius, glm::length(corners[c] - center));
+    }
+    radius = std::ceil(radius * 16.f) / 16.f;
+
+    // 3) Snap the center to the shadow-map texel grid in light space
+    glm::vec3 lc = glm::vec3(lightRotation * glm::vec4(center, 1.f));
+    float texel = 2.f * radius / (float)m_resolution;
+    lc.x = std::floor(lc.x / texel) * texel;
+    lc.y = std::floor(lc.y / texel) * texel;
+
+    // 4) Select casters whose footprint overlaps the cascade and that are not
+    //    entirely behind it.  The light looks down -z, so "towards the light"
+    //    is +z; casters up there stretch the near plane.
+    float minZ = lc.z - radius;
+    float maxZ = lc.z + radius;
+    uint64_t hash = 14695981039346656037ull;
+    cascade.casters.clear();
+    for (size_t k = 0; k < casters.size(); ++k) {
+        const CullItem& item = casters[k];
+        glm::vec3 p = glm::vec3(lightRotation * glm::vec4(item.center, 1.f));
+        float reach = radius + item.radius;
+        if (std::fabs(p.x - lc.x) > reach || std::fabs(p.y - lc.y) > reach) {
+            continue;
+        }
+        if (p.z + item.radius < minZ) {
+            continue;
+        }
+        maxZ = std::max(maxZ, p.z + item.radius);
+        cascade.casters.push_back((uint32_t)k);
+
+        hash = (hash ^ item.id) * 1099511628211ull;
+        hash = (hash ^ item.version) * 1099511628211ull;
+    }
+    cascade.casterHash = hash;
+
+    // 5) Light matrices.  Round the near plane so small caster motion along
+    //    the light direction does not invalidate the cascade.
+    maxZ = std::ceil(maxZ + 1.f);
+    minZ = std::floor(minZ - 1.f);
+    cascade.lightView = lightRotation;
+    cascade.lightProj = glm::ortho(lc.x - radius, lc.x + radius,
+                                   lc.y - radius, lc.y + radius,
+                                   -maxZ, -minZ);
+    cascade.lightSpaceMatrix = cascade.lightProj * cascade.lightView;
+}
+
+void ShadowCascades::markClean(int i)
+{
+    m_renderedMatrix[i] = m_cascades[i].lightSpaceMatrix;
+    m_renderedHash[i]   = m_cascades[i].casterHash;
+    m_renderedValid[i]  = true;
+    m_cascades[i].dirty = false;
+}
+
+void ShadowCascades::invalidate()
+{
+    for (int i = 0; i < GetNumCascades(); ++i) {
+        m_renderedValid[i]  = false;
+        m_cascades[i].dirty = true;
+    }
+}
+
+//#define TEST
+#ifdef TEST
+
+#include "../SelfTest.hpp"
+
+int
+main( int argc, char *argv[ ] )
+{
+	// same camera as FinalProject's Display( ):
+	glm::mat4 view = glm::lookAt( glm::vec3( -50.f, 54.f, 53.f ), glm::vec3( 0.f, 5.f, 0.f ), glm::vec3( 0.f, 1.f, 0.f ) );
+	glm::mat4 proj = glm::perspective( glm::radians( 70.f ), 1.f, 0.1f, 1000.f );
+	glm::vec3 lightDir( 0.3f, -1.f, 0.2f );
+
+	SceneCuller culler;
+	culler.addItem( glm::vec3(    0.f, 10.f,    0.f ), 10.f, 0 );	// tree near the look-at point
+	culler.addItem( glm::vec3(  -45.f, 50.f,   48.f ),  1.f, 1 );	// leaf right next to the camera
+	culler.addItem( glm::vec3( 5000.f,  0.f, 5000.f ),  1.f, 2 );	// far outside everything
+
+	ShadowCascades csm( 3, 1024 );
+	csm.setShadowDistance( 150.f );
+	csm.update( view, proj, 0.1f, 1000.f, lightDir, culler.GetItems( ) );
+
+	bool increasing = true;
+	for( int i = 0; i < csm.GetNumCascades( ); i++ )
+		increasing = increasing && csm.GetCascade(i).farDist > csm.GetCascade(i).nearDist;
+	Check( increasing, "splits increase" );
+	Check( csm.GetCascade(0).nearDist == 0.1f, "first split starts at zNear" );
+	Check( std::fabs( csm.GetCascade(2).farDist - 150.f ) < 1e-3f, "last split ends at the shadow distance" );
+
+	// every corner of each slice must land inside its light clip box:
+	glm::mat4 invViewProj = glm::inverse( proj * view );
+	bool inside = true;
+	for( int i = 0; i < csm.GetNumCascades( ); i++ )
+	{
+		const ShadowCascade &c = csm.GetCascade(i);
+		float zs[2] = { c.nearDist, c.farDist };
+		for( int k = 0; k < 2; k++ )
+		{
+			// view depth -> ndc z for this perspective matrix
+			glm::vec4 clip = proj * glm::vec4( 0.f, 0.f, -zs[k], 1.f );
+			float ndcz = clip.z / clip.w;
+			for( int sx = -1; sx <= 1; sx += 2 )
+			for( int sy = -1; sy <= 1; sy += 2 )
+			{
+				glm::vec4 w = invViewProj * glm::vec4( (float)sx, (float)sy, ndcz, 1.f );
+				glm::vec4 l = c.lightSpaceMatrix * ( w / w.w );
+				if( std::fabs(l.x) > 1.001f || std::fabs(l.y) > 1.001f || std::fabs(l.z) > 1.001f )
+					inside = false;
+			}
+		}
+	}
+	Check( inside, "slice corners inside their cascade" );
+
+	bool farExcluded = true, treeSelected = false;
+	for( int i = 0; i < csm.GetNumCascades( ); i++ )
+	{
+		const std::vector<uint32_t> &cs = csm.GetCascade(i).casters;
+		for( size_t k = 0; k < cs.size( ); k++ )
+		{
+			if( cs[k] == 2 )	farExcluded = false;
+			if( cs[k] == 0 )	treeSelected = true;
+		}
+	}
+	Check( farExcluded, "far-away caster is not selected" );
+	Check( treeSelected, "tree is selected" );
+	Check( std::find( csm.GetCascade(0).casters.begin( ), csm.GetCascade(0).casters.end( ), 1u ) != csm.GetCascade(0).casters.end( ),
+		"leaf next to the camera is in the first cascade" );
+
+	for( int i = 0; i < csm.GetNumCascades( ); i++ )
+		csm.markClean( i );
+	csm.update( view, proj, 0.1f, 1000.f, lightDir, culler.GetItems( ) );
+	bool anyDirty = false;
+	for( int i = 0; i < csm.GetNumCascades( ); i++ )
+		anyDirty = anyDirty || csm.GetCascade(i).dirty;
+	Check( ! anyDirty, "unchanged scene leaves every cascade clean" );
+
+	// move the leaf next to the camera a tiny bit:
+	culler.clear( );
+	culler.addItem( glm::vec3(    0.f, 10.f,    0.f ), 10.f, 0 );
+	culler.addItem( glm::vec3(  -45.f, 50.1f,  48.f ),  1.f, 1 );
+	culler.addItem( glm::vec3( 5000.f,  0.f, 5000.f ),  1.f, 2 );
+	csm.update( view, proj, 0.1f, 1000.f, lightDir, culler.GetItems( ) );
+	Check( csm.GetCascade(0).dirty, "cascade holding the moved caster is dirty" );
+	bool othersClean = true;
+	for( int i = 1; i < csm.GetNumCascades( ); i++ )
+	{
+		const std::vector<uint32_t> &cs = csm.GetCascade(i).casters;
+		if( std::find( cs.begin( ), cs.end( ), 1u ) == cs.end( ) )
+			othersClean = othersClean && ! csm.GetCascade(i).dirty;
+	}
+	Check( othersClean, "cascades without the moved caster stay clean" );
+
+	return CheckResult( );
+}
+#endif
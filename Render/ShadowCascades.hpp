@@ -0,0 +1,73 @@
+#ifndef SHADOWCASCADES_HPP
+#define SHADOWCASCADES_HPP
+#include <vector>
+#include <cstdint>
+#include "../glm/glm.hpp"
+#include "Culling.hpp"
+
+// One slice of the camera frustum with its own orthographic light frustum.
+struct ShadowCascade {
+    float     nearDist;           // view-space distance where the slice starts
+    float     farDist;            // ... and ends
+    glm::mat4 lightView;
+    glm::mat4 lightProj;
+    glm::mat4 lightSpaceMatrix;   // lightProj * lightView
+    std::vector<uint32_t> casters; // indices into the caster list given to update()
+    uint64_t  casterHash;         // hash of (id, version) of every selected caster
+    bool      dirty;              // needs to be re-rendered
+};
+
+// Cascaded shadow maps fitted to the camera frustum.
+//
+// All of the fitting and caster selection is plain CPU math so it can be
+// checked without a GL context (see the TEST block in ShadowCascades.cpp).
+// The caller owns the depth textures; after rendering cascade i it calls
+// markClean(i), and the cascade stays clean until either its light matrix or
+// its set of casters changes.
+class ShadowCascades {
+public:
+    static const int MAX_CASCADES = 4;
+
+    ShadowCascades(int numCascades = 3, int resolution = 1024);
+
+    // 0 = uniform splits, 1 = logarithmic splits
+    void setSplitLambda(float lambda);
+    // Shadows are only computed out to this view distance
+    void setShadowDistance(float distance);
+
+    int GetNumCascades() const { return (int)m_cascades.size(); }
+    int GetResolution() const { return m_resolution; }
+    const ShadowCascade& GetCascade(int i) const { return m_cascades[i]; }
+
+    // Split the view range [zNear, min(zFar, shadowDistance)] into slices
+    void computeSplits(float zNear, float zFar);
+
+    // Fit every cascade to its slice of the camera frustum and pick the casters
+    // (from the culling stage) that can throw a shadow into it.
+    void update(const glm::mat4& cameraView, const glm::mat4& cameraProj,
+                float zNear, float zFar,
+                const glm::vec3& lightDir,
+                const std::vector<CullItem>& casters);
+
+    void markClean(int i);
+    void invalidate();      // force every cascade to be re-rendered
+
+private:
+    void fitCascade(ShadowCascade& cascade,
+                    const glm::vec3 nearCorners[4], const glm::vec3 farCorners[4],
+                    float zNear, float zFar,
+                    const glm::mat4& lightRotation,
+                    const std::vector<CullItem>& casters);
+
+    int   m_resolution;
+    float m_splitLambda;
+    float m_shadowDistance;
+    std::vector<ShadowCascade> m_cascades;
+
+    // What was in the depth texture the last time each cascade was rendered
+    std::vector<glm::mat4> m_renderedMatrix;
+    std::vector<uint64_t>  m_renderedHash;
+    std::vector<bool>      m_renderedValid;
+};
+
+#endif // SHADOWCASCADES_HPP
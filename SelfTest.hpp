@@ -0,0 +1,26 @@
+#ifndef SELFTEST_HPP
+#define SELFTEST_HPP
+#include <stdio.h>
+
+// For the -DTEST / -DBENCH mains in Render/, Jobs/ and LeafSim/: Check( )
+// prints one line per check, and main( ) ends with "return CheckResult( );",
+// which prints the number that failed and gives the exit status.
+
+static int Failures = 0;
+
+static void
+Check( bool ok, const char *what )
+{
+	fprintf( stderr, "%s: %s\n", ok ? "ok  " : "FAIL", what );
+	if( ! ok )
+		Failures++;
+}
+
+static int
+CheckResult( )
+{
+	fprintf( stderr, "%d failure(s)\n", Failures );
+	return Failures == 0 ? 0 : 1;
+}
+
+#endif // SELFTEST_HPP
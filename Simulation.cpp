@@ -1,11 +1,19 @@
-// g++ -std=c++17 -o simulation Simulation.cpp
+// g++ -std=c++17 -O2 -o simulation Simulation.cpp LeafSim/FlutterModel.cpp LeafSim/LeafBatch.cpp LeafSim/WindField.cpp LeafSim/Snapshot.cpp LeafSim/MappedFile.cpp LeafSim/TrajectoryStream.cpp Jobs/JobSystem.cpp -pthread
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <vector>
 #include <functional>
 #include <fstream>
+#include <string>
+#include "LeafSim/FlutterModel.hpp"
+#include "LeafSim/LeafBatch.hpp"
+#include "LeafSim/TrajectoryStream.hpp"
+#include "LeafSim/WindField.hpp"
 #include <iomanip>
-#include <algorithm>  // For std::clamp
 
 struct Object {
     double mass;            // Mass of the object (kg)
@@ -24,41 +32,27 @@ struct State {
     double vx, vy, omega;
 };
 
-State derivatives(const State &state, const Object &obj, double rho_f, double g) {
-    double A_perp = obj.dragCoeffPerp;
-    double A_para = obj.dragCoeffPara;
-    double V = std::sqrt(state.vx * state.vx + state.vy * state.vy);
-    
-    // Avoid calculations if velocity is too small
-    if (V < 1e-6) V = 1e-6;
-
-    double liftForce = 0.5 * rho_f * obj.width * V * V;
-    double dragForce = 0.5 * rho_f * obj.height * V * V;
-
-    State dState;
-    dState.x = state.vx;
-    dState.y = state.vy;
-    dState.theta = state.omega;
-
-    dState.vx = -(A_perp * std::sin(state.theta) * state.vx + dragForce / obj.mass);
-    dState.vy = -g + -(A_para * std::cos(state.theta) * state.vy + liftForce / obj.mass);
-    dState.omega = -(A_perp * state.omega);
-
-    // Clamp velocities to prevent excessive values
-    dState.vx = std::clamp(dState.vx, -50.0, 50.0);
-    dState.vy = std::clamp(dState.vy, -50.0, 50.0);
+// wind = air velocity [x, y] at the leaf, NULL for still air
+State derivatives(const State &state, const Object &obj, double rho_f, double g, const double *wind = NULL) {
+    // Same model as ComputeTrajectory.py and LeafBatch: LeafSim/FlutterModel.hpp
+    FlutterParams params = { obj.mass, obj.width, obj.height, obj.dragCoeffPerp, obj.dragCoeffPara };
+    double s[FLUTTER_DIM] = { state.x, state.y, state.theta, state.vx, state.vy, state.omega };
+    double ds[FLUTTER_DIM];
+    FlutterDerivatives(s, params, rho_f, g, ds, wind);
 
+    State dState = { ds[0], ds[1], ds[2], ds[3], ds[4], ds[5] };
     return dState;
 }
 
-State rungeKutta4(const State &initial, const Object &obj, double rho_f, double g, double dt) {
-    State k1 = derivatives(initial, obj, rho_f, g);
+State rungeKutta4(const State &initial, const Object &obj, double rho_f, double g, double dt,
+                  const double *wind = NULL) {
+    State k1 = derivatives(initial, obj, rho_f, g, wind);
     State k2 = derivatives({initial.x + k1.x * dt / 2, initial.y + k1.y * dt / 2, initial.theta + k1.theta * dt / 2,
-                            initial.vx + k1.vx * dt / 2, initial.vy + k1.vy * dt / 2, initial.omega + k1.omega * dt / 2}, obj, rho_f, g);
+                            initial.vx + k1.vx * dt / 2, initial.vy + k1.vy * dt / 2, initial.omega + k1.omega * dt / 2}, obj, rho_f, g, wind);
     State k3 = derivatives({initial.x + k2.x * dt / 2, initial.y + k2.y * dt / 2, initial.theta + k2.theta * dt / 2,
-                            initial.vx + k2.vx * dt / 2, initial.vy + k2.vy * dt / 2, initial.omega + k2.omega * dt / 2}, obj, rho_f, g);
+                            initial.vx + k2.vx * dt / 2, initial.vy + k2.vy * dt / 2, initial.omega + k2.omega * dt / 2}, obj, rho_f, g, wind);
     State k4 = derivatives({initial.x + k3.x * dt, initial.y + k3.y * dt, initial.theta + k3.theta * dt,
-                            initial.vx + k3.vx * dt, initial.vy + k3.vy * dt, initial.omega + k3.omega * dt}, obj, rho_f, g);
+                            initial.vx + k3.vx * dt, initial.vy + k3.vy * dt, initial.omega + k3.omega * dt}, obj, rho_f, g, wind);
 
     State next;
     next.x = initial.x + (dt / 6.0) * (k1.x + 2 * k2.x + 2 * k3.x + k4.x);
@@ -71,16 +65,53 @@ State rungeKutta4(const State &initial, const Object &obj, double rho_f, double
     return next;
 }
 
-// Save trajectory segments to a file
-void saveTrajectorySegment(const std::vector<State> &trajectory, const std::string &filename) {
-    std::ofstream outFile(filename);
-    for (const auto &state : trajectory) {
-        outFile << state.x << " " << state.y << " " << state.theta << "\n";
-    }
-    outFile.close();
+static void printUsage(const char* prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  --out FILE          .trs trajectory stream (fluttering_trajectory.trs), or .txt for x y theta lines\n"
+              << "  --quantize          delta + 16-bit steps in a .trs (half the size)\n"
+              << "  --steps N           time steps (1000)\n"
+              << "  --deterministic     float32 replay path: the same output from any build (still air)\n"
+              << "  --wind S            a gusty breeze along +x, S m/s on average (0 = still air)\n"
+              << "  --log-hz R          progress lines per second of run time (10; 0 = none)\n"
+              << "  -q                  no progress lines\n";
 }
 
-int main() {
+static bool endsWith(const std::string &s, const char *suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+int main(int argc, char *argv[]) {
+    std::string outPath = "fluttering_trajectory.trs";
+    bool quantize = false;
+    bool deterministic = false;
+    double windSpeed = 0.;
+    long steps = 1000;
+    double logHz = 10.;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--quantize") {
+            quantize = true;
+        } else if (arg == "--deterministic") {
+            deterministic = true;
+        } else if (arg == "-q") {
+            logHz = 0.;
+        } else if (arg == "--out" && hasValue) {
+            outPath = argv[++i];
+        } else if (arg == "--steps" && hasValue) {
+            steps = atol(argv[++i]);
+        } else if (arg == "--log-hz" && hasValue) {
+            logHz = atof(argv[++i]);
+        } else if (arg == "--wind" && hasValue) {
+            windSpeed = atof(argv[++i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
     Object obj(0.01, 0.1, 0.1, 1000, 4.1, 0.9); // Adjusted mass and drag coefficients
     double rho_f = 1.225;  // Air density (kg/m^3)
     double g = 9.81;       // Gravity (m/s^2)
@@ -88,21 +119,90 @@ int main() {
 
     State state = {0.0, 0.0, 0.0, 0.0, -1.0, 0.0};
 
-    std::vector<State> trajectory;
+    // --deterministic: the same leaf through LeafBatch::stepDeterministic(),
+    // without the wind field (its gusts are not part of the replay guarantee)
+    LeafBatch batch((float)rho_f, (float)g);
+    if (deterministic) {
+        LeafState s0 = { (float)state.x, (float)state.y, (float)state.theta,
+                         (float)state.vx, (float)state.vy, (float)state.omega };
+        LeafParams p = { (float)obj.mass, (float)obj.width, (float)obj.height,
+                         (float)obj.dragCoeffPerp, (float)obj.dragCoeffPara };
+        batch.add(s0, p);
+    }
+
+    // --wind: a gusty breeze along +x over the fall (the leaf moves in the
+    // z = 0 plane).  Without it the leaf falls in still air, as it always has.
+    bool windy = windSpeed > 0. && !deterministic;
+    const float windLo[3] = { -5.f, -10.f, -1.f }, windHi[3] = { 5.f, 1.f, 1.f };
+    WindField windField;
+    if (windy) {
+        windField.setGrid(windLo, windHi, 11, 12, 2);
+        WindSettings windSettings;
+        windSettings.speed = (float)windSpeed;
+        windSettings.gustSize = 2.f;
+        windField.setSettings(windSettings);
+    }
+
+    // States stream out as they are made (the file is written on another
+    // thread), so a run of any length keeps a few chunks in memory
+    bool text = endsWith(outPath, ".txt");
+    std::ofstream textFile;
+    TrajectoryStreamWriter stream;
+    if (text) {
+        textFile.open(outPath);
+    } else {
+        FlutterParams params = { obj.mass, obj.width, obj.height, obj.dragCoeffPerp, obj.dragCoeffPara };
+        stream.open(outPath.c_str(), params, rho_f, g, dt, quantize ? STREAM_DELTA16 : STREAM_FLOAT32);
+    }
+    if (text ? !textFile : !stream.isOpen()) {
+        std::cerr << "Cannot write '" << outPath << "'\n";
+        return 1;
+    }
 
-    for (int i = 0; i < 1000; ++i) {
-        trajectory.push_back(state);
-        std::cout << i << ": x=" << state.x << ", y=" << state.y << ", vx=" << state.vx << ", vy=" << state.vy << "\n";
-        state = rungeKutta4(state, obj, rho_f, g, dt);
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point start = Clock::now(), nextLog = start;
+    Clock::duration logEvery = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(logHz > 0. ? 1. / logHz : 0.));
+    long i = 0;
+    for (; i < steps; ++i) {
+        if (text) {
+            textFile << state.x << " " << state.y << " " << state.theta << "\n";
+        } else {
+            stream.push(&state.x);
+        }
+
+        // progress at most logHz times a second; the clock is only read every 256 steps
+        if (logHz > 0. && (i & 255) == 0 && Clock::now() >= nextLog) {
+            std::cout << i << ": x=" << state.x << ", y=" << state.y << ", vx=" << state.vx << ", vy=" << state.vy << "\n";
+            nextLog = Clock::now() + logEvery;
+        }
+
+        if (deterministic) {
+            batch.stepDeterministic((float)dt);
+            LeafState s = batch.GetState(0);
+            state = { s.x, s.y, s.theta, s.vx, s.vy, s.omega };
+        } else if (windy) {
+            windField.update(i * dt);
+            float p[3] = { (float)state.x, (float)state.y, 0.f }, u[3];
+            windField.sample(p, u);
+            double wind[2] = { u[0], u[1] };
+            state = rungeKutta4(state, obj, rho_f, g, dt, wind);
+        } else {
+            state = rungeKutta4(state, obj, rho_f, g, dt);
+        }
         if (std::isnan(state.x) || std::isnan(state.y)) {
             std::cerr << "Error: NaN detected at iteration " << i << "\n";
             break;
         }
     }
-    // Save the trajectory segment
-    saveTrajectorySegment(trajectory, "fluttering_trajectory.txt");
 
-    std::cout << "Trajectory saved!" << std::endl;
+    bool ok = text ? (textFile.close(), !textFile.fail()) : stream.close();
+    if (!ok) {
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << i << " steps in " << seconds << " s (" << i / std::max(seconds, 1e-9) << " steps/s), saved to "
+              << outPath << std::endl;
 
     return 0;
 }
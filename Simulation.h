@@ -3,6 +3,7 @@
 #include <vector>
 #include <functional>
 #include <fstream>
+#include "LeafSim/FlutterModel.hpp"
 
 struct Object {
     double mass;         // Mass of the object (kg)
@@ -26,21 +27,13 @@ struct State {
 
 // Differential equations for the falling object
 State derivatives(const State &state, const Object &obj, double rho_f, double g) {
-    double A_perp = obj.dragCoeffPerp;
-    double A_para = obj.dragCoeffPara;
-    double V = std::sqrt(state.vx * state.vx + state.vy * state.vy);
-    double liftForce = 0.5 * rho_f * obj.width * V * V;
-    double dragForce = 0.5 * rho_f * obj.height * V * V;
-
-    State dState;
-    dState.x = state.vx;
-    dState.y = state.vy;
-    dState.theta = state.omega;
-
-    dState.vx = -(A_perp * std::sin(state.theta) * state.vx + dragForce / obj.mass);
-    dState.vy = -g + -(A_para * std::cos(state.theta) * state.vy + liftForce / obj.mass);
-    dState.omega = -(A_perp * state.omega);
+    // Same model as ComputeTrajectory.py and LeafBatch: LeafSim/FlutterModel.hpp
+    FlutterParams params = { obj.mass, obj.width, obj.height, obj.dragCoeffPerp, obj.dragCoeffPara };
+    double s[FLUTTER_DIM] = { state.x, state.y, state.theta, state.vx, state.vy, state.omega };
+    double ds[FLUTTER_DIM];
+    FlutterDerivatives(s, params, rho_f, g, ds);
 
+    State dState = { ds[0], ds[1], ds[2], ds[3], ds[4], ds[5] };
     return dState;
 }
 
@@ -4,6 +4,7 @@
 #include <iostream>
 #include <cctype>       // for std::isdigit, std::isalpha
 #include <cmath>
+#include <chrono>
 #include "../glm/gtc/matrix_transform.hpp"
 #include "../glm/gtc/constants.hpp"
 #include "../glm/gtc/type_ptr.hpp"
@@ -34,6 +35,8 @@ Turtle::Turtle()
     m_state.zAxis    = glm::vec3(0.0f, 0.0f, 1.0f); // up
     m_state.xAxis    = glm::vec3(1.0f, 0.0f, 0.0f); // right
     m_state.depth    = 0;
+    m_state.flex     = 0.0f;
+    m_state.branch   = 0;
 }
 
 // -------------------------------------
@@ -69,8 +72,12 @@ void Turtle::setInitialFactor(float angleDegrees, float stepLength, float radius
     m_taperFactor = taperFactor;
 }
 
-std::vector<Turtle::Leaf> Turtle::GetLeaves() const {
-    return leafPositions; // Returns a copy of the leafPositions vector
+const std::vector<Turtle::Leaf>& Turtle::GetLeaves() const {
+    return leafPositions;
+}
+
+const std::vector<Turtle::Segment>& Turtle::GetSegments() const {
+    return segments;
 }
 
 int Turtle::quantize(float value, float scale = 100.0f) {
@@ -170,7 +177,7 @@ void Turtle::applyTropism()
 // ---------------------------------------------------------
 // interpret(...) with parametric commands + TROPISM
 // ---------------------------------------------------------
-void Turtle::interpret(const std::string &lsystemString,  GLSLProgram * prog)
+void Turtle::interpret(const std::string &lsystemString)
 {
     static std::uniform_real_distribution<float> branchDist(0.0f, 1.0f);
     static std::uniform_real_distribution<float> anglePitchDist(-20.0f, 20.0f);
@@ -217,13 +224,13 @@ void Turtle::interpret(const std::string &lsystemString,  GLSLProgram * prog)
 
                 // Taper from currentRadius -> (currentRadius - partialDeltaRadius)
                 float newRadius = currentRadius - partialDeltaRadius;
-                float colorFactor = baseR / m_initialRadius;
-                float uColor[3] = {0.3f * colorFactor, 0.1f * colorFactor, 0.07f * colorFactor};
-                // prog->Use();
-                // prog->SetUniformVariable((char*)"uColor", uColor);
-        
-                glColor3f(uColor[0], uColor[1], uColor[2]);
-                drawCylinder(start, end, currentRadius, newRadius);
+
+                // Record it; drawSegments() does the drawing
+                float flexStart = m_state.flex;
+                m_state.flex += partialDist * (float)(1 + m_state.depth);
+                Segment segment = { start, end, currentRadius, newRadius, m_state.depth,
+                                    flexStart, m_state.flex, m_state.branch };
+                segments.push_back(segment);
 
                 // Move the turtle forward
                 m_state.position = end;
@@ -314,6 +321,8 @@ void Turtle::interpret(const std::string &lsystemString,  GLSLProgram * prog)
                 // Keep the sub-branch as usual
                 // (1) push state
                 stateStack.push(m_state);
+                m_state.depth++;
+                m_state.branch = m_numBranches++;
 
                 // (2) push radius stack if needed
                 float newRadius = m_radiusStack.top() * m_taperFactor;
@@ -394,6 +403,8 @@ void Turtle::addLeaf(float currentRadius)
 
     // 1) Position: place the leaf at the turtle's current tip
     leaf.position = m_state.position;
+    leaf.flex = m_state.flex;
+    leaf.segment = (int)segments.size() - 1;   // interpret() adds its segment just before
     unsigned int seed = generateSeed(leaf.position);
     std::mt19937 generator(seed);
     // 3) Random offset in plane perpendicular to the branch axis (yAxis)
@@ -458,6 +469,25 @@ void Turtle::rotate(glm::vec3 &dir, const glm::vec3 &axis, float angle) {
 }
 
 
+// Draw a recorded branch piece, darker the thinner it is
+void Turtle::drawSegment(const Segment& segment, const glm::vec3* sway)
+{
+    float colorFactor = segment.baseRadius / m_initialRadius;
+    glColor3f(0.3f * colorFactor, 0.1f * colorFactor, 0.07f * colorFactor);
+    if (sway != NULL) {
+        drawCylinder(segment.start + sway[0], segment.end + sway[1], segment.baseRadius, segment.topRadius);
+    } else {
+        drawCylinder(segment.start, segment.end, segment.baseRadius, segment.topRadius);
+    }
+}
+
+void Turtle::drawSegments(const glm::vec3* sway)
+{
+    for (size_t i = 0; i < segments.size(); ++i) {
+        drawSegment(segments[i], sway != NULL ? &sway[2 * i] : NULL);
+    }
+}
+
 // Function to draw a cylinder between two points
 void Turtle::drawCylinder(const glm::vec3& start, 
                           const glm::vec3& end, 
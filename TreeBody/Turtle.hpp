@@ -1,6 +1,7 @@
 #ifndef TURTLE_HPP
 #define TURTLE_HPP
 #include <stack> 
+#include <cstddef>
 #include <string>
 #include <vector>
 #include <random>
@@ -15,6 +16,25 @@ public:
         glm::vec3 up;
         glm::vec3 right;
         float scale;
+        float flex;         // of the branch where it hangs (see Segment)
+        int segment;        // the one it hangs from
+    };
+
+    // One drawn branch piece, kept so the branch can be redrawn (e.g. into a
+    // shadow map) without re-interpreting the L-system string
+    struct Segment {
+        glm::vec3 start;
+        glm::vec3 end;
+        float baseRadius;
+        float topRadius;
+        int depth;          // bracket depth: 0 = trunk
+        // How far the wind moves each end, relative to the trunk base:
+        // length along the branch path, counted (1 + depth) times per unit
+        // so thinner branches give more.  A branch starts at its parent's value,
+        // so swayed segments stay joined.
+        float flexStart;
+        float flexEnd;
+        int branch;         // one per kept '[' (0 = trunk), shared by all its segments
     };
     
     Turtle();
@@ -23,12 +43,18 @@ public:
     void setRadius(float radius);
     void setTaperFactor(float taperFactor);
     void setInitialFactor(float angleDegrees, float stepLength, float radius, float taperFactor);
-    void interpret(const std::string &lsystemString, GLSLProgram * prog);
+    void interpret(const std::string &lsystemString);
     // Call these to set tropism (T) and coefficient (e)
     void setTropismVector(const glm::vec3& tropism);
     void setTropismCoefficient(float coeff);
     // Public method to retrieve leaf data
-    std::vector<Leaf> GetLeaves() const;
+    const std::vector<Leaf>& GetLeaves() const;
+    const std::vector<Segment>& GetSegments() const;
+    // interpret() only records geometry; these issue the GL calls.  sway, if
+    // given, holds start and end offsets: one pair for drawSegment(), a pair
+    // per segment for drawSegments().
+    void drawSegment(const Segment& segment, const glm::vec3* sway = NULL);
+    void drawSegments(const glm::vec3* sway = NULL);
     static void setGlobalSeed(unsigned int seedVal);
 
 private:
@@ -39,6 +65,8 @@ private:
         glm::vec3 xAxis; // Right direction
         float currentRadius;
         int depth;
+        float flex;
+        int branch;
     };
  
     TurtleState m_state;
@@ -46,6 +74,7 @@ private:
     float m_stepLength;
     float m_initialRadius = 0.5f;
     float m_taperFactor = 0.7f;
+    int m_numBranches = 1;
     std::stack<float> m_radiusStack;
     glm::vec3 m_tropismVector = glm::vec3(0.0f, 0.0f, 0.0f);
     float     m_tropismCoefficient = 0.0f;
@@ -65,6 +94,7 @@ private:
 
     // Store leaf positions and orientations
     std::vector<Leaf> leafPositions;
+    std::vector<Segment> segments;
 };
 
 #endif // TURTLE_HPP
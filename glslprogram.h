@@ -72,7 +72,7 @@ inline int GetOSU(int flag)
 
 //********************************************************************************
 // #define GLM to allow this to accept glm uniform variables:
-	//#define GLM
+	#define GLM
 
 // i'm assuming that this code is #include'ed into the application code and that the
 //	glm #includes are in that application program before this code is #included.
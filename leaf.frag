@@ -13,11 +13,47 @@ uniform float   uTranslucency;     // How strong the back-light effect is
 // square-equation uniform variables -- these should be set every time Display( ) is called:
 uniform float   uS0, uT0, uD;
 
+// cascaded shadow maps:
+uniform int       uShadowsOn;
+uniform float     uCascadeEnd0, uCascadeEnd1, uCascadeEnd2;	// far view distance of each cascade
+uniform sampler2D uShadowMap0, uShadowMap1, uShadowMap2;
+
 // in variables from the vertex shader and interpolated in the rasterizer:
 varying  vec3  vN;		   // normal vector
 varying  vec3  vL;		   // vector from point to light
 varying  vec3  vE;		   // vector from point to eye
 varying  vec2  vST;		   // (s,t) texture coordinates
+varying  vec4  vLightSpace[3];	   // position in each cascade's light space
+varying  float vViewDepth;	   // distance along the view direction
+
+const float BIAS = 0.005;
+
+// 1.0 if the fragment is in shadow in the cascade that covers it, 0.0 if not
+float ShadowFactor()
+{
+    if (uShadowsOn == 0 || vViewDepth > uCascadeEnd2)
+        return 0.0;
+
+    vec4 p;
+    float closestDepth;
+    if (vViewDepth <= uCascadeEnd0)
+    {
+        p = vLightSpace[0];
+        closestDepth = texture2D(uShadowMap0, 0.5 * p.xy / p.w + 0.5).r;
+    }
+    else if (vViewDepth <= uCascadeEnd1)
+    {
+        p = vLightSpace[1];
+        closestDepth = texture2D(uShadowMap1, 0.5 * p.xy / p.w + 0.5).r;
+    }
+    else
+    {
+        p = vLightSpace[2];
+        closestDepth = texture2D(uShadowMap2, 0.5 * p.xy / p.w + 0.5).r;
+    }
+    float currentDepth = 0.5 * p.z / p.w + 0.5;
+    return (currentDepth - BIAS) > closestDepth ? 1.0 : 0.0;
+}
 
 void main()
 {
@@ -54,8 +90,9 @@ void main()
     // 5. Adjust transparency based on back-lighting
     float finalAlpha = mix(uAlpha, uAlpha * 0.6, backLit); // Reduce alpha when back-lit
 
-    // 6. Combine all terms:
-    vec3 finalColor = ambient + diffuse + specular + translucency;
+    // 6. Combine all terms (the shadow only blocks direct light):
+    float lit = 1.0 - ShadowFactor();
+    vec3 finalColor = ambient + lit * (diffuse + specular) + translucency;
 
     gl_FragColor = vec4(finalColor, clamp(finalAlpha, 0.0, 1.0));
 }
@@ -7,6 +7,12 @@ varying  vec3  vN;	  // normal vector
 varying  vec3  vL;	  // vector from point to light
 varying  vec3  vE;	  // vector from point to eye
 
+// cascaded shadow maps:
+uniform mat4 uEyeToWorld;		// inverse of the camera view matrix
+uniform mat4 uLightSpaceMatrices[3];	// one per cascade
+varying vec4 vLightSpace[3];		// fragment position in each cascade
+varying float vViewDepth;		// distance along the view direction
+
 // where the light is:
 
 const vec3 LightPosition = vec3(  10., 20., 0. );
@@ -21,5 +27,11 @@ main( )
 							// to the light position
 	vE = vec3( 0., 0., 0. ) - ECposition.xyz;       // vector from the point
 							// to the eye position
+
+	vec4 worldPosition = uEyeToWorld * ECposition;
+	for( int i = 0; i < 3; i++ )
+		vLightSpace[i] = uLightSpaceMatrices[i] * worldPosition;
+	vViewDepth = -ECposition.z;
+
 	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
 }